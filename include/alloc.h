@@ -0,0 +1,167 @@
+#pragma once
+
+#include "ast.h"
+#include "object.h"
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <format>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+struct AllocationCount {
+    uint64_t objects = 0;
+    uint64_t bytes = 0;
+};
+
+class MemoryLimitExceeded : public std::runtime_error {
+public:
+    MemoryLimitExceeded(size_t limit)
+        : runtime_error(std::format("memory limit of {} bytes exceeded", limit))
+    {
+    }
+};
+
+// Counts the objects and bytes allocated while it is installed on the current
+// thread through an AllocationScope, broken down by ValueKind for values and by
+// ASTNode::Kind for parsed nodes. Values freed under it are subtracted from the
+// live bytes, and a non-zero limit caps those, so a loop that keeps replacing
+// its values runs for as long as it likes.
+class AllocationTracker {
+public:
+    static constexpr size_t MAX_KINDS = 32;
+
+    explicit AllocationTracker(size_t limit = 0)
+        : m_limit(limit)
+    {
+    }
+
+    void record(ValueKind kind, size_t bytes, size_t objects = 1);
+    void record(ASTNode::Kind kind, size_t bytes);
+    void release(size_t bytes);
+    void reset();
+
+    const AllocationCount& values(ValueKind kind) const { return m_values[size_t(kind)]; }
+    const AllocationCount& nodes(ASTNode::Kind kind) const { return m_nodes[size_t(kind)]; }
+    const AllocationCount& total() const { return m_total; }
+    // bytes allocated and not yet freed, and the most there were at once
+    size_t live() const { return m_live; }
+    size_t peak() const { return m_peak; }
+
+    size_t limit() const { return m_limit; }
+    void set_limit(size_t limit) { m_limit = limit; }
+
+    std::string report() const;
+
+    static AllocationTracker* current() { return s_current; }
+
+private:
+    void account(AllocationCount& count, size_t bytes, size_t objects);
+
+    size_t m_limit;
+    size_t m_live = 0;
+    size_t m_peak = 0;
+    AllocationCount m_total;
+    std::array<AllocationCount, MAX_KINDS> m_values;
+    std::array<AllocationCount, MAX_KINDS> m_nodes;
+
+    static thread_local AllocationTracker* s_current;
+
+    friend class AllocationScope;
+};
+
+class AllocationScope {
+public:
+    explicit AllocationScope(AllocationTracker& tracker)
+        : m_previous(AllocationTracker::s_current)
+    {
+        AllocationTracker::s_current = &tracker;
+    }
+
+    ~AllocationScope() { AllocationTracker::s_current = m_previous; }
+
+    AllocationScope(const AllocationScope&) = delete;
+    AllocationScope& operator=(const AllocationScope&) = delete;
+
+private:
+    AllocationTracker* m_previous;
+};
+
+template <typename T>
+class TrackingAllocator {
+public:
+    using value_type = T;
+
+    explicit TrackingAllocator(ValueKind kind)
+        : m_kind(kind)
+    {
+    }
+
+    template <typename U>
+    TrackingAllocator(const TrackingAllocator<U>& other)
+        : m_kind(other.kind())
+    {
+    }
+
+    T* allocate(size_t n)
+    {
+        if (auto tracker = AllocationTracker::current()) {
+            tracker->record(m_kind, n * sizeof(T));
+        }
+        return std::allocator<T>().allocate(n);
+    }
+
+    void deallocate(T* p, size_t n)
+    {
+        if (auto tracker = AllocationTracker::current()) {
+            tracker->release(n * sizeof(T));
+        }
+        std::allocator<T>().deallocate(p, n);
+    }
+
+    ValueKind kind() const { return m_kind; }
+
+    template <typename U>
+    bool operator==(const TrackingAllocator<U>& other) const { return m_kind == other.kind(); }
+
+private:
+    ValueKind m_kind;
+};
+
+// Every heap object behind a Value is created here so it shows up in the
+// current AllocationTracker.
+template <typename T, typename... Arguments>
+std::shared_ptr<T> make_object(ValueKind kind, Arguments&&... args)
+{
+    return std::allocate_shared<T>(TrackingAllocator<T>(kind),
+        std::forward<Arguments>(args)...);
+}
+
+// Payload memory owned by a value (e.g. a string buffer) rather than the
+// object itself.
+inline void track_allocation(ValueKind kind, size_t bytes)
+{
+    if (auto tracker = AllocationTracker::current()) {
+        tracker->record(kind, bytes, 0);
+    }
+}
+
+// Payload memory given back, the counterpart of track_allocation.
+inline void track_release(size_t bytes)
+{
+    if (auto tracker = AllocationTracker::current()) {
+        tracker->release(bytes);
+    }
+}
+
+template <typename T, typename... Arguments>
+std::unique_ptr<T> make_node(Arguments&&... args)
+{
+    auto node = std::make_unique<T>(std::forward<Arguments>(args)...);
+    if (auto tracker = AllocationTracker::current()) {
+        tracker->record(node->kind(), sizeof(T));
+    }
+    return node;
+}
@@ -1,11 +1,19 @@
 #pragma once
 
+#include "kind.h"
+#include <array>
+#include <cstddef>
+#include <cstdint>
 #include <memory>
 #include <string>
 #include <unordered_map>
 #include <utility>
 #include <vector>
 
+class Shape;
+class String;
+class Value;
+
 enum class Operator {
     Invalid,
     Add, // +
@@ -72,14 +80,43 @@ public:
         CallExpr,
         AccessExpr,
         ArrayExpr,
+        ObjectExpr,
     };
 
     virtual Kind kind() const = 0;
 };
 
+std::string node_kind_str(ASTNode::Kind kind);
+
 class Expression : public ASTNode {
 public:
     virtual ~Expression() = default;
+
+    // kinds the expression may evaluate to, empty until infer_types() ran
+    KindSet& kinds() { return m_kinds; }
+
+private:
+    KindSet m_kinds;
+};
+
+// Inline cache of a binary operator site: the operand kind pairs seen there,
+// each with the handler specialized for it. Sites that see more pairs than
+// fit keep using the first ones and look the rest up on every evaluation.
+struct BinaryCache {
+    using Handler = Value (*)(const Value&, const Value&);
+
+    struct Entry {
+        ValueKind lhs;
+        ValueKind rhs;
+        Handler handler;
+    };
+
+    static constexpr size_t capacity = 4;
+
+    std::array<Entry, capacity> entries {};
+    size_t size = 0;
+    uint64_t hits = 0;
+    uint64_t misses = 0;
 };
 
 class BinaryExpression : public Expression {
@@ -97,11 +134,17 @@ public:
     Operator op() const { return m_operator; }
     Expression& left() const { return *m_left; }
     Expression& right() const { return *m_right; }
+    BinaryCache& cache() { return m_cache; }
+
+    // owning handles, for passes that rewrite the tree
+    std::unique_ptr<Expression>& left_ptr() { return m_left; }
+    std::unique_ptr<Expression>& right_ptr() { return m_right; }
 
 private:
     Operator m_operator;
     std::unique_ptr<Expression> m_left;
     std::unique_ptr<Expression> m_right;
+    BinaryCache m_cache;
 };
 
 class PrefixExpression : public Expression {
@@ -116,6 +159,7 @@ public:
 
     Operator op() const { return m_operator; }
     Expression& expr() const { return *m_expr; }
+    std::unique_ptr<Expression>& expr_ptr() { return m_expr; }
 
 private:
     Operator m_operator;
@@ -211,19 +255,24 @@ private:
     double m_value;
 };
 
+// Holds its text as the String value every evaluation returns, so running
+// the literal shares it instead of copying the text again.
 class StringLiteral : public LiteralExpression {
 public:
-    StringLiteral(std::string value)
-        : m_value(std::move(value))
+    StringLiteral(std::string value);
+    // `constant` has to be flat; the parser shares one per distinct text
+    StringLiteral(std::shared_ptr<String> constant)
+        : m_constant(std::move(constant))
     {
     }
 
     //
     LiteralKind literal_kind() const override { return LiteralKind::String; }
-    std::string& value() { return m_value; }
+    std::string& value();
+    const std::shared_ptr<String>& constant() const { return m_constant; }
 
 private:
-    std::string m_value;
+    std::shared_ptr<String> m_constant;
 };
 
 class VariableExpression : public Expression {
@@ -256,6 +305,59 @@ private:
     std::vector<std::unique_ptr<Expression>> m_elements;
 };
 
+class ObjectExpression : public Expression {
+public:
+    ObjectExpression(std::vector<std::string> keys,
+        std::vector<std::unique_ptr<Expression>> values)
+        : m_keys(std::move(keys))
+        , m_values(std::move(values))
+    {
+    }
+
+    Kind kind() const override { return Kind::ObjectExpr; }
+
+    std::vector<std::string>& keys() { return m_keys; }
+    std::vector<std::unique_ptr<Expression>>& values() { return m_values; }
+
+    // shape of the records built here, resolved on first evaluation
+    Shape*& shape() { return m_shape; }
+
+private:
+    std::vector<std::string> m_keys;
+    std::vector<std::unique_ptr<Expression>> m_values;
+    Shape* m_shape = nullptr;
+};
+
+// Inline cache of a field access site: the last record shape seen there and
+// the slot the field lives in for that shape.
+struct AccessCache {
+    Shape* shape = nullptr;
+    size_t slot = 0;
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+};
+
+class AccessExpression : public Expression {
+public:
+    AccessExpression(std::unique_ptr<Expression> object, std::string name)
+        : m_object(std::move(object))
+        , m_name(std::move(name))
+    {
+    }
+
+    Kind kind() const override { return Kind::AccessExpr; }
+
+    Expression& object() { return *m_object; }
+    std::string& name() { return m_name; }
+    AccessCache& cache() { return m_cache; }
+    std::unique_ptr<Expression>& object_ptr() { return m_object; }
+
+private:
+    std::unique_ptr<Expression> m_object;
+    std::string m_name;
+    AccessCache m_cache;
+};
+
 class IndexExpression : public Expression {
 public:
     IndexExpression(std::unique_ptr<Expression> object,
@@ -269,6 +371,8 @@ public:
 
     Expression& object() { return *m_object; }
     Expression& index() { return *m_index; }
+    std::unique_ptr<Expression>& object_ptr() { return m_object; }
+    std::unique_ptr<Expression>& index_ptr() { return m_index; }
 
 private:
     std::unique_ptr<Expression> m_object;
@@ -288,6 +392,7 @@ public:
 
     Expression& callee() { return *m_callee; }
     std::vector<std::unique_ptr<Expression>>& args() { return m_args; }
+    std::unique_ptr<Expression>& callee_ptr() { return m_callee; }
 
 private:
     std::unique_ptr<Expression> m_callee;
@@ -337,6 +442,8 @@ public:
     Expression& condition() { return *m_condition; }
     Statement& then_branch() { return *m_then_branch; }
     std::unique_ptr<Statement>& else_branch() { return m_else_branch; }
+    std::unique_ptr<Expression>& condition_ptr() { return m_condition; }
+    std::unique_ptr<Statement>& then_branch_ptr() { return m_then_branch; }
 
 private:
     std::unique_ptr<Expression> m_condition;
@@ -363,6 +470,7 @@ public:
     std::unique_ptr<Expression>& condition() { return m_condition; }
     std::unique_ptr<Expression>& increment() { return m_increment; }
     Statement& body() { return *m_body; };
+    std::unique_ptr<Statement>& body_ptr() { return m_body; }
 
 private:
     std::unique_ptr<Statement> m_initializer;
@@ -396,6 +504,7 @@ public:
     Kind kind() const override { return Kind::ExprStmt; }
 
     Expression& expr() { return *m_expr; }
+    std::unique_ptr<Expression>& expr_ptr() { return m_expr; }
 
 private:
     std::unique_ptr<Expression> m_expr;
@@ -445,6 +554,7 @@ public:
     std::string& name() { return m_name; }
     std::vector<std::string>& params() { return m_params; }
     Statement& body() { return *m_body; }
+    std::unique_ptr<Statement>& body_ptr() { return m_body; }
 
 private:
     std::string m_name;
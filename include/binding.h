@@ -0,0 +1,104 @@
+#pragma once
+
+#include "object.h"
+#include "shape.h"
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+enum class FieldType {
+    Boolean,
+    Int32,
+    Int64,
+    Double,
+    String, // std::string
+    StringView, // std::string_view
+};
+
+struct FieldAccessor {
+    std::string name;
+    FieldType type;
+    size_t offset;
+};
+
+template <typename T>
+constexpr FieldType field_type()
+{
+    if constexpr (std::is_same_v<T, bool>) {
+        return FieldType::Boolean;
+    } else if constexpr (std::is_same_v<T, int32_t>) {
+        return FieldType::Int32;
+    } else if constexpr (std::is_same_v<T, int64_t>) {
+        return FieldType::Int64;
+    } else if constexpr (std::is_same_v<T, double>) {
+        return FieldType::Double;
+    } else if constexpr (std::is_same_v<T, std::string>) {
+        return FieldType::String;
+    } else {
+        static_assert(std::is_same_v<T, std::string_view>, "unsupported field type");
+        return FieldType::StringView;
+    }
+}
+
+// Layout of a host struct or buffer, registered once and shared by every
+// HostRecord bound to it:
+//
+//     auto schema = std::make_shared<Schema>();
+//     schema->field<int64_t>("status", offsetof(Request, status))
+//         .field<std::string_view>("path", offsetof(Request, path));
+//
+// Fields get slots in registration order, so the schema has a Shape like any
+// record and field access sites cache it the same way.
+class Schema {
+public:
+    Schema()
+        : m_shape(Shape::root())
+    {
+    }
+
+    Schema& field(std::string name, FieldType type, size_t offset);
+
+    template <typename T>
+    Schema& field(std::string name, size_t offset)
+    {
+        return field(std::move(name), field_type<T>(), offset);
+    }
+
+    Shape* shape() const { return m_shape; }
+    const std::vector<FieldAccessor>& fields() const { return m_fields; }
+
+    Value read(size_t slot, const void* data) const;
+
+private:
+    Shape* m_shape;
+    std::vector<FieldAccessor> m_fields;
+};
+
+// Read-only view of host memory laid out by a Schema. Fields are read in
+// place on access, so feeding a new request is a `rebind` rather than one
+// `Context::define` per field.
+class HostRecord : public ShapedObject {
+public:
+    HostRecord(std::shared_ptr<const Schema> schema, const void* data = nullptr)
+        : ShapedObject(schema->shape())
+        , m_schema(std::move(schema))
+        , m_data(data)
+    {
+    }
+
+    void rebind(const void* data) { m_data = data; }
+    const void* data() const { return m_data; }
+
+    Value load(size_t slot) override;
+    void store(size_t slot, Value value) override;
+
+    void set_attr(std::string name, Value value) override;
+
+private:
+    std::shared_ptr<const Schema> m_schema;
+    const void* m_data;
+};
@@ -0,0 +1,28 @@
+#pragma once
+
+#include "object.h"
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+using BuiltinTable = std::unordered_map<std::string, Value>;
+
+// Native functions visible to every script, looked up after the variables
+// defined by the host.
+const BuiltinTable& builtins();
+
+// true for the builtins that change one of their arguments
+bool mutating_builtin(const std::string& name);
+
+void define_builtin(BuiltinTable& table, std::string name,
+    std::function<Value(std::vector<Value>&)> func);
+
+void check_arguments(const std::string& name, std::vector<Value>& args,
+    size_t count);
+
+void register_core_builtins(BuiltinTable& table);
+
+void register_kernel_builtins(BuiltinTable& table);
+
+void register_string_builtins(BuiltinTable& table);
@@ -0,0 +1,154 @@
+#pragma once
+
+#include "ast.h"
+#include "eval.h"
+#include "object.h"
+#include "shape.h"
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+// Opcodes of the stack VM. `a` and `b` are the instruction operands; "pops"
+// and "pushes" refer to the value stack. The superinstructions at the end
+// fuse the sequences the compiler sees most often.
+#define EXPR_OPCODES(X)                                                            \
+    X(LoadConst) /* a: constant */                                                 \
+    X(LoadUndefined)                                                               \
+    X(LoadLocal) /* a: slot */                                                     \
+    X(StoreLocal) /* a: slot, pops */                                              \
+    X(LoadGlobal) /* a: name */                                                    \
+    X(StoreGlobal) /* a: name, pops */                                             \
+    X(DefineGlobal) /* a: name, pops */                                            \
+    X(Pop)                                                                         \
+    X(Dup)                                                                         \
+    X(Add)                                                                         \
+    X(Sub)                                                                         \
+    X(Mul)                                                                         \
+    X(Div)                                                                         \
+    X(Mod)                                                                         \
+    X(Equal)                                                                       \
+    X(NotEqual)                                                                    \
+    X(Less)                                                                        \
+    X(LessEqual)                                                                   \
+    X(Greater)                                                                     \
+    X(GreaterEqual)                                                                \
+    X(Negate)                                                                      \
+    X(Not)                                                                         \
+    X(Jump) /* a: target */                                                        \
+    X(JumpIfFalse) /* a: target, pops a Boolean */                                 \
+    X(Call) /* a: argument count, callee below the arguments */                    \
+    X(CallFunction) /* a: chunk, b: argument count */                              \
+    X(Return)                                                                      \
+    X(MakeArray) /* a: element count */                                            \
+    X(MakeObject) /* a: object site */                                             \
+    X(Index)                                                                       \
+    X(SetIndex) /* pops value, object, index, pushes value */                      \
+    X(GetAttr) /* a: name, b: access site */                                       \
+    X(SetAttr) /* a: name, b: access site, pops value, object, pushes value */     \
+    X(AddLocalConst) /* a: slot, b: constant, pushes local + constant */           \
+    X(SubLocalConst) /* a: slot, b: constant, pushes local - constant */           \
+    X(JumpUnlessEqual) /* a: target, pops two, jumps unless lhs == rhs */          \
+    X(JumpUnlessNotEqual)                                                          \
+    X(JumpUnlessLess)                                                              \
+    X(JumpUnlessLessEqual)                                                         \
+    X(JumpUnlessGreater)                                                           \
+    X(JumpUnlessGreaterEqual)                                                      \
+    X(IncLocal) /* a: slot */                                                      \
+    X(DecLocal) /* a: slot */
+
+enum class Opcode : uint8_t {
+#define EXPR_OPCODE_ENUM(name) name,
+    EXPR_OPCODES(EXPR_OPCODE_ENUM)
+#undef EXPR_OPCODE_ENUM
+};
+
+std::string opcode_str(Opcode op);
+
+struct Instruction {
+    Opcode op;
+    uint32_t a = 0;
+    uint32_t b = 0;
+};
+
+struct Chunk {
+    std::string name;
+    uint32_t params = 0;
+    // params first, then every `let` of the function
+    uint32_t locals = 0;
+    std::vector<Instruction> code;
+};
+
+// A compiled program. Chunk 0 is the top-level code, the others are the
+// program's functions.
+//
+// Names declared in a function (parameters and lets) are resolved to local
+// slots at compile time, so scoping is lexical: anything else is looked up in
+// the Context, which holds top-level lets read by functions, host definitions
+// and builtins. Programs whose result depends on the tree evaluator's dynamic
+// scoping are rejected, see require_lexical_scoping().
+struct Bytecode {
+    std::vector<Chunk> chunks;
+    std::vector<Value> constants;
+    std::vector<std::string> names;
+    // keys of each object literal, as name indices
+    std::vector<std::vector<uint32_t>> objects;
+    uint32_t access_sites = 0;
+    std::unordered_map<std::string, uint32_t> functions;
+};
+
+Bytecode compile(Program& program);
+
+// Names read or assigned in the program's function bodies. Top-level lets
+// with one of these names are kept in the Context so the functions can still
+// see them.
+std::unordered_set<std::string> shared_names(Program& program);
+
+// Names bound anywhere in the program by a `let`, a parameter or an
+// assignment. A call by one of these names may reach something other than the
+// function of that name, so it is not bound to that function ahead of time.
+std::unordered_set<std::string> rebound_names(Program& program);
+
+// The tree evaluator scopes names dynamically: a function reading a name it
+// does not bind sees the binding of whichever caller made one. Backends that
+// resolve names per function cannot do that, so they call this first, and it
+// throws when a function reads or assigns a free name that some function
+// binds with a `let` or as a parameter.
+void require_lexical_scoping(Program& program);
+
+std::string disassemble(const Bytecode& bytecode);
+
+// Executes a compiled program. Dispatch uses computed gotos when the compiler
+// supports labels-as-values and a switch otherwise; define
+// EXPR_SWITCH_DISPATCH to force the switch.
+class VM {
+public:
+    VM(Bytecode bytecode, Context& context);
+
+    Value run();
+
+    const Bytecode& bytecode() const { return m_bytecode; }
+
+private:
+    struct Frame {
+        const Instruction* ip; // the caller's call instruction
+        const Instruction* code;
+        size_t base;
+        size_t unwind; // stack size to restore on return
+    };
+
+    Value get_attr(const Instruction& instruction, Value& object);
+    void set_attr(const Instruction& instruction, Value& object, Value& value);
+    Value make_record(uint32_t site, size_t count);
+
+    Bytecode m_bytecode;
+    Context& m_context;
+
+    std::vector<Value> m_stack;
+    std::vector<Frame> m_frames;
+    std::vector<AccessCache> m_access_caches;
+    std::vector<Shape*> m_object_shapes;
+    Value m_undefined;
+};
@@ -0,0 +1,68 @@
+#pragma once
+
+#include "ast.h"
+#include "eval.h"
+#include "object.h"
+#include "types.h"
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+class ClosureProgram;
+
+// State of one running function: its locals, addressed by the slots the
+// compiler resolved, and the value of the `return` that ended it.
+struct ClosureFrame {
+    const ClosureProgram& program;
+    Context& context;
+    std::vector<Value> locals;
+    Value result;
+};
+
+// How a compiled statement finished, mirroring ControlFlow::Kind.
+enum class Completion {
+    Normal,
+    Break,
+    Continue,
+    Return,
+};
+
+using ExprClosure = std::function<Value(ClosureFrame&)>;
+using StmtClosure = std::function<Completion(ClosureFrame&)>;
+
+struct ClosureFunction {
+    std::string name;
+    uint32_t params = 0;
+    // params first, then the locals
+    uint32_t locals = 0;
+    StmtClosure body;
+};
+
+// A program lowered to a tree of pre-bound closures. Every AST node is turned
+// into a callable once, capturing its children, its operator and its resolved
+// local slot, so running it does no switching on node kinds or operators.
+// Scoping is lexical and names that are not locals resolve through the
+// Context, the same way as for the VMs, and the same programs are rejected.
+//
+// Compiling runs infer_types() first; operators whose operands are known to
+// be integers get closures without kind checks.
+class ClosureProgram {
+public:
+    explicit ClosureProgram(Program& program, const TypeEnvironment& environment = {});
+
+    Value run(Context& context) const;
+
+    // the function `name` or nullptr
+    const ClosureFunction* function(const std::string& name) const;
+
+    // calls `fn`, with `args` already evaluated
+    static Value call(const ClosureFunction& fn, const ClosureProgram& program, Context& context,
+        std::vector<Value> args);
+
+private:
+    ClosureFunction m_main;
+    std::unordered_map<std::string, std::unique_ptr<ClosureFunction>> m_functions;
+};
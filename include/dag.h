@@ -0,0 +1,75 @@
+#pragma once
+
+#include "ast.h"
+#include "eval.h"
+#include "object.h"
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Many independent expressions, typically the rules of a rule set, merged
+// into one graph where equal subexpressions are a single node:
+//
+//   dag.add(Parser("price * qty > 100").parse_expression());
+//   dag.add(Parser("price * qty - discount > 50").parse_expression());
+//   auto results = dag.evaluate(context);
+//
+// computes `price * qty` once per evaluation. Literals, names, field and index
+// reads, prefix operators and arithmetic and comparisons are shared; anything
+// else, like a call, stays a private subtree run by the tree walker. The
+// expressions should not assign names the others read, since shared nodes are
+// evaluated once, in the order they were first added.
+class ExpressionDAG {
+public:
+    // adds `expression` as the next output and returns its index
+    size_t add(std::unique_ptr<Expression> expression);
+
+    // the value of every output, in the order they were added
+    std::vector<Value> evaluate(Context& context);
+
+    size_t outputs() const { return m_outputs.size(); }
+    // distinct nodes, against the nodes of all the expressions added
+    size_t nodes() const { return m_nodes.size(); }
+    size_t references() const { return m_references; }
+
+    std::string report() const;
+
+private:
+    struct Node {
+        enum class Kind {
+            Literal,
+            Variable,
+            Access,
+            Index,
+            Prefix,
+            Binary,
+            // a subtree the graph does not look into
+            Opaque,
+        };
+
+        Kind kind = Kind::Opaque;
+        Operator op = Operator::Invalid;
+        uint32_t lhs = 0;
+        uint32_t rhs = 0;
+        std::string name {};
+        Value value {};
+        Expression* expression = nullptr;
+        // the binary handler for the operand kinds seen last
+        ValueKind lhs_kind = ValueKind::Undefined;
+        ValueKind rhs_kind = ValueKind::Undefined;
+        BinaryCache::Handler handler = nullptr;
+        AccessCache cache {};
+    };
+
+    uint32_t node(Expression& expression);
+    uint32_t intern(std::string key, Node node);
+    Value evaluate(Node& node, Context& context, const std::vector<Value>& values);
+
+    std::vector<std::unique_ptr<Expression>> m_expressions;
+    std::vector<Node> m_nodes;
+    std::unordered_map<std::string, uint32_t> m_keys;
+    std::vector<uint32_t> m_outputs;
+    size_t m_references = 0;
+};
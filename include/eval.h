@@ -1,9 +1,19 @@
+#pragma once
+
+#include "alloc.h"
 #include "ast.h"
+#include "binding.h"
+#include "builtins.h"
+#include "jit.h"
+#include "memo.h"
 #include "object.h"
+#include "profiler.h"
 #include <memory>
+#include <optional>
 #include <stdexcept>
 #include <string>
 #include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
 struct StackFrame {
@@ -17,9 +27,12 @@ public:
     void enter_scope() { m_frames.push_back(StackFrame()); }
     void level_scope() { m_frames.pop_back(); }
 
+    size_t depth() const { return m_frames.size(); }
+    void level_to(size_t depth) { m_frames.resize(depth); }
+
     void insert(std::string name, Value value)
     {
-        m_frames.back().locals.insert({ name, value });
+        m_frames.back().locals.insert_or_assign(name, value);
     }
 
     void set(std::string name, Value value)
@@ -90,7 +103,7 @@ public:
         , m_stack(Stack())
     {
         for (auto& fn : program->functions()) {
-            insert_variable(fn.first, Value(std::make_shared<UserFunction>(fn.first)));
+            insert_variable(fn.first, Value(make_object<UserFunction>(ValueKind::UserFunction, fn.first)));
         }
     }
 
@@ -121,6 +134,11 @@ public:
             return found->second;
         }
 
+        auto builtin = builtins().find(name);
+        if (builtin != builtins().end()) {
+            return builtin->second;
+        }
+
         throw std::runtime_error("Variable not found: " + name);
     }
     void set_variable(std::string name, Value value)
@@ -153,14 +171,62 @@ public:
     void define(std::string name, T value)
     {
         m_environment.insert_or_assign(name, Value(value));
+        m_constants.erase(name);
+    }
+
+    // like define(), and promises the value stays the same for every run that
+    // uses this context, so programs may be specialized against it
+    template <typename T>
+        requires to_value<T>
+    void define_constant(std::string name, T value)
+    {
+        define(name, value);
+        m_constants.insert(name);
+    }
+
+    // the bindings made with define_constant()
+    std::unordered_map<std::string, Value> constants() const
+    {
+        std::unordered_map<std::string, Value> constants;
+        for (auto& name : m_constants) {
+            constants.emplace(name, m_environment.at(name));
+        }
+        return constants;
     }
 
 private:
     Stack m_stack;
     std::unordered_map<std::string, Value> m_environment;
+    std::unordered_set<std::string> m_constants;
     std::shared_ptr<Program> m_program;
 };
 
+// Enters a scope for its lifetime and leaves it again on the way out, also
+// when an error such as MemoryLimitExceeded unwinds through it, so a context
+// stays usable after a caught error.
+class ContextScope {
+public:
+    explicit ContextScope(Context& context)
+        : m_stack(context.stack())
+        , m_depth(m_stack.depth())
+    {
+        m_stack.enter_scope();
+    }
+
+    ~ContextScope() { m_stack.level_to(m_depth); }
+
+    ContextScope(const ContextScope&) = delete;
+    ContextScope& operator=(const ContextScope&) = delete;
+
+private:
+    Stack& m_stack;
+    size_t m_depth;
+};
+
+// The handler the evaluator uses for `op` on operands of these kinds, or
+// nullptr for operators that are not arithmetic or comparisons.
+BinaryCache::Handler binary_handler(Operator op, ValueKind lhs, ValueKind rhs);
+
 class Evaluator {
 public:
     Evaluator(Context& context)
@@ -171,6 +237,15 @@ public:
     Value eval();
     Value eval(Expression& expression);
 
+    // only takes effect when built with EXPR_PROFILE
+    void set_profiler(Profiler* profiler) { m_profiler = profiler; }
+
+    // hands calls to user functions to the JIT first
+    void set_jit(Jit* jit) { m_jit = jit; }
+
+    // answers calls to pure user functions from `memo` where it can
+    void set_memo(MemoCache* memo) { m_memo = memo; }
+
 private:
     ControlFlow eval(Statement& statement);
     ControlFlow eval(ReturnStatement& statement);
@@ -186,13 +261,17 @@ private:
     Value eval(PrefixExpression& expression);
     Value eval(PostfixExpression& expression);
     Value eval(CallExpression& expression);
+    Value eval(ArrayExpression& expression);
+    Value eval(IndexExpression& expression);
+    Value eval(ObjectExpression& expression);
+    Value eval(AccessExpression& expression);
 
+    Value eval_assign(BinaryExpression& expression);
     Value eval_call(FnStatement& fn, std::vector<Value>& args);
-
-    template <typename Arguments> Value eval_call(Object& obj, Arguments args)
-    {
-       return obj.call(args);
-    }
+    Value invoke(FnStatement& fn, std::vector<Value>& args);
 
     Context& m_context;
+    Profiler* m_profiler = nullptr;
+    Jit* m_jit = nullptr;
+    MemoCache* m_memo = nullptr;
 };
\ No newline at end of file
@@ -0,0 +1,159 @@
+#pragma once
+
+#include "ast.h"
+#include "eval.h"
+#include "object.h"
+#include "shape.h"
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+constexpr uint32_t FLAT_NONE = UINT32_MAX;
+
+// One node of a flattened program. Children are indices into the node array;
+// variable-length children (block statements, call arguments, ...) and names
+// live in the shared `lists` table. The meaning of `a`, `b` and `c` depends on
+// the kind:
+//
+//     LetStmt       a: name             b: value or FLAT_NONE
+//     IfStmt        a: condition        b: then            c: else or FLAT_NONE
+//     ForStmt       a: list of [initializer, condition, increment, body]
+//     BlockStmt     a: list of statements                  b: count
+//     ReturnStmt    a: value or FLAT_NONE
+//     ExprStmt      a: expression
+//     BinaryExpr    op: Operator        a: left            b: right
+//     PrefixExpr    op: Operator        a: expression
+//     PostfixExpr   op: Operator        a: expression
+//     VariableExpr  a: name
+//     LiteralExpr   op: LiteralKind     a: constant (string index for strings)
+//     IndexExpr     a: object           b: index
+//     CallExpr      a: callee           b: list of arguments  c: count
+//     AccessExpr    a: object           b: name            c: access site
+//     ArrayExpr     a: list of elements b: count
+//     ObjectExpr    a: list of keys followed by values     b: count  c: object site
+//
+// Names are string table indices. Access and object sites number the inline
+// caches an evaluator keeps next to the (possibly read-only) program.
+struct FlatNode {
+    uint8_t kind;
+    uint8_t op;
+    uint16_t reserved;
+    uint32_t a;
+    uint32_t b;
+    uint32_t c;
+
+    ASTNode::Kind node_kind() const { return ASTNode::Kind(kind); }
+};
+
+static_assert(sizeof(FlatNode) == 16);
+
+struct FlatString {
+    uint32_t offset;
+    uint32_t length;
+};
+
+struct FlatFunction {
+    uint32_t name;
+    uint32_t params; // list of parameter names
+    uint32_t param_count;
+    uint32_t body;
+};
+
+// Non-owning view of a flattened program, backed by a FlatBuffer or by a
+// mapped ProgramImage.
+struct FlatProgram {
+    std::span<const FlatNode> nodes;
+    std::span<const uint32_t> lists;
+    std::span<const uint64_t> constants;
+    std::span<const FlatString> strings;
+    std::string_view chars;
+    std::span<const FlatFunction> functions;
+
+    uint32_t statements = 0;
+    uint32_t statement_count = 0;
+    uint32_t access_sites = 0;
+    uint32_t object_sites = 0;
+
+    std::string_view string(uint32_t index) const
+    {
+        return chars.substr(strings[index].offset, strings[index].length);
+    }
+};
+
+// Owning storage for a program flattened in memory.
+class FlatBuffer {
+public:
+    uint32_t add_node(FlatNode node);
+    uint32_t add_list(const std::vector<uint32_t>& items);
+    uint32_t add_constant(uint64_t bits);
+    uint32_t intern(std::string_view text);
+    void add_function(FlatFunction function) { m_functions.push_back(function); }
+
+    uint32_t next_access_site() { return m_access_sites++; }
+    uint32_t next_object_site() { return m_object_sites++; }
+
+    void set_statements(uint32_t list, uint32_t count)
+    {
+        m_statements = list;
+        m_statement_count = count;
+    }
+
+    FlatProgram view() const;
+
+private:
+    std::vector<FlatNode> m_nodes;
+    std::vector<uint32_t> m_lists;
+    std::vector<uint64_t> m_constants;
+    std::vector<FlatString> m_strings;
+    std::string m_chars;
+    std::vector<FlatFunction> m_functions;
+    std::unordered_map<std::string, uint32_t> m_interned;
+
+    uint32_t m_statements = 0;
+    uint32_t m_statement_count = 0;
+    uint32_t m_access_sites = 0;
+    uint32_t m_object_sites = 0;
+};
+
+FlatBuffer flatten(Program& program);
+
+// Tree-walking evaluator over a FlatProgram. Per-program state that has to be
+// writable (inline caches, the function table, materialized names) is kept
+// here, so the program itself can live in read-only memory.
+class FlatEvaluator {
+public:
+    FlatEvaluator(FlatProgram program, Context& context);
+
+    Value eval();
+
+private:
+    ControlFlow exec(uint32_t index);
+    ControlFlow exec_for(const FlatNode& node);
+    ControlFlow exec_block(const FlatNode& node);
+
+    Value eval(uint32_t index);
+    Value eval_literal(const FlatNode& node);
+    Value eval_binary(const FlatNode& node);
+    Value eval_assign(const FlatNode& node);
+    Value eval_prefix(const FlatNode& node);
+    Value eval_postfix(const FlatNode& node);
+    Value eval_call(const FlatNode& node);
+    Value eval_array(const FlatNode& node);
+    Value eval_object(const FlatNode& node);
+    Value eval_access(const FlatNode& node);
+    Value call_function(const FlatFunction& fn, std::vector<Value>& args);
+
+    FlatProgram m_program;
+    Context& m_context;
+
+    std::vector<std::string> m_names;
+    std::unordered_map<std::string, uint32_t> m_functions;
+    std::vector<AccessCache> m_access_caches;
+    std::vector<Shape*> m_object_shapes;
+    // string literals by string index, made on first use
+    std::vector<std::shared_ptr<String>> m_literals;
+};
@@ -0,0 +1,69 @@
+#pragma once
+
+#include "flat.h"
+#include "mapped_file.h"
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+// On-disk image of a flattened program. The header is followed by the node,
+// list, constant, string, character and function sections, each padded to 8
+// bytes, so a mapped image is used in place without any per-node work.
+//
+// Bump IMAGE_VERSION whenever FlatNode, the section order or the meaning of a
+// node field changes; older images are then rejected instead of misread.
+constexpr char IMAGE_MAGIC[8] = { 'E', 'X', 'P', 'R', 'I', 'M', 'G', '\0' };
+constexpr uint32_t IMAGE_VERSION = 1;
+constexpr uint32_t IMAGE_BYTE_ORDER = 0x01020304;
+
+struct ImageHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint64_t checksum; // of everything after the header
+    uint64_t size; // bytes after the header
+
+    uint32_t node_count;
+    uint32_t list_count;
+    uint32_t constant_count;
+    uint32_t string_count;
+    uint32_t char_count;
+    uint32_t function_count;
+
+    uint32_t statements;
+    uint32_t statement_count;
+    uint32_t access_sites;
+    uint32_t object_sites;
+};
+
+static_assert(sizeof(ImageHeader) % 8 == 0);
+
+class ImageError : public std::runtime_error {
+public:
+    ImageError(const std::string& msg)
+        : runtime_error(msg)
+    {
+    }
+};
+
+uint64_t image_checksum(std::string_view data);
+
+void write_image(const FlatProgram& program, std::ostream& out);
+void write_image(const FlatProgram& program, const std::string& path);
+
+// A program image mapped from disk. Construction checks the magic, version,
+// byte order, size and checksum, then bounds-checks every node, list, string
+// and function reference, and throws ImageError on any mismatch.
+class ProgramImage {
+public:
+    explicit ProgramImage(const std::string& path);
+
+    const FlatProgram& program() const { return m_program; }
+
+private:
+    MappedFile m_file;
+    FlatProgram m_program;
+};
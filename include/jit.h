@@ -0,0 +1,77 @@
+#pragma once
+
+#include "ast.h"
+#include "object.h"
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+struct JitStats {
+    size_t compiled = 0;
+    size_t rejected = 0;
+    size_t native_calls = 0;
+    // calls whose arguments did not match any compiled version
+    size_t guard_failures = 0;
+    // native calls that bailed out to the interpreter halfway
+    size_t deopts = 0;
+};
+
+// Baseline x86-64 compiler for hot user functions. The Evaluator hands every
+// call to `call()`; once a function has been called `threshold` times it is
+// compiled to machine code specialized for the kinds of the arguments it is
+// seeing, and later calls with the same kinds run natively.
+//
+// Only functions that work on integers, floats and booleans held in locals
+// and call other such functions are compiled. Those functions cannot observe
+// or change anything outside their own frame, so whenever native code hits a
+// case it does not handle (division by zero, falling off the end, a callee
+// bailing out) it simply abandons the call and the interpreter runs it again
+// from the start. Everything else, and every platform but Linux x86-64,
+// keeps running in the interpreter.
+class Jit {
+public:
+    explicit Jit(std::shared_ptr<Program> program, uint32_t threshold = 100);
+    ~Jit();
+
+    Jit(const Jit&) = delete;
+    Jit& operator=(const Jit&) = delete;
+
+    static bool supported();
+
+    // nullopt when the call has to be interpreted
+    std::optional<Value> call(FnStatement& fn, const std::vector<Value>& args);
+
+    const JitStats& stats() const { return m_stats; }
+
+    // one line per compiled or rejected version
+    std::string report() const;
+
+    struct Code;
+
+    // the version of `fn` for `params`, compiling it on first use; used by the
+    // compiler to resolve calls between compiled functions
+    Code& specialize(FnStatement& fn, const std::vector<ValueKind>& params);
+
+    // the program function a call by `name` reaches, or nullptr when there is
+    // none or the program also binds `name` with a let, parameter or
+    // assignment, which a caller's binding could shadow
+    FnStatement* function(const std::string& name) const;
+
+private:
+    struct Entry {
+        uint32_t calls = 0;
+        std::vector<std::unique_ptr<Code>> versions;
+    };
+
+    std::shared_ptr<Program> m_program;
+    std::unordered_set<std::string> m_rebound;
+    uint32_t m_threshold;
+    std::unordered_map<const FnStatement*, Entry> m_functions;
+    std::vector<uint64_t> m_arguments;
+    JitStats m_stats;
+};
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Kernels over contiguous numeric buffers, backing the numeric array builtins.
+// The double kernels use AVX2 when the CPU supports it and SSE2 otherwise, with
+// a portable scalar fallback on other targets.
+
+double sum_f64(const double* data, size_t n);
+int64_t sum_i64(const int64_t* data, size_t n);
+
+double dot_f64(const double* a, const double* b, size_t n);
+int64_t dot_i64(const int64_t* a, const int64_t* b, size_t n);
+
+// index of the first minimum / maximum, n must not be zero
+size_t argmin_f64(const double* data, size_t n);
+size_t argmax_f64(const double* data, size_t n);
+size_t argmin_i64(const int64_t* data, size_t n);
+size_t argmax_i64(const int64_t* data, size_t n);
+
+void scale_f64(const double* data, double factor, double* out, size_t n);
+void scale_i64(const int64_t* data, int64_t factor, int64_t* out, size_t n);
+
+void add_f64(const double* a, const double* b, double* out, size_t n);
+void add_i64(const int64_t* a, const int64_t* b, int64_t* out, size_t n);
+void mul_f64(const double* a, const double* b, double* out, size_t n);
+void mul_i64(const int64_t* a, const int64_t* b, int64_t* out, size_t n);
+
+// copies the elements whose mask byte is non-zero, returns the count written
+size_t filter_f64(const double* data, const uint8_t* mask, double* out, size_t n);
+size_t filter_i64(const int64_t* data, const uint8_t* mask, int64_t* out, size_t n);
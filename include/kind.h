@@ -0,0 +1,54 @@
+#pragma once
+
+#include <cstdint>
+
+enum class ValueKind {
+    Undefined,
+    Boolean,
+    Integer,
+    Float,
+    String,
+    Array,
+    Object,
+    UserFunction,
+    NativeFunction,
+};
+
+// A set of ValueKinds, as inferred for an expression by infer_types().
+class KindSet {
+public:
+    KindSet() = default;
+    KindSet(ValueKind kind)
+        : m_bits(bit(kind))
+    {
+    }
+
+    static KindSet any() { return from_bits((bit(ValueKind::NativeFunction) << 1) - 1); }
+    static KindSet from_bits(uint32_t bits)
+    {
+        KindSet set;
+        set.m_bits = bits;
+        return set;
+    }
+
+    bool empty() const { return m_bits == 0; }
+    bool contains(ValueKind kind) const { return (m_bits & bit(kind)) != 0; }
+    // exactly `kind`
+    bool is(ValueKind kind) const { return m_bits == bit(kind); }
+    bool is_any() const { return *this == any(); }
+    uint32_t bits() const { return m_bits; }
+
+    KindSet operator|(KindSet other) const { return from_bits(m_bits | other.m_bits); }
+    KindSet operator&(KindSet other) const { return from_bits(m_bits & other.m_bits); }
+    KindSet& operator|=(KindSet other)
+    {
+        m_bits |= other.m_bits;
+        return *this;
+    }
+    bool operator==(const KindSet& other) const = default;
+
+private:
+    static uint32_t bit(ValueKind kind) { return uint32_t(1) << uint32_t(kind); }
+
+    uint32_t m_bits = 0;
+};
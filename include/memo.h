@@ -0,0 +1,72 @@
+#pragma once
+
+#include "ast.h"
+#include "object.h"
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+// The functions of `program` whose result depends only on their arguments:
+// their bodies read and assign nothing but their parameters and their own
+// `let`s, and call only functions of this set, by a name the program never
+// rebinds. Anything else, including builtins, may read or change state the
+// arguments do not capture.
+std::unordered_set<std::string> pure_functions(Program& program);
+
+struct MemoStats {
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    // entries dropped to stay within the capacity
+    uint64_t evictions = 0;
+    // calls to pure functions with an array, object or function argument
+    uint64_t skipped = 0;
+};
+
+// Results of calls to pure functions, keyed on the argument values. The
+// Evaluator looks calls up here first, then runs and records the misses:
+//
+//   MemoCache memo(program);
+//   Evaluator evaluator(context);
+//   evaluator.set_memo(&memo);
+//
+// Only calls whose arguments and result are undefined, booleans, numbers or
+// strings are cached, since arrays and objects can change after the call.
+// Keep one cache per evaluation, or per program to share results between
+// runs. Once `capacity` results are held, the least recently used goes.
+class MemoCache {
+public:
+    explicit MemoCache(Program& program, size_t capacity = 4096);
+
+    bool pure(const FnStatement& fn) const { return m_pure.contains(&fn); }
+
+    // nullopt when the call has to be run, and then store() its result
+    std::optional<Value> lookup(const FnStatement& fn, const std::vector<Value>& args);
+    void store(const FnStatement& fn, const std::vector<Value>& args, const Value& result);
+
+    void clear();
+
+    size_t size() const { return m_entries.size(); }
+    const MemoStats& stats() const { return m_stats; }
+    std::string report() const;
+
+private:
+    std::optional<std::string> key(const FnStatement& fn, const std::vector<Value>& args) const;
+
+    struct Entry {
+        std::string key;
+        Value result;
+    };
+
+    std::unordered_set<const FnStatement*> m_pure;
+    size_t m_capacity;
+    // most recently used first
+    std::list<Entry> m_entries;
+    std::unordered_map<std::string, std::list<Entry>::iterator> m_index;
+    MemoStats m_stats;
+};
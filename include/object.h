@@ -1,4 +1,8 @@
+#pragma once
+
 #include "ast.h"
+#include "kind.h"
+#include "shape.h"
 #include <cstdint>
 #include <ctime>
 #include <format>
@@ -6,20 +10,12 @@
 #include <memory>
 #include <stdexcept>
 #include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include <variant>
 #include <vector>
 
-enum class ValueKind {
-    Undefined,
-    Boolean,
-    Integer,
-    Float,
-    String,
-    Array,
-    Object,
-    UserFunction,
-    NativeFunction,
-};
-
 enum class Comparison {
     Equal,
     Less,
@@ -63,6 +59,12 @@ class String;
 
 class UserFunction;
 
+class Array;
+
+class ShapedObject;
+
+class Record;
+
 class Object {
 public:
     virtual ~Object() = default;
@@ -84,7 +86,9 @@ public:
 
     virtual Value index(const Value& index);
 
-    virtual Value call(Value args...);
+    virtual void set_index(const Value& index, Value value);
+
+    virtual Value call(std::vector<Value>& args);
 
     virtual Value get_attr(std::string name);
 
@@ -111,9 +115,12 @@ public:
         return std::format("<native fn {}>", this->name());
     }
 
-    Value call(Value args...) override;
+    Value call(std::vector<Value>& args) override;
 
 private:
+    template <size_t... I>
+    Value invoke(std::vector<Value>& args, std::index_sequence<I...>);
+
     std::string m_name;
     std::function<T(Arguments...)> m_func;
 };
@@ -158,7 +165,10 @@ public:
     explicit Value(double value);
     explicit Value(std::string value);
 
-    Value operator=(const Value& other);
+    Value(const Value&) = default;
+    Value(Value&&) = default;
+    Value& operator=(const Value&) = default;
+    Value& operator=(Value&&) = default;
     operator bool() const;
     operator int64_t() const;
     operator double() const;
@@ -172,6 +182,9 @@ public:
     double& as_float() const;
     std::string& as_string() const;
     UserFunction& as_user_function() const;
+    Array& as_array() const;
+    ShapedObject& as_shaped() const;
+    Record& as_record() const;
 
     template <typename T, typename... Arguments>
     NativeFunction<T, Arguments...>& as_native_function() const
@@ -181,6 +194,7 @@ public:
     }
 
     std::shared_ptr<Object> obj() const { return m_obj; }
+    Object* get() const { return m_obj.get(); }
     void set_obj(std::shared_ptr<Object> obj) { m_obj = obj; }
     void set(Value value);
 
@@ -192,6 +206,7 @@ class Undefined : public Object {
 public:
     Undefined() = default;
     ValueKind kind() override { return ValueKind::Undefined; }
+    std::string inspect() override { return "undefined"; }
 
     Comparison compare(const Value& other) override;
 };
@@ -204,6 +219,7 @@ public:
     }
 
     ValueKind kind() override { return ValueKind::Boolean; }
+    std::string inspect() override { return m_value ? "true" : "false"; }
 
     bool& value() { return m_value; }
 
@@ -256,14 +272,57 @@ private:
     double m_value;
 };
 
-class String : public Object {
+// A string, or the concatenation of two strings that is only copied into one
+// buffer when its characters are first read. `s = s + x` in a loop then links
+// the pieces instead of copying the whole of `s` on every iteration. Strings
+// that are short anyway are concatenated right away, and std::string keeps
+// the shortest ones inline.
+//
+// A string can also borrow characters the host owns, see borrow(), or share
+// those of another string, see slice(). Strings are never changed once made,
+// so literals and values share them freely.
+class String : public Object, public std::enable_shared_from_this<String> {
 public:
     String(std::string value)
-        : m_value(value)
+        : m_value(std::move(value))
+        , m_size(m_value.size())
     {
     }
 
-    std::string& value() { return m_value; }
+    struct Borrowed { };
+
+    String(Borrowed, std::string_view view)
+        : m_view(view)
+        , m_borrowed(true)
+        , m_size(view.size())
+    {
+    }
+
+    String(std::shared_ptr<String> left, std::shared_ptr<String> right)
+        : m_size(left->size() + right->size())
+        , m_left(std::move(left))
+        , m_right(std::move(right))
+    {
+    }
+
+    ~String() override;
+
+    // A string over `text` without copying it. The host keeps `text` alive and
+    // unchanged for as long as any value made from it may be read, usually
+    // until the run that gets it returns. value() copies it on first use,
+    // while size(), view(), comparisons and concatenation do not.
+    static Value borrow(std::string_view text);
+    // `size` characters of `owner` from `offset`, sharing its characters
+    // unless the slice is short enough to be copied inline
+    static Value slice(const std::shared_ptr<String>& owner, size_t offset, size_t size);
+
+    // the characters, flattening a concatenation first
+    std::string& value();
+    // the same characters without copying borrowed ones
+    std::string_view view();
+    size_t size() const { return m_size; }
+    bool flat() const { return m_left == nullptr; }
+    bool borrowed() const { return m_borrowed; }
 
     Value add(const Value& other) override;
     Comparison compare(const Value& other) override;
@@ -275,7 +334,18 @@ public:
     }
 
 private:
+    void append_to(std::string& out) const;
+
     std::string m_value;
+    std::string_view m_view;
+    bool m_borrowed = false;
+    // keeps the characters of a slice alive
+    std::shared_ptr<String> m_owner;
+    size_t m_size;
+    // both set until the concatenation is flattened, and while they are the
+    // string is charged its size in the current AllocationTracker
+    std::shared_ptr<String> m_left;
+    std::shared_ptr<String> m_right;
 };
 
 class UserFunction : public Object {
@@ -302,31 +372,165 @@ concept to_value = requires(T t) {
     Value(t);
 };
 
-// template <typename... Arguments>
-// class Callable : public Object {
-// public:
-//     Callable(std::string name, std::function<Value(Arguments...)> func)
-//         : m_name(name)
-//         , m_func(func)
-//     {
-//     }
+// Native function taking its arguments as a list, used for builtins.
+class Callable : public Object {
+public:
+    Callable(std::string name, std::function<Value(std::vector<Value>&)> func)
+        : m_name(name)
+        , m_func(func)
+    {
+    }
 
-//     ValueKind kind() override { return ValueKind::NativeFunction; }
+    ValueKind kind() override { return ValueKind::NativeFunction; }
 
-//     std::string name() { return m_name; }
+    std::string name() { return m_name; }
 
-//     std::string inspect() override
-//     {
-//         return std::format("<native fn {}>", this->name());
-//     }
+    std::string inspect() override
+    {
+        return std::format("<native fn {}>", this->name());
+    }
 
-//     Value call(std::vector<Value>& args) override
-//     {
-//         // return m_func(args);
-//         return Value();
-//     }
+    Value call(std::vector<Value>& args) override { return m_func(args); }
 
-// private:
-//     std::string m_name;
-//     std::function<Value(Arguments...)> m_func;
-// };
+private:
+    std::string m_name;
+    std::function<Value(std::vector<Value>&)> m_func;
+};
+
+// Array elements are kept in a contiguous int64_t or double buffer while the
+// array is homogeneous, and fall back to generic Values otherwise.
+class Array : public Object {
+public:
+    using Storage = std::variant<std::vector<int64_t>, std::vector<double>,
+        std::vector<Value>>;
+
+    Array() { }
+
+    explicit Array(std::vector<int64_t> values)
+        : m_storage(std::move(values))
+    {
+    }
+
+    explicit Array(std::vector<double> values)
+        : m_storage(std::move(values))
+    {
+    }
+
+    explicit Array(std::vector<Value> values);
+    ~Array() override;
+
+    ValueKind kind() override { return ValueKind::Array; }
+    std::string inspect() override;
+
+    size_t length() const;
+    void reserve(size_t capacity);
+
+    Value get(size_t index) const;
+    void set(size_t index, Value value);
+    void push(Value value);
+
+    Value index(const Value& index) override;
+    void set_index(const Value& index, Value value) override;
+
+    std::vector<int64_t>* integers() { return std::get_if<std::vector<int64_t>>(&m_storage); }
+    std::vector<double>* floats() { return std::get_if<std::vector<double>>(&m_storage); }
+    std::vector<Value>* values() { return std::get_if<std::vector<Value>>(&m_storage); }
+
+private:
+    size_t checked_index(const Value& index) const;
+    size_t capacity_bytes() const;
+    void generalize();
+
+    Storage m_storage;
+};
+
+// Object values whose fields are laid out by a Shape. Field access sites
+// resolve a key to a slot once per shape and then go through load/store.
+class ShapedObject : public Object {
+public:
+    explicit ShapedObject(Shape* shape)
+        : m_shape(shape)
+    {
+    }
+
+    ValueKind kind() override { return ValueKind::Object; }
+    std::string inspect() override;
+
+    Shape* shape() const { return m_shape; }
+    size_t length() const { return m_shape->size(); }
+
+    virtual Value load(size_t slot) = 0;
+    virtual void store(size_t slot, Value value) = 0;
+
+    Value get_attr(std::string name) override;
+
+    Value index(const Value& index) override;
+    void set_index(const Value& index, Value value) override;
+
+protected:
+    Shape* m_shape;
+};
+
+// Record (object/map) values keep their fields in a flat slot vector whose
+// layout is described by a shared Shape.
+class Record : public ShapedObject {
+public:
+    Record()
+        : ShapedObject(Shape::root())
+    {
+    }
+
+    Record(Shape* shape, std::vector<Value> slots);
+    ~Record() override;
+
+    Value load(size_t slot) override { return m_slots[slot]; }
+    void store(size_t slot, Value value) override { m_slots[slot] = value; }
+
+    void set_attr(std::string name, Value value) override;
+
+private:
+    std::vector<Value> m_slots;
+    // set once the record has left the shared shape tree, see Shape::extend
+    std::unique_ptr<Shape> m_dictionary;
+};
+
+template <typename T>
+T from_value(const Value& value)
+{
+    if constexpr (std::is_same_v<T, Value>) {
+        return value;
+    } else if constexpr (std::is_same_v<T, bool>) {
+        return value.as_boolean();
+    } else if constexpr (std::is_integral_v<T>) {
+        return T(value.as_integer());
+    } else if constexpr (std::is_floating_point_v<T>) {
+        return value.kind() == ValueKind::Integer ? T(value.as_integer())
+                                                  : T(value.as_float());
+    } else {
+        return T(value.as_string());
+    }
+}
+
+template <typename T, typename... Arguments>
+Value NativeFunction<T, Arguments...>::call(std::vector<Value>& args)
+{
+    if (args.size() != sizeof...(Arguments)) {
+        throw InvalidOperate(std::format("{} expects {} arguments, got {}",
+            this->name(), sizeof...(Arguments), args.size()));
+    }
+
+    return invoke(args, std::index_sequence_for<Arguments...>());
+}
+
+template <typename T, typename... Arguments>
+template <size_t... I>
+Value NativeFunction<T, Arguments...>::invoke(std::vector<Value>& args,
+    std::index_sequence<I...>)
+{
+    if constexpr (std::is_void_v<T>) {
+        m_func(from_value<Arguments>(args[I])...);
+        return Value();
+    } else {
+        return Value(m_func(from_value<Arguments>(args[I])...));
+    }
+}
@@ -0,0 +1,170 @@
+#pragma once
+
+#include "ast.h"
+#include "object.h"
+#include "types.h"
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+struct LoopStats {
+    // `for` loops looked at
+    uint32_t loops = 0;
+    // invariant expressions moved in front of their loop
+    uint32_t hoisted = 0;
+    // induction variable multiplications turned into running sums
+    uint32_t reduced = 0;
+
+    std::string report() const;
+};
+
+// Rewrites the `for` loops of `program` in place:
+//
+//   for (let i = 0; i < n * 2; i++) { s = s + x * y + i * 4; }
+//
+// becomes
+//
+//   let i = 0; let $t0 = n * 2; let $t1 = x * y; let $t2 = i * 4;
+//   for (; i < $t0; i++) { s = s + $t1 + $t2; $t2 = $t2 + 4; }
+//
+// Only numeric arithmetic and comparisons whose operands infer_types() proves
+// to be Integer or Float are hoisted, so moving them can neither throw nor
+// have side effects even when the loop body would not have run them. A name
+// counts as invariant when nothing in the loop assigns it, directly or, if
+// the loop calls a user function, from any function body, which keeps the
+// rewrite valid under the tree walker's dynamic scoping.
+//
+// Loops are only rewritten where they sit in a statement list, since the
+// initializer moves out in front of them.
+LoopStats optimize_loops(Program& program, const TypeEnvironment& environment = {});
+
+struct InlineStats {
+    // call sites replaced by the body of the callee
+    uint32_t inlined = 0;
+    // constant expressions folded afterwards
+    uint32_t folded = 0;
+
+    std::string report() const;
+};
+
+// Replaces operators whose operands are all literals by the literal they
+// evaluate to, using the tree walker itself so the results match exactly.
+// Operators that would throw, or fault like integer division by zero, are
+// left for the run to report. Returns the number of folded expressions.
+uint32_t fold_constants(Program& program);
+
+// Substitutes calls to small helpers, functions whose body is a single
+// `return` of at most `budget` nodes that neither calls nor assigns anything,
+// into their call sites, folding constants before and after. Such helpers cannot be
+// recursive; helpers that only call other helpers become inlinable once
+// those calls are inlined.
+//
+// A call is left alone when an argument has side effects, when an argument
+// more complex than a literal or a name would be evaluated more than once,
+// or when a free name of the helper is a local of the calling function, which
+// would capture it under the VMs' lexical scoping.
+InlineStats inline_functions(Program& program, uint32_t budget = 16);
+
+struct CseStats {
+    // temporaries introduced, one per repeated expression
+    uint32_t expressions = 0;
+    // occurrences replaced by a read of their temporary
+    uint32_t eliminated = 0;
+
+    std::string report() const;
+};
+
+// Finds arithmetic and comparisons over literals and names that are computed
+// more than once in a run of statements with the same values for those names,
+// and computes them once:
+//
+//   let a = price * qty + 1; let b = price * qty > 100;
+//
+// becomes
+//
+//   let $c0; let a = ($c0 = price * qty) + 1; let b = $c0 > 100;
+//
+// The first occurrence stays where it was evaluated, so errors and evaluation
+// order do not change. Statements with calls end the run, since a function may
+// assign any name, and loops are only optimized inside their bodies.
+CseStats eliminate_common_subexpressions(Program& program);
+
+struct DeadCodeStats {
+    // statements that could never run, or ran without any effect
+    uint32_t statements = 0;
+    // `if` and `for` statements with a constant condition, reduced to the part that runs
+    uint32_t branches = 0;
+    // `let` bindings nothing reads, and functions nothing calls
+    std::vector<std::string> bindings;
+    std::vector<std::string> functions;
+
+    std::string report() const;
+};
+
+// Removes what cannot affect a run, after folding constants:
+//
+// - statements after a `return`, `break` or `continue` in the same block
+// - the branch of an `if` its constant condition never takes, and loops whose
+//   condition is constant false
+// - `let` bindings no expression reads, together with the assignments to
+//   them, keeping the values that have side effects
+// - expression statements without side effects
+// - functions no reachable code references
+//
+// Reads are matched by name anywhere in the program, which is what dynamic
+// scoping requires. Dropping an expression without side effects also drops
+// the error it might have raised. `roots` are names the host reads or calls
+// after the run, kept even when the script never uses them.
+DeadCodeStats eliminate_dead_code(Program& program, const std::unordered_set<std::string>& roots = {});
+
+// Values the host promises not to change between runs, see
+// Context::define_constant().
+using Constants = std::unordered_map<std::string, Value>;
+
+struct SpecializeStats {
+    // reads of a constant replaced by its value
+    uint32_t substituted = 0;
+    DeadCodeStats dead;
+
+    std::string report() const;
+};
+
+// Replaces the reads of boolean, number and string constants by literals, then
+// folds and removes what they make dead. Under
+//
+//   { { "strict", false }, { "limit", 100 } }
+//
+// `if (strict) { ... } else if (amount > limit * 2) { ... }` becomes
+// `if (amount > 200) { ... }`. A name is only substituted when the script
+// never declares, assigns or increments it, so every read reaches the host
+// binding. Other constants stay reads, and the context running the result
+// still has to define all of them.
+SpecializeStats specialize(
+    Program& program, const Constants& constants, const std::unordered_set<std::string>& roots = {});
+
+// The programs specialized from one source, one per set of constant values:
+//
+//   SpecializationCache rules(source);
+//   auto program = rules.get(context.constants());
+//
+// Each call with values not seen before parses and specializes a new copy.
+class SpecializationCache {
+public:
+    explicit SpecializationCache(std::string source, std::unordered_set<std::string> roots = {});
+
+    std::shared_ptr<Program> get(const Constants& constants);
+
+    size_t size() const { return m_programs.size(); }
+    size_t hits() const { return m_hits; }
+    size_t misses() const { return m_misses; }
+
+private:
+    std::string m_source;
+    std::unordered_set<std::string> m_roots;
+    std::unordered_map<std::string, std::shared_ptr<Program>> m_programs;
+    size_t m_hits = 0;
+    size_t m_misses = 0;
+};
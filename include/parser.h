@@ -6,6 +6,9 @@
 #include <format>
 #include <memory>
 #include <string_view>
+#include <unordered_map>
+
+class FlatBuffer;
 
 class Parser {
 public:
@@ -13,6 +16,8 @@ public:
     Parser(std::string_view input);
 
     std::unique_ptr<Program> parse();
+    // the program in the flat layout of flat.h, for FlatEvaluator
+    FlatBuffer parse_flat();
     std::unique_ptr<Statement> parse_statement();
     std::unique_ptr<Expression> parse_expression();
 
@@ -21,6 +26,11 @@ private:
     std::shared_ptr<Token> m_peek_token;
 
 private:
+    // one String per distinct literal text, keyed on its own characters
+    std::unordered_map<std::string_view, std::shared_ptr<String>> m_strings;
+
+    std::unique_ptr<Expression> string_literal(std::string_view text);
+
     std::shared_ptr<Token> peek_token();
     std::shared_ptr<Token> next_token();
     std::shared_ptr<Token> consum_token(TokenKind kind);
@@ -0,0 +1,101 @@
+#pragma once
+
+#include "ast.h"
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+struct ProfileEntry {
+    const ASTNode* node = nullptr;
+    std::string label;
+    uint64_t count = 0;
+    std::chrono::nanoseconds inclusive { 0 };
+    std::chrono::nanoseconds exclusive { 0 };
+};
+
+// Hit counts of the inline cache of one binary operator or attribute access
+// site. `label` lists the operand kinds a binary site has cached.
+struct CacheEntry {
+    const ASTNode* node = nullptr;
+    std::string label;
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+
+    double hit_rate() const
+    {
+        auto total = hits + misses;
+        return total > 0 ? double(hits) / double(total) : 0.0;
+    }
+};
+
+// Collects execution counts and timings per AST node while an Evaluator runs.
+// Hooks are only compiled in when EXPR_PROFILE is defined, otherwise the
+// evaluator never touches the profiler.
+class Profiler {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    Profiler() { }
+
+    void enter(ASTNode& node);
+    void leave();
+    void reset();
+
+    // all entries, sorted by exclusive time
+    std::vector<ProfileEntry> entries() const;
+    // entries of `FnStatement`s only, sorted by inclusive time
+    std::vector<ProfileEntry> functions() const;
+
+    std::string flat_report(size_t limit = 20) const;
+    // one `main;fn;fn <microseconds>` line per call path, for flamegraph tools
+    std::string folded_stacks() const;
+
+    static std::string label(ASTNode& node);
+
+    // inline caches of every site in `program` that ran, most used first;
+    // they live on the AST, so this works without EXPR_PROFILE
+    static std::vector<CacheEntry> inline_caches(Program& program);
+    static std::string cache_report(Program& program, size_t limit = 20);
+
+private:
+    struct Record {
+        ProfileEntry entry;
+        // recursion depth, inclusive time is only taken from the outermost call
+        uint32_t active = 0;
+    };
+
+    struct Frame {
+        Record* record;
+        Clock::time_point start;
+        std::chrono::nanoseconds children;
+        size_t path_length;
+    };
+
+    std::unordered_map<const ASTNode*, Record> m_records;
+    std::vector<Frame> m_frames;
+    std::string m_path = "main";
+    std::unordered_map<std::string, std::chrono::nanoseconds> m_folded;
+};
+
+class ProfileScope {
+public:
+    ProfileScope(Profiler* profiler, ASTNode& node)
+        : m_profiler(profiler)
+    {
+        if (m_profiler != nullptr) {
+            m_profiler->enter(node);
+        }
+    }
+
+    ~ProfileScope()
+    {
+        if (m_profiler != nullptr) {
+            m_profiler->leave();
+        }
+    }
+
+private:
+    Profiler* m_profiler;
+};
@@ -0,0 +1,173 @@
+#pragma once
+
+#include "ast.h"
+#include "bytecode.h"
+#include "eval.h"
+#include "object.h"
+#include "shape.h"
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Opcodes of the register VM. `a`, `b` and `c` are register numbers unless
+// noted otherwise; every jump keeps its target in `c`.
+//
+// Registers hold either a boxed Value or a raw int64_t, double or bool. The
+// compiler tracks which one statically: the typed instructions (suffix II for
+// two integers, FF for two floats, I/F/B for one operand) read and write the
+// raw part, the generic ones the boxed Value. Comparisons always produce a raw
+// bool.
+#define EXPR_REG_OPCODES(X)                                                       \
+    X(Move) /* a = b */                                                           \
+    X(MoveRaw) /* a = b, raw */                                                   \
+    X(LoadConst) /* a = constants[b] */                                           \
+    X(LoadInt) /* a = integers[b] */                                              \
+    X(LoadFloat) /* a = floats[b] */                                              \
+    X(LoadBool) /* a = bool(b) */                                                 \
+    X(LoadUndefined)                                                              \
+    X(BoxInt) /* a = Value(b) */                                                  \
+    X(BoxFloat)                                                                   \
+    X(BoxBool)                                                                    \
+    X(IntToFloat)                                                                 \
+    X(GetGlobal) /* a = names[b] */                                               \
+    X(SetGlobal) /* names[a] = b */                                               \
+    X(DefineGlobal) /* names[a] = b */                                            \
+    X(Add) /* a = b + c */                                                        \
+    X(Sub)                                                                        \
+    X(Mul)                                                                        \
+    X(Div)                                                                        \
+    X(Mod)                                                                        \
+    X(AddII)                                                                      \
+    X(SubII)                                                                      \
+    X(MulII)                                                                      \
+    X(DivII)                                                                      \
+    X(ModII)                                                                      \
+    X(AddFF)                                                                      \
+    X(SubFF)                                                                      \
+    X(MulFF)                                                                      \
+    X(DivFF)                                                                      \
+    X(Equal) /* a = b == c */                                                     \
+    X(NotEqual)                                                                   \
+    X(Less)                                                                       \
+    X(LessEqual)                                                                  \
+    X(Greater)                                                                    \
+    X(GreaterEqual)                                                               \
+    X(EqualII)                                                                    \
+    X(NotEqualII)                                                                 \
+    X(LessII)                                                                     \
+    X(LessEqualII)                                                                \
+    X(GreaterII)                                                                  \
+    X(GreaterEqualII)                                                             \
+    X(EqualFF)                                                                    \
+    X(NotEqualFF)                                                                 \
+    X(LessFF)                                                                     \
+    X(LessEqualFF)                                                                \
+    X(GreaterFF)                                                                  \
+    X(GreaterEqualFF)                                                             \
+    X(Negate) /* a = -b */                                                        \
+    X(NegateI)                                                                    \
+    X(NegateF)                                                                    \
+    X(Not) /* a = !b */                                                           \
+    X(NotB)                                                                       \
+    X(Jump)                                                                       \
+    X(JumpIfFalse) /* a: raw bool */                                              \
+    X(JumpIfFalseValue) /* a: Boolean value */                                    \
+    X(JumpUnlessEqualII) /* jumps unless a == b */                                \
+    X(JumpUnlessNotEqualII)                                                       \
+    X(JumpUnlessLessII)                                                           \
+    X(JumpUnlessLessEqualII)                                                      \
+    X(JumpUnlessGreaterII)                                                        \
+    X(JumpUnlessGreaterEqualII)                                                   \
+    X(Call) /* a = chunks[b](c, c + 1, ...) */                                    \
+    X(CallValue) /* a = b(b + 1, ..., b + c) */                                   \
+    X(Return) /* returns a */                                                     \
+    X(NewArray) /* a = [b, ..., b + c - 1] */                                     \
+    X(NewObject) /* a = {objects[c]: b, ...} */                                   \
+    X(Index) /* a = b[c] */                                                       \
+    X(SetIndex) /* a[b] = c */                                                    \
+    X(GetAttr) /* a = b.attributes[c] */                                          \
+    X(SetAttr) /* a.attributes[c] = b */                                          \
+    X(Inc) /* a++ */                                                              \
+    X(Dec)                                                                        \
+    X(IncI)                                                                       \
+    X(DecI)
+
+enum class RegOp : uint8_t {
+#define EXPR_REG_OPCODE_ENUM(name) name,
+    EXPR_REG_OPCODES(EXPR_REG_OPCODE_ENUM)
+#undef EXPR_REG_OPCODE_ENUM
+};
+
+std::string reg_opcode_str(RegOp op);
+
+struct RegInstruction {
+    RegOp op;
+    uint32_t a = 0;
+    uint32_t b = 0;
+    uint32_t c = 0;
+};
+
+struct RegChunk {
+    std::string name;
+    uint32_t params = 0;
+    // params first, then the locals, then temporaries
+    uint32_t registers = 0;
+    std::vector<RegInstruction> code;
+};
+
+// A program compiled for the register VM. Chunk 0 is the top-level code. Names
+// resolve the same way as for the stack VM, see Bytecode.
+struct RegProgram {
+    std::vector<RegChunk> chunks;
+    std::vector<Value> constants;
+    std::vector<int64_t> integers;
+    std::vector<double> floats;
+    std::vector<std::string> names;
+    // keys of each object literal, as name indices
+    std::vector<std::vector<uint32_t>> objects;
+    // the name of each attribute access site
+    std::vector<uint32_t> attributes;
+    std::unordered_map<std::string, uint32_t> functions;
+};
+
+RegProgram compile_registers(Program& program);
+
+std::string disassemble(const RegProgram& program);
+
+class RegisterVM {
+public:
+    RegisterVM(RegProgram program, Context& context);
+
+    Value run();
+
+    const RegProgram& program() const { return m_program; }
+
+private:
+    struct Register {
+        union {
+            int64_t i;
+            double f;
+            bool b;
+        };
+        Value value;
+    };
+
+    struct Frame {
+        const RegInstruction* ip; // the caller's call instruction
+        const RegChunk* chunk;
+        size_t base;
+    };
+
+    Register* enter(const RegChunk& chunk, size_t base);
+
+    RegProgram m_program;
+    Context& m_context;
+
+    std::vector<Register> m_registers;
+    std::vector<Frame> m_frames;
+    std::vector<AccessCache> m_access_caches;
+    std::vector<Shape*> m_object_shapes;
+    Value m_undefined;
+};
@@ -0,0 +1,71 @@
+#pragma once
+
+#include "ast.h"
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+// Assigns every local of a chunk a slot and records which expressions flow
+// into it. Variables that are not locals are left out of `slots` and resolve
+// through the Context. Shared by the register compiler and the JIT.
+class Resolver {
+public:
+    struct Assignment {
+        uint32_t slot;
+        Expression* value; // nullptr for `let x;`
+        bool postfix = false;
+    };
+
+    explicit Resolver(const std::unordered_set<std::string>* shared)
+        : m_shared(shared)
+    {
+        m_scopes.emplace_back();
+    }
+
+    void function(FnStatement& fn)
+    {
+        for (auto& param : fn.params()) {
+            declare(param);
+        }
+        statement(fn.body());
+    }
+
+    void statement(Statement& statement);
+    void expression(Expression& expression);
+
+    uint32_t locals() const { return m_locals; }
+
+    std::unordered_map<const ASTNode*, uint32_t> slots;
+    std::vector<Assignment> assignments;
+    // the value of every return statement, nullptr for a bare `return;`
+    std::vector<Expression*> returns;
+
+private:
+    uint32_t declare(const std::string& name)
+    {
+        auto slot = m_locals++;
+        m_scopes.back().push_back({ name, slot });
+        return slot;
+    }
+
+    std::optional<uint32_t> resolve(const std::string& name) const
+    {
+        for (auto scope = m_scopes.rbegin(); scope != m_scopes.rend(); ++scope) {
+            for (auto it = scope->rbegin(); it != scope->rend(); ++it) {
+                if (it->first == name) {
+                    return it->second;
+                }
+            }
+        }
+        return std::nullopt;
+    }
+
+    // set for the top-level chunk only
+    const std::unordered_set<std::string>* m_shared;
+    std::vector<std::vector<std::pair<std::string, uint32_t>>> m_scopes;
+    uint32_t m_locals = 0;
+};
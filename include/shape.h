@@ -0,0 +1,62 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Hidden class describing the property layout of a Record: the ordered keys
+// and the slot each key lives in. Records built by adding the same keys in the
+// same order share one Shape, so a field access site can remember
+// `shape -> slot` and skip the key lookup while it keeps seeing that shape.
+//
+// Shapes form a transition tree rooted at `Shape::root()`. The tree is never
+// pruned, so a Shape pointer stays valid for the lifetime of the program. Keys
+// only known at run time go through extend(), which stops growing the tree
+// past `max_transitions` keys out of one shape, `max_depth` keys in one shape
+// or `max_extended` shapes made that way in total; a record going further
+// switches to a dictionary shape of its own.
+class Shape {
+public:
+    static constexpr size_t max_transitions = 64;
+    static constexpr size_t max_depth = 64;
+    static constexpr size_t max_extended = 16384;
+
+    static Shape* root();
+
+    // shape with `key` appended, shared by every record taking that transition
+    Shape* transition(const std::string& key);
+    // like transition() for a key computed at run time, or nullptr when the
+    // new shape would go past one of the limits above
+    Shape* extend(const std::string& key);
+
+    // an unshared copy of `shape` that add() appends keys to in place
+    static std::unique_ptr<Shape> dictionary(const Shape& shape);
+    void add(const std::string& key);
+
+    // Dictionary shapes are freed with their record and their address may be
+    // reused, so access caches only remember tree shapes.
+    bool cacheable() const { return !m_dictionary; }
+
+    std::optional<size_t> lookup(const std::string& key) const;
+
+    size_t size() const { return m_keys.size(); }
+    const std::vector<std::string>& keys() const { return m_keys; }
+
+    Shape(const Shape&) = delete;
+    Shape& operator=(const Shape&) = delete;
+
+private:
+    Shape() { }
+    Shape(const Shape& parent, const std::string& key);
+
+    std::vector<std::string> m_keys;
+    std::unordered_map<std::string, size_t> m_slots;
+    bool m_dictionary = false;
+
+    std::mutex m_mutex;
+    std::unordered_map<std::string, std::unique_ptr<Shape>> m_transitions;
+};
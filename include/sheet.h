@@ -0,0 +1,74 @@
+#pragma once
+
+#include "ast.h"
+#include "eval.h"
+#include "object.h"
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+// Named formulas over host inputs that are only recomputed when something
+// they read changed, like the cells of a spreadsheet:
+//
+//   Sheet sheet;
+//   sheet.input("price", 3);
+//   sheet.input("qty", 4);
+//   sheet.formula("total", Parser("price * qty").parse_expression());
+//   sheet.formula("large", Parser("total > 10").parse_expression());
+//   sheet.get("large");      // evaluates total, then large
+//   sheet.input("qty", 2);   // marks total and large stale
+//   sheet.get("total");      // evaluates total only
+//
+// A formula depends on the names it mentions, which may be inputs, other
+// formulas or functions defined on the context. Values are cached until one
+// of those names changes; functions the host defines are assumed to be pure.
+// Formulas that assign, increment or call a mutating builtin are rejected.
+class Sheet {
+public:
+    // sets an input, marking every formula that depends on it stale
+    template <typename T>
+        requires to_value<T>
+    void input(const std::string& name, T value)
+    {
+        assign(name, Value(value));
+    }
+    // sets or replaces a formula, marking it and its dependents stale
+    void formula(const std::string& name, std::unique_ptr<Expression> expression);
+    // adds the top-level `let` statements of `program` as formulas; anything
+    // else in it is rejected
+    void load(Program& program);
+
+    // the value of an input or formula, evaluating the stale formulas it needs
+    Value get(const std::string& name);
+    // evaluates every stale formula and returns how many there were
+    size_t recompute();
+
+    size_t formulas() const { return m_cells.size(); }
+    size_t stale() const;
+    // formula evaluations since the sheet was created
+    uint64_t evaluations() const { return m_evaluations; }
+
+    Context& context() { return m_context; }
+
+private:
+    struct Cell {
+        std::unique_ptr<Expression> expression;
+        std::unordered_set<std::string> reads;
+        bool stale = true;
+        // set while the cell is being evaluated, to report cycles
+        bool active = false;
+    };
+
+    void assign(const std::string& name, Value value);
+    void invalidate(const std::string& name);
+    void refresh(const std::string& name, Cell& cell);
+
+    Context m_context;
+    std::unordered_map<std::string, Cell> m_cells;
+    // name to the formulas reading it
+    std::unordered_map<std::string, std::unordered_set<std::string>> m_dependents;
+    uint64_t m_evaluations = 0;
+};
@@ -0,0 +1,109 @@
+#pragma once
+
+#include "mapped_file.h"
+#include "object.h"
+#include "shape.h"
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+// One line of an NDJSON or CSV input, exposed to the script as a record whose
+// fields are only located and parsed when the expression reads them. A worker
+// keeps one instance and rebinds it per line; parsed fields are cached until
+// the next rebind.
+class LineRecord : public ShapedObject {
+public:
+    explicit LineRecord(Shape* shape)
+        : ShapedObject(shape)
+    {
+    }
+
+    void rebind(std::string_view line);
+
+    Value load(size_t slot) override;
+    void store(size_t slot, Value value) override;
+
+    void set_attr(std::string name, Value value) override;
+
+protected:
+    // fills m_spans with the raw text of every field known to the shape
+    virtual void scan() = 0;
+    virtual Value decode(std::string_view raw) = 0;
+
+    std::string_view m_line;
+    std::vector<std::pair<const char*, size_t>> m_spans;
+
+private:
+    bool m_scanned = false;
+    uint64_t m_generation = 1;
+    std::vector<uint64_t> m_loaded;
+    std::vector<Value> m_values;
+};
+
+// Top-level fields of a JSON object line. The shape starts empty and grows by
+// the keys the expression asks for, so keys it never reads are skipped over
+// without being decoded. Past the limits of Shape::extend a key is looked up in
+// the current line only.
+class JsonRecord : public LineRecord {
+public:
+    JsonRecord()
+        : LineRecord(Shape::root())
+    {
+    }
+
+    Value get_attr(std::string name) override;
+
+protected:
+    void scan() override;
+    Value decode(std::string_view raw) override;
+};
+
+// Columns of a CSV line, named by the header. Lines are split on '\n', so
+// quoted fields may contain commas and `""` but not line breaks.
+class CsvRecord : public LineRecord {
+public:
+    explicit CsvRecord(Shape* header)
+        : LineRecord(header)
+    {
+    }
+
+    static Shape* parse_header(std::string_view line);
+
+protected:
+    void scan() override;
+    Value decode(std::string_view raw) override;
+};
+
+enum class RecordFormat {
+    NDJSON,
+    CSV,
+};
+
+struct StreamOptions {
+    RecordFormat format = RecordFormat::NDJSON;
+    // name the current record is bound to in the expression
+    std::string record_name = "r";
+    size_t threads = 1;
+    size_t chunk_size = 1 << 20;
+};
+
+struct StreamStats {
+    uint64_t records = 0;
+    uint64_t emitted = 0;
+    uint64_t errors = 0;
+};
+
+// Evaluates `expression` once per record of `input`. A Boolean result filters:
+// the matching lines are written unchanged. An Array result is written as one
+// CSV row, any other result as a single column. Records whose evaluation
+// throws are counted as errors and skipped.
+//
+// The input is split into chunks at line boundaries that are evaluated in
+// parallel, each worker with its own parse of the expression, and written in
+// input order.
+StreamStats stream_records(std::string_view input, std::string_view expression,
+    const StreamOptions& options, std::ostream& out);
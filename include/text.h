@@ -0,0 +1,14 @@
+#pragma once
+
+#include <cstddef>
+
+// Byte search over string buffers, backing the string builtins. Both use
+// AVX2 when the CPU supports it and SSE2 otherwise, with a portable scalar
+// fallback on other targets. They return `n` when there is no match.
+
+// offset of the first `byte` in `data`, like memchr
+size_t find_byte(const char* data, size_t n, char byte);
+
+// offset of the first occurrence of `needle` in `data`; candidates are found
+// by comparing the first and last byte of the needle a whole vector at a time
+size_t find_bytes(const char* data, size_t n, const char* needle, size_t m);
@@ -60,6 +60,9 @@ const static std::unordered_map<std::string_view, TokenKind> KEYWORDS = {
     { "break", TokenKind::Break },
     { "continue", TokenKind::Continue },
     { "return", TokenKind::Return },
+    { "true", TokenKind::True },
+    { "false", TokenKind::False },
+    { "undefined", TokenKind::Undefined },
 };
 
 const static std::unordered_map<char32_t, TokenKind> PUNCTUATIONS = {
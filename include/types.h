@@ -0,0 +1,45 @@
+#pragma once
+
+#include "ast.h"
+#include "kind.h"
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Kinds of the variables the host defines before running a script, for
+// example `{ { "limit", ValueKind::Integer } }`. They are trusted: backends
+// may drop kind checks on values read from these names.
+using TypeEnvironment = std::unordered_map<std::string, KindSet>;
+
+struct VariableType {
+    std::string name;
+    KindSet kinds;
+};
+
+struct FunctionType {
+    std::string name;
+    std::vector<VariableType> params;
+    // every `let` of the function, in slot order
+    std::vector<VariableType> locals;
+    KindSet result;
+};
+
+struct TypeInfo {
+    // the top level first as "<main>", then the functions by name
+    std::vector<FunctionType> functions;
+
+    std::string report() const;
+};
+
+// "Integer | Float", "any", or "never" for an empty set
+std::string kinds_str(KindSet kinds);
+
+// Infers the kinds every expression, parameter and local of `program` may
+// take, from literals, operators, calls and the host-declared variables, and
+// stores them on the expressions (Expression::kinds()).
+//
+// The result over-approximates: a parameter gets the kinds of every direct
+// call, a function used as a value gets `any` parameters, and a name that is
+// not a local gets every kind assigned to that name anywhere, so it also
+// holds under the tree walker's dynamic scoping.
+TypeInfo infer_types(Program& program, const TypeEnvironment& environment = {});
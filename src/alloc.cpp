@@ -0,0 +1,79 @@
+#include "alloc.h"
+#include "ast.h"
+#include "object.h"
+#include <algorithm>
+#include <format>
+#include <sstream>
+#include <string>
+
+thread_local AllocationTracker* AllocationTracker::s_current = nullptr;
+
+void AllocationTracker::account(AllocationCount& count, size_t bytes, size_t objects)
+{
+    if (m_limit != 0 && m_live + bytes > m_limit) {
+        throw MemoryLimitExceeded(m_limit);
+    }
+
+    count.objects += objects;
+    count.bytes += bytes;
+    m_total.objects += objects;
+    m_total.bytes += bytes;
+    m_live += bytes;
+    m_peak = std::max(m_peak, m_live);
+}
+
+void AllocationTracker::release(size_t bytes)
+{
+    // memory allocated before this tracker was installed may be freed under it
+    m_live -= std::min(bytes, m_live);
+}
+
+void AllocationTracker::record(ValueKind kind, size_t bytes, size_t objects)
+{
+    account(m_values[size_t(kind)], bytes, objects);
+}
+
+void AllocationTracker::record(ASTNode::Kind kind, size_t bytes)
+{
+    account(m_nodes[size_t(kind)], bytes, 1);
+}
+
+void AllocationTracker::reset()
+{
+    m_total = AllocationCount();
+    m_live = 0;
+    m_peak = 0;
+    m_values.fill(AllocationCount());
+    m_nodes.fill(AllocationCount());
+}
+
+std::string AllocationTracker::report() const
+{
+    std::stringstream ss;
+
+    ss << std::format("{:>10} {:>12}  {}", "objects", "bytes", "kind") << std::endl;
+
+    for (size_t i = 0; i < MAX_KINDS; ++i) {
+        auto& count = m_values[i];
+        if (count.objects != 0 || count.bytes != 0) {
+            ss << std::format("{:>10} {:>12}  {}", count.objects, count.bytes,
+                      value_kind_str(ValueKind(i)))
+               << std::endl;
+        }
+    }
+
+    for (size_t i = 0; i < MAX_KINDS; ++i) {
+        auto& count = m_nodes[i];
+        if (count.objects != 0) {
+            ss << std::format("{:>10} {:>12}  {}", count.objects, count.bytes,
+                      node_kind_str(ASTNode::Kind(i)))
+               << std::endl;
+        }
+    }
+
+    ss << std::format("{:>10} {:>12}  {}", m_total.objects, m_total.bytes, "total")
+       << std::endl;
+    ss << std::format("{:>10} {:>12}  {}", "", m_peak, "peak live") << std::endl;
+
+    return ss.str();
+}
@@ -1,8 +1,19 @@
 #include "ast.h"
+#include "object.h"
 #include <format>
 #include <sstream>
 #include <string>
 
+StringLiteral::StringLiteral(std::string value)
+    : m_constant(std::static_pointer_cast<String>(Value(std::move(value)).obj()))
+{
+}
+
+std::string& StringLiteral::value()
+{
+    return m_constant->value();
+}
+
 std::string operator_str(Operator op)
 {
     switch (op) {
@@ -47,6 +58,56 @@ std::string operator_str(Operator op)
     }
 }
 
+std::string node_kind_str(ASTNode::Kind kind)
+{
+    switch (kind) {
+    case ASTNode::Kind::Program:
+        return "Program";
+    case ASTNode::Kind::FnStmt:
+        return "FnStmt";
+    case ASTNode::Kind::EmptyStmt:
+        return "EmptyStmt";
+    case ASTNode::Kind::BlockStmt:
+        return "BlockStmt";
+    case ASTNode::Kind::LetStmt:
+        return "LetStmt";
+    case ASTNode::Kind::IfStmt:
+        return "IfStmt";
+    case ASTNode::Kind::ForStmt:
+        return "ForStmt";
+    case ASTNode::Kind::ReturnStmt:
+        return "ReturnStmt";
+    case ASTNode::Kind::BreakStmt:
+        return "BreakStmt";
+    case ASTNode::Kind::ContinueStmt:
+        return "ContinueStmt";
+    case ASTNode::Kind::ExprStmt:
+        return "ExprStmt";
+    case ASTNode::Kind::BinaryExpr:
+        return "BinaryExpr";
+    case ASTNode::Kind::PrefixExpr:
+        return "PrefixExpr";
+    case ASTNode::Kind::PostfixExpr:
+        return "PostfixExpr";
+    case ASTNode::Kind::VariableExpr:
+        return "VariableExpr";
+    case ASTNode::Kind::LiteralExpr:
+        return "LiteralExpr";
+    case ASTNode::Kind::IndexExpr:
+        return "IndexExpr";
+    case ASTNode::Kind::CallExpr:
+        return "CallExpr";
+    case ASTNode::Kind::AccessExpr:
+        return "AccessExpr";
+    case ASTNode::Kind::ArrayExpr:
+        return "ArrayExpr";
+    case ASTNode::Kind::ObjectExpr:
+        return "ObjectExpr";
+    default:
+        return "";
+    }
+}
+
 std::string ASTInspector::inspect(ASTNode& node)
 {
     switch (node.kind()) {
@@ -194,6 +255,23 @@ std::string ASTInspector::inspect(ASTNode& node)
 
         return std::format("ArrayExpr(elements: [{0}])", ss.str());
     }
+    case ASTNode::Kind::ObjectExpr: {
+        ObjectExpression& obj_expr = dynamic_cast<ObjectExpression&>(node);
+
+        std::stringstream ss;
+        for (size_t i = 0; i < obj_expr.keys().size(); ++i) {
+            ss << std::format("{0}: {1}, ", obj_expr.keys()[i],
+                inspect(*obj_expr.values()[i]));
+        }
+
+        return std::format("ObjectExpr(fields: [{0}])", ss.str());
+    }
+    case ASTNode::Kind::AccessExpr: {
+        AccessExpression& access_expr = dynamic_cast<AccessExpression&>(node);
+
+        return std::format("AccessExpr(object: {0}, name: {1})",
+            inspect(access_expr.object()), access_expr.name());
+    }
     case ASTNode::Kind::IndexExpr: {
         IndexExpression& index_expr = dynamic_cast<IndexExpression&>(node);
 
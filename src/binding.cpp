@@ -0,0 +1,71 @@
+#include "binding.h"
+#include "object.h"
+#include <cstdint>
+#include <cstring>
+#include <format>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+Schema& Schema::field(std::string name, FieldType type, size_t offset)
+{
+    if (m_shape->lookup(name).has_value()) {
+        throw std::invalid_argument(std::format("duplicate field {} in schema", name));
+    }
+
+    m_shape = m_shape->transition(name);
+    m_fields.push_back(FieldAccessor { std::move(name), type, offset });
+
+    return *this;
+}
+
+template <typename T>
+static T read_field(const void* data, size_t offset)
+{
+    T value;
+    std::memcpy(&value, static_cast<const char*>(data) + offset, sizeof(T));
+    return value;
+}
+
+Value Schema::read(size_t slot, const void* data) const
+{
+    auto& field = m_fields[slot];
+    auto address = static_cast<const char*>(data) + field.offset;
+
+    switch (field.type) {
+    case FieldType::Boolean:
+        return Value(read_field<bool>(data, field.offset));
+    case FieldType::Int32:
+        return Value(int64_t(read_field<int32_t>(data, field.offset)));
+    case FieldType::Int64:
+        return Value(read_field<int64_t>(data, field.offset));
+    case FieldType::Double:
+        return Value(read_field<double>(data, field.offset));
+    case FieldType::String:
+        return Value(*reinterpret_cast<const std::string*>(address));
+    case FieldType::StringView:
+        return Value(std::string(*reinterpret_cast<const std::string_view*>(address)));
+    default:
+        throw std::runtime_error("Invalid FieldType");
+    }
+}
+
+Value HostRecord::load(size_t slot)
+{
+    if (m_data == nullptr) {
+        throw std::runtime_error("host record is not bound");
+    }
+
+    return m_schema->read(slot, m_data);
+}
+
+void HostRecord::store(size_t slot, Value)
+{
+    throw InvalidOperate(std::format("field {} of host record is read-only",
+        m_shape->keys()[slot]));
+}
+
+void HostRecord::set_attr(std::string name, Value)
+{
+    throw InvalidOperate(std::format("field {} of host record is read-only", name));
+}
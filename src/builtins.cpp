@@ -0,0 +1,70 @@
+#include "builtins.h"
+#include "alloc.h"
+#include "object.h"
+#include <format>
+#include <functional>
+#include <string>
+#include <vector>
+
+const BuiltinTable& builtins()
+{
+    static const BuiltinTable table = []() {
+        BuiltinTable table;
+        register_core_builtins(table);
+        register_kernel_builtins(table);
+        register_string_builtins(table);
+        return table;
+    }();
+
+    return table;
+}
+
+bool mutating_builtin(const std::string& name)
+{
+    return name == "push";
+}
+
+void define_builtin(BuiltinTable& table, std::string name,
+    std::function<Value(std::vector<Value>&)> func)
+{
+    table.insert_or_assign(name, Value(make_object<Callable>(ValueKind::NativeFunction, name, func)));
+}
+
+void check_arguments(const std::string& name, std::vector<Value>& args,
+    size_t count)
+{
+    if (args.size() != count) {
+        throw InvalidOperate(std::format("{} expects {} arguments, got {}",
+            name, count, args.size()));
+    }
+}
+
+void register_core_builtins(BuiltinTable& table)
+{
+    define_builtin(table, "len", [](std::vector<Value>& args) {
+        check_arguments("len", args, 1);
+        switch (args[0].kind()) {
+        case ValueKind::Array:
+            return Value(int64_t(args[0].as_array().length()));
+        case ValueKind::String:
+            // no need to flatten a concatenation
+            return Value(int64_t(static_cast<String*>(args[0].get())->size()));
+        case ValueKind::Object:
+            return Value(int64_t(args[0].as_shaped().length()));
+        default:
+            throw InvalidOperate(std::format("invalid len for {}",
+                value_kind_str(args[0].kind())));
+        }
+    });
+
+    define_builtin(table, "push", [](std::vector<Value>& args) {
+        check_arguments("push", args, 2);
+        if (args[0].kind() != ValueKind::Array) {
+            throw InvalidOperate(std::format("invalid push for {}",
+                value_kind_str(args[0].kind())));
+        }
+        auto& array = args[0].as_array();
+        array.push(args[1]);
+        return Value(int64_t(array.length()));
+    });
+}
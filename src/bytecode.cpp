@@ -0,0 +1,1025 @@
+#include "bytecode.h"
+#include "ast.h"
+#include <algorithm>
+#include <format>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+std::string opcode_str(Opcode op)
+{
+    switch (op) {
+#define EXPR_OPCODE_NAME(name) \
+    case Opcode::name:         \
+        return #name;
+        EXPR_OPCODES(EXPR_OPCODE_NAME)
+#undef EXPR_OPCODE_NAME
+    default:
+        return "Unknown";
+    }
+}
+
+static void collect_names(Expression& expression, std::unordered_set<std::string>& names);
+
+static void collect_names(Statement& statement, std::unordered_set<std::string>& names)
+{
+    switch (statement.kind()) {
+    case ASTNode::Kind::LetStmt: {
+        auto& let = dynamic_cast<LetStatement&>(statement);
+        if (let.value()) {
+            collect_names(*let.value(), names);
+        }
+        break;
+    }
+    case ASTNode::Kind::IfStmt: {
+        auto& if_stmt = dynamic_cast<IfStatement&>(statement);
+        collect_names(if_stmt.condition(), names);
+        collect_names(if_stmt.then_branch(), names);
+        if (if_stmt.else_branch()) {
+            collect_names(*if_stmt.else_branch(), names);
+        }
+        break;
+    }
+    case ASTNode::Kind::ForStmt: {
+        auto& for_stmt = dynamic_cast<ForStatement&>(statement);
+        if (for_stmt.initializer()) {
+            collect_names(*for_stmt.initializer(), names);
+        }
+        if (for_stmt.condition()) {
+            collect_names(*for_stmt.condition(), names);
+        }
+        if (for_stmt.increment()) {
+            collect_names(*for_stmt.increment(), names);
+        }
+        collect_names(for_stmt.body(), names);
+        break;
+    }
+    case ASTNode::Kind::BlockStmt:
+        for (auto& stmt : dynamic_cast<BlockStatement&>(statement).statements()) {
+            collect_names(*stmt, names);
+        }
+        break;
+    case ASTNode::Kind::ReturnStmt: {
+        auto& ret = dynamic_cast<ReturnStatement&>(statement);
+        if (ret.value()) {
+            collect_names(*ret.value(), names);
+        }
+        break;
+    }
+    case ASTNode::Kind::ExprStmt:
+        collect_names(dynamic_cast<ExpressionStatement&>(statement).expr(), names);
+        break;
+    default:
+        break;
+    }
+}
+
+static void collect_names(Expression& expression, std::unordered_set<std::string>& names)
+{
+    switch (expression.kind()) {
+    case ASTNode::Kind::VariableExpr:
+        names.insert(dynamic_cast<VariableExpression&>(expression).name());
+        break;
+    case ASTNode::Kind::BinaryExpr: {
+        auto& binary = dynamic_cast<BinaryExpression&>(expression);
+        collect_names(binary.left(), names);
+        collect_names(binary.right(), names);
+        break;
+    }
+    case ASTNode::Kind::PrefixExpr:
+        collect_names(dynamic_cast<PrefixExpression&>(expression).expr(), names);
+        break;
+    case ASTNode::Kind::PostfixExpr:
+        collect_names(dynamic_cast<PostfixExpression&>(expression).expr(), names);
+        break;
+    case ASTNode::Kind::IndexExpr: {
+        auto& index = dynamic_cast<IndexExpression&>(expression);
+        collect_names(index.object(), names);
+        collect_names(index.index(), names);
+        break;
+    }
+    case ASTNode::Kind::CallExpr: {
+        auto& call = dynamic_cast<CallExpression&>(expression);
+        collect_names(call.callee(), names);
+        for (auto& arg : call.args()) {
+            collect_names(*arg, names);
+        }
+        break;
+    }
+    case ASTNode::Kind::AccessExpr:
+        collect_names(dynamic_cast<AccessExpression&>(expression).object(), names);
+        break;
+    case ASTNode::Kind::ArrayExpr:
+        for (auto& element : dynamic_cast<ArrayExpression&>(expression).elements()) {
+            collect_names(*element, names);
+        }
+        break;
+    case ASTNode::Kind::ObjectExpr:
+        for (auto& value : dynamic_cast<ObjectExpression&>(expression).values()) {
+            collect_names(*value, names);
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+std::unordered_set<std::string> shared_names(Program& program)
+{
+    std::unordered_set<std::string> names;
+    for (auto& [name, fn] : program.functions()) {
+        collect_names(fn->body(), names);
+    }
+    return names;
+}
+
+// lets and for loop initializers anywhere in the statement, and with
+// `targets` also the names it assigns or increments
+static void collect_bindings(Expression& expression, std::unordered_set<std::string>& names, bool targets);
+
+static void collect_bindings(Statement& statement, std::unordered_set<std::string>& names, bool targets)
+{
+    switch (statement.kind()) {
+    case ASTNode::Kind::LetStmt: {
+        auto& let = dynamic_cast<LetStatement&>(statement);
+        names.insert(let.name());
+        if (let.value()) {
+            collect_bindings(*let.value(), names, targets);
+        }
+        break;
+    }
+    case ASTNode::Kind::IfStmt: {
+        auto& if_stmt = dynamic_cast<IfStatement&>(statement);
+        collect_bindings(if_stmt.condition(), names, targets);
+        collect_bindings(if_stmt.then_branch(), names, targets);
+        if (if_stmt.else_branch()) {
+            collect_bindings(*if_stmt.else_branch(), names, targets);
+        }
+        break;
+    }
+    case ASTNode::Kind::ForStmt: {
+        auto& for_stmt = dynamic_cast<ForStatement&>(statement);
+        if (for_stmt.initializer()) {
+            collect_bindings(*for_stmt.initializer(), names, targets);
+        }
+        if (for_stmt.condition()) {
+            collect_bindings(*for_stmt.condition(), names, targets);
+        }
+        if (for_stmt.increment()) {
+            collect_bindings(*for_stmt.increment(), names, targets);
+        }
+        collect_bindings(for_stmt.body(), names, targets);
+        break;
+    }
+    case ASTNode::Kind::BlockStmt:
+        for (auto& stmt : dynamic_cast<BlockStatement&>(statement).statements()) {
+            collect_bindings(*stmt, names, targets);
+        }
+        break;
+    case ASTNode::Kind::ReturnStmt: {
+        auto& ret = dynamic_cast<ReturnStatement&>(statement);
+        if (ret.value()) {
+            collect_bindings(*ret.value(), names, targets);
+        }
+        break;
+    }
+    case ASTNode::Kind::ExprStmt:
+        collect_bindings(dynamic_cast<ExpressionStatement&>(statement).expr(), names, targets);
+        break;
+    default:
+        break;
+    }
+}
+
+static void collect_bindings(Expression& expression, std::unordered_set<std::string>& names, bool targets)
+{
+    switch (expression.kind()) {
+    case ASTNode::Kind::BinaryExpr: {
+        auto& binary = dynamic_cast<BinaryExpression&>(expression);
+        if (targets && binary.op() == Operator::Assign && binary.left().kind() == ASTNode::Kind::VariableExpr) {
+            names.insert(dynamic_cast<VariableExpression&>(binary.left()).name());
+        }
+        collect_bindings(binary.left(), names, targets);
+        collect_bindings(binary.right(), names, targets);
+        break;
+    }
+    case ASTNode::Kind::PrefixExpr:
+        collect_bindings(dynamic_cast<PrefixExpression&>(expression).expr(), names, targets);
+        break;
+    case ASTNode::Kind::PostfixExpr: {
+        auto& postfix = dynamic_cast<PostfixExpression&>(expression);
+        if (targets && postfix.expr().kind() == ASTNode::Kind::VariableExpr) {
+            names.insert(dynamic_cast<VariableExpression&>(postfix.expr()).name());
+        }
+        break;
+    }
+    case ASTNode::Kind::IndexExpr: {
+        auto& index = dynamic_cast<IndexExpression&>(expression);
+        collect_bindings(index.object(), names, targets);
+        collect_bindings(index.index(), names, targets);
+        break;
+    }
+    case ASTNode::Kind::CallExpr: {
+        auto& call = dynamic_cast<CallExpression&>(expression);
+        collect_bindings(call.callee(), names, targets);
+        for (auto& arg : call.args()) {
+            collect_bindings(*arg, names, targets);
+        }
+        break;
+    }
+    case ASTNode::Kind::AccessExpr:
+        collect_bindings(dynamic_cast<AccessExpression&>(expression).object(), names, targets);
+        break;
+    case ASTNode::Kind::ArrayExpr:
+        for (auto& element : dynamic_cast<ArrayExpression&>(expression).elements()) {
+            collect_bindings(*element, names, targets);
+        }
+        break;
+    case ASTNode::Kind::ObjectExpr:
+        for (auto& value : dynamic_cast<ObjectExpression&>(expression).values()) {
+            collect_bindings(*value, names, targets);
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+std::unordered_set<std::string> rebound_names(Program& program)
+{
+    std::unordered_set<std::string> names;
+    for (auto& stmt : program.statements()) {
+        collect_bindings(*stmt, names, true);
+    }
+    for (auto& [name, fn] : program.functions()) {
+        names.insert(fn->params().begin(), fn->params().end());
+        collect_bindings(fn->body(), names, true);
+    }
+    return names;
+}
+
+// Names a function body uses before or outside the reach of its own
+// parameters and lets. A name is local from its `let` on and within the block
+// declaring it, as in Resolver.
+class FreeNames {
+public:
+    explicit FreeNames(std::unordered_set<std::string>& free)
+        : m_free(free)
+    {
+    }
+
+    void function(FnStatement& fn)
+    {
+        std::unordered_set<std::string> locals(fn.params().begin(), fn.params().end());
+        statement(fn.body(), locals);
+    }
+
+private:
+    void statement(Statement& statement, std::unordered_set<std::string>& locals);
+    void expression(Expression& expression, const std::unordered_set<std::string>& locals);
+
+    std::unordered_set<std::string>& m_free;
+};
+
+void FreeNames::statement(Statement& statement, std::unordered_set<std::string>& locals)
+{
+    switch (statement.kind()) {
+    case ASTNode::Kind::LetStmt: {
+        auto& let = dynamic_cast<LetStatement&>(statement);
+        if (let.value()) {
+            expression(*let.value(), locals);
+        }
+        locals.insert(let.name());
+        break;
+    }
+    case ASTNode::Kind::IfStmt: {
+        auto& if_stmt = dynamic_cast<IfStatement&>(statement);
+        expression(if_stmt.condition(), locals);
+        auto then_locals = locals;
+        this->statement(if_stmt.then_branch(), then_locals);
+        if (if_stmt.else_branch()) {
+            auto else_locals = locals;
+            this->statement(*if_stmt.else_branch(), else_locals);
+        }
+        break;
+    }
+    case ASTNode::Kind::ForStmt: {
+        auto& for_stmt = dynamic_cast<ForStatement&>(statement);
+        auto loop_locals = locals;
+        if (for_stmt.initializer()) {
+            this->statement(*for_stmt.initializer(), loop_locals);
+        }
+        if (for_stmt.condition()) {
+            expression(*for_stmt.condition(), loop_locals);
+        }
+        if (for_stmt.increment()) {
+            expression(*for_stmt.increment(), loop_locals);
+        }
+        this->statement(for_stmt.body(), loop_locals);
+        break;
+    }
+    case ASTNode::Kind::BlockStmt: {
+        auto block_locals = locals;
+        for (auto& stmt : dynamic_cast<BlockStatement&>(statement).statements()) {
+            this->statement(*stmt, block_locals);
+        }
+        break;
+    }
+    case ASTNode::Kind::ReturnStmt: {
+        auto& ret = dynamic_cast<ReturnStatement&>(statement);
+        if (ret.value()) {
+            expression(*ret.value(), locals);
+        }
+        break;
+    }
+    case ASTNode::Kind::ExprStmt:
+        expression(dynamic_cast<ExpressionStatement&>(statement).expr(), locals);
+        break;
+    default:
+        break;
+    }
+}
+
+void FreeNames::expression(Expression& expression, const std::unordered_set<std::string>& locals)
+{
+    std::unordered_set<std::string> names;
+    collect_names(expression, names);
+    for (auto& name : names) {
+        if (!locals.contains(name)) {
+            m_free.insert(name);
+        }
+    }
+}
+
+void require_lexical_scoping(Program& program)
+{
+    // names some function binds, which its callees would see
+    std::unordered_set<std::string> bound;
+    for (auto& [name, fn] : program.functions()) {
+        bound.insert(fn->params().begin(), fn->params().end());
+        collect_bindings(fn->body(), bound, false);
+    }
+
+    std::vector<std::string> names;
+    for (auto& [name, fn] : program.functions()) {
+        names.push_back(name);
+    }
+    std::sort(names.begin(), names.end());
+
+    for (auto& name : names) {
+        std::unordered_set<std::string> free;
+        FreeNames(free).function(*program.functions()[name]);
+
+        std::vector<std::string> dynamic;
+        for (auto& variable : free) {
+            if (bound.contains(variable)) {
+                dynamic.push_back(variable);
+            }
+        }
+        if (!dynamic.empty()) {
+            std::sort(dynamic.begin(), dynamic.end());
+            throw std::runtime_error(std::format(
+                "cannot compile {}: `{}` may resolve to a caller's binding", name, dynamic.front()));
+        }
+    }
+}
+
+class Compiler {
+public:
+    Compiler(Bytecode& bytecode, Chunk& chunk, std::unordered_map<std::string, uint32_t>& names,
+        const std::unordered_set<std::string>& rebound, const std::unordered_set<std::string>* shared)
+        : m_bytecode(bytecode)
+        , m_chunk(chunk)
+        , m_names(names)
+        , m_rebound(rebound)
+        , m_shared(shared)
+    {
+    }
+
+    void function(FnStatement& fn);
+    void statement(Statement& statement);
+    void expression(Expression& expression);
+
+    void emit(Opcode op, uint32_t a = 0, uint32_t b = 0)
+    {
+        m_chunk.code.push_back(Instruction { op, a, b });
+    }
+
+private:
+    struct Local {
+        std::string name;
+        uint32_t slot;
+    };
+
+    struct Loop {
+        std::vector<size_t> breaks;
+        std::vector<size_t> continues;
+    };
+
+    std::optional<uint32_t> resolve(const std::string& name) const
+    {
+        for (auto it = m_locals.rbegin(); it != m_locals.rend(); ++it) {
+            if (it->name == name) {
+                return it->slot;
+            }
+        }
+        return std::nullopt;
+    }
+
+    uint32_t declare(const std::string& name)
+    {
+        auto slot = m_chunk.locals++;
+        m_locals.push_back(Local { name, slot });
+        return slot;
+    }
+
+    uint32_t name(const std::string& name);
+    uint32_t constant(Value value);
+
+    size_t here() const { return m_chunk.code.size(); }
+    size_t jump(Opcode op)
+    {
+        emit(op);
+        return here() - 1;
+    }
+    void patch(size_t at) { m_chunk.code[at].a = uint32_t(here()); }
+
+    void effect(Expression& expression);
+    void assign(BinaryExpression& expression, bool keep);
+    size_t branch_unless(Expression& condition);
+    std::optional<uint32_t> local_constant(Expression& expression);
+
+    Bytecode& m_bytecode;
+    Chunk& m_chunk;
+    std::unordered_map<std::string, uint32_t>& m_names;
+    const std::unordered_set<std::string>& m_rebound;
+    // set for the top-level chunk only
+    const std::unordered_set<std::string>* m_shared;
+
+    std::vector<Local> m_locals;
+    std::vector<Loop> m_loops;
+};
+
+uint32_t Compiler::name(const std::string& name)
+{
+    auto found = m_names.find(name);
+    if (found != m_names.end()) {
+        return found->second;
+    }
+
+    auto index = uint32_t(m_bytecode.names.size());
+    m_bytecode.names.push_back(name);
+    m_names.insert({ name, index });
+
+    return index;
+}
+
+uint32_t Compiler::constant(Value value)
+{
+    m_bytecode.constants.push_back(value);
+    return uint32_t(m_bytecode.constants.size() - 1);
+}
+
+void Compiler::function(FnStatement& fn)
+{
+    m_chunk.name = fn.name();
+    m_chunk.params = uint32_t(fn.params().size());
+    for (auto& param : fn.params()) {
+        declare(param);
+    }
+
+    statement(fn.body());
+
+    emit(Opcode::LoadUndefined);
+    emit(Opcode::Return);
+}
+
+void Compiler::statement(Statement& statement)
+{
+    switch (statement.kind()) {
+    case ASTNode::Kind::LetStmt: {
+        auto& let = dynamic_cast<LetStatement&>(statement);
+        if (let.value()) {
+            expression(*let.value());
+        } else {
+            emit(Opcode::LoadUndefined);
+        }
+
+        if (m_shared && m_shared->contains(let.name())) {
+            emit(Opcode::DefineGlobal, name(let.name()));
+        } else {
+            emit(Opcode::StoreLocal, declare(let.name()));
+        }
+        break;
+    }
+    case ASTNode::Kind::IfStmt: {
+        auto& if_stmt = dynamic_cast<IfStatement&>(statement);
+        auto otherwise = branch_unless(if_stmt.condition());
+        this->statement(if_stmt.then_branch());
+
+        if (if_stmt.else_branch()) {
+            auto end = jump(Opcode::Jump);
+            patch(otherwise);
+            this->statement(*if_stmt.else_branch());
+            patch(end);
+        } else {
+            patch(otherwise);
+        }
+        break;
+    }
+    case ASTNode::Kind::ForStmt: {
+        auto& for_stmt = dynamic_cast<ForStatement&>(statement);
+        // like the tree evaluator, the initializer is not scoped to the loop
+        if (for_stmt.initializer()) {
+            this->statement(*for_stmt.initializer());
+        }
+
+        auto start = here();
+        std::optional<size_t> exit;
+        if (for_stmt.condition()) {
+            exit = branch_unless(*for_stmt.condition());
+        }
+
+        m_loops.push_back(Loop());
+        this->statement(for_stmt.body());
+        auto loop = std::move(m_loops.back());
+        m_loops.pop_back();
+
+        for (auto at : loop.continues) {
+            patch(at);
+        }
+        if (for_stmt.increment()) {
+            effect(*for_stmt.increment());
+        }
+        emit(Opcode::Jump, uint32_t(start));
+
+        if (exit) {
+            patch(*exit);
+        }
+        for (auto at : loop.breaks) {
+            patch(at);
+        }
+        break;
+    }
+    case ASTNode::Kind::BlockStmt: {
+        auto depth = m_locals.size();
+        for (auto& stmt : dynamic_cast<BlockStatement&>(statement).statements()) {
+            this->statement(*stmt);
+        }
+        m_locals.resize(depth);
+        break;
+    }
+    case ASTNode::Kind::ReturnStmt: {
+        auto& ret = dynamic_cast<ReturnStatement&>(statement);
+        if (ret.value()) {
+            expression(*ret.value());
+        } else {
+            emit(Opcode::LoadUndefined);
+        }
+        emit(Opcode::Return);
+        break;
+    }
+    case ASTNode::Kind::BreakStmt:
+    case ASTNode::Kind::ContinueStmt: {
+        if (m_loops.empty()) {
+            throw std::runtime_error(std::format("{} outside of a loop",
+                statement.kind() == ASTNode::Kind::BreakStmt ? "break" : "continue"));
+        }
+        auto at = jump(Opcode::Jump);
+        auto& loop = m_loops.back();
+        (statement.kind() == ASTNode::Kind::BreakStmt ? loop.breaks : loop.continues).push_back(at);
+        break;
+    }
+    case ASTNode::Kind::ExprStmt:
+        effect(dynamic_cast<ExpressionStatement&>(statement).expr());
+        break;
+    case ASTNode::Kind::EmptyStmt:
+        break;
+    default:
+        throw std::runtime_error(std::format("cannot compile {}",
+            ASTInspector::inspect(statement)));
+    }
+}
+
+// Compiles an expression whose value is discarded.
+void Compiler::effect(Expression& expression)
+{
+    if (expression.kind() == ASTNode::Kind::PostfixExpr) {
+        auto& postfix = dynamic_cast<PostfixExpression&>(expression);
+        if (postfix.expr().kind() == ASTNode::Kind::VariableExpr) {
+            auto slot = resolve(dynamic_cast<VariableExpression&>(postfix.expr()).name());
+            if (slot) {
+                emit(postfix.op() == Operator::Increase ? Opcode::IncLocal : Opcode::DecLocal, *slot);
+                return;
+            }
+        }
+    }
+
+    if (expression.kind() == ASTNode::Kind::BinaryExpr) {
+        auto& binary = dynamic_cast<BinaryExpression&>(expression);
+        if (binary.op() == Operator::Assign) {
+            assign(binary, false);
+            return;
+        }
+    }
+
+    this->expression(expression);
+    emit(Opcode::Pop);
+}
+
+void Compiler::assign(BinaryExpression& expression, bool keep)
+{
+    auto& target = expression.left();
+
+    switch (target.kind()) {
+    case ASTNode::Kind::VariableExpr: {
+        auto& variable = dynamic_cast<VariableExpression&>(target);
+        this->expression(expression.right());
+        if (keep) {
+            emit(Opcode::Dup);
+        }
+
+        auto slot = resolve(variable.name());
+        if (slot) {
+            emit(Opcode::StoreLocal, *slot);
+        } else {
+            emit(Opcode::StoreGlobal, name(variable.name()));
+        }
+        return;
+    }
+    case ASTNode::Kind::IndexExpr: {
+        auto& index = dynamic_cast<IndexExpression&>(target);
+        this->expression(expression.right());
+        this->expression(index.object());
+        this->expression(index.index());
+        emit(Opcode::SetIndex);
+        break;
+    }
+    case ASTNode::Kind::AccessExpr: {
+        auto& access = dynamic_cast<AccessExpression&>(target);
+        this->expression(expression.right());
+        this->expression(access.object());
+        emit(Opcode::SetAttr, name(access.name()), m_bytecode.access_sites++);
+        break;
+    }
+    default:
+        throw InvalidOperate(std::format("Invalid assignment target, {}",
+            node_kind_str(target.kind())));
+    }
+
+    if (!keep) {
+        emit(Opcode::Pop);
+    }
+}
+
+// Emits a jump taken when `condition` is false and returns it for patching.
+// Comparisons fuse into a single compare-and-branch instruction.
+size_t Compiler::branch_unless(Expression& condition)
+{
+    if (condition.kind() == ASTNode::Kind::BinaryExpr) {
+        auto& binary = dynamic_cast<BinaryExpression&>(condition);
+
+        std::optional<Opcode> op;
+        switch (binary.op()) {
+        case Operator::Equals:
+            op = Opcode::JumpUnlessEqual;
+            break;
+        case Operator::NotEquals:
+            op = Opcode::JumpUnlessNotEqual;
+            break;
+        case Operator::LessThan:
+            op = Opcode::JumpUnlessLess;
+            break;
+        case Operator::LessThanOrEqual:
+            op = Opcode::JumpUnlessLessEqual;
+            break;
+        case Operator::GreaterThan:
+            op = Opcode::JumpUnlessGreater;
+            break;
+        case Operator::GreaterThanOrEqual:
+            op = Opcode::JumpUnlessGreaterEqual;
+            break;
+        default:
+            break;
+        }
+
+        if (op) {
+            expression(binary.left());
+            expression(binary.right());
+            return jump(*op);
+        }
+    }
+
+    expression(condition);
+    return jump(Opcode::JumpIfFalse);
+}
+
+// The constant index of a numeric literal, for the local-and-constant
+// superinstructions.
+std::optional<uint32_t> Compiler::local_constant(Expression& expression)
+{
+    if (expression.kind() != ASTNode::Kind::LiteralExpr) {
+        return std::nullopt;
+    }
+
+    auto& literal = dynamic_cast<LiteralExpression&>(expression);
+    switch (literal.literal_kind()) {
+    case LiteralKind::Integer:
+        return constant(Value(dynamic_cast<IntegerLiteral&>(literal).value()));
+    case LiteralKind::Float:
+        return constant(Value(dynamic_cast<FloatLiteral&>(literal).value()));
+    default:
+        return std::nullopt;
+    }
+}
+
+void Compiler::expression(Expression& expression)
+{
+    switch (expression.kind()) {
+    case ASTNode::Kind::LiteralExpr: {
+        auto& literal = dynamic_cast<LiteralExpression&>(expression);
+        switch (literal.literal_kind()) {
+        case LiteralKind::Undefined:
+            emit(Opcode::LoadUndefined);
+            break;
+        case LiteralKind::Boolean:
+            emit(Opcode::LoadConst, constant(Value(dynamic_cast<BooleanLiteral&>(literal).value())));
+            break;
+        case LiteralKind::Integer:
+            emit(Opcode::LoadConst, constant(Value(dynamic_cast<IntegerLiteral&>(literal).value())));
+            break;
+        case LiteralKind::Float:
+            emit(Opcode::LoadConst, constant(Value(dynamic_cast<FloatLiteral&>(literal).value())));
+            break;
+        case LiteralKind::String:
+            emit(Opcode::LoadConst, constant(Value(dynamic_cast<StringLiteral&>(literal).constant())));
+            break;
+        default:
+            throw std::runtime_error("Invalid literal kind");
+        }
+        break;
+    }
+    case ASTNode::Kind::VariableExpr: {
+        auto& variable = dynamic_cast<VariableExpression&>(expression);
+        auto slot = resolve(variable.name());
+        if (slot) {
+            emit(Opcode::LoadLocal, *slot);
+        } else {
+            emit(Opcode::LoadGlobal, name(variable.name()));
+        }
+        break;
+    }
+    case ASTNode::Kind::BinaryExpr: {
+        auto& binary = dynamic_cast<BinaryExpression&>(expression);
+        if (binary.op() == Operator::Assign) {
+            assign(binary, true);
+            break;
+        }
+
+        if ((binary.op() == Operator::Add || binary.op() == Operator::Subtract)
+            && binary.left().kind() == ASTNode::Kind::VariableExpr) {
+            auto slot = resolve(dynamic_cast<VariableExpression&>(binary.left()).name());
+            auto constant = slot ? local_constant(binary.right()) : std::nullopt;
+            if (constant) {
+                emit(binary.op() == Operator::Add ? Opcode::AddLocalConst : Opcode::SubLocalConst,
+                    *slot, *constant);
+                break;
+            }
+        }
+
+        this->expression(binary.left());
+        this->expression(binary.right());
+
+        switch (binary.op()) {
+        case Operator::Add:
+            emit(Opcode::Add);
+            break;
+        case Operator::Subtract:
+            emit(Opcode::Sub);
+            break;
+        case Operator::Multiply:
+            emit(Opcode::Mul);
+            break;
+        case Operator::Divide:
+            emit(Opcode::Div);
+            break;
+        case Operator::Modulo:
+            emit(Opcode::Mod);
+            break;
+        case Operator::Equals:
+            emit(Opcode::Equal);
+            break;
+        case Operator::NotEquals:
+            emit(Opcode::NotEqual);
+            break;
+        case Operator::LessThan:
+            emit(Opcode::Less);
+            break;
+        case Operator::LessThanOrEqual:
+            emit(Opcode::LessEqual);
+            break;
+        case Operator::GreaterThan:
+            emit(Opcode::Greater);
+            break;
+        case Operator::GreaterThanOrEqual:
+            emit(Opcode::GreaterEqual);
+            break;
+        default:
+            throw InvalidOperate(std::format("unsupported operator {}", operator_str(binary.op())));
+        }
+        break;
+    }
+    case ASTNode::Kind::PrefixExpr: {
+        auto& prefix = dynamic_cast<PrefixExpression&>(expression);
+        this->expression(prefix.expr());
+        switch (prefix.op()) {
+        case Operator::Subtract:
+            emit(Opcode::Negate);
+            break;
+        case Operator::Not:
+            emit(Opcode::Not);
+            break;
+        default:
+            throw InvalidOperate(std::format("unsupported operator {}", operator_str(prefix.op())));
+        }
+        break;
+    }
+    case ASTNode::Kind::PostfixExpr: {
+        auto& postfix = dynamic_cast<PostfixExpression&>(expression);
+        auto increase = postfix.op() == Operator::Increase;
+        if (postfix.expr().kind() != ASTNode::Kind::VariableExpr) {
+            throw InvalidOperate(std::format("Invalid {} target, {}",
+                operator_str(postfix.op()), node_kind_str(postfix.expr().kind())));
+        }
+
+        auto& variable = dynamic_cast<VariableExpression&>(postfix.expr());
+        auto slot = resolve(variable.name());
+        if (slot) {
+            emit(increase ? Opcode::IncLocal : Opcode::DecLocal, *slot);
+            emit(Opcode::LoadLocal, *slot);
+        } else {
+            auto index = name(variable.name());
+            emit(Opcode::LoadGlobal, index);
+            emit(Opcode::LoadConst, constant(Value(int64_t(1))));
+            emit(increase ? Opcode::Add : Opcode::Sub);
+            emit(Opcode::Dup);
+            emit(Opcode::StoreGlobal, index);
+        }
+        break;
+    }
+    case ASTNode::Kind::IndexExpr: {
+        auto& index = dynamic_cast<IndexExpression&>(expression);
+        this->expression(index.object());
+        this->expression(index.index());
+        emit(Opcode::Index);
+        break;
+    }
+    case ASTNode::Kind::CallExpr: {
+        auto& call = dynamic_cast<CallExpression&>(expression);
+        auto argc = uint32_t(call.args().size());
+
+        // calls to a program function by name skip the callee lookup
+        if (call.callee().kind() == ASTNode::Kind::VariableExpr) {
+            auto& callee = dynamic_cast<VariableExpression&>(call.callee()).name();
+            auto found = m_bytecode.functions.find(callee);
+            if (!resolve(callee) && found != m_bytecode.functions.end() && !m_rebound.contains(callee)) {
+                for (auto& arg : call.args()) {
+                    this->expression(*arg);
+                }
+                emit(Opcode::CallFunction, found->second, argc);
+                break;
+            }
+        }
+
+        this->expression(call.callee());
+        for (auto& arg : call.args()) {
+            this->expression(*arg);
+        }
+        emit(Opcode::Call, argc);
+        break;
+    }
+    case ASTNode::Kind::AccessExpr: {
+        auto& access = dynamic_cast<AccessExpression&>(expression);
+        this->expression(access.object());
+        emit(Opcode::GetAttr, name(access.name()), m_bytecode.access_sites++);
+        break;
+    }
+    case ASTNode::Kind::ArrayExpr: {
+        auto& array = dynamic_cast<ArrayExpression&>(expression);
+        for (auto& element : array.elements()) {
+            this->expression(*element);
+        }
+        emit(Opcode::MakeArray, uint32_t(array.elements().size()));
+        break;
+    }
+    case ASTNode::Kind::ObjectExpr: {
+        auto& object = dynamic_cast<ObjectExpression&>(expression);
+        std::vector<uint32_t> keys;
+        for (auto& key : object.keys()) {
+            keys.push_back(name(key));
+        }
+        for (auto& value : object.values()) {
+            this->expression(*value);
+        }
+        m_bytecode.objects.push_back(std::move(keys));
+        emit(Opcode::MakeObject, uint32_t(m_bytecode.objects.size() - 1));
+        break;
+    }
+    default:
+        throw std::runtime_error(std::format("cannot compile {}",
+            ASTInspector::inspect(expression)));
+    }
+}
+
+Bytecode compile(Program& program)
+{
+    require_lexical_scoping(program);
+
+    Bytecode bytecode;
+
+    // sorted so the same source always compiles to the same chunks
+    std::vector<std::string> names;
+    for (auto& [name, fn] : program.functions()) {
+        names.push_back(name);
+    }
+    std::sort(names.begin(), names.end());
+
+    bytecode.chunks.resize(names.size() + 1);
+    for (uint32_t i = 0; i < names.size(); ++i) {
+        bytecode.functions.insert({ names[i], i + 1 });
+    }
+
+    auto rebound = rebound_names(program);
+    std::unordered_map<std::string, uint32_t> interned;
+    for (auto& name : names) {
+        auto& fn = *program.functions()[name];
+        Compiler(bytecode, bytecode.chunks[bytecode.functions[name]], interned, rebound, nullptr).function(fn);
+    }
+
+    auto shared = shared_names(program);
+
+    Compiler main(bytecode, bytecode.chunks[0], interned, rebound, &shared);
+    bytecode.chunks[0].name = "<main>";
+    for (auto& stmt : program.statements()) {
+        main.statement(*stmt);
+    }
+    main.emit(Opcode::LoadUndefined);
+    main.emit(Opcode::Return);
+
+    return bytecode;
+}
+
+std::string disassemble(const Bytecode& bytecode)
+{
+    std::string out;
+
+    for (auto& chunk : bytecode.chunks) {
+        out += std::format("{} (params: {}, locals: {}):\n", chunk.name, chunk.params, chunk.locals);
+        for (size_t i = 0; i < chunk.code.size(); ++i) {
+            auto& instruction = chunk.code[i];
+            out += std::format("  {:4} {:<24}", i, opcode_str(instruction.op));
+
+            switch (instruction.op) {
+            case Opcode::LoadConst:
+                out += Value(bytecode.constants[instruction.a]).inspect();
+                break;
+            case Opcode::LoadGlobal:
+            case Opcode::StoreGlobal:
+            case Opcode::DefineGlobal:
+            case Opcode::GetAttr:
+            case Opcode::SetAttr:
+                out += bytecode.names[instruction.a];
+                break;
+            case Opcode::CallFunction:
+                out += std::format("{} {}", bytecode.chunks[instruction.a].name, instruction.b);
+                break;
+            case Opcode::AddLocalConst:
+            case Opcode::SubLocalConst:
+                out += std::format("{} {}", instruction.a, Value(bytecode.constants[instruction.b]).inspect());
+                break;
+            case Opcode::LoadUndefined:
+            case Opcode::Pop:
+            case Opcode::Dup:
+            case Opcode::Return:
+            case Opcode::Index:
+            case Opcode::SetIndex:
+                break;
+            default:
+                if (instruction.op >= Opcode::Add && instruction.op <= Opcode::Not) {
+                    break;
+                }
+                out += std::to_string(instruction.a);
+                break;
+            }
+
+            while (!out.empty() && out.back() == ' ') {
+                out.pop_back();
+            }
+            out += '\n';
+        }
+    }
+
+    return out;
+}
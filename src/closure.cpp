@@ -0,0 +1,718 @@
+#include "closure.h"
+#include "alloc.h"
+#include "ast.h"
+#include "bytecode.h"
+#include "resolver.h"
+#include <format>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+using CondClosure = std::function<bool(ClosureFrame&)>;
+
+static int64_t integer(const Value& value)
+{
+    return static_cast<Integer*>(value.get())->value();
+}
+
+static bool integers(const Value& lhs, const Value& rhs)
+{
+    return lhs.kind() == ValueKind::Integer && rhs.kind() == ValueKind::Integer;
+}
+
+static Comparison compare(int64_t lhs, int64_t rhs)
+{
+    return lhs == rhs ? Comparison::Equal : (lhs < rhs ? Comparison::Less : Comparison::Greater);
+}
+
+static Comparison compare(const Value& lhs, const Value& rhs)
+{
+    if (integers(lhs, rhs)) {
+        return compare(integer(lhs), integer(rhs));
+    }
+    return lhs.get()->compare(rhs);
+}
+
+// both operands were inferred to be integers
+static bool unboxed(BinaryExpression& expression)
+{
+    return expression.left().kinds().is(ValueKind::Integer) && expression.right().kinds().is(ValueKind::Integer);
+}
+
+// `lhs op rhs` with a fast path for two integers
+template <typename Fast, typename Slow>
+static ExprClosure arithmetic(ExprClosure lhs, ExprClosure rhs, Fast fast, Slow slow)
+{
+    return [lhs = std::move(lhs), rhs = std::move(rhs), fast, slow](ClosureFrame& frame) {
+        auto l = lhs(frame);
+        auto r = rhs(frame);
+        if (integers(l, r)) {
+            return Value(fast(integer(l), integer(r)));
+        }
+        return slow(l, r);
+    };
+}
+
+template <typename Fast>
+static ExprClosure integer_arithmetic(ExprClosure lhs, ExprClosure rhs, Fast fast)
+{
+    return [lhs = std::move(lhs), rhs = std::move(rhs), fast](ClosureFrame& frame) {
+        auto l = integer(lhs(frame));
+        return Value(fast(l, integer(rhs(frame))));
+    };
+}
+
+static std::optional<bool (*)(Comparison)> comparison(Operator op)
+{
+    switch (op) {
+    case Operator::Equals:
+        return [](Comparison c) { return c == Comparison::Equal; };
+    case Operator::NotEquals:
+        return [](Comparison c) { return c != Comparison::Equal; };
+    case Operator::LessThan:
+        return [](Comparison c) { return c == Comparison::Less; };
+    case Operator::LessThanOrEqual:
+        return [](Comparison c) { return c != Comparison::Greater; };
+    case Operator::GreaterThan:
+        return [](Comparison c) { return c == Comparison::Greater; };
+    case Operator::GreaterThanOrEqual:
+        return [](Comparison c) { return c != Comparison::Less; };
+    default:
+        return std::nullopt;
+    }
+}
+
+class ClosureCompiler {
+public:
+    ClosureCompiler(const ClosureProgram& program, const std::unordered_set<std::string>& rebound,
+        const std::unordered_set<std::string>* shared)
+        : m_program(program)
+        , m_rebound(rebound)
+        , m_resolver(shared)
+    {
+    }
+
+    void function(FnStatement& fn, ClosureFunction& out);
+    void top_level(std::vector<std::unique_ptr<Statement>>& statements, ClosureFunction& out);
+
+private:
+    StmtClosure statement(Statement& statement);
+    StmtClosure block(std::vector<std::unique_ptr<Statement>>& statements);
+    CondClosure condition(Expression& expression);
+
+    ExprClosure expression(Expression& expression);
+    ExprClosure literal(LiteralExpression& literal);
+    ExprClosure binary(BinaryExpression& expression);
+    ExprClosure assign(BinaryExpression& expression);
+    ExprClosure prefix(PrefixExpression& expression);
+    ExprClosure postfix(PostfixExpression& expression);
+    ExprClosure call(CallExpression& expression);
+    ExprClosure object(ObjectExpression& expression);
+    ExprClosure access(AccessExpression& expression);
+
+    std::optional<uint32_t> local(Expression& expression) const;
+
+    const ClosureProgram& m_program;
+    const std::unordered_set<std::string>& m_rebound;
+    Resolver m_resolver;
+};
+
+std::optional<uint32_t> ClosureCompiler::local(Expression& expression) const
+{
+    auto found = m_resolver.slots.find(&expression);
+    if (found == m_resolver.slots.end()) {
+        return std::nullopt;
+    }
+    return found->second;
+}
+
+void ClosureCompiler::function(FnStatement& fn, ClosureFunction& out)
+{
+    m_resolver.function(fn);
+    out.body = statement(fn.body());
+    out.locals = m_resolver.locals();
+}
+
+void ClosureCompiler::top_level(std::vector<std::unique_ptr<Statement>>& statements, ClosureFunction& out)
+{
+    for (auto& stmt : statements) {
+        m_resolver.statement(*stmt);
+    }
+    out.body = block(statements);
+    out.locals = m_resolver.locals();
+}
+
+StmtClosure ClosureCompiler::block(std::vector<std::unique_ptr<Statement>>& statements)
+{
+    std::vector<StmtClosure> body;
+    for (auto& stmt : statements) {
+        body.push_back(statement(*stmt));
+    }
+
+    return [body = std::move(body)](ClosureFrame& frame) {
+        for (auto& stmt : body) {
+            auto completion = stmt(frame);
+            if (completion != Completion::Normal) {
+                return completion;
+            }
+        }
+        return Completion::Normal;
+    };
+}
+
+StmtClosure ClosureCompiler::statement(Statement& statement)
+{
+    switch (statement.kind()) {
+    case ASTNode::Kind::LetStmt: {
+        auto& let = dynamic_cast<LetStatement&>(statement);
+        ExprClosure value = let.value() ? expression(*let.value())
+                                        : [](ClosureFrame&) { return Value(); };
+
+        auto found = m_resolver.slots.find(&let);
+        if (found == m_resolver.slots.end()) {
+            return [name = let.name(), value = std::move(value)](ClosureFrame& frame) {
+                frame.context.insert_variable(name, value(frame));
+                return Completion::Normal;
+            };
+        }
+        return [slot = found->second, value = std::move(value)](ClosureFrame& frame) {
+            frame.locals[slot] = value(frame);
+            return Completion::Normal;
+        };
+    }
+    case ASTNode::Kind::IfStmt: {
+        auto& if_stmt = dynamic_cast<IfStatement&>(statement);
+        auto cond = condition(if_stmt.condition());
+        auto then_branch = this->statement(if_stmt.then_branch());
+        if (!if_stmt.else_branch()) {
+            return [cond = std::move(cond), then_branch = std::move(then_branch)](ClosureFrame& frame) {
+                return cond(frame) ? then_branch(frame) : Completion::Normal;
+            };
+        }
+
+        auto else_branch = this->statement(*if_stmt.else_branch());
+        return [cond = std::move(cond), then_branch = std::move(then_branch),
+                   else_branch = std::move(else_branch)](ClosureFrame& frame) {
+            return cond(frame) ? then_branch(frame) : else_branch(frame);
+        };
+    }
+    case ASTNode::Kind::ForStmt: {
+        auto& for_stmt = dynamic_cast<ForStatement&>(statement);
+        auto init = for_stmt.initializer() ? this->statement(*for_stmt.initializer()) : StmtClosure();
+        auto cond = for_stmt.condition() ? condition(*for_stmt.condition()) : CondClosure();
+        auto body = this->statement(for_stmt.body());
+        auto increment = for_stmt.increment() ? expression(*for_stmt.increment()) : ExprClosure();
+
+        return [init = std::move(init), cond = std::move(cond), body = std::move(body),
+                   increment = std::move(increment)](ClosureFrame& frame) {
+            if (init) {
+                init(frame);
+            }
+            while (!cond || cond(frame)) {
+                auto completion = body(frame);
+                if (completion == Completion::Break) {
+                    break;
+                }
+                if (completion == Completion::Return) {
+                    return completion;
+                }
+                if (increment) {
+                    increment(frame);
+                }
+            }
+            return Completion::Normal;
+        };
+    }
+    case ASTNode::Kind::BlockStmt:
+        return block(dynamic_cast<BlockStatement&>(statement).statements());
+    case ASTNode::Kind::ReturnStmt: {
+        auto& ret = dynamic_cast<ReturnStatement&>(statement);
+        if (!ret.value()) {
+            return [](ClosureFrame& frame) {
+                frame.result = Value();
+                return Completion::Return;
+            };
+        }
+        return [value = expression(*ret.value())](ClosureFrame& frame) {
+            frame.result = value(frame);
+            return Completion::Return;
+        };
+    }
+    case ASTNode::Kind::BreakStmt:
+        return [](ClosureFrame&) { return Completion::Break; };
+    case ASTNode::Kind::ContinueStmt:
+        return [](ClosureFrame&) { return Completion::Continue; };
+    case ASTNode::Kind::ExprStmt:
+        return [value = expression(dynamic_cast<ExpressionStatement&>(statement).expr())](ClosureFrame& frame) {
+            value(frame);
+            return Completion::Normal;
+        };
+    case ASTNode::Kind::EmptyStmt:
+        return [](ClosureFrame&) { return Completion::Normal; };
+    default:
+        throw std::runtime_error(std::format("cannot compile {}",
+            ASTInspector::inspect(statement)));
+    }
+}
+
+// Comparisons in a condition produce the bool directly instead of a Boolean.
+CondClosure ClosureCompiler::condition(Expression& expression)
+{
+    if (expression.kind() == ASTNode::Kind::BinaryExpr) {
+        auto& binary = dynamic_cast<BinaryExpression&>(expression);
+        auto test = comparison(binary.op());
+        if (test && unboxed(binary)) {
+            return [lhs = this->expression(binary.left()), rhs = this->expression(binary.right()),
+                       test = *test](ClosureFrame& frame) {
+                auto l = integer(lhs(frame));
+                return test(compare(l, integer(rhs(frame))));
+            };
+        }
+        if (test) {
+            return [lhs = this->expression(binary.left()), rhs = this->expression(binary.right()),
+                       test = *test](ClosureFrame& frame) {
+                auto l = lhs(frame);
+                return test(compare(l, rhs(frame)));
+            };
+        }
+    }
+
+    return [value = this->expression(expression)](ClosureFrame& frame) {
+        auto result = value(frame);
+        if (result.kind() != ValueKind::Boolean) {
+            throw InvalidOperate(Operator::Equals, ValueKind::Boolean, result.kind());
+        }
+        return result.as_boolean();
+    };
+}
+
+ExprClosure ClosureCompiler::expression(Expression& expression)
+{
+    switch (expression.kind()) {
+    case ASTNode::Kind::LiteralExpr:
+        return literal(dynamic_cast<LiteralExpression&>(expression));
+    case ASTNode::Kind::VariableExpr: {
+        auto slot = local(expression);
+        if (slot) {
+            return [slot = *slot](ClosureFrame& frame) { return frame.locals[slot]; };
+        }
+        return [name = dynamic_cast<VariableExpression&>(expression).name()](ClosureFrame& frame) {
+            return frame.context.get_variable(name);
+        };
+    }
+    case ASTNode::Kind::BinaryExpr:
+        return binary(dynamic_cast<BinaryExpression&>(expression));
+    case ASTNode::Kind::PrefixExpr:
+        return prefix(dynamic_cast<PrefixExpression&>(expression));
+    case ASTNode::Kind::PostfixExpr:
+        return postfix(dynamic_cast<PostfixExpression&>(expression));
+    case ASTNode::Kind::CallExpr:
+        return call(dynamic_cast<CallExpression&>(expression));
+    case ASTNode::Kind::ArrayExpr: {
+        std::vector<ExprClosure> elements;
+        for (auto& element : dynamic_cast<ArrayExpression&>(expression).elements()) {
+            elements.push_back(this->expression(*element));
+        }
+        return [elements = std::move(elements)](ClosureFrame& frame) {
+            std::vector<Value> values;
+            values.reserve(elements.size());
+            for (auto& element : elements) {
+                values.push_back(element(frame));
+            }
+            return Value(make_object<Array>(ValueKind::Array, std::move(values)));
+        };
+    }
+    case ASTNode::Kind::IndexExpr: {
+        auto& index = dynamic_cast<IndexExpression&>(expression);
+        return [object = this->expression(index.object()), index = this->expression(index.index())](ClosureFrame& frame) {
+            auto target = object(frame);
+            return target.get()->index(index(frame));
+        };
+    }
+    case ASTNode::Kind::ObjectExpr:
+        return object(dynamic_cast<ObjectExpression&>(expression));
+    case ASTNode::Kind::AccessExpr:
+        return access(dynamic_cast<AccessExpression&>(expression));
+    default:
+        throw std::runtime_error(std::format("cannot compile {}",
+            ASTInspector::inspect(expression)));
+    }
+}
+
+// Numbers and booleans are boxed once and shared, like the constants of the
+// VMs: nothing in compiled code updates them in place.
+ExprClosure ClosureCompiler::literal(LiteralExpression& literal)
+{
+    Value value;
+    switch (literal.literal_kind()) {
+    case LiteralKind::Undefined:
+        return [](ClosureFrame&) { return Value(); };
+    case LiteralKind::Boolean:
+        value = Value(dynamic_cast<BooleanLiteral&>(literal).value());
+        break;
+    case LiteralKind::Integer:
+        value = Value(dynamic_cast<IntegerLiteral&>(literal).value());
+        break;
+    case LiteralKind::Float:
+        value = Value(dynamic_cast<FloatLiteral&>(literal).value());
+        break;
+    case LiteralKind::String:
+        return [value = Value(dynamic_cast<StringLiteral&>(literal).constant())](ClosureFrame&) { return value; };
+    default:
+        throw std::runtime_error("Invalid literal kind");
+    }
+    return [value = std::move(value)](ClosureFrame&) { return value; };
+}
+
+ExprClosure ClosureCompiler::binary(BinaryExpression& expression)
+{
+    if (expression.op() == Operator::Assign) {
+        return assign(expression);
+    }
+
+    auto lhs = this->expression(expression.left());
+    auto rhs = this->expression(expression.right());
+
+    auto test = comparison(expression.op());
+    if (test && unboxed(expression)) {
+        return [lhs = std::move(lhs), rhs = std::move(rhs), test = *test](ClosureFrame& frame) {
+            auto l = integer(lhs(frame));
+            return Value(test(compare(l, integer(rhs(frame)))));
+        };
+    }
+    if (test) {
+        return [lhs = std::move(lhs), rhs = std::move(rhs), test = *test](ClosureFrame& frame) {
+            auto l = lhs(frame);
+            return Value(test(compare(l, rhs(frame))));
+        };
+    }
+
+    if (unboxed(expression)) {
+        switch (expression.op()) {
+        case Operator::Add:
+            return integer_arithmetic(std::move(lhs), std::move(rhs), [](int64_t l, int64_t r) { return l + r; });
+        case Operator::Subtract:
+            return integer_arithmetic(std::move(lhs), std::move(rhs), [](int64_t l, int64_t r) { return l - r; });
+        case Operator::Multiply:
+            return integer_arithmetic(std::move(lhs), std::move(rhs), [](int64_t l, int64_t r) { return l * r; });
+        default:
+            break;
+        }
+    }
+
+    switch (expression.op()) {
+    case Operator::Add:
+        return arithmetic(
+            std::move(lhs), std::move(rhs), [](int64_t l, int64_t r) { return l + r; },
+            [](const Value& l, const Value& r) { return l.get()->add(r); });
+    case Operator::Subtract:
+        return arithmetic(
+            std::move(lhs), std::move(rhs), [](int64_t l, int64_t r) { return l - r; },
+            [](const Value& l, const Value& r) { return l.get()->sub(r); });
+    case Operator::Multiply:
+        return arithmetic(
+            std::move(lhs), std::move(rhs), [](int64_t l, int64_t r) { return l * r; },
+            [](const Value& l, const Value& r) { return l.get()->mul(r); });
+    case Operator::Divide:
+        return [lhs = std::move(lhs), rhs = std::move(rhs)](ClosureFrame& frame) {
+            auto l = lhs(frame);
+            return l.get()->div(rhs(frame));
+        };
+    case Operator::Modulo:
+        return [lhs = std::move(lhs), rhs = std::move(rhs)](ClosureFrame& frame) {
+            auto l = lhs(frame);
+            return l.get()->mod(rhs(frame));
+        };
+    default:
+        return [lhs = std::move(lhs), rhs = std::move(rhs), op = expression.op()](ClosureFrame& frame) -> Value {
+            auto l = lhs(frame);
+            throw InvalidOperate(op, l.kind(), rhs(frame).kind());
+        };
+    }
+}
+
+// The value is evaluated before the target, as in Evaluator::eval_assign.
+ExprClosure ClosureCompiler::assign(BinaryExpression& expression)
+{
+    auto value = this->expression(expression.right());
+
+    switch (expression.left().kind()) {
+    case ASTNode::Kind::VariableExpr: {
+        auto slot = local(expression.left());
+        if (slot) {
+            return [slot = *slot, value = std::move(value)](ClosureFrame& frame) {
+                return frame.locals[slot] = value(frame);
+            };
+        }
+        return [name = dynamic_cast<VariableExpression&>(expression.left()).name(),
+                   value = std::move(value)](ClosureFrame& frame) {
+            auto result = value(frame);
+            frame.context.set_variable(name, result);
+            return result;
+        };
+    }
+    case ASTNode::Kind::IndexExpr: {
+        auto& target = dynamic_cast<IndexExpression&>(expression.left());
+        return [value = std::move(value), object = this->expression(target.object()),
+                   index = this->expression(target.index())](ClosureFrame& frame) {
+            auto result = value(frame);
+            auto target = object(frame);
+            target.get()->set_index(index(frame), result);
+            return result;
+        };
+    }
+    case ASTNode::Kind::AccessExpr: {
+        auto& target = dynamic_cast<AccessExpression&>(expression.left());
+        return [value = std::move(value), object = this->expression(target.object()),
+                   name = target.name(), cache = AccessCache()](ClosureFrame& frame) mutable {
+            auto result = value(frame);
+            auto target = object(frame);
+            if (target.kind() != ValueKind::Object) {
+                target.get()->set_attr(name, result);
+                return result;
+            }
+
+            auto& record = target.as_shaped();
+            if (record.shape() == cache.shape) {
+                cache.hits++;
+                record.store(cache.slot, result);
+                return result;
+            }
+
+            cache.misses++;
+            record.set_attr(name, result);
+            if (record.shape()->cacheable()) {
+                cache.shape = record.shape();
+                cache.slot = record.shape()->lookup(name).value();
+            }
+            return result;
+        };
+    }
+    default:
+        throw InvalidOperate(std::format("Invalid assignment target, {}",
+            node_kind_str(expression.left().kind())));
+    }
+}
+
+ExprClosure ClosureCompiler::prefix(PrefixExpression& expression)
+{
+    auto value = this->expression(expression.expr());
+
+    switch (expression.op()) {
+    case Operator::Subtract:
+        return [value = std::move(value)](ClosureFrame& frame) {
+            auto operand = value(frame);
+            switch (operand.kind()) {
+            case ValueKind::Integer:
+                return Value(-integer(operand));
+            case ValueKind::Float:
+                return Value(-operand.as_float());
+            default:
+                throw InvalidOperate(Operator::Subtract, operand.kind());
+            }
+        };
+    case Operator::Not:
+        return [value = std::move(value)](ClosureFrame& frame) {
+            auto operand = value(frame);
+            if (operand.kind() != ValueKind::Boolean) {
+                throw InvalidOperate(Operator::Not, operand.kind());
+            }
+            return Value(!operand.as_boolean());
+        };
+    default:
+        return [value = std::move(value), op = expression.op()](ClosureFrame& frame) -> Value {
+            throw InvalidOperate(op, value(frame).kind());
+        };
+    }
+}
+
+// Stores a new Integer rather than updating the old one, which may be shared.
+ExprClosure ClosureCompiler::postfix(PostfixExpression& expression)
+{
+    if (expression.expr().kind() != ASTNode::Kind::VariableExpr) {
+        throw InvalidOperate(std::format("Invalid {} target, {}",
+            operator_str(expression.op()), node_kind_str(expression.expr().kind())));
+    }
+
+    auto op = expression.op();
+    auto step = op == Operator::Increase ? 1 : -1;
+
+    auto slot = local(expression.expr());
+    if (slot) {
+        return [slot = *slot, op, step](ClosureFrame& frame) {
+            auto& value = frame.locals[slot];
+            if (value.kind() != ValueKind::Integer) {
+                throw InvalidOperate(op, value.kind());
+            }
+            return value = Value(integer(value) + step);
+        };
+    }
+
+    return [name = dynamic_cast<VariableExpression&>(expression.expr()).name(), op, step](ClosureFrame& frame) {
+        auto value = frame.context.get_variable(name);
+        if (value.kind() != ValueKind::Integer) {
+            throw InvalidOperate(op, value.kind());
+        }
+        auto result = Value(integer(value) + step);
+        frame.context.set_variable(name, result);
+        return result;
+    };
+}
+
+ExprClosure ClosureCompiler::call(CallExpression& expression)
+{
+    std::vector<ExprClosure> args;
+    for (auto& arg : expression.args()) {
+        args.push_back(this->expression(*arg));
+    }
+
+    // calls to a program function by name skip the callee lookup
+    if (expression.callee().kind() == ASTNode::Kind::VariableExpr && !local(expression.callee())) {
+        auto& name = dynamic_cast<VariableExpression&>(expression.callee()).name();
+        auto fn = m_program.function(name);
+        if (fn && fn->params == args.size() && !m_rebound.contains(name)) {
+            return [fn, args = std::move(args)](ClosureFrame& frame) {
+                std::vector<Value> values;
+                values.reserve(fn->locals);
+                for (auto& arg : args) {
+                    values.push_back(arg(frame));
+                }
+                return ClosureProgram::call(*fn, frame.program, frame.context, std::move(values));
+            };
+        }
+    }
+
+    return [callee = this->expression(expression.callee()), args = std::move(args)](ClosureFrame& frame) {
+        auto target = callee(frame);
+
+        std::vector<Value> values;
+        values.reserve(args.size());
+        for (auto& arg : args) {
+            values.push_back(arg(frame));
+        }
+
+        switch (target.kind()) {
+        case ValueKind::UserFunction: {
+            auto fn = frame.program.function(target.as_user_function().name());
+            if (!fn) {
+                throw std::runtime_error("Function not found");
+            }
+            if (fn->params != values.size()) {
+                throw InvalidOperate(std::format("Invalid call for {}", fn->name));
+            }
+            return ClosureProgram::call(*fn, frame.program, frame.context, std::move(values));
+        }
+        case ValueKind::NativeFunction:
+            return target.get()->call(values);
+        default:
+            throw InvalidOperate(std::format("Invalid call for {}", target.inspect()));
+        }
+    };
+}
+
+ExprClosure ClosureCompiler::object(ObjectExpression& expression)
+{
+    std::vector<ExprClosure> values;
+    for (auto& value : expression.values()) {
+        values.push_back(this->expression(*value));
+    }
+
+    // the literal always builds the same shape, resolved on first use
+    return [keys = expression.keys(), values = std::move(values), shape = (Shape*)nullptr](ClosureFrame& frame) mutable {
+        if (shape == nullptr) {
+            auto resolved = Shape::root();
+            for (auto& key : keys) {
+                resolved = resolved->transition(key);
+            }
+            shape = resolved;
+        }
+
+        std::vector<Value> slots;
+        slots.reserve(values.size());
+        for (auto& value : values) {
+            slots.push_back(value(frame));
+        }
+        return Value(make_object<Record>(ValueKind::Object, shape, std::move(slots)));
+    };
+}
+
+ExprClosure ClosureCompiler::access(AccessExpression& expression)
+{
+    return [object = this->expression(expression.object()), name = expression.name(),
+               cache = AccessCache()](ClosureFrame& frame) mutable {
+        auto target = object(frame);
+        if (target.kind() != ValueKind::Object) {
+            return target.get()->get_attr(name);
+        }
+
+        auto& record = target.as_shaped();
+        if (record.shape() == cache.shape) {
+            cache.hits++;
+            return record.load(cache.slot);
+        }
+
+        cache.misses++;
+        auto value = record.get_attr(name);
+        auto slot = record.shape()->lookup(name);
+        if (slot.has_value() && record.shape()->cacheable()) {
+            cache.shape = record.shape();
+            cache.slot = slot.value();
+        }
+        return value;
+    };
+}
+
+ClosureProgram::ClosureProgram(Program& program, const TypeEnvironment& environment)
+{
+    require_lexical_scoping(program);
+    infer_types(program, environment);
+
+    // every function exists before any body is compiled so calls can bind to
+    // them directly, including recursive ones
+    for (auto& [name, fn] : program.functions()) {
+        auto compiled = std::make_unique<ClosureFunction>();
+        compiled->name = name;
+        compiled->params = uint32_t(fn->params().size());
+        m_functions.insert({ name, std::move(compiled) });
+    }
+
+    auto rebound = rebound_names(program);
+    for (auto& [name, fn] : program.functions()) {
+        ClosureCompiler(*this, rebound, nullptr).function(*fn, *m_functions.at(name));
+    }
+
+    m_main.name = "<main>";
+    auto shared = shared_names(program);
+    ClosureCompiler(*this, rebound, &shared).top_level(program.statements(), m_main);
+}
+
+const ClosureFunction* ClosureProgram::function(const std::string& name) const
+{
+    auto found = m_functions.find(name);
+    return found == m_functions.end() ? nullptr : found->second.get();
+}
+
+Value ClosureProgram::call(const ClosureFunction& fn, const ClosureProgram& program, Context& context,
+    std::vector<Value> args)
+{
+    // every local is written before it is read, so new ones start out empty
+    args.resize(fn.locals, Value(std::shared_ptr<Object>()));
+
+    ClosureFrame frame { program, context, std::move(args), Value(std::shared_ptr<Object>()) };
+    if (fn.body(frame) == Completion::Return) {
+        return std::move(frame.result);
+    }
+    return Value();
+}
+
+Value ClosureProgram::run(Context& context) const
+{
+    for (auto& [name, fn] : m_functions) {
+        context.insert_variable(name, Value(make_object<UserFunction>(ValueKind::UserFunction, name)));
+    }
+
+    return call(m_main, *this, context, {});
+}
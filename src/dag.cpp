@@ -0,0 +1,163 @@
+#include "dag.h"
+#include "ast.h"
+#include "eval.h"
+#include "object.h"
+#include <format>
+#include <string>
+#include <vector>
+
+std::string ExpressionDAG::report() const
+{
+    return std::format("outputs: {}, nodes: {} of {}", m_outputs.size(), m_nodes.size(), m_references);
+}
+
+size_t ExpressionDAG::add(std::unique_ptr<Expression> expression)
+{
+    m_outputs.push_back(node(*expression));
+    m_expressions.push_back(std::move(expression));
+    return m_outputs.size() - 1;
+}
+
+uint32_t ExpressionDAG::intern(std::string key, Node node)
+{
+    auto found = m_keys.find(key);
+    if (found != m_keys.end()) {
+        return found->second;
+    }
+
+    auto index = uint32_t(m_nodes.size());
+    m_nodes.push_back(std::move(node));
+    m_keys.emplace(std::move(key), index);
+    return index;
+}
+
+uint32_t ExpressionDAG::node(Expression& expression)
+{
+    m_references++;
+
+    switch (expression.kind()) {
+    case ASTNode::Kind::LiteralExpr: {
+        Context empty;
+        auto value = Evaluator(empty).eval(expression);
+        auto key = std::format("{}:{}", value_kind_str(value.kind()), value.inspect());
+        return intern(std::move(key), { .kind = Node::Kind::Literal, .value = value });
+    }
+    case ASTNode::Kind::VariableExpr: {
+        auto& name = dynamic_cast<VariableExpression&>(expression).name();
+        return intern("$" + name, { .kind = Node::Kind::Variable, .name = name });
+    }
+    case ASTNode::Kind::AccessExpr: {
+        auto& access = dynamic_cast<AccessExpression&>(expression);
+        auto object = node(access.object());
+        return intern(std::format("{}.{}", object, access.name()),
+            { .kind = Node::Kind::Access, .lhs = object, .name = access.name() });
+    }
+    case ASTNode::Kind::IndexExpr: {
+        auto& index = dynamic_cast<IndexExpression&>(expression);
+        auto object = node(index.object());
+        auto key = node(index.index());
+        return intern(std::format("{}[{}]", object, key), { .kind = Node::Kind::Index, .lhs = object, .rhs = key });
+    }
+    case ASTNode::Kind::PrefixExpr: {
+        auto& prefix = dynamic_cast<PrefixExpression&>(expression);
+        auto operand = node(prefix.expr());
+        return intern(std::format("{}({})", operator_str(prefix.op()), operand),
+            { .kind = Node::Kind::Prefix, .op = prefix.op(), .lhs = operand });
+    }
+    case ASTNode::Kind::BinaryExpr: {
+        auto& binary = dynamic_cast<BinaryExpression&>(expression);
+        if (binary.op() == Operator::Assign) {
+            break;
+        }
+        auto lhs = node(binary.left());
+        auto rhs = node(binary.right());
+        return intern(std::format("({} {} {})", lhs, operator_str(binary.op()), rhs),
+            { .kind = Node::Kind::Binary, .op = binary.op(), .lhs = lhs, .rhs = rhs });
+    }
+    default:
+        break;
+    }
+
+    // never shared, so it keys on its own address
+    return intern(std::format("@{}", static_cast<void*>(&expression)),
+        { .kind = Node::Kind::Opaque, .expression = &expression });
+}
+
+Value ExpressionDAG::evaluate(Node& node, Context& context, const std::vector<Value>& values)
+{
+    switch (node.kind) {
+    case Node::Kind::Literal:
+        return node.value;
+    case Node::Kind::Variable:
+        return context.get_variable(node.name);
+    case Node::Kind::Access: {
+        auto& object = values[node.lhs];
+        if (object.kind() != ValueKind::Object) {
+            return object.obj()->get_attr(node.name);
+        }
+
+        auto& record = object.as_shaped();
+        auto& cache = node.cache;
+        if (record.shape() == cache.shape) {
+            cache.hits++;
+            return record.load(cache.slot);
+        }
+
+        cache.misses++;
+        auto value = record.get_attr(node.name);
+        auto slot = record.shape()->lookup(node.name);
+        if (slot.has_value() && record.shape()->cacheable()) {
+            cache.shape = record.shape();
+            cache.slot = slot.value();
+        }
+        return value;
+    }
+    case Node::Kind::Index:
+        return values[node.lhs].obj()->index(values[node.rhs]);
+    case Node::Kind::Prefix: {
+        auto& value = values[node.lhs];
+        if (node.op == Operator::Subtract && value.kind() == ValueKind::Integer) {
+            return Value(-value.as_integer());
+        }
+        if (node.op == Operator::Subtract && value.kind() == ValueKind::Float) {
+            return Value(-value.as_float());
+        }
+        if (node.op == Operator::Not && value.kind() == ValueKind::Boolean) {
+            return Value(!value.as_boolean());
+        }
+        throw InvalidOperate(node.op, value.kind());
+    }
+    case Node::Kind::Binary: {
+        auto& lhs = values[node.lhs];
+        auto& rhs = values[node.rhs];
+        if (node.handler == nullptr || node.lhs_kind != lhs.kind() || node.rhs_kind != rhs.kind()) {
+            node.handler = binary_handler(node.op, lhs.kind(), rhs.kind());
+            if (node.handler == nullptr) {
+                throw InvalidOperate(node.op, lhs.kind(), rhs.kind());
+            }
+            node.lhs_kind = lhs.kind();
+            node.rhs_kind = rhs.kind();
+        }
+        return node.handler(lhs, rhs);
+    }
+    case Node::Kind::Opaque:
+        return Evaluator(context).eval(*node.expression);
+    }
+    return Value();
+}
+
+std::vector<Value> ExpressionDAG::evaluate(Context& context)
+{
+    // operands are always added before the nodes using them
+    std::vector<Value> values(m_nodes.size());
+    for (size_t i = 0; i < m_nodes.size(); ++i) {
+        values[i] = evaluate(m_nodes[i], context, values);
+    }
+
+    std::vector<Value> results;
+    results.reserve(m_outputs.size());
+    for (auto output : m_outputs) {
+        results.push_back(values[output]);
+    }
+    return results;
+}
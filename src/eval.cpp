@@ -5,6 +5,13 @@
 #include <memory>
 #include <ostream>
 #include <sstream>
+#include <type_traits>
+
+#ifdef EXPR_PROFILE
+#define PROFILE_SCOPE(node) ProfileScope profile_scope(m_profiler, node)
+#else
+#define PROFILE_SCOPE(node)
+#endif
 
 std::string Stack::inspect()
 {
@@ -37,11 +44,13 @@ Value Evaluator::eval()
         }
     }
 
-    return Value(std::make_shared<Undefined>());
+    return Value();
 }
 
 ControlFlow Evaluator::eval(Statement& statement)
 {
+    PROFILE_SCOPE(statement);
+
     switch (statement.kind()) {
     case ASTNode::Kind::LetStmt:
         return eval(dynamic_cast<LetStatement&>(statement));
@@ -70,7 +79,7 @@ ControlFlow Evaluator::eval(Statement& statement)
 ControlFlow Evaluator::eval(ReturnStatement& statement)
 {
     auto value = statement.value() ? eval(*statement.value())
-                                   : Value(std::make_shared<Undefined>());
+                                   : Value();
     return ControlFlow(ControlFlow::Kind::Return, value);
 }
 
@@ -80,7 +89,7 @@ ControlFlow Evaluator::eval(LetStatement& statement)
         this->m_context.insert_variable(statement.name(), eval(*statement.value()));
     } else {
         this->m_context.insert_variable(statement.name(),
-            Value(std::make_shared<Undefined>()));
+            Value());
     }
 
     return ControlFlow(ControlFlow::Kind::None);
@@ -137,15 +146,13 @@ ControlFlow Evaluator::eval(ForStatement& statement)
 
 ControlFlow Evaluator::eval(BlockStatement& statement)
 {
-    m_context.enter_scope();
+    ContextScope scope(m_context);
     for (auto& stmt : statement.statements()) {
         auto control_flow = eval(*stmt);
         if (control_flow.kind() != ControlFlow::Kind::None) {
-            m_context.level_scope();
             return control_flow;
         }
     }
-    m_context.level_scope();
 
     return ControlFlow(ControlFlow::Kind::None);
 }
@@ -158,6 +165,8 @@ ControlFlow Evaluator::eval(ExpressionStatement& statement)
 
 Value Evaluator::eval(Expression& expression)
 {
+    PROFILE_SCOPE(expression);
+
     switch (expression.kind()) {
     case ASTNode::Kind::LiteralExpr:
         return eval(dynamic_cast<LiteralExpression&>(expression));
@@ -171,6 +180,14 @@ Value Evaluator::eval(Expression& expression)
         return eval(dynamic_cast<PostfixExpression&>(expression));
     case ASTNode::Kind::CallExpr:
         return eval(dynamic_cast<CallExpression&>(expression));
+    case ASTNode::Kind::ArrayExpr:
+        return eval(dynamic_cast<ArrayExpression&>(expression));
+    case ASTNode::Kind::IndexExpr:
+        return eval(dynamic_cast<IndexExpression&>(expression));
+    case ASTNode::Kind::ObjectExpr:
+        return eval(dynamic_cast<ObjectExpression&>(expression));
+    case ASTNode::Kind::AccessExpr:
+        return eval(dynamic_cast<AccessExpression&>(expression));
     default:
         throw std::runtime_error(std::format("unimplemented for eval: {}",
             ASTInspector::inspect(expression)));
@@ -199,7 +216,7 @@ Value Evaluator::eval(LiteralExpression& literal)
     }
     case LiteralKind::String: {
         StringLiteral& string_lit = dynamic_cast<StringLiteral&>(literal);
-        return Value(string_lit.value());
+        return Value(string_lit.constant());
     }
     default:
         throw std::runtime_error("Invalid literal kind");
@@ -211,62 +228,206 @@ Value Evaluator::eval(VariableExpression& expression)
     return m_context.get_variable(expression.name());
 }
 
-Value Evaluator::eval(BinaryExpression& expression)
+template <Operator op>
+static bool holds(Comparison result)
 {
-    auto lhs = eval(expression.left());
-    auto rhs = eval(expression.right());
+    if constexpr (op == Operator::Equals) {
+        return result == Comparison::Equal;
+    } else if constexpr (op == Operator::NotEquals) {
+        return result != Comparison::Equal;
+    } else if constexpr (op == Operator::GreaterThan) {
+        return result == Comparison::Greater;
+    } else if constexpr (op == Operator::GreaterThanOrEqual) {
+        return result == Comparison::Equal || result == Comparison::Greater;
+    } else if constexpr (op == Operator::LessThan) {
+        return result == Comparison::Less;
+    } else {
+        return result == Comparison::Equal || result == Comparison::Less;
+    }
+}
 
-    switch (expression.op()) {
-    case Operator::Add:
+// Handlers for the inline caches of binary operator sites. The generic ones
+// go through Object like before but no longer switch on the operator; the
+// numeric ones also skip the virtual calls for the kinds they were made for.
+template <Operator op>
+static Value generic_binary(const Value& lhs, const Value& rhs)
+{
+    if constexpr (op == Operator::Add) {
         return lhs.obj()->add(rhs);
-    case Operator::Subtract:
+    } else if constexpr (op == Operator::Subtract) {
         return lhs.obj()->sub(rhs);
-    case Operator::Multiply:
+    } else if constexpr (op == Operator::Multiply) {
         return lhs.obj()->mul(rhs);
-    case Operator::Divide:
+    } else if constexpr (op == Operator::Divide) {
         return lhs.obj()->div(rhs);
-    case Operator::Modulo:
+    } else if constexpr (op == Operator::Modulo) {
         return lhs.obj()->mod(rhs);
-    case Operator::Equals: {
-        auto result = lhs.obj()->compare(rhs);
-        return Value(result == Comparison::Equal);
-    }
-    case Operator::NotEquals: {
-        auto result = lhs.obj()->compare(rhs);
-        return Value(result != Comparison::Equal);
-    }
-    case Operator::GreaterThan: {
-        auto result = lhs.obj()->compare(rhs);
-        return Value(result == Comparison::Greater);
-    }
-    case Operator::GreaterThanOrEqual: {
-        auto result = lhs.obj()->compare(rhs);
-        return Value(result == Comparison::Equal || result == Comparison::Greater);
-    }
-    case Operator::LessThan: {
-        auto result = lhs.obj()->compare(rhs);
-        return Value(result == Comparison::Less);
-    }
-    case Operator::LessThanOrEqual: {
-        auto result = lhs.obj()->compare(rhs);
-        return Value(result == Comparison::Equal || result == Comparison::Less);
-    }
-    case Operator::Assign: {
-        switch (expression.left().kind()) {
-        case ASTNode::Kind::VariableExpr: {
-            auto variable = dynamic_cast<VariableExpression&>(expression.left());
-            this->m_context.set_variable(variable.name(), rhs);
-            return rhs;
+    } else {
+        return Value(holds<op>(lhs.obj()->compare(rhs)));
+    }
+}
+
+// the cache already checked the kind, so no dynamic cast is needed
+template <typename T>
+static T number(const Value& value)
+{
+    if constexpr (std::is_same_v<T, int64_t>) {
+        return static_cast<Integer*>(value.get())->value();
+    } else {
+        return static_cast<Float*>(value.get())->value();
+    }
+}
+
+// same results as Integer and Float, which promote to double when either
+// side is a float
+template <Operator op, typename L, typename R>
+static Value numeric_binary(const Value& lhs, const Value& rhs)
+{
+    using T = std::conditional_t<std::is_same_v<L, double> || std::is_same_v<R, double>, double, int64_t>;
+    auto l = number<L>(lhs);
+    auto r = number<R>(rhs);
+
+    if constexpr (op == Operator::Add) {
+        return Value(T(l) + T(r));
+    } else if constexpr (op == Operator::Subtract) {
+        return Value(T(l) - T(r));
+    } else if constexpr (op == Operator::Multiply) {
+        return Value(T(l) * T(r));
+    } else if constexpr (op == Operator::Divide) {
+        return Value(T(l) / T(r));
+    } else {
+        auto result = l == r ? Comparison::Equal : (l > r ? Comparison::Greater : Comparison::Less);
+        return Value(holds<op>(result));
+    }
+}
+
+template <Operator op>
+static BinaryCache::Handler binary_handler(ValueKind lhs, ValueKind rhs)
+{
+    // integer division and modulo keep the checks of Integer
+    if constexpr (op != Operator::Modulo) {
+        if (lhs == ValueKind::Integer && rhs == ValueKind::Integer && op != Operator::Divide) {
+            return numeric_binary<op, int64_t, int64_t>;
         }
-        default:
-            throw InvalidOperate(
-                std::format("Invalid assignment target, {}",
-                    ASTInspector::inspect(expression.left())));
+        if (lhs == ValueKind::Float && rhs == ValueKind::Float) {
+            return numeric_binary<op, double, double>;
+        }
+        if (lhs == ValueKind::Integer && rhs == ValueKind::Float) {
+            return numeric_binary<op, int64_t, double>;
+        }
+        if (lhs == ValueKind::Float && rhs == ValueKind::Integer) {
+            return numeric_binary<op, double, int64_t>;
         }
     }
+    return generic_binary<op>;
+}
+
+BinaryCache::Handler binary_handler(Operator op, ValueKind lhs, ValueKind rhs)
+{
+    switch (op) {
+    case Operator::Add:
+        return binary_handler<Operator::Add>(lhs, rhs);
+    case Operator::Subtract:
+        return binary_handler<Operator::Subtract>(lhs, rhs);
+    case Operator::Multiply:
+        return binary_handler<Operator::Multiply>(lhs, rhs);
+    case Operator::Divide:
+        return binary_handler<Operator::Divide>(lhs, rhs);
+    case Operator::Modulo:
+        return binary_handler<Operator::Modulo>(lhs, rhs);
+    case Operator::Equals:
+        return binary_handler<Operator::Equals>(lhs, rhs);
+    case Operator::NotEquals:
+        return binary_handler<Operator::NotEquals>(lhs, rhs);
+    case Operator::GreaterThan:
+        return binary_handler<Operator::GreaterThan>(lhs, rhs);
+    case Operator::GreaterThanOrEqual:
+        return binary_handler<Operator::GreaterThanOrEqual>(lhs, rhs);
+    case Operator::LessThan:
+        return binary_handler<Operator::LessThan>(lhs, rhs);
+    case Operator::LessThanOrEqual:
+        return binary_handler<Operator::LessThanOrEqual>(lhs, rhs);
     default:
+        return nullptr;
+    }
+}
+
+Value Evaluator::eval(BinaryExpression& expression)
+{
+    if (expression.op() == Operator::Assign) {
+        return eval_assign(expression);
+    }
+
+    auto lhs = eval(expression.left());
+    auto rhs = eval(expression.right());
+
+    auto& cache = expression.cache();
+    for (size_t i = 0; i < cache.size; ++i) {
+        auto& entry = cache.entries[i];
+        if (entry.lhs == lhs.kind() && entry.rhs == rhs.kind()) {
+            cache.hits++;
+            return entry.handler(lhs, rhs);
+        }
+    }
+
+    cache.misses++;
+    auto handler = binary_handler(expression.op(), lhs.kind(), rhs.kind());
+    if (handler == nullptr) {
         throw InvalidOperate(expression.op(), lhs.kind(), rhs.kind());
     }
+    if (cache.size < BinaryCache::capacity) {
+        cache.entries[cache.size++] = { lhs.kind(), rhs.kind(), handler };
+    }
+
+    return handler(lhs, rhs);
+}
+
+Value Evaluator::eval_assign(BinaryExpression& expression)
+{
+    auto rhs = eval(expression.right());
+
+    switch (expression.left().kind()) {
+    case ASTNode::Kind::VariableExpr: {
+        auto& variable = dynamic_cast<VariableExpression&>(expression.left());
+        this->m_context.set_variable(variable.name(), rhs);
+        return rhs;
+    }
+    case ASTNode::Kind::IndexExpr: {
+        auto& target = dynamic_cast<IndexExpression&>(expression.left());
+        auto object = eval(target.object());
+        auto index = eval(target.index());
+        object.obj()->set_index(index, rhs);
+        return rhs;
+    }
+    case ASTNode::Kind::AccessExpr: {
+        auto& target = dynamic_cast<AccessExpression&>(expression.left());
+        auto object = eval(target.object());
+        if (object.kind() != ValueKind::Object) {
+            object.obj()->set_attr(target.name(), rhs);
+            return rhs;
+        }
+
+        auto& record = object.as_shaped();
+        auto& cache = target.cache();
+        if (record.shape() == cache.shape) {
+            cache.hits++;
+            record.store(cache.slot, rhs);
+            return rhs;
+        }
+
+        cache.misses++;
+        record.set_attr(target.name(), rhs);
+        if (record.shape()->cacheable()) {
+            cache.shape = record.shape();
+            cache.slot = record.shape()->lookup(target.name()).value();
+        }
+        return rhs;
+    }
+    default:
+        throw InvalidOperate(
+            std::format("Invalid assignment target, {}",
+                ASTInspector::inspect(expression.left())));
+    }
 }
 
 Value Evaluator::eval(PrefixExpression& expression)
@@ -308,9 +469,10 @@ Value Evaluator::eval(PostfixExpression& expression)
     case Operator::Increase: {
         switch (value.kind()) {
         case ValueKind::Integer: {
-            auto variable = dynamic_cast<VariableExpression&>(expression.expr());
-            value.as_integer() = value.as_integer() + 1;
-            return value;
+            auto& variable = dynamic_cast<VariableExpression&>(expression.expr());
+            auto result = Value(value.as_integer() + 1);
+            m_context.set_variable(variable.name(), result);
+            return result;
         }
         default:
             throw InvalidOperate(expression.op(), value.kind());
@@ -319,9 +481,10 @@ Value Evaluator::eval(PostfixExpression& expression)
     case Operator::Decrease: {
         switch (value.kind()) {
         case ValueKind::Integer: {
-            auto variable = dynamic_cast<VariableExpression&>(expression.expr());
-            value.as_integer() = value.as_integer() - 1;
-            return value;
+            auto& variable = dynamic_cast<VariableExpression&>(expression.expr());
+            auto result = Value(value.as_integer() - 1);
+            m_context.set_variable(variable.name(), result);
+            return result;
         }
         default:
             throw InvalidOperate(expression.op(), value.kind());
@@ -348,13 +511,12 @@ Value Evaluator::eval(CallExpression& expression)
         return eval_call(*fn_stmt, args);
     }
     case ValueKind::NativeFunction: {
-        
         std::vector<Value> args;
         for (auto& arg : expression.args()) {
             args.push_back(eval(*arg));
         }
 
-        return eval_call(*callee.obj(), args[0]);
+        return callee.obj()->call(args);
     }
 
     default:
@@ -362,23 +524,114 @@ Value Evaluator::eval(CallExpression& expression)
     }
 }
 
+Value Evaluator::eval(ArrayExpression& expression)
+{
+    std::vector<Value> elements;
+    elements.reserve(expression.elements().size());
+    for (auto& element : expression.elements()) {
+        elements.push_back(eval(*element));
+    }
+
+    return Value(make_object<Array>(ValueKind::Array, std::move(elements)));
+}
+
+Value Evaluator::eval(IndexExpression& expression)
+{
+    auto object = eval(expression.object());
+    auto index = eval(expression.index());
+
+    return object.obj()->index(index);
+}
+
+Value Evaluator::eval(ObjectExpression& expression)
+{
+    auto& shape = expression.shape();
+    if (shape == nullptr) {
+        auto resolved = Shape::root();
+        for (auto& key : expression.keys()) {
+            resolved = resolved->transition(key);
+        }
+        shape = resolved;
+    }
+
+    std::vector<Value> slots;
+    slots.reserve(expression.values().size());
+    for (auto& value : expression.values()) {
+        slots.push_back(eval(*value));
+    }
+
+    return Value(make_object<Record>(ValueKind::Object, shape, std::move(slots)));
+}
+
+Value Evaluator::eval(AccessExpression& expression)
+{
+    auto object = eval(expression.object());
+    if (object.kind() != ValueKind::Object) {
+        return object.obj()->get_attr(expression.name());
+    }
+
+    auto& record = object.as_shaped();
+    auto& cache = expression.cache();
+    if (record.shape() == cache.shape) {
+        cache.hits++;
+        return record.load(cache.slot);
+    }
+
+    cache.misses++;
+    auto value = record.get_attr(expression.name());
+
+    // get_attr may have moved the record to a new shape
+    auto slot = record.shape()->lookup(expression.name());
+    if (slot.has_value() && record.shape()->cacheable()) {
+        cache.shape = record.shape();
+        cache.slot = slot.value();
+    }
+
+    return value;
+}
+
 Value Evaluator::eval_call(FnStatement& fn, std::vector<Value>& args)
 {
     if (fn.params().size() != args.size()) {
         throw InvalidOperate(std::format("Invalid call for {}", ASTInspector::inspect(fn)));
     }
 
-    m_context.enter_scope();
+    if (!m_memo || !m_memo->pure(fn)) {
+        return invoke(fn, args);
+    }
 
-    // std::cout << m_context.stack().inspect() << std::endl;
+    auto memoized = m_memo->lookup(fn, args);
+    if (memoized) {
+        return *memoized;
+    }
+    auto result = invoke(fn, args);
+    m_memo->store(fn, args, result);
+    return result;
+}
 
-    for (size_t i = 0; i < fn.params().size(); ++i) {
-        m_context.insert_variable(fn.params()[i], args[i]);
+Value Evaluator::invoke(FnStatement& fn, std::vector<Value>& args)
+{
+    if (m_jit) {
+        auto result = m_jit->call(fn, args);
+        if (result) {
+            return *result;
+        }
     }
 
-    auto ret = eval(fn.body());
+    PROFILE_SCOPE(fn);
+
+    ControlFlow ret(ControlFlow::Kind::None);
+    {
+        ContextScope scope(m_context);
+
+        // std::cout << m_context.stack().inspect() << std::endl;
 
-    m_context.level_scope();
+        for (size_t i = 0; i < fn.params().size(); ++i) {
+            m_context.insert_variable(fn.params()[i], args[i]);
+        }
+
+        ret = eval(fn.body());
+    }
 
     if (ret.kind() == ControlFlow::Kind::Return) {
         return ret.value();
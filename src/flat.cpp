@@ -0,0 +1,272 @@
+#include "flat.h"
+#include "ast.h"
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <format>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+uint32_t FlatBuffer::add_node(FlatNode node)
+{
+    m_nodes.push_back(node);
+    return uint32_t(m_nodes.size() - 1);
+}
+
+uint32_t FlatBuffer::add_list(const std::vector<uint32_t>& items)
+{
+    auto offset = uint32_t(m_lists.size());
+    m_lists.insert(m_lists.end(), items.begin(), items.end());
+    return offset;
+}
+
+uint32_t FlatBuffer::add_constant(uint64_t bits)
+{
+    m_constants.push_back(bits);
+    return uint32_t(m_constants.size() - 1);
+}
+
+uint32_t FlatBuffer::intern(std::string_view text)
+{
+    auto found = m_interned.find(std::string(text));
+    if (found != m_interned.end()) {
+        return found->second;
+    }
+
+    auto index = uint32_t(m_strings.size());
+    m_strings.push_back(FlatString { uint32_t(m_chars.size()), uint32_t(text.size()) });
+    m_chars.append(text);
+    m_interned.insert({ std::string(text), index });
+
+    return index;
+}
+
+FlatProgram FlatBuffer::view() const
+{
+    FlatProgram program;
+    program.nodes = m_nodes;
+    program.lists = m_lists;
+    program.constants = m_constants;
+    program.strings = m_strings;
+    program.chars = m_chars;
+    program.functions = m_functions;
+    program.statements = m_statements;
+    program.statement_count = m_statement_count;
+    program.access_sites = m_access_sites;
+    program.object_sites = m_object_sites;
+    return program;
+}
+
+class Flattener {
+public:
+    explicit Flattener(FlatBuffer& buffer)
+        : m_buffer(buffer)
+    {
+    }
+
+    uint32_t statement(Statement& statement);
+    uint32_t expression(Expression& expression);
+    void function(FnStatement& fn);
+
+private:
+    uint32_t node(ASTNode::Kind kind, uint8_t op = 0, uint32_t a = FLAT_NONE,
+        uint32_t b = FLAT_NONE, uint32_t c = FLAT_NONE)
+    {
+        return m_buffer.add_node(FlatNode { uint8_t(kind), op, 0, a, b, c });
+    }
+
+    uint32_t literal(LiteralExpression& literal);
+
+    FlatBuffer& m_buffer;
+};
+
+uint32_t Flattener::statement(Statement& statement)
+{
+    switch (statement.kind()) {
+    case ASTNode::Kind::LetStmt: {
+        auto& let = dynamic_cast<LetStatement&>(statement);
+        auto value = let.value() ? expression(*let.value()) : FLAT_NONE;
+        return node(ASTNode::Kind::LetStmt, 0, m_buffer.intern(let.name()), value);
+    }
+    case ASTNode::Kind::IfStmt: {
+        auto& if_stmt = dynamic_cast<IfStatement&>(statement);
+        auto condition = expression(if_stmt.condition());
+        auto then_branch = this->statement(if_stmt.then_branch());
+        auto else_branch = if_stmt.else_branch() ? this->statement(*if_stmt.else_branch()) : FLAT_NONE;
+        return node(ASTNode::Kind::IfStmt, 0, condition, then_branch, else_branch);
+    }
+    case ASTNode::Kind::ForStmt: {
+        auto& for_stmt = dynamic_cast<ForStatement&>(statement);
+        std::vector<uint32_t> parts = {
+            for_stmt.initializer() ? this->statement(*for_stmt.initializer()) : FLAT_NONE,
+            for_stmt.condition() ? expression(*for_stmt.condition()) : FLAT_NONE,
+            for_stmt.increment() ? expression(*for_stmt.increment()) : FLAT_NONE,
+            this->statement(for_stmt.body()),
+        };
+        return node(ASTNode::Kind::ForStmt, 0, m_buffer.add_list(parts));
+    }
+    case ASTNode::Kind::BlockStmt: {
+        auto& block = dynamic_cast<BlockStatement&>(statement);
+        std::vector<uint32_t> statements;
+        for (auto& stmt : block.statements()) {
+            statements.push_back(this->statement(*stmt));
+        }
+        return node(ASTNode::Kind::BlockStmt, 0, m_buffer.add_list(statements),
+            uint32_t(statements.size()));
+    }
+    case ASTNode::Kind::ReturnStmt: {
+        auto& ret = dynamic_cast<ReturnStatement&>(statement);
+        return node(ASTNode::Kind::ReturnStmt, 0, ret.value() ? expression(*ret.value()) : FLAT_NONE);
+    }
+    case ASTNode::Kind::ExprStmt: {
+        auto& expr = dynamic_cast<ExpressionStatement&>(statement);
+        return node(ASTNode::Kind::ExprStmt, 0, expression(expr.expr()));
+    }
+    case ASTNode::Kind::BreakStmt:
+    case ASTNode::Kind::ContinueStmt:
+    case ASTNode::Kind::EmptyStmt:
+        return node(statement.kind());
+    default:
+        throw std::runtime_error(std::format("cannot flatten {}",
+            ASTInspector::inspect(statement)));
+    }
+}
+
+uint32_t Flattener::literal(LiteralExpression& literal)
+{
+    auto kind = uint8_t(literal.literal_kind());
+
+    switch (literal.literal_kind()) {
+    case LiteralKind::Undefined:
+        return node(ASTNode::Kind::LiteralExpr, kind);
+    case LiteralKind::Boolean: {
+        auto value = dynamic_cast<BooleanLiteral&>(literal).value();
+        return node(ASTNode::Kind::LiteralExpr, kind, m_buffer.add_constant(value ? 1 : 0));
+    }
+    case LiteralKind::Integer: {
+        auto value = dynamic_cast<IntegerLiteral&>(literal).value();
+        return node(ASTNode::Kind::LiteralExpr, kind, m_buffer.add_constant(uint64_t(value)));
+    }
+    case LiteralKind::Float: {
+        auto value = dynamic_cast<FloatLiteral&>(literal).value();
+        return node(ASTNode::Kind::LiteralExpr, kind,
+            m_buffer.add_constant(std::bit_cast<uint64_t>(value)));
+    }
+    case LiteralKind::String: {
+        auto& value = dynamic_cast<StringLiteral&>(literal).value();
+        return node(ASTNode::Kind::LiteralExpr, kind, m_buffer.intern(value));
+    }
+    default:
+        throw std::runtime_error("Invalid literal kind");
+    }
+}
+
+uint32_t Flattener::expression(Expression& expression)
+{
+    switch (expression.kind()) {
+    case ASTNode::Kind::LiteralExpr:
+        return literal(dynamic_cast<LiteralExpression&>(expression));
+    case ASTNode::Kind::VariableExpr: {
+        auto& variable = dynamic_cast<VariableExpression&>(expression);
+        return node(ASTNode::Kind::VariableExpr, 0, m_buffer.intern(variable.name()));
+    }
+    case ASTNode::Kind::BinaryExpr: {
+        auto& binary = dynamic_cast<BinaryExpression&>(expression);
+        auto left = this->expression(binary.left());
+        auto right = this->expression(binary.right());
+        return node(ASTNode::Kind::BinaryExpr, uint8_t(binary.op()), left, right);
+    }
+    case ASTNode::Kind::PrefixExpr: {
+        auto& prefix = dynamic_cast<PrefixExpression&>(expression);
+        return node(ASTNode::Kind::PrefixExpr, uint8_t(prefix.op()), this->expression(prefix.expr()));
+    }
+    case ASTNode::Kind::PostfixExpr: {
+        auto& postfix = dynamic_cast<PostfixExpression&>(expression);
+        return node(ASTNode::Kind::PostfixExpr, uint8_t(postfix.op()), this->expression(postfix.expr()));
+    }
+    case ASTNode::Kind::IndexExpr: {
+        auto& index = dynamic_cast<IndexExpression&>(expression);
+        auto object = this->expression(index.object());
+        auto key = this->expression(index.index());
+        return node(ASTNode::Kind::IndexExpr, 0, object, key);
+    }
+    case ASTNode::Kind::CallExpr: {
+        auto& call = dynamic_cast<CallExpression&>(expression);
+        auto callee = this->expression(call.callee());
+        std::vector<uint32_t> args;
+        for (auto& arg : call.args()) {
+            args.push_back(this->expression(*arg));
+        }
+        return node(ASTNode::Kind::CallExpr, 0, callee, m_buffer.add_list(args), uint32_t(args.size()));
+    }
+    case ASTNode::Kind::AccessExpr: {
+        auto& access = dynamic_cast<AccessExpression&>(expression);
+        auto object = this->expression(access.object());
+        return node(ASTNode::Kind::AccessExpr, 0, object, m_buffer.intern(access.name()),
+            m_buffer.next_access_site());
+    }
+    case ASTNode::Kind::ArrayExpr: {
+        auto& array = dynamic_cast<ArrayExpression&>(expression);
+        std::vector<uint32_t> elements;
+        for (auto& element : array.elements()) {
+            elements.push_back(this->expression(*element));
+        }
+        return node(ASTNode::Kind::ArrayExpr, 0, m_buffer.add_list(elements), uint32_t(elements.size()));
+    }
+    case ASTNode::Kind::ObjectExpr: {
+        auto& object = dynamic_cast<ObjectExpression&>(expression);
+        std::vector<uint32_t> items;
+        for (auto& key : object.keys()) {
+            items.push_back(m_buffer.intern(key));
+        }
+        for (auto& value : object.values()) {
+            items.push_back(this->expression(*value));
+        }
+        return node(ASTNode::Kind::ObjectExpr, 0, m_buffer.add_list(items),
+            uint32_t(object.keys().size()), m_buffer.next_object_site());
+    }
+    default:
+        throw std::runtime_error(std::format("cannot flatten {}",
+            ASTInspector::inspect(expression)));
+    }
+}
+
+void Flattener::function(FnStatement& fn)
+{
+    std::vector<uint32_t> params;
+    for (auto& param : fn.params()) {
+        params.push_back(m_buffer.intern(param));
+    }
+
+    auto name = m_buffer.intern(fn.name());
+    auto params_list = m_buffer.add_list(params);
+    auto body = statement(fn.body());
+
+    m_buffer.add_function(FlatFunction { name, params_list, uint32_t(params.size()), body });
+}
+
+FlatBuffer flatten(Program& program)
+{
+    FlatBuffer buffer;
+    Flattener flattener(buffer);
+
+    // sorted so the same source always flattens to the same bytes
+    std::vector<std::string> names;
+    for (auto& [name, fn] : program.functions()) {
+        names.push_back(name);
+    }
+    std::sort(names.begin(), names.end());
+    for (auto& name : names) {
+        flattener.function(*program.functions()[name]);
+    }
+
+    std::vector<uint32_t> statements;
+    for (auto& stmt : program.statements()) {
+        statements.push_back(flattener.statement(*stmt));
+    }
+    buffer.set_statements(buffer.add_list(statements), uint32_t(statements.size()));
+
+    return buffer;
+}
@@ -0,0 +1,431 @@
+#include "flat.h"
+#include "alloc.h"
+#include "ast.h"
+#include "eval.h"
+#include <bit>
+#include <format>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+FlatEvaluator::FlatEvaluator(FlatProgram program, Context& context)
+    : m_program(program)
+    , m_context(context)
+    , m_access_caches(program.access_sites)
+    , m_object_shapes(program.object_sites, nullptr)
+    , m_literals(program.strings.size())
+{
+    m_names.reserve(m_program.strings.size());
+    for (uint32_t i = 0; i < m_program.strings.size(); ++i) {
+        m_names.emplace_back(m_program.string(i));
+    }
+
+    for (uint32_t i = 0; i < m_program.functions.size(); ++i) {
+        auto& name = m_names[m_program.functions[i].name];
+        m_functions.insert({ name, i });
+        m_context.insert_variable(name, Value(make_object<UserFunction>(ValueKind::UserFunction, name)));
+    }
+}
+
+Value FlatEvaluator::eval()
+{
+    for (uint32_t i = 0; i < m_program.statement_count; ++i) {
+        auto control_flow = exec(m_program.lists[m_program.statements + i]);
+        if (control_flow.kind() == ControlFlow::Kind::Return) {
+            return control_flow.value();
+        }
+    }
+
+    return Value();
+}
+
+ControlFlow FlatEvaluator::exec(uint32_t index)
+{
+    auto& node = m_program.nodes[index];
+
+    switch (node.node_kind()) {
+    case ASTNode::Kind::LetStmt:
+        m_context.insert_variable(m_names[node.a], node.b != FLAT_NONE ? eval(node.b) : Value());
+        return ControlFlow(ControlFlow::Kind::None);
+    case ASTNode::Kind::IfStmt: {
+        auto condition = eval(node.a);
+        if (condition.kind() != ValueKind::Boolean) {
+            throw InvalidOperate(Operator::Equals, ValueKind::Boolean,
+                condition.kind());
+        }
+
+        if (condition.as_boolean()) {
+            return exec(node.b);
+        } else if (node.c != FLAT_NONE) {
+            return exec(node.c);
+        }
+
+        return ControlFlow(ControlFlow::Kind::None);
+    }
+    case ASTNode::Kind::ForStmt:
+        return exec_for(node);
+    case ASTNode::Kind::BlockStmt:
+        return exec_block(node);
+    case ASTNode::Kind::BreakStmt:
+        return ControlFlow(ControlFlow::Kind::Break);
+    case ASTNode::Kind::ContinueStmt:
+        return ControlFlow(ControlFlow::Kind::Continue);
+    case ASTNode::Kind::EmptyStmt:
+        return ControlFlow(ControlFlow::Kind::None);
+    case ASTNode::Kind::ReturnStmt:
+        return ControlFlow(ControlFlow::Kind::Return, node.a != FLAT_NONE ? eval(node.a) : Value());
+    case ASTNode::Kind::ExprStmt:
+        eval(node.a);
+        return ControlFlow(ControlFlow::Kind::None);
+    default:
+        throw std::runtime_error(std::format("unimplemented exec for {}",
+            node_kind_str(node.node_kind())));
+    }
+}
+
+ControlFlow FlatEvaluator::exec_for(const FlatNode& node)
+{
+    auto initializer = m_program.lists[node.a];
+    auto condition = m_program.lists[node.a + 1];
+    auto increment = m_program.lists[node.a + 2];
+    auto body = m_program.lists[node.a + 3];
+
+    if (initializer != FLAT_NONE) {
+        exec(initializer);
+    }
+    while (true) {
+        if (condition != FLAT_NONE) {
+            auto value = eval(condition);
+            if (Boolean(true).compare(value) != Comparison::Equal) {
+                return ControlFlow(ControlFlow::Kind::None);
+            }
+        }
+
+        auto ctrl = exec(body);
+
+        switch (ctrl.kind()) {
+        case ControlFlow::Kind::Break:
+            return ControlFlow(ControlFlow::Kind::None);
+        case ControlFlow::Kind::Return:
+            return ctrl;
+        default:
+            break;
+        }
+
+        if (increment != FLAT_NONE) {
+            eval(increment);
+        }
+    }
+}
+
+ControlFlow FlatEvaluator::exec_block(const FlatNode& node)
+{
+    ContextScope scope(m_context);
+    for (uint32_t i = 0; i < node.b; ++i) {
+        auto control_flow = exec(m_program.lists[node.a + i]);
+        if (control_flow.kind() != ControlFlow::Kind::None) {
+            return control_flow;
+        }
+    }
+
+    return ControlFlow(ControlFlow::Kind::None);
+}
+
+Value FlatEvaluator::eval(uint32_t index)
+{
+    auto& node = m_program.nodes[index];
+
+    switch (node.node_kind()) {
+    case ASTNode::Kind::LiteralExpr:
+        return eval_literal(node);
+    case ASTNode::Kind::VariableExpr:
+        return m_context.get_variable(m_names[node.a]);
+    case ASTNode::Kind::BinaryExpr:
+        return eval_binary(node);
+    case ASTNode::Kind::PrefixExpr:
+        return eval_prefix(node);
+    case ASTNode::Kind::PostfixExpr:
+        return eval_postfix(node);
+    case ASTNode::Kind::CallExpr:
+        return eval_call(node);
+    case ASTNode::Kind::ArrayExpr:
+        return eval_array(node);
+    case ASTNode::Kind::IndexExpr: {
+        auto object = eval(node.a);
+        auto key = eval(node.b);
+        return object.obj()->index(key);
+    }
+    case ASTNode::Kind::ObjectExpr:
+        return eval_object(node);
+    case ASTNode::Kind::AccessExpr:
+        return eval_access(node);
+    default:
+        throw std::runtime_error(std::format("unimplemented for eval: {}",
+            node_kind_str(node.node_kind())));
+    }
+}
+
+Value FlatEvaluator::eval_literal(const FlatNode& node)
+{
+    switch (LiteralKind(node.op)) {
+    case LiteralKind::Undefined:
+        return Value();
+    case LiteralKind::Boolean:
+        return Value(m_program.constants[node.a] != 0);
+    case LiteralKind::Integer:
+        return Value(int64_t(m_program.constants[node.a]));
+    case LiteralKind::Float:
+        return Value(std::bit_cast<double>(m_program.constants[node.a]));
+    case LiteralKind::String: {
+        auto& literal = m_literals[node.a];
+        if (!literal) {
+            literal = std::static_pointer_cast<String>(Value(m_names[node.a]).obj());
+        }
+        return Value(literal);
+    }
+    default:
+        throw std::runtime_error("Invalid literal kind");
+    }
+}
+
+Value FlatEvaluator::eval_binary(const FlatNode& node)
+{
+    auto op = Operator(node.op);
+    if (op == Operator::Assign) {
+        return eval_assign(node);
+    }
+
+    auto lhs = eval(node.a);
+    auto rhs = eval(node.b);
+
+    switch (op) {
+    case Operator::Add:
+        return lhs.obj()->add(rhs);
+    case Operator::Subtract:
+        return lhs.obj()->sub(rhs);
+    case Operator::Multiply:
+        return lhs.obj()->mul(rhs);
+    case Operator::Divide:
+        return lhs.obj()->div(rhs);
+    case Operator::Modulo:
+        return lhs.obj()->mod(rhs);
+    case Operator::Equals:
+        return Value(lhs.obj()->compare(rhs) == Comparison::Equal);
+    case Operator::NotEquals:
+        return Value(lhs.obj()->compare(rhs) != Comparison::Equal);
+    case Operator::GreaterThan:
+        return Value(lhs.obj()->compare(rhs) == Comparison::Greater);
+    case Operator::GreaterThanOrEqual:
+        return Value(lhs.obj()->compare(rhs) != Comparison::Less);
+    case Operator::LessThan:
+        return Value(lhs.obj()->compare(rhs) == Comparison::Less);
+    case Operator::LessThanOrEqual:
+        return Value(lhs.obj()->compare(rhs) != Comparison::Greater);
+    default:
+        throw InvalidOperate(op, lhs.kind(), rhs.kind());
+    }
+}
+
+Value FlatEvaluator::eval_assign(const FlatNode& node)
+{
+    auto rhs = eval(node.b);
+    auto& target = m_program.nodes[node.a];
+
+    switch (target.node_kind()) {
+    case ASTNode::Kind::VariableExpr:
+        m_context.set_variable(m_names[target.a], rhs);
+        return rhs;
+    case ASTNode::Kind::IndexExpr: {
+        auto object = eval(target.a);
+        auto index = eval(target.b);
+        object.obj()->set_index(index, rhs);
+        return rhs;
+    }
+    case ASTNode::Kind::AccessExpr: {
+        auto object = eval(target.a);
+        auto& name = m_names[target.b];
+        if (object.kind() != ValueKind::Object) {
+            object.obj()->set_attr(name, rhs);
+            return rhs;
+        }
+
+        auto& record = object.as_shaped();
+        auto& cache = m_access_caches[target.c];
+        if (record.shape() == cache.shape) {
+            cache.hits++;
+            record.store(cache.slot, rhs);
+            return rhs;
+        }
+
+        cache.misses++;
+        record.set_attr(name, rhs);
+        if (record.shape()->cacheable()) {
+            cache.shape = record.shape();
+            cache.slot = record.shape()->lookup(name).value();
+        }
+        return rhs;
+    }
+    default:
+        throw InvalidOperate(std::format("Invalid assignment target, {}",
+            node_kind_str(target.node_kind())));
+    }
+}
+
+Value FlatEvaluator::eval_prefix(const FlatNode& node)
+{
+    auto op = Operator(node.op);
+    auto value = eval(node.a);
+
+    switch (op) {
+    case Operator::Subtract:
+        switch (value.kind()) {
+        case ValueKind::Integer:
+            return Value(-(value.as_integer()));
+        case ValueKind::Float:
+            return Value(-(value.as_float()));
+        default:
+            throw InvalidOperate(op, value.kind());
+        }
+    case Operator::Not:
+        if (value.kind() == ValueKind::Boolean) {
+            return Value(!(value.as_boolean()));
+        }
+        throw InvalidOperate(op, value.kind());
+    default:
+        throw InvalidOperate(op, value.kind());
+    }
+}
+
+Value FlatEvaluator::eval_postfix(const FlatNode& node)
+{
+    auto op = Operator(node.op);
+    auto value = eval(node.a);
+
+    if (value.kind() != ValueKind::Integer) {
+        throw InvalidOperate(op, value.kind());
+    }
+
+    auto& target = m_program.nodes[node.a];
+    if (target.node_kind() != ASTNode::Kind::VariableExpr) {
+        throw InvalidOperate(op, value.kind());
+    }
+
+    Value result;
+    switch (op) {
+    case Operator::Increase:
+        result = Value(value.as_integer() + 1);
+        break;
+    case Operator::Decrease:
+        result = Value(value.as_integer() - 1);
+        break;
+    default:
+        throw InvalidOperate(op, value.kind());
+    }
+    m_context.set_variable(m_names[target.a], result);
+    return result;
+}
+
+Value FlatEvaluator::eval_call(const FlatNode& node)
+{
+    auto callee = eval(node.a);
+
+    std::vector<Value> args;
+    args.reserve(node.c);
+    for (uint32_t i = 0; i < node.c; ++i) {
+        args.push_back(eval(m_program.lists[node.b + i]));
+    }
+
+    switch (callee.kind()) {
+    case ValueKind::UserFunction: {
+        auto found = m_functions.find(callee.as_user_function().name());
+        if (found == m_functions.end()) {
+            throw std::runtime_error("Function not found");
+        }
+        return call_function(m_program.functions[found->second], args);
+    }
+    case ValueKind::NativeFunction:
+        return callee.obj()->call(args);
+    default:
+        throw InvalidOperate(std::format("Invalid call for {}", callee.inspect()));
+    }
+}
+
+Value FlatEvaluator::call_function(const FlatFunction& fn, std::vector<Value>& args)
+{
+    if (fn.param_count != args.size()) {
+        throw InvalidOperate(std::format("Invalid call for {}", m_names[fn.name]));
+    }
+
+    ControlFlow ret(ControlFlow::Kind::None);
+    {
+        ContextScope scope(m_context);
+        for (uint32_t i = 0; i < fn.param_count; ++i) {
+            m_context.insert_variable(m_names[m_program.lists[fn.params + i]], args[i]);
+        }
+        ret = exec(fn.body);
+    }
+
+    if (ret.kind() == ControlFlow::Kind::Return) {
+        return ret.value();
+    }
+
+    return Value();
+}
+
+Value FlatEvaluator::eval_array(const FlatNode& node)
+{
+    std::vector<Value> elements;
+    elements.reserve(node.b);
+    for (uint32_t i = 0; i < node.b; ++i) {
+        elements.push_back(eval(m_program.lists[node.a + i]));
+    }
+
+    return Value(make_object<Array>(ValueKind::Array, std::move(elements)));
+}
+
+Value FlatEvaluator::eval_object(const FlatNode& node)
+{
+    auto& shape = m_object_shapes[node.c];
+    if (shape == nullptr) {
+        auto resolved = Shape::root();
+        for (uint32_t i = 0; i < node.b; ++i) {
+            resolved = resolved->transition(m_names[m_program.lists[node.a + i]]);
+        }
+        shape = resolved;
+    }
+
+    std::vector<Value> slots;
+    slots.reserve(node.b);
+    for (uint32_t i = 0; i < node.b; ++i) {
+        slots.push_back(eval(m_program.lists[node.a + node.b + i]));
+    }
+
+    return Value(make_object<Record>(ValueKind::Object, shape, std::move(slots)));
+}
+
+Value FlatEvaluator::eval_access(const FlatNode& node)
+{
+    auto object = eval(node.a);
+    auto& name = m_names[node.b];
+    if (object.kind() != ValueKind::Object) {
+        return object.obj()->get_attr(name);
+    }
+
+    auto& record = object.as_shaped();
+    auto& cache = m_access_caches[node.c];
+    if (record.shape() == cache.shape) {
+        cache.hits++;
+        return record.load(cache.slot);
+    }
+
+    cache.misses++;
+    auto value = record.get_attr(name);
+
+    auto slot = record.shape()->lookup(name);
+    if (slot.has_value() && record.shape()->cacheable()) {
+        cache.shape = record.shape();
+        cache.slot = slot.value();
+    }
+
+    return value;
+}
@@ -0,0 +1,331 @@
+#include "image.h"
+#include "ast.h"
+#include "flat.h"
+#include <cstring>
+#include <format>
+#include <fstream>
+#include <span>
+#include <string>
+#include <string_view>
+
+static size_t padded(size_t size)
+{
+    return (size + 7) & ~size_t(7);
+}
+
+uint64_t image_checksum(std::string_view data)
+{
+    // 64-bit multiply-xorshift over 8-byte words, then the tail bytes
+    constexpr uint64_t prime = 0x9E3779B97F4A7C15ull;
+    uint64_t hash = 0xCBF29CE484222325ull ^ data.size();
+
+    size_t i = 0;
+    for (; i + 8 <= data.size(); i += 8) {
+        uint64_t word;
+        std::memcpy(&word, data.data() + i, 8);
+        hash = (hash ^ word) * prime;
+        hash ^= hash >> 32;
+    }
+    for (; i < data.size(); ++i) {
+        hash = (hash ^ uint8_t(data[i])) * prime;
+    }
+
+    return hash ^ (hash >> 29);
+}
+
+template <typename T>
+static void append_section(std::string& payload, std::span<const T> items)
+{
+    payload.append(reinterpret_cast<const char*>(items.data()), items.size_bytes());
+    payload.resize(padded(payload.size()), '\0');
+}
+
+void write_image(const FlatProgram& program, std::ostream& out)
+{
+    std::string payload;
+    append_section(payload, program.nodes);
+    append_section(payload, program.lists);
+    append_section(payload, program.constants);
+    append_section(payload, program.strings);
+    append_section(payload, std::span<const char>(program.chars.data(), program.chars.size()));
+    append_section(payload, program.functions);
+
+    ImageHeader header {};
+    std::memcpy(header.magic, IMAGE_MAGIC, sizeof(IMAGE_MAGIC));
+    header.version = IMAGE_VERSION;
+    header.byte_order = IMAGE_BYTE_ORDER;
+    header.checksum = image_checksum(payload);
+    header.size = payload.size();
+    header.node_count = uint32_t(program.nodes.size());
+    header.list_count = uint32_t(program.lists.size());
+    header.constant_count = uint32_t(program.constants.size());
+    header.string_count = uint32_t(program.strings.size());
+    header.char_count = uint32_t(program.chars.size());
+    header.function_count = uint32_t(program.functions.size());
+    header.statements = program.statements;
+    header.statement_count = program.statement_count;
+    header.access_sites = program.access_sites;
+    header.object_sites = program.object_sites;
+
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    out.write(payload.data(), std::streamsize(payload.size()));
+}
+
+void write_image(const FlatProgram& program, const std::string& path)
+{
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    if (!out) {
+        throw ImageError(std::format("cannot write {}", path));
+    }
+
+    write_image(program, out);
+    if (!out) {
+        throw ImageError(std::format("cannot write {}", path));
+    }
+}
+
+template <typename T>
+static std::span<const T> read_section(std::string_view payload, size_t& offset, size_t count)
+{
+    auto bytes = count * sizeof(T);
+    if (offset + bytes > payload.size()) {
+        throw ImageError("truncated program image");
+    }
+
+    auto section = std::span<const T>(reinterpret_cast<const T*>(payload.data() + offset), count);
+    offset += padded(bytes);
+
+    return section;
+}
+
+// Checks every index a node or function holds, so a crafted image with a valid
+// checksum cannot make an evaluator read past a section. Children must come
+// before their parent, as flatten() emits them, which also rules out cycles.
+class ImageValidator {
+public:
+    ImageValidator(const FlatProgram& program, const std::string& path)
+        : m_program(program)
+        , m_path(path)
+    {
+    }
+
+    void check();
+
+private:
+    void check_node(uint32_t index);
+    void child(uint32_t parent, uint32_t index);
+    void optional_child(uint32_t parent, uint32_t index);
+    void list(uint32_t offset, size_t count);
+    void string(uint32_t index);
+    void below(uint32_t index, size_t count);
+
+    [[noreturn]] void fail(std::string_view what)
+    {
+        throw ImageError(std::format("{} has {} out of range", m_path, what));
+    }
+
+    const FlatProgram& m_program;
+    const std::string& m_path;
+};
+
+void ImageValidator::check()
+{
+    for (auto& string : m_program.strings) {
+        if (size_t(string.offset) + string.length > m_program.chars.size()) {
+            fail("a string");
+        }
+    }
+
+    if (size_t(m_program.statements) + m_program.statement_count > m_program.lists.size()) {
+        fail("statements");
+    }
+    for (uint32_t i = 0; i < m_program.statement_count; ++i) {
+        if (m_program.lists[m_program.statements + i] >= m_program.nodes.size()) {
+            fail("a statement");
+        }
+    }
+
+    for (auto& fn : m_program.functions) {
+        string(fn.name);
+        list(fn.params, fn.param_count);
+        for (uint32_t i = 0; i < fn.param_count; ++i) {
+            string(m_program.lists[fn.params + i]);
+        }
+        if (fn.body >= m_program.nodes.size()) {
+            fail("a function body");
+        }
+    }
+
+    for (uint32_t i = 0; i < m_program.nodes.size(); ++i) {
+        check_node(i);
+    }
+}
+
+void ImageValidator::check_node(uint32_t index)
+{
+    auto& node = m_program.nodes[index];
+
+    switch (node.node_kind()) {
+    case ASTNode::Kind::LetStmt:
+        string(node.a);
+        optional_child(index, node.b);
+        break;
+    case ASTNode::Kind::IfStmt:
+        child(index, node.a);
+        child(index, node.b);
+        optional_child(index, node.c);
+        break;
+    case ASTNode::Kind::ForStmt:
+        list(node.a, 4);
+        for (uint32_t i = 0; i < 3; ++i) {
+            optional_child(index, m_program.lists[node.a + i]);
+        }
+        child(index, m_program.lists[node.a + 3]);
+        break;
+    case ASTNode::Kind::BlockStmt:
+    case ASTNode::Kind::ArrayExpr:
+        list(node.a, node.b);
+        for (uint32_t i = 0; i < node.b; ++i) {
+            child(index, m_program.lists[node.a + i]);
+        }
+        break;
+    case ASTNode::Kind::ReturnStmt:
+        optional_child(index, node.a);
+        break;
+    case ASTNode::Kind::ExprStmt:
+    case ASTNode::Kind::PrefixExpr:
+    case ASTNode::Kind::PostfixExpr:
+        child(index, node.a);
+        break;
+    case ASTNode::Kind::BreakStmt:
+    case ASTNode::Kind::ContinueStmt:
+    case ASTNode::Kind::EmptyStmt:
+        break;
+    case ASTNode::Kind::BinaryExpr:
+    case ASTNode::Kind::IndexExpr:
+        child(index, node.a);
+        child(index, node.b);
+        break;
+    case ASTNode::Kind::VariableExpr:
+        string(node.a);
+        break;
+    case ASTNode::Kind::LiteralExpr:
+        switch (LiteralKind(node.op)) {
+        case LiteralKind::Undefined:
+            break;
+        case LiteralKind::Boolean:
+        case LiteralKind::Integer:
+        case LiteralKind::Float:
+            below(node.a, m_program.constants.size());
+            break;
+        case LiteralKind::String:
+            string(node.a);
+            break;
+        default:
+            fail("a literal kind");
+        }
+        break;
+    case ASTNode::Kind::CallExpr:
+        child(index, node.a);
+        list(node.b, node.c);
+        for (uint32_t i = 0; i < node.c; ++i) {
+            child(index, m_program.lists[node.b + i]);
+        }
+        break;
+    case ASTNode::Kind::AccessExpr:
+        child(index, node.a);
+        string(node.b);
+        below(node.c, m_program.access_sites);
+        break;
+    case ASTNode::Kind::ObjectExpr:
+        list(node.a, size_t(node.b) * 2);
+        for (uint32_t i = 0; i < node.b; ++i) {
+            string(m_program.lists[node.a + i]);
+            child(index, m_program.lists[node.a + node.b + i]);
+        }
+        below(node.c, m_program.object_sites);
+        break;
+    default:
+        fail("a node kind");
+    }
+}
+
+void ImageValidator::child(uint32_t parent, uint32_t index)
+{
+    if (index >= parent) {
+        fail("a node reference");
+    }
+}
+
+void ImageValidator::optional_child(uint32_t parent, uint32_t index)
+{
+    if (index != FLAT_NONE) {
+        child(parent, index);
+    }
+}
+
+void ImageValidator::list(uint32_t offset, size_t count)
+{
+    if (size_t(offset) + count > m_program.lists.size()) {
+        fail("a list");
+    }
+}
+
+void ImageValidator::string(uint32_t index)
+{
+    below(index, m_program.strings.size());
+}
+
+void ImageValidator::below(uint32_t index, size_t count)
+{
+    if (index >= count) {
+        fail("an index");
+    }
+}
+
+ProgramImage::ProgramImage(const std::string& path)
+    : m_file(path)
+{
+    auto data = m_file.view();
+    if (data.size() < sizeof(ImageHeader)) {
+        throw ImageError(std::format("{} is not a program image", path));
+    }
+
+    ImageHeader header;
+    std::memcpy(&header, data.data(), sizeof(header));
+
+    if (std::memcmp(header.magic, IMAGE_MAGIC, sizeof(IMAGE_MAGIC)) != 0) {
+        throw ImageError(std::format("{} is not a program image", path));
+    }
+    if (header.version != IMAGE_VERSION) {
+        throw ImageError(std::format("{} has image version {}, expected {}", path,
+            header.version, IMAGE_VERSION));
+    }
+    if (header.byte_order != IMAGE_BYTE_ORDER) {
+        throw ImageError(std::format("{} was written with a different byte order", path));
+    }
+
+    auto payload = data.substr(sizeof(ImageHeader));
+    if (payload.size() != header.size) {
+        throw ImageError(std::format("{} is truncated", path));
+    }
+    if (image_checksum(payload) != header.checksum) {
+        throw ImageError(std::format("{} failed its checksum", path));
+    }
+
+    size_t offset = 0;
+    m_program.nodes = read_section<FlatNode>(payload, offset, header.node_count);
+    m_program.lists = read_section<uint32_t>(payload, offset, header.list_count);
+    m_program.constants = read_section<uint64_t>(payload, offset, header.constant_count);
+    m_program.strings = read_section<FlatString>(payload, offset, header.string_count);
+    auto chars = read_section<char>(payload, offset, header.char_count);
+    m_program.chars = std::string_view(chars.data(), chars.size());
+    m_program.functions = read_section<FlatFunction>(payload, offset, header.function_count);
+
+    m_program.statements = header.statements;
+    m_program.statement_count = header.statement_count;
+    m_program.access_sites = header.access_sites;
+    m_program.object_sites = header.object_sites;
+
+    ImageValidator(m_program, path).check();
+}
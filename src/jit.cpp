@@ -0,0 +1,1016 @@
+#include "jit.h"
+#include "ast.h"
+#include "bytecode.h"
+#include "resolver.h"
+#include <algorithm>
+#include <bit>
+#include <cstring>
+#include <format>
+#include <initializer_list>
+#include <sstream>
+#include <stdexcept>
+
+#if defined(__x86_64__) && defined(__linux__)
+#define EXPR_JIT_X86_64
+#include <sys/mman.h>
+#endif
+
+// versions compiled per function before further argument kinds stay
+// interpreted
+static constexpr size_t max_versions = 4;
+
+struct Jit::Code {
+    enum class State {
+        Compiling,
+        Ready,
+        Rejected,
+    };
+
+    FnStatement* fn = nullptr;
+    std::vector<ValueKind> params;
+    // Undefined until inferred
+    ValueKind result = ValueKind::Undefined;
+    State state = State::Compiling;
+    std::string reason;
+
+    // calls from other compiled code load the entry point from here, which
+    // lets a function call itself before it is finished
+    void* entry = nullptr;
+    size_t size = 0;
+    uint32_t deopts = 0;
+
+    ~Code()
+    {
+#ifdef EXPR_JIT_X86_64
+        if (entry) {
+            munmap(entry, size);
+        }
+#endif
+    }
+};
+
+// Thrown while compiling a function the JIT does not handle; the function
+// then stays in the interpreter.
+class Unsupported : public std::runtime_error {
+public:
+    using std::runtime_error::runtime_error;
+};
+
+#ifdef EXPR_JIT_X86_64
+
+namespace {
+
+// x86 condition codes, as used by jcc and setcc
+enum class Cond : uint8_t {
+    Equal = 0x4,
+    NotEqual = 0x5,
+    Above = 0x7,
+    NotParity = 0xb,
+    Less = 0xc,
+    GreaterEqual = 0xd,
+    LessEqual = 0xe,
+    Greater = 0xf,
+};
+
+class Assembler {
+public:
+    void emit(std::initializer_list<uint8_t> bytes) { code.insert(code.end(), bytes); }
+
+    void imm32(int32_t value)
+    {
+        for (int i = 0; i < 4; ++i) {
+            code.push_back(uint8_t(uint32_t(value) >> (i * 8)));
+        }
+    }
+
+    void imm64(uint64_t value)
+    {
+        for (int i = 0; i < 8; ++i) {
+            code.push_back(uint8_t(value >> (i * 8)));
+        }
+    }
+
+    size_t here() const { return code.size(); }
+
+    // jmp rel32 / jcc rel32, returning the operand for `patch`
+    size_t jump()
+    {
+        emit({ 0xe9 });
+        imm32(0);
+        return here() - 4;
+    }
+
+    size_t jump_if(Cond cond)
+    {
+        emit({ 0x0f, uint8_t(0x80 | uint8_t(cond)) });
+        imm32(0);
+        return here() - 4;
+    }
+
+    void jump_to(size_t target) { patch(jump(), target); }
+
+    void patch(size_t at, size_t target)
+    {
+        auto rel = int32_t(int64_t(target) - int64_t(at + 4));
+        std::memcpy(code.data() + at, &rel, sizeof(rel));
+    }
+
+    void patch(size_t at) { patch(at, here()); }
+
+    // mov rax, imm64
+    void mov_rax(uint64_t value)
+    {
+        emit({ 0x48, 0xb8 });
+        imm64(value);
+    }
+
+    // mov rax, [rbp + disp]
+    void load(int32_t disp)
+    {
+        emit({ 0x48, 0x8b, 0x85 });
+        imm32(disp);
+    }
+
+    // mov [rbp + disp], rax
+    void store(int32_t disp)
+    {
+        emit({ 0x48, 0x89, 0x85 });
+        imm32(disp);
+    }
+
+    // setcc al; movzx eax, al
+    void set(Cond cond) { emit({ 0x0f, uint8_t(0x90 | uint8_t(cond)), 0xc0, 0x0f, 0xb6, 0xc0 }); }
+
+    std::vector<uint8_t> code;
+};
+
+bool numeric(ValueKind kind)
+{
+    return kind == ValueKind::Integer || kind == ValueKind::Float;
+}
+
+// Kinds of a local never change in compiled code, Undefined standing for a
+// local no assignment has reached yet.
+ValueKind join(ValueKind lhs, ValueKind rhs)
+{
+    if (lhs == ValueKind::Undefined) {
+        return rhs;
+    }
+    if (rhs == ValueKind::Undefined || lhs == rhs) {
+        return lhs;
+    }
+    throw Unsupported(std::format("local holds both {} and {}",
+        value_kind_str(lhs), value_kind_str(rhs)));
+}
+
+bool comparison(Operator op)
+{
+    switch (op) {
+    case Operator::Equals:
+    case Operator::NotEquals:
+    case Operator::LessThan:
+    case Operator::LessThanOrEqual:
+    case Operator::GreaterThan:
+    case Operator::GreaterThanOrEqual:
+        return true;
+    default:
+        return false;
+    }
+}
+
+// the kind `lhs op rhs` evaluates to, mirroring Integer, Float and Boolean
+ValueKind binary_kind(Operator op, ValueKind lhs, ValueKind rhs)
+{
+    if (lhs == ValueKind::Undefined || rhs == ValueKind::Undefined) {
+        return comparison(op) ? ValueKind::Boolean : ValueKind::Undefined;
+    }
+
+    if (comparison(op)) {
+        if ((numeric(lhs) && numeric(rhs)) || (lhs == ValueKind::Boolean && rhs == ValueKind::Boolean)) {
+            return ValueKind::Boolean;
+        }
+    } else if (op == Operator::Modulo) {
+        if (lhs == ValueKind::Integer && rhs == ValueKind::Integer) {
+            return ValueKind::Integer;
+        }
+    } else if (op == Operator::Add || op == Operator::Subtract
+        || op == Operator::Multiply || op == Operator::Divide) {
+        if (lhs == ValueKind::Integer && rhs == ValueKind::Integer) {
+            return ValueKind::Integer;
+        }
+        if (numeric(lhs) && numeric(rhs)) {
+            return ValueKind::Float;
+        }
+    }
+
+    throw Unsupported(std::format("{} on {} and {}",
+        operator_str(op), value_kind_str(lhs), value_kind_str(rhs)));
+}
+
+// Compiles one version of a function. Values live unboxed in rax: integers as
+// themselves, booleans as 0 or 1 and floats as their bit pattern. Locals sit
+// below the saved registers, temporaries are pushed on the machine stack.
+//
+// The generated function is `bool (*)(const uint64_t* args, uint64_t* result)`
+// and returns false when it bails out.
+class JitCompiler {
+public:
+    JitCompiler(Jit& jit, Jit::Code& code)
+        : m_jit(jit)
+        , m_code(code)
+        , m_resolver(nullptr)
+    {
+    }
+
+    std::vector<uint8_t> compile();
+
+private:
+    struct Loop {
+        std::vector<size_t> breaks;
+        std::vector<size_t> continues;
+    };
+
+    void infer();
+    ValueKind type_of(Expression& expression);
+    Jit::Code& callee(CallExpression& expression, const std::vector<ValueKind>& args);
+
+    void statement(Statement& statement);
+    size_t branch_unless(Expression& condition);
+    ValueKind expression(Expression& expression);
+    ValueKind binary(BinaryExpression& expression);
+    ValueKind call(CallExpression& expression);
+
+    uint32_t local(Expression& expression) const;
+    static int32_t offset(uint32_t slot) { return -24 - int32_t(slot) * 8; }
+
+    void push()
+    {
+        m_asm.emit({ 0x50 }); // push rax
+        m_depth++;
+    }
+
+    Jit& m_jit;
+    Jit::Code& m_code;
+    Resolver m_resolver;
+    Assembler m_asm;
+
+    std::vector<ValueKind> m_kinds;
+    std::vector<Loop> m_loops;
+    std::vector<size_t> m_returns;
+    std::vector<size_t> m_bails;
+    // words pushed below the locals, to keep calls 16-byte aligned
+    uint32_t m_depth = 0;
+};
+
+uint32_t JitCompiler::local(Expression& expression) const
+{
+    auto found = m_resolver.slots.find(&expression);
+    if (found == m_resolver.slots.end()) {
+        if (expression.kind() == ASTNode::Kind::VariableExpr) {
+            throw Unsupported(std::format("uses global {}",
+                dynamic_cast<VariableExpression&>(expression).name()));
+        }
+        throw Unsupported(std::format("assigns to {}", node_kind_str(expression.kind())));
+    }
+    return found->second;
+}
+
+std::vector<uint8_t> JitCompiler::compile()
+{
+    auto& fn = *m_code.fn;
+    m_resolver.function(fn);
+    infer();
+
+    auto locals = m_resolver.locals();
+    auto frame = int32_t((locals * 8 + 15) / 16 * 16);
+
+    m_asm.emit({ 0x55 }); // push rbp
+    m_asm.emit({ 0x48, 0x89, 0xe5 }); // mov rbp, rsp
+    m_asm.emit({ 0x53 }); // push rbx
+    m_asm.emit({ 0x41, 0x54 }); // push r12
+    m_asm.emit({ 0x48, 0x81, 0xec }); // sub rsp, frame
+    m_asm.imm32(frame);
+    m_asm.emit({ 0x49, 0x89, 0xf4 }); // mov r12, rsi
+
+    for (uint32_t i = 0; i < uint32_t(fn.params().size()); ++i) {
+        m_asm.emit({ 0x48, 0x8b, 0x87 }); // mov rax, [rdi + 8i]
+        m_asm.imm32(int32_t(i * 8));
+        m_asm.store(offset(i));
+    }
+
+    statement(fn.body());
+
+    // falling off the end returns undefined, which only the interpreter has
+    for (auto at : m_bails) {
+        m_asm.patch(at);
+    }
+    m_asm.emit({ 0x31, 0xc0 }); // xor eax, eax
+
+    for (auto at : m_returns) {
+        m_asm.patch(at);
+    }
+    m_asm.emit({ 0x48, 0x8d, 0x65, 0xf0 }); // lea rsp, [rbp - 16]
+    m_asm.emit({ 0x41, 0x5c }); // pop r12
+    m_asm.emit({ 0x5b }); // pop rbx
+    m_asm.emit({ 0x5d }); // pop rbp
+    m_asm.emit({ 0xc3 }); // ret
+
+    return std::move(m_asm.code);
+}
+
+// Gives every local the kind assigned to it and the function its result
+// kind, iterated to a fixed point since both may depend on recursive calls.
+void JitCompiler::infer()
+{
+    m_kinds.assign(m_resolver.locals(), ValueKind::Undefined);
+    std::copy(m_code.params.begin(), m_code.params.end(), m_kinds.begin());
+    m_code.result = ValueKind::Undefined;
+
+    for (bool changed = true; changed;) {
+        changed = false;
+        for (auto& assignment : m_resolver.assignments) {
+            ValueKind kind;
+            if (assignment.postfix) {
+                kind = ValueKind::Integer;
+            } else if (assignment.value) {
+                kind = type_of(*assignment.value);
+            } else {
+                throw Unsupported("declares a local without a value");
+            }
+
+            auto joined = join(m_kinds[assignment.slot], kind);
+            if (joined != m_kinds[assignment.slot]) {
+                m_kinds[assignment.slot] = joined;
+                changed = true;
+            }
+        }
+
+        for (auto value : m_resolver.returns) {
+            if (!value) {
+                throw Unsupported("returns undefined");
+            }
+            auto joined = join(m_code.result, type_of(*value));
+            if (joined != m_code.result) {
+                m_code.result = joined;
+                changed = true;
+            }
+        }
+    }
+
+    if (std::find(m_kinds.begin(), m_kinds.end(), ValueKind::Undefined) != m_kinds.end()) {
+        throw Unsupported("local is never given a value");
+    }
+    if (m_code.result == ValueKind::Undefined) {
+        throw Unsupported("never returns a value");
+    }
+}
+
+ValueKind JitCompiler::type_of(Expression& expression)
+{
+    switch (expression.kind()) {
+    case ASTNode::Kind::LiteralExpr:
+        switch (dynamic_cast<LiteralExpression&>(expression).literal_kind()) {
+        case LiteralKind::Integer:
+            return ValueKind::Integer;
+        case LiteralKind::Float:
+            return ValueKind::Float;
+        case LiteralKind::Boolean:
+            return ValueKind::Boolean;
+        default:
+            throw Unsupported("uses a string or undefined literal");
+        }
+    case ASTNode::Kind::VariableExpr:
+        return m_kinds[local(expression)];
+    case ASTNode::Kind::BinaryExpr: {
+        auto& binary = dynamic_cast<BinaryExpression&>(expression);
+        if (binary.op() == Operator::Assign) {
+            return m_kinds[local(binary.left())];
+        }
+        return binary_kind(binary.op(), type_of(binary.left()), type_of(binary.right()));
+    }
+    case ASTNode::Kind::PrefixExpr: {
+        auto& prefix = dynamic_cast<PrefixExpression&>(expression);
+        auto kind = type_of(prefix.expr());
+        if (prefix.op() == Operator::Not) {
+            if (kind != ValueKind::Undefined && kind != ValueKind::Boolean) {
+                throw Unsupported(std::format("! on {}", value_kind_str(kind)));
+            }
+            return ValueKind::Boolean;
+        }
+        if (kind != ValueKind::Undefined && !numeric(kind)) {
+            throw Unsupported(std::format("- on {}", value_kind_str(kind)));
+        }
+        return kind;
+    }
+    case ASTNode::Kind::PostfixExpr:
+        local(dynamic_cast<PostfixExpression&>(expression).expr());
+        return ValueKind::Integer;
+    case ASTNode::Kind::CallExpr: {
+        auto& call = dynamic_cast<CallExpression&>(expression);
+        std::vector<ValueKind> args;
+        for (auto& arg : call.args()) {
+            auto kind = type_of(*arg);
+            if (kind == ValueKind::Undefined) {
+                return ValueKind::Undefined;
+            }
+            args.push_back(kind);
+        }
+        return callee(call, args).result;
+    }
+    default:
+        throw Unsupported(std::format("uses {}", node_kind_str(expression.kind())));
+    }
+}
+
+// The compiled version a call resolves to. Calls go to program functions by
+// name only, as for the register VM, and never by a name the program rebinds.
+Jit::Code& JitCompiler::callee(CallExpression& expression, const std::vector<ValueKind>& args)
+{
+    if (expression.callee().kind() != ASTNode::Kind::VariableExpr
+        || m_resolver.slots.contains(&expression.callee())) {
+        throw Unsupported("calls a computed value");
+    }
+
+    auto& name = dynamic_cast<VariableExpression&>(expression.callee()).name();
+    auto fn = m_jit.function(name);
+    if (!fn) {
+        throw Unsupported(std::format("calls {}", name));
+    }
+    if (fn->params().size() != args.size()) {
+        throw Unsupported(std::format("calls {} with {} arguments", name, args.size()));
+    }
+
+    if (fn == m_code.fn && args == m_code.params) {
+        return m_code;
+    }
+
+    auto& code = m_jit.specialize(*fn, args);
+    if (code.state == Jit::Code::State::Compiling) {
+        throw Unsupported(std::format("mutually recursive with {}", name));
+    }
+    if (code.state == Jit::Code::State::Rejected) {
+        throw Unsupported(std::format("calls {}, which is not compiled", name));
+    }
+    return code;
+}
+
+void JitCompiler::statement(Statement& statement)
+{
+    switch (statement.kind()) {
+    case ASTNode::Kind::LetStmt: {
+        auto& let = dynamic_cast<LetStatement&>(statement);
+        expression(*let.value());
+        m_asm.store(offset(m_resolver.slots.at(&let)));
+        break;
+    }
+    case ASTNode::Kind::IfStmt: {
+        auto& if_stmt = dynamic_cast<IfStatement&>(statement);
+        auto otherwise = branch_unless(if_stmt.condition());
+        this->statement(if_stmt.then_branch());
+
+        if (if_stmt.else_branch()) {
+            auto end = m_asm.jump();
+            m_asm.patch(otherwise);
+            this->statement(*if_stmt.else_branch());
+            m_asm.patch(end);
+        } else {
+            m_asm.patch(otherwise);
+        }
+        break;
+    }
+    case ASTNode::Kind::ForStmt: {
+        auto& for_stmt = dynamic_cast<ForStatement&>(statement);
+        if (for_stmt.initializer()) {
+            this->statement(*for_stmt.initializer());
+        }
+
+        auto start = m_asm.here();
+        std::optional<size_t> exit;
+        if (for_stmt.condition()) {
+            exit = branch_unless(*for_stmt.condition());
+        }
+
+        m_loops.push_back(Loop());
+        this->statement(for_stmt.body());
+        auto loop = std::move(m_loops.back());
+        m_loops.pop_back();
+
+        for (auto at : loop.continues) {
+            m_asm.patch(at);
+        }
+        if (for_stmt.increment()) {
+            expression(*for_stmt.increment());
+        }
+        m_asm.jump_to(start);
+
+        if (exit) {
+            m_asm.patch(*exit);
+        }
+        for (auto at : loop.breaks) {
+            m_asm.patch(at);
+        }
+        break;
+    }
+    case ASTNode::Kind::BlockStmt:
+        for (auto& stmt : dynamic_cast<BlockStatement&>(statement).statements()) {
+            this->statement(*stmt);
+        }
+        break;
+    case ASTNode::Kind::ReturnStmt:
+        expression(*dynamic_cast<ReturnStatement&>(statement).value());
+        m_asm.emit({ 0x49, 0x89, 0x04, 0x24 }); // mov [r12], rax
+        m_asm.emit({ 0xb8, 0x01, 0x00, 0x00, 0x00 }); // mov eax, 1
+        m_returns.push_back(m_asm.jump());
+        break;
+    case ASTNode::Kind::BreakStmt:
+    case ASTNode::Kind::ContinueStmt: {
+        if (m_loops.empty()) {
+            throw Unsupported("break or continue outside of a loop");
+        }
+        auto at = m_asm.jump();
+        auto& loop = m_loops.back();
+        (statement.kind() == ASTNode::Kind::BreakStmt ? loop.breaks : loop.continues).push_back(at);
+        break;
+    }
+    case ASTNode::Kind::ExprStmt:
+        expression(dynamic_cast<ExpressionStatement&>(statement).expr());
+        break;
+    case ASTNode::Kind::EmptyStmt:
+        break;
+    default:
+        throw Unsupported(std::format("uses {}", node_kind_str(statement.kind())));
+    }
+}
+
+// Emits a jump taken when `condition` is false and returns it for patching.
+size_t JitCompiler::branch_unless(Expression& condition)
+{
+    if (condition.kind() == ASTNode::Kind::BinaryExpr) {
+        auto& binary = dynamic_cast<BinaryExpression&>(condition);
+        if (comparison(binary.op()) && type_of(binary.left()) == ValueKind::Integer
+            && type_of(binary.right()) == ValueKind::Integer) {
+            expression(binary.left());
+            push();
+            expression(binary.right());
+            m_asm.emit({ 0x48, 0x89, 0xc1 }); // mov rcx, rax
+            m_asm.emit({ 0x58 }); // pop rax
+            m_depth--;
+            m_asm.emit({ 0x48, 0x39, 0xc8 }); // cmp rax, rcx
+
+            switch (binary.op()) {
+            case Operator::Equals:
+                return m_asm.jump_if(Cond::NotEqual);
+            case Operator::NotEquals:
+                return m_asm.jump_if(Cond::Equal);
+            case Operator::LessThan:
+                return m_asm.jump_if(Cond::GreaterEqual);
+            case Operator::LessThanOrEqual:
+                return m_asm.jump_if(Cond::Greater);
+            case Operator::GreaterThan:
+                return m_asm.jump_if(Cond::LessEqual);
+            default:
+                return m_asm.jump_if(Cond::Less);
+            }
+        }
+    }
+
+    auto kind = expression(condition);
+    if (kind != ValueKind::Boolean) {
+        throw Unsupported(std::format("condition is {}", value_kind_str(kind)));
+    }
+    m_asm.emit({ 0x48, 0x85, 0xc0 }); // test rax, rax
+    return m_asm.jump_if(Cond::Equal);
+}
+
+ValueKind JitCompiler::expression(Expression& expression)
+{
+    switch (expression.kind()) {
+    case ASTNode::Kind::LiteralExpr: {
+        auto& literal = dynamic_cast<LiteralExpression&>(expression);
+        switch (literal.literal_kind()) {
+        case LiteralKind::Integer:
+            m_asm.mov_rax(uint64_t(dynamic_cast<IntegerLiteral&>(literal).value()));
+            return ValueKind::Integer;
+        case LiteralKind::Float:
+            m_asm.mov_rax(std::bit_cast<uint64_t>(dynamic_cast<FloatLiteral&>(literal).value()));
+            return ValueKind::Float;
+        case LiteralKind::Boolean:
+            m_asm.mov_rax(dynamic_cast<BooleanLiteral&>(literal).value() ? 1 : 0);
+            return ValueKind::Boolean;
+        default:
+            return type_of(expression);
+        }
+    }
+    case ASTNode::Kind::VariableExpr: {
+        auto slot = local(expression);
+        m_asm.load(offset(slot));
+        return m_kinds[slot];
+    }
+    case ASTNode::Kind::BinaryExpr:
+        return binary(dynamic_cast<BinaryExpression&>(expression));
+    case ASTNode::Kind::PrefixExpr: {
+        auto& prefix = dynamic_cast<PrefixExpression&>(expression);
+        auto kind = type_of(prefix);
+        this->expression(prefix.expr());
+        if (prefix.op() == Operator::Not) {
+            m_asm.emit({ 0x83, 0xf0, 0x01 }); // xor eax, 1
+        } else if (kind == ValueKind::Integer) {
+            m_asm.emit({ 0x48, 0xf7, 0xd8 }); // neg rax
+        } else {
+            m_asm.emit({ 0x48, 0xb9 }); // mov rcx, sign bit
+            m_asm.imm64(uint64_t(1) << 63);
+            m_asm.emit({ 0x48, 0x31, 0xc8 }); // xor rax, rcx
+        }
+        return kind;
+    }
+    case ASTNode::Kind::PostfixExpr: {
+        auto& postfix = dynamic_cast<PostfixExpression&>(expression);
+        auto slot = local(postfix.expr());
+        m_asm.load(offset(slot));
+        if (postfix.op() == Operator::Increase) {
+            m_asm.emit({ 0x48, 0x83, 0xc0, 0x01 }); // add rax, 1
+        } else {
+            m_asm.emit({ 0x48, 0x83, 0xe8, 0x01 }); // sub rax, 1
+        }
+        m_asm.store(offset(slot));
+        return ValueKind::Integer;
+    }
+    case ASTNode::Kind::CallExpr:
+        return call(dynamic_cast<CallExpression&>(expression));
+    default:
+        return type_of(expression);
+    }
+}
+
+ValueKind JitCompiler::binary(BinaryExpression& expression)
+{
+    if (expression.op() == Operator::Assign) {
+        auto slot = local(expression.left());
+        this->expression(expression.right());
+        m_asm.store(offset(slot));
+        return m_kinds[slot];
+    }
+
+    auto lhs = this->expression(expression.left());
+    push();
+    auto rhs = this->expression(expression.right());
+    m_asm.emit({ 0x48, 0x89, 0xc1 }); // mov rcx, rax
+    m_asm.emit({ 0x58 }); // pop rax
+    m_depth--;
+
+    auto op = expression.op();
+    auto kind = binary_kind(op, lhs, rhs);
+
+    if (lhs == ValueKind::Integer && rhs == ValueKind::Integer) {
+        switch (op) {
+        case Operator::Add:
+            m_asm.emit({ 0x48, 0x01, 0xc8 }); // add rax, rcx
+            return kind;
+        case Operator::Subtract:
+            m_asm.emit({ 0x48, 0x29, 0xc8 }); // sub rax, rcx
+            return kind;
+        case Operator::Multiply:
+            m_asm.emit({ 0x48, 0x0f, 0xaf, 0xc1 }); // imul rax, rcx
+            return kind;
+        case Operator::Divide:
+        case Operator::Modulo: {
+            // dividing by zero is left to the interpreter
+            m_asm.emit({ 0x48, 0x85, 0xc9 }); // test rcx, rcx
+            m_bails.push_back(m_asm.jump_if(Cond::Equal));
+
+            // idiv faults on INT64_MIN / -1
+            m_asm.emit({ 0x48, 0x83, 0xf9, 0xff }); // cmp rcx, -1
+            auto divide = m_asm.jump_if(Cond::NotEqual);
+            if (op == Operator::Divide) {
+                m_asm.emit({ 0x48, 0xf7, 0xd8 }); // neg rax
+            } else {
+                m_asm.emit({ 0x31, 0xc0 }); // xor eax, eax
+            }
+            auto end = m_asm.jump();
+
+            m_asm.patch(divide);
+            m_asm.emit({ 0x48, 0x99 }); // cqo
+            m_asm.emit({ 0x48, 0xf7, 0xf9 }); // idiv rcx
+            if (op == Operator::Modulo) {
+                m_asm.emit({ 0x48, 0x89, 0xd0 }); // mov rax, rdx
+            }
+            m_asm.patch(end);
+            return kind;
+        }
+        default:
+            break;
+        }
+    }
+
+    if (kind == ValueKind::Boolean && !(lhs == ValueKind::Float || rhs == ValueKind::Float)) {
+        // integers or booleans
+        m_asm.emit({ 0x48, 0x39, 0xc8 }); // cmp rax, rcx
+        switch (op) {
+        case Operator::Equals:
+            m_asm.set(Cond::Equal);
+            break;
+        case Operator::NotEquals:
+            m_asm.set(Cond::NotEqual);
+            break;
+        case Operator::LessThan:
+            m_asm.set(Cond::Less);
+            break;
+        case Operator::LessThanOrEqual:
+            m_asm.set(Cond::LessEqual);
+            break;
+        case Operator::GreaterThan:
+            m_asm.set(Cond::Greater);
+            break;
+        default:
+            m_asm.set(Cond::GreaterEqual);
+            break;
+        }
+        return kind;
+    }
+
+    if (lhs == ValueKind::Integer) {
+        m_asm.emit({ 0xf2, 0x48, 0x0f, 0x2a, 0xc0 }); // cvtsi2sd xmm0, rax
+    } else {
+        m_asm.emit({ 0x66, 0x48, 0x0f, 0x6e, 0xc0 }); // movq xmm0, rax
+    }
+    if (rhs == ValueKind::Integer) {
+        m_asm.emit({ 0xf2, 0x48, 0x0f, 0x2a, 0xc9 }); // cvtsi2sd xmm1, rcx
+    } else {
+        m_asm.emit({ 0x66, 0x48, 0x0f, 0x6e, 0xc9 }); // movq xmm1, rcx
+    }
+
+    if (kind == ValueKind::Float) {
+        switch (op) {
+        case Operator::Add:
+            m_asm.emit({ 0xf2, 0x0f, 0x58, 0xc1 }); // addsd xmm0, xmm1
+            break;
+        case Operator::Subtract:
+            m_asm.emit({ 0xf2, 0x0f, 0x5c, 0xc1 }); // subsd xmm0, xmm1
+            break;
+        case Operator::Multiply:
+            m_asm.emit({ 0xf2, 0x0f, 0x59, 0xc1 }); // mulsd xmm0, xmm1
+            break;
+        default:
+            m_asm.emit({ 0xf2, 0x0f, 0x5e, 0xc1 }); // divsd xmm0, xmm1
+            break;
+        }
+        m_asm.emit({ 0x66, 0x48, 0x0f, 0x7e, 0xc0 }); // movq rax, xmm0
+        return kind;
+    }
+
+    // Float::compare tests == and then >, so an unordered pair is Less
+    m_asm.emit({ 0x66, 0x0f, 0x2e, 0xc1 }); // ucomisd xmm0, xmm1
+    m_asm.emit({ 0x0f, 0x97, 0xc2 }); // seta dl: greater
+    m_asm.emit({ 0x0f, 0x94, 0xc0 }); // sete al
+    m_asm.emit({ 0x0f, 0x9b, 0xc1 }); // setnp cl
+    m_asm.emit({ 0x20, 0xc8 }); // and al, cl: equal
+    switch (op) {
+    case Operator::Equals:
+        break;
+    case Operator::NotEquals:
+        m_asm.emit({ 0x34, 0x01 }); // xor al, 1
+        break;
+    case Operator::GreaterThan:
+        m_asm.emit({ 0x88, 0xd0 }); // mov al, dl
+        break;
+    case Operator::GreaterThanOrEqual:
+        m_asm.emit({ 0x08, 0xd0 }); // or al, dl
+        break;
+    case Operator::LessThan:
+        m_asm.emit({ 0x08, 0xd0, 0x34, 0x01 }); // or al, dl; xor al, 1
+        break;
+    default:
+        m_asm.emit({ 0x88, 0xd0, 0x34, 0x01 }); // mov al, dl; xor al, 1
+        break;
+    }
+    m_asm.emit({ 0x0f, 0xb6, 0xc0 }); // movzx eax, al
+    return kind;
+}
+
+// Arguments are stored into an area below the temporaries, which the callee
+// also writes its result to.
+ValueKind JitCompiler::call(CallExpression& expression)
+{
+    auto argc = uint32_t(expression.args().size());
+    auto words = std::max(argc, 1u);
+    words += (m_depth + words) % 2;
+
+    m_asm.emit({ 0x48, 0x81, 0xec }); // sub rsp, words * 8
+    m_asm.imm32(int32_t(words * 8));
+    m_depth += words;
+
+    std::vector<ValueKind> args;
+    for (uint32_t i = 0; i < argc; ++i) {
+        args.push_back(this->expression(*expression.args()[i]));
+        m_asm.emit({ 0x48, 0x89, 0x84, 0x24 }); // mov [rsp + 8i], rax
+        m_asm.imm32(int32_t(i * 8));
+    }
+
+    auto& code = callee(expression, args);
+
+    m_asm.emit({ 0x48, 0x89, 0xe7 }); // mov rdi, rsp
+    m_asm.emit({ 0x48, 0x89, 0xe6 }); // mov rsi, rsp
+    m_asm.mov_rax(uint64_t(reinterpret_cast<uintptr_t>(&code.entry)));
+    m_asm.emit({ 0xff, 0x10 }); // call [rax]
+
+    // the callee bailing out means running this call again too
+    m_asm.emit({ 0x84, 0xc0 }); // test al, al
+    m_bails.push_back(m_asm.jump_if(Cond::Equal));
+
+    m_asm.emit({ 0x48, 0x8b, 0x04, 0x24 }); // mov rax, [rsp]
+    m_asm.emit({ 0x48, 0x81, 0xc4 }); // add rsp, words * 8
+    m_asm.imm32(int32_t(words * 8));
+    m_depth -= words;
+
+    return code.result;
+}
+
+// W^X: the code is written while the pages are writable and only then made
+// executable.
+void* map_executable(const std::vector<uint8_t>& code)
+{
+    auto memory = mmap(nullptr, code.size(), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED) {
+        throw Unsupported("cannot map executable memory");
+    }
+
+    std::memcpy(memory, code.data(), code.size());
+    if (mprotect(memory, code.size(), PROT_READ | PROT_EXEC) != 0) {
+        munmap(memory, code.size());
+        throw Unsupported("cannot map executable memory");
+    }
+
+    return memory;
+}
+
+} // namespace
+
+#endif
+
+Jit::Jit(std::shared_ptr<Program> program, uint32_t threshold)
+    : m_program(std::move(program))
+    , m_rebound(rebound_names(*m_program))
+    , m_threshold(threshold)
+{
+}
+
+Jit::~Jit() = default;
+
+bool Jit::supported()
+{
+#ifdef EXPR_JIT_X86_64
+    return true;
+#else
+    return false;
+#endif
+}
+
+FnStatement* Jit::function(const std::string& name) const
+{
+    auto found = m_program->functions().find(name);
+    if (found == m_program->functions().end() || m_rebound.contains(name)) {
+        return nullptr;
+    }
+    return found->second.get();
+}
+
+Jit::Code& Jit::specialize(FnStatement& fn, const std::vector<ValueKind>& params)
+{
+    auto& versions = m_functions[&fn].versions;
+    for (auto& version : versions) {
+        if (version->params == params) {
+            return *version;
+        }
+    }
+
+    versions.push_back(std::make_unique<Code>());
+    // compiling may add functions to m_functions, only `code` stays valid
+    auto& code = *versions.back();
+    code.fn = &fn;
+    code.params = params;
+
+#ifdef EXPR_JIT_X86_64
+    try {
+        auto machine_code = JitCompiler(*this, code).compile();
+        code.entry = map_executable(machine_code);
+        code.size = machine_code.size();
+        code.state = Code::State::Ready;
+        m_stats.compiled++;
+    } catch (Unsupported& e) {
+        code.state = Code::State::Rejected;
+        code.reason = e.what();
+        m_stats.rejected++;
+    }
+#else
+    code.state = Code::State::Rejected;
+    code.reason = "no JIT for this platform";
+    m_stats.rejected++;
+#endif
+
+    return code;
+}
+
+std::optional<Value> Jit::call(FnStatement& fn, const std::vector<Value>& args)
+{
+    auto& entry = m_functions[&fn];
+    if (entry.calls < m_threshold) {
+        entry.calls++;
+        return std::nullopt;
+    }
+
+    Code* code = nullptr;
+    for (auto& version : entry.versions) {
+        if (std::equal(args.begin(), args.end(), version->params.begin(), version->params.end(),
+                [](const Value& arg, ValueKind kind) { return arg.kind() == kind; })) {
+            code = version.get();
+            break;
+        }
+    }
+
+    if (!code) {
+        std::vector<ValueKind> params;
+        for (auto& arg : args) {
+            if (arg.kind() != ValueKind::Integer && arg.kind() != ValueKind::Float
+                && arg.kind() != ValueKind::Boolean) {
+                m_stats.guard_failures++;
+                return std::nullopt;
+            }
+            params.push_back(arg.kind());
+        }
+        if (entry.versions.size() >= max_versions) {
+            m_stats.guard_failures++;
+            return std::nullopt;
+        }
+        code = &specialize(fn, params);
+    }
+
+    if (code->state != Code::State::Ready) {
+        return std::nullopt;
+    }
+
+    m_arguments.resize(std::max<size_t>(args.size(), 1));
+    for (size_t i = 0; i < args.size(); ++i) {
+        switch (args[i].kind()) {
+        case ValueKind::Integer:
+            m_arguments[i] = uint64_t(args[i].as_integer());
+            break;
+        case ValueKind::Float:
+            m_arguments[i] = std::bit_cast<uint64_t>(args[i].as_float());
+            break;
+        default:
+            m_arguments[i] = args[i].as_boolean() ? 1 : 0;
+            break;
+        }
+    }
+
+    m_stats.native_calls++;
+    auto native = reinterpret_cast<bool (*)(const uint64_t*, uint64_t*)>(code->entry);
+    uint64_t result = 0;
+    if (!native(m_arguments.data(), &result)) {
+        m_stats.deopts++;
+        // a version that keeps bailing out only costs time
+        if (++code->deopts >= m_threshold) {
+            code->state = Code::State::Rejected;
+            code->reason = "deoptimized too often";
+        }
+        return std::nullopt;
+    }
+
+    switch (code->result) {
+    case ValueKind::Integer:
+        return Value(int64_t(result));
+    case ValueKind::Float:
+        return Value(std::bit_cast<double>(result));
+    default:
+        return Value(result != 0);
+    }
+}
+
+std::string Jit::report() const
+{
+    std::vector<std::string> lines;
+    for (auto& [_, entry] : m_functions) {
+        for (auto& version : entry.versions) {
+            std::string params;
+            for (auto kind : version->params) {
+                params += (params.empty() ? "" : ", ") + value_kind_str(kind);
+            }
+
+            auto line = std::format("{}({})", version->fn->name(), params);
+            if (version->state == Code::State::Ready) {
+                line += std::format(" -> {}: {} bytes, {} deopts",
+                    value_kind_str(version->result), version->size, version->deopts);
+            } else {
+                line += std::format(": interpreted, {}", version->reason);
+            }
+            lines.push_back(line);
+        }
+    }
+    std::sort(lines.begin(), lines.end());
+
+    std::stringstream ss;
+    for (auto& line : lines) {
+        ss << line << std::endl;
+    }
+    return ss.str();
+}
@@ -0,0 +1,842 @@
+#include "kernels.h"
+#include "alloc.h"
+#include "builtins.h"
+#include "object.h"
+#include <cstddef>
+#include <cstdint>
+#include <format>
+#include <vector>
+
+#if defined(__GNUC__) && defined(__SSE2__) && (defined(__x86_64__) || defined(__i386__))
+#define EXPR_X86_SIMD
+#include <immintrin.h>
+#endif
+
+#ifdef EXPR_X86_SIMD
+
+#define TARGET_AVX2 __attribute__((target("avx2")))
+
+static bool has_avx2()
+{
+    static const bool supported = __builtin_cpu_supports("avx2");
+    return supported;
+}
+
+TARGET_AVX2 static double hsum256(__m256d v)
+{
+    __m128d lo = _mm256_castpd256_pd128(v);
+    __m128d hi = _mm256_extractf128_pd(v, 1);
+    lo = _mm_add_pd(lo, hi);
+    return _mm_cvtsd_f64(_mm_add_sd(lo, _mm_unpackhi_pd(lo, lo)));
+}
+
+static double hsum128(__m128d v)
+{
+    return _mm_cvtsd_f64(_mm_add_sd(v, _mm_unpackhi_pd(v, v)));
+}
+
+TARGET_AVX2 static double sum_f64_avx2(const double* data, size_t n)
+{
+    __m256d acc0 = _mm256_setzero_pd();
+    __m256d acc1 = _mm256_setzero_pd();
+    __m256d acc2 = _mm256_setzero_pd();
+    __m256d acc3 = _mm256_setzero_pd();
+
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        acc0 = _mm256_add_pd(acc0, _mm256_loadu_pd(data + i));
+        acc1 = _mm256_add_pd(acc1, _mm256_loadu_pd(data + i + 4));
+        acc2 = _mm256_add_pd(acc2, _mm256_loadu_pd(data + i + 8));
+        acc3 = _mm256_add_pd(acc3, _mm256_loadu_pd(data + i + 12));
+    }
+    for (; i + 4 <= n; i += 4) {
+        acc0 = _mm256_add_pd(acc0, _mm256_loadu_pd(data + i));
+    }
+
+    double sum = hsum256(_mm256_add_pd(_mm256_add_pd(acc0, acc1),
+        _mm256_add_pd(acc2, acc3)));
+    for (; i < n; ++i) {
+        sum += data[i];
+    }
+
+    return sum;
+}
+
+static double sum_f64_sse2(const double* data, size_t n)
+{
+    __m128d acc0 = _mm_setzero_pd();
+    __m128d acc1 = _mm_setzero_pd();
+
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        acc0 = _mm_add_pd(acc0, _mm_loadu_pd(data + i));
+        acc1 = _mm_add_pd(acc1, _mm_loadu_pd(data + i + 2));
+    }
+
+    double sum = hsum128(_mm_add_pd(acc0, acc1));
+    for (; i < n; ++i) {
+        sum += data[i];
+    }
+
+    return sum;
+}
+
+TARGET_AVX2 static int64_t sum_i64_avx2(const int64_t* data, size_t n)
+{
+    __m256i acc0 = _mm256_setzero_si256();
+    __m256i acc1 = _mm256_setzero_si256();
+
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        acc0 = _mm256_add_epi64(acc0, _mm256_loadu_si256((const __m256i*)(data + i)));
+        acc1 = _mm256_add_epi64(acc1, _mm256_loadu_si256((const __m256i*)(data + i + 4)));
+    }
+
+    alignas(32) int64_t lanes[4];
+    _mm256_store_si256((__m256i*)lanes, _mm256_add_epi64(acc0, acc1));
+    int64_t sum = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+    for (; i < n; ++i) {
+        sum += data[i];
+    }
+
+    return sum;
+}
+
+static int64_t sum_i64_sse2(const int64_t* data, size_t n)
+{
+    __m128i acc0 = _mm_setzero_si128();
+    __m128i acc1 = _mm_setzero_si128();
+
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        acc0 = _mm_add_epi64(acc0, _mm_loadu_si128((const __m128i*)(data + i)));
+        acc1 = _mm_add_epi64(acc1, _mm_loadu_si128((const __m128i*)(data + i + 2)));
+    }
+
+    alignas(16) int64_t lanes[2];
+    _mm_store_si128((__m128i*)lanes, _mm_add_epi64(acc0, acc1));
+    int64_t sum = lanes[0] + lanes[1];
+    for (; i < n; ++i) {
+        sum += data[i];
+    }
+
+    return sum;
+}
+
+TARGET_AVX2 static double dot_f64_avx2(const double* a, const double* b, size_t n)
+{
+    __m256d acc0 = _mm256_setzero_pd();
+    __m256d acc1 = _mm256_setzero_pd();
+    __m256d acc2 = _mm256_setzero_pd();
+    __m256d acc3 = _mm256_setzero_pd();
+
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        acc0 = _mm256_add_pd(acc0, _mm256_mul_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i)));
+        acc1 = _mm256_add_pd(acc1, _mm256_mul_pd(_mm256_loadu_pd(a + i + 4), _mm256_loadu_pd(b + i + 4)));
+        acc2 = _mm256_add_pd(acc2, _mm256_mul_pd(_mm256_loadu_pd(a + i + 8), _mm256_loadu_pd(b + i + 8)));
+        acc3 = _mm256_add_pd(acc3, _mm256_mul_pd(_mm256_loadu_pd(a + i + 12), _mm256_loadu_pd(b + i + 12)));
+    }
+    for (; i + 4 <= n; i += 4) {
+        acc0 = _mm256_add_pd(acc0, _mm256_mul_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i)));
+    }
+
+    double sum = hsum256(_mm256_add_pd(_mm256_add_pd(acc0, acc1),
+        _mm256_add_pd(acc2, acc3)));
+    for (; i < n; ++i) {
+        sum += a[i] * b[i];
+    }
+
+    return sum;
+}
+
+static double dot_f64_sse2(const double* a, const double* b, size_t n)
+{
+    __m128d acc0 = _mm_setzero_pd();
+    __m128d acc1 = _mm_setzero_pd();
+
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        acc0 = _mm_add_pd(acc0, _mm_mul_pd(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i)));
+        acc1 = _mm_add_pd(acc1, _mm_mul_pd(_mm_loadu_pd(a + i + 2), _mm_loadu_pd(b + i + 2)));
+    }
+
+    double sum = hsum128(_mm_add_pd(acc0, acc1));
+    for (; i < n; ++i) {
+        sum += a[i] * b[i];
+    }
+
+    return sum;
+}
+
+TARGET_AVX2 static double max_f64_avx2(const double* data, size_t n)
+{
+    __m256d acc = _mm256_set1_pd(data[0]);
+
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        acc = _mm256_max_pd(acc, _mm256_loadu_pd(data + i));
+    }
+
+    alignas(32) double lanes[4];
+    _mm256_store_pd(lanes, acc);
+    double max = lanes[0];
+    for (int lane = 1; lane < 4; ++lane) {
+        max = lanes[lane] > max ? lanes[lane] : max;
+    }
+    for (; i < n; ++i) {
+        max = data[i] > max ? data[i] : max;
+    }
+
+    return max;
+}
+
+TARGET_AVX2 static double min_f64_avx2(const double* data, size_t n)
+{
+    __m256d acc = _mm256_set1_pd(data[0]);
+
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        acc = _mm256_min_pd(acc, _mm256_loadu_pd(data + i));
+    }
+
+    alignas(32) double lanes[4];
+    _mm256_store_pd(lanes, acc);
+    double min = lanes[0];
+    for (int lane = 1; lane < 4; ++lane) {
+        min = lanes[lane] < min ? lanes[lane] : min;
+    }
+    for (; i < n; ++i) {
+        min = data[i] < min ? data[i] : min;
+    }
+
+    return min;
+}
+
+static double max_f64_sse2(const double* data, size_t n)
+{
+    __m128d acc = _mm_set1_pd(data[0]);
+
+    size_t i = 0;
+    for (; i + 2 <= n; i += 2) {
+        acc = _mm_max_pd(acc, _mm_loadu_pd(data + i));
+    }
+
+    double lo = _mm_cvtsd_f64(acc);
+    double hi = _mm_cvtsd_f64(_mm_unpackhi_pd(acc, acc));
+    double max = hi > lo ? hi : lo;
+    for (; i < n; ++i) {
+        max = data[i] > max ? data[i] : max;
+    }
+
+    return max;
+}
+
+static double min_f64_sse2(const double* data, size_t n)
+{
+    __m128d acc = _mm_set1_pd(data[0]);
+
+    size_t i = 0;
+    for (; i + 2 <= n; i += 2) {
+        acc = _mm_min_pd(acc, _mm_loadu_pd(data + i));
+    }
+
+    double lo = _mm_cvtsd_f64(acc);
+    double hi = _mm_cvtsd_f64(_mm_unpackhi_pd(acc, acc));
+    double min = hi < lo ? hi : lo;
+    for (; i < n; ++i) {
+        min = data[i] < min ? data[i] : min;
+    }
+
+    return min;
+}
+
+// the remaining elementwise kernels share one loop shape
+#define ELEMENTWISE_F64(name, op256, op128, scalar)                                         \
+    TARGET_AVX2 static void name##_avx2(const double* a, const double* b, double* out, size_t n) \
+    {                                                                                       \
+        size_t i = 0;                                                                       \
+        for (; i + 4 <= n; i += 4) {                                                        \
+            _mm256_storeu_pd(out + i, op256(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i))); \
+        }                                                                                   \
+        for (; i < n; ++i) {                                                                \
+            out[i] = a[i] scalar b[i];                                                      \
+        }                                                                                   \
+    }                                                                                       \
+    static void name##_sse2(const double* a, const double* b, double* out, size_t n)        \
+    {                                                                                       \
+        size_t i = 0;                                                                       \
+        for (; i + 2 <= n; i += 2) {                                                        \
+            _mm_storeu_pd(out + i, op128(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i)));        \
+        }                                                                                   \
+        for (; i < n; ++i) {                                                                \
+            out[i] = a[i] scalar b[i];                                                      \
+        }                                                                                   \
+    }
+
+ELEMENTWISE_F64(add_f64, _mm256_add_pd, _mm_add_pd, +)
+ELEMENTWISE_F64(mul_f64, _mm256_mul_pd, _mm_mul_pd, *)
+
+TARGET_AVX2 static void scale_f64_avx2(const double* data, double factor, double* out, size_t n)
+{
+    __m256d k = _mm256_set1_pd(factor);
+
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        _mm256_storeu_pd(out + i, _mm256_mul_pd(_mm256_loadu_pd(data + i), k));
+    }
+    for (; i < n; ++i) {
+        out[i] = data[i] * factor;
+    }
+}
+
+static void scale_f64_sse2(const double* data, double factor, double* out, size_t n)
+{
+    __m128d k = _mm_set1_pd(factor);
+
+    size_t i = 0;
+    for (; i + 2 <= n; i += 2) {
+        _mm_storeu_pd(out + i, _mm_mul_pd(_mm_loadu_pd(data + i), k));
+    }
+    for (; i < n; ++i) {
+        out[i] = data[i] * factor;
+    }
+}
+
+TARGET_AVX2 static void add_i64_avx2(const int64_t* a, const int64_t* b, int64_t* out, size_t n)
+{
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        auto x = _mm256_loadu_si256((const __m256i*)(a + i));
+        auto y = _mm256_loadu_si256((const __m256i*)(b + i));
+        _mm256_storeu_si256((__m256i*)(out + i), _mm256_add_epi64(x, y));
+    }
+    for (; i < n; ++i) {
+        out[i] = a[i] + b[i];
+    }
+}
+
+static void add_i64_sse2(const int64_t* a, const int64_t* b, int64_t* out, size_t n)
+{
+    size_t i = 0;
+    for (; i + 2 <= n; i += 2) {
+        auto x = _mm_loadu_si128((const __m128i*)(a + i));
+        auto y = _mm_loadu_si128((const __m128i*)(b + i));
+        _mm_storeu_si128((__m128i*)(out + i), _mm_add_epi64(x, y));
+    }
+    for (; i < n; ++i) {
+        out[i] = a[i] + b[i];
+    }
+}
+
+#else
+
+static double sum_f64_scalar(const double* data, size_t n)
+{
+    double acc[4] = { 0, 0, 0, 0 };
+
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        acc[0] += data[i];
+        acc[1] += data[i + 1];
+        acc[2] += data[i + 2];
+        acc[3] += data[i + 3];
+    }
+
+    double sum = (acc[0] + acc[1]) + (acc[2] + acc[3]);
+    for (; i < n; ++i) {
+        sum += data[i];
+    }
+
+    return sum;
+}
+
+static double dot_f64_scalar(const double* a, const double* b, size_t n)
+{
+    double acc[4] = { 0, 0, 0, 0 };
+
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        acc[0] += a[i] * b[i];
+        acc[1] += a[i + 1] * b[i + 1];
+        acc[2] += a[i + 2] * b[i + 2];
+        acc[3] += a[i + 3] * b[i + 3];
+    }
+
+    double sum = (acc[0] + acc[1]) + (acc[2] + acc[3]);
+    for (; i < n; ++i) {
+        sum += a[i] * b[i];
+    }
+
+    return sum;
+}
+
+#endif
+
+double sum_f64(const double* data, size_t n)
+{
+#ifdef EXPR_X86_SIMD
+    if (has_avx2()) {
+        return sum_f64_avx2(data, n);
+    }
+    return sum_f64_sse2(data, n);
+#else
+    return sum_f64_scalar(data, n);
+#endif
+}
+
+int64_t sum_i64(const int64_t* data, size_t n)
+{
+#ifdef EXPR_X86_SIMD
+    if (has_avx2()) {
+        return sum_i64_avx2(data, n);
+    }
+    return sum_i64_sse2(data, n);
+#else
+    int64_t sum = 0;
+    for (size_t i = 0; i < n; ++i) {
+        sum += data[i];
+    }
+    return sum;
+#endif
+}
+
+double dot_f64(const double* a, const double* b, size_t n)
+{
+#ifdef EXPR_X86_SIMD
+    if (has_avx2()) {
+        return dot_f64_avx2(a, b, n);
+    }
+    return dot_f64_sse2(a, b, n);
+#else
+    return dot_f64_scalar(a, b, n);
+#endif
+}
+
+int64_t dot_i64(const int64_t* a, const int64_t* b, size_t n)
+{
+    // there is no packed 64-bit multiply below AVX-512, so rely on
+    // independent accumulators instead
+    int64_t acc[4] = { 0, 0, 0, 0 };
+
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        acc[0] += a[i] * b[i];
+        acc[1] += a[i + 1] * b[i + 1];
+        acc[2] += a[i + 2] * b[i + 2];
+        acc[3] += a[i + 3] * b[i + 3];
+    }
+
+    int64_t sum = acc[0] + acc[1] + acc[2] + acc[3];
+    for (; i < n; ++i) {
+        sum += a[i] * b[i];
+    }
+
+    return sum;
+}
+
+template <typename T>
+static size_t find_first(const T* data, size_t n, T value)
+{
+    for (size_t i = 0; i < n; ++i) {
+        if (data[i] == value) {
+            return i;
+        }
+    }
+    return n;
+}
+
+template <typename T, typename Better>
+static size_t arg_scalar(const T* data, size_t n, Better better)
+{
+    size_t index = 0;
+    for (size_t i = 1; i < n; ++i) {
+        if (better(data[i], data[index])) {
+            index = i;
+        }
+    }
+    return index;
+}
+
+size_t argmin_f64(const double* data, size_t n)
+{
+#ifdef EXPR_X86_SIMD
+    // reduce with packed min first, then locate the first occurrence
+    auto min = has_avx2() ? min_f64_avx2(data, n) : min_f64_sse2(data, n);
+    auto index = find_first(data, n, min);
+    if (index != n) {
+        return index;
+    }
+#endif
+    return arg_scalar(data, n, [](double a, double b) { return a < b; });
+}
+
+size_t argmax_f64(const double* data, size_t n)
+{
+#ifdef EXPR_X86_SIMD
+    auto max = has_avx2() ? max_f64_avx2(data, n) : max_f64_sse2(data, n);
+    auto index = find_first(data, n, max);
+    if (index != n) {
+        return index;
+    }
+#endif
+    return arg_scalar(data, n, [](double a, double b) { return a > b; });
+}
+
+size_t argmin_i64(const int64_t* data, size_t n)
+{
+    return arg_scalar(data, n, [](int64_t a, int64_t b) { return a < b; });
+}
+
+size_t argmax_i64(const int64_t* data, size_t n)
+{
+    return arg_scalar(data, n, [](int64_t a, int64_t b) { return a > b; });
+}
+
+void scale_f64(const double* data, double factor, double* out, size_t n)
+{
+#ifdef EXPR_X86_SIMD
+    if (has_avx2()) {
+        return scale_f64_avx2(data, factor, out, n);
+    }
+    return scale_f64_sse2(data, factor, out, n);
+#else
+    for (size_t i = 0; i < n; ++i) {
+        out[i] = data[i] * factor;
+    }
+#endif
+}
+
+void scale_i64(const int64_t* data, int64_t factor, int64_t* out, size_t n)
+{
+    for (size_t i = 0; i < n; ++i) {
+        out[i] = data[i] * factor;
+    }
+}
+
+void add_f64(const double* a, const double* b, double* out, size_t n)
+{
+#ifdef EXPR_X86_SIMD
+    if (has_avx2()) {
+        return add_f64_avx2(a, b, out, n);
+    }
+    return add_f64_sse2(a, b, out, n);
+#else
+    for (size_t i = 0; i < n; ++i) {
+        out[i] = a[i] + b[i];
+    }
+#endif
+}
+
+void add_i64(const int64_t* a, const int64_t* b, int64_t* out, size_t n)
+{
+#ifdef EXPR_X86_SIMD
+    if (has_avx2()) {
+        return add_i64_avx2(a, b, out, n);
+    }
+    return add_i64_sse2(a, b, out, n);
+#else
+    for (size_t i = 0; i < n; ++i) {
+        out[i] = a[i] + b[i];
+    }
+#endif
+}
+
+void mul_f64(const double* a, const double* b, double* out, size_t n)
+{
+#ifdef EXPR_X86_SIMD
+    if (has_avx2()) {
+        return mul_f64_avx2(a, b, out, n);
+    }
+    return mul_f64_sse2(a, b, out, n);
+#else
+    for (size_t i = 0; i < n; ++i) {
+        out[i] = a[i] * b[i];
+    }
+#endif
+}
+
+void mul_i64(const int64_t* a, const int64_t* b, int64_t* out, size_t n)
+{
+    for (size_t i = 0; i < n; ++i) {
+        out[i] = a[i] * b[i];
+    }
+}
+
+template <typename T>
+static size_t filter(const T* data, const uint8_t* mask, T* out, size_t n)
+{
+    // branchless compaction: always store, only advance on a set mask byte
+    size_t count = 0;
+    for (size_t i = 0; i < n; ++i) {
+        out[count] = data[i];
+        count += mask[i] != 0;
+    }
+    return count;
+}
+
+size_t filter_f64(const double* data, const uint8_t* mask, double* out, size_t n)
+{
+    return filter(data, mask, out, n);
+}
+
+size_t filter_i64(const int64_t* data, const uint8_t* mask, int64_t* out, size_t n)
+{
+    return filter(data, mask, out, n);
+}
+
+// Numeric view over an array argument. Integer and float storage is used in
+// place, generic storage is converted once.
+class NumericArgument {
+public:
+    NumericArgument(const std::string& name, const Value& value)
+    {
+        if (value.kind() != ValueKind::Array) {
+            throw InvalidOperate(std::format("{} expects an Array, got {}",
+                name, value_kind_str(value.kind())));
+        }
+
+        auto& array = value.as_array();
+        if (auto integers = array.integers()) {
+            m_integers = integers->data();
+            m_length = integers->size();
+        } else if (auto floats = array.floats()) {
+            m_floats = floats->data();
+            m_length = floats->size();
+        } else {
+            m_length = array.length();
+            m_values = array.values();
+            for (auto& element : *m_values) {
+                switch (element.kind()) {
+                case ValueKind::Integer:
+                    m_converted.push_back(double(element.as_integer()));
+                    break;
+                case ValueKind::Float:
+                    m_converted.push_back(element.as_float());
+                    break;
+                default:
+                    throw InvalidOperate(std::format("{} expects numeric elements, got {}",
+                        name, value_kind_str(element.kind())));
+                }
+            }
+            m_floats = m_converted.data();
+        }
+    }
+
+    size_t length() const { return m_length; }
+    bool is_integers() const { return m_integers != nullptr; }
+    const int64_t* integers() const { return m_integers; }
+
+    // the element at `index` as stored, keeping the kind of each element of
+    // an array that mixes integers and floats
+    Value element(size_t index)
+    {
+        if (m_values != nullptr) {
+            return (*m_values)[index];
+        }
+        if (m_integers != nullptr) {
+            return Value(m_integers[index]);
+        }
+        return Value(m_floats[index]);
+    }
+
+    // the generic elements of a mixed array, null for typed storage
+    const std::vector<Value>* values() const { return m_values; }
+
+    const double* floats()
+    {
+        if (m_floats == nullptr) {
+            m_converted.assign(m_integers, m_integers + m_length);
+            m_floats = m_converted.data();
+        }
+        return m_floats;
+    }
+
+private:
+    const int64_t* m_integers = nullptr;
+    const double* m_floats = nullptr;
+    const std::vector<Value>* m_values = nullptr;
+    size_t m_length = 0;
+    std::vector<double> m_converted;
+};
+
+static void check_lengths(const std::string& name, NumericArgument& a,
+    NumericArgument& b)
+{
+    if (a.length() != b.length()) {
+        throw InvalidOperate(std::format("{} expects arrays of the same length, got {} and {}",
+            name, a.length(), b.length()));
+    }
+}
+
+static void check_not_empty(const std::string& name, NumericArgument& a)
+{
+    if (a.length() == 0) {
+        throw InvalidOperate(std::format("{} of an empty Array", name));
+    }
+}
+
+template <typename T>
+static Value make_array(std::vector<T> values)
+{
+    track_allocation(ValueKind::Array, values.capacity() * sizeof(T));
+    return Value(make_object<Array>(ValueKind::Array, std::move(values)));
+}
+
+template <typename IntegerKernel, typename FloatKernel>
+static void define_elementwise(BuiltinTable& table, std::string name,
+    IntegerKernel integer_kernel, FloatKernel float_kernel)
+{
+    define_builtin(table, name, [name, integer_kernel, float_kernel](std::vector<Value>& args) {
+        check_arguments(name, args, 2);
+        NumericArgument a(name, args[0]);
+        NumericArgument b(name, args[1]);
+        check_lengths(name, a, b);
+
+        if (a.is_integers() && b.is_integers()) {
+            std::vector<int64_t> out(a.length());
+            integer_kernel(a.integers(), b.integers(), out.data(), out.size());
+            return make_array(std::move(out));
+        }
+
+        std::vector<double> out(a.length());
+        float_kernel(a.floats(), b.floats(), out.data(), out.size());
+        return make_array(std::move(out));
+    });
+}
+
+void register_kernel_builtins(BuiltinTable& table)
+{
+    define_builtin(table, "sum", [](std::vector<Value>& args) {
+        check_arguments("sum", args, 1);
+        NumericArgument a("sum", args[0]);
+        if (a.is_integers()) {
+            return Value(sum_i64(a.integers(), a.length()));
+        }
+        return Value(sum_f64(a.floats(), a.length()));
+    });
+
+    define_builtin(table, "mean", [](std::vector<Value>& args) {
+        check_arguments("mean", args, 1);
+        NumericArgument a("mean", args[0]);
+        check_not_empty("mean", a);
+        if (a.is_integers()) {
+            return Value(double(sum_i64(a.integers(), a.length())) / double(a.length()));
+        }
+        return Value(sum_f64(a.floats(), a.length()) / double(a.length()));
+    });
+
+    define_builtin(table, "dot", [](std::vector<Value>& args) {
+        check_arguments("dot", args, 2);
+        NumericArgument a("dot", args[0]);
+        NumericArgument b("dot", args[1]);
+        check_lengths("dot", a, b);
+        if (a.is_integers() && b.is_integers()) {
+            return Value(dot_i64(a.integers(), b.integers(), a.length()));
+        }
+        return Value(dot_f64(a.floats(), b.floats(), a.length()));
+    });
+
+    define_builtin(table, "min", [](std::vector<Value>& args) {
+        check_arguments("min", args, 1);
+        NumericArgument a("min", args[0]);
+        check_not_empty("min", a);
+        if (a.is_integers()) {
+            return Value(a.integers()[argmin_i64(a.integers(), a.length())]);
+        }
+        return a.element(argmin_f64(a.floats(), a.length()));
+    });
+
+    define_builtin(table, "max", [](std::vector<Value>& args) {
+        check_arguments("max", args, 1);
+        NumericArgument a("max", args[0]);
+        check_not_empty("max", a);
+        if (a.is_integers()) {
+            return Value(a.integers()[argmax_i64(a.integers(), a.length())]);
+        }
+        return a.element(argmax_f64(a.floats(), a.length()));
+    });
+
+    define_builtin(table, "argmax", [](std::vector<Value>& args) {
+        check_arguments("argmax", args, 1);
+        NumericArgument a("argmax", args[0]);
+        check_not_empty("argmax", a);
+        if (a.is_integers()) {
+            return Value(int64_t(argmax_i64(a.integers(), a.length())));
+        }
+        return Value(int64_t(argmax_f64(a.floats(), a.length())));
+    });
+
+    define_builtin(table, "scale", [](std::vector<Value>& args) {
+        check_arguments("scale", args, 2);
+        NumericArgument a("scale", args[0]);
+        auto& factor = args[1];
+        if (factor.kind() != ValueKind::Integer && factor.kind() != ValueKind::Float) {
+            throw InvalidOperate(std::format("scale expects a numeric factor, got {}",
+                value_kind_str(factor.kind())));
+        }
+        if (a.is_integers() && factor.kind() == ValueKind::Integer) {
+            std::vector<int64_t> out(a.length());
+            scale_i64(a.integers(), factor.as_integer(), out.data(), out.size());
+            return make_array(std::move(out));
+        }
+
+        std::vector<double> out(a.length());
+        scale_f64(a.floats(), from_value<double>(factor), out.data(), out.size());
+        return make_array(std::move(out));
+    });
+
+    define_elementwise(table, "vadd", add_i64, add_f64);
+    define_elementwise(table, "vmul", mul_i64, mul_f64);
+
+    define_builtin(table, "filter", [](std::vector<Value>& args) {
+        check_arguments("filter", args, 2);
+        NumericArgument a("filter", args[0]);
+        if (args[1].kind() != ValueKind::Array) {
+            throw InvalidOperate(std::format("filter expects an Array mask, got {}",
+                value_kind_str(args[1].kind())));
+        }
+
+        auto& mask_array = args[1].as_array();
+        if (mask_array.length() != a.length()) {
+            throw InvalidOperate(std::format("filter expects a mask of length {}, got {}",
+                a.length(), mask_array.length()));
+        }
+
+        std::vector<uint8_t> mask(a.length());
+        if (auto integers = mask_array.integers()) {
+            for (size_t i = 0; i < mask.size(); ++i) {
+                mask[i] = (*integers)[i] != 0;
+            }
+        } else {
+            for (size_t i = 0; i < mask.size(); ++i) {
+                auto element = mask_array.get(i);
+                if (element.kind() != ValueKind::Boolean) {
+                    throw InvalidOperate(std::format("filter expects a Boolean mask, got {}",
+                        value_kind_str(element.kind())));
+                }
+                mask[i] = element.as_boolean();
+            }
+        }
+
+        if (a.is_integers()) {
+            std::vector<int64_t> out(a.length());
+            out.resize(filter_i64(a.integers(), mask.data(), out.data(), out.size()));
+            return make_array(std::move(out));
+        }
+
+        if (auto values = a.values()) {
+            std::vector<Value> out;
+            for (size_t i = 0; i < mask.size(); ++i) {
+                if (mask[i]) {
+                    out.push_back((*values)[i]);
+                }
+            }
+            return Value(make_object<Array>(ValueKind::Array, std::move(out)));
+        }
+
+        std::vector<double> out(a.length());
+        out.resize(filter_f64(a.floats(), mask.data(), out.data(), out.size()));
+        return make_array(std::move(out));
+    });
+}
@@ -0,0 +1,46 @@
+#include "mapped_file.h"
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <format>
+#include <stdexcept>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+MappedFile::MappedFile(const std::string& path)
+{
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error(std::format("cannot open {}: {}", path, std::strerror(errno)));
+    }
+
+    struct stat st;
+    if (::fstat(fd, &st) != 0) {
+        auto error = errno;
+        ::close(fd);
+        throw std::runtime_error(std::format("cannot stat {}: {}", path, std::strerror(error)));
+    }
+
+    m_size = size_t(st.st_size);
+    if (m_size > 0) {
+        auto data = ::mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED) {
+            auto error = errno;
+            ::close(fd);
+            throw std::runtime_error(std::format("cannot map {}: {}", path, std::strerror(error)));
+        }
+        ::madvise(data, m_size, MADV_SEQUENTIAL);
+        m_data = static_cast<const char*>(data);
+    }
+
+    ::close(fd);
+}
+
+MappedFile::~MappedFile()
+{
+    if (m_data != nullptr) {
+        ::munmap(const_cast<char*>(m_data), m_size);
+    }
+}
@@ -0,0 +1,332 @@
+#include "memo.h"
+#include "ast.h"
+#include "object.h"
+#include <bit>
+#include <format>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+using Names = std::unordered_set<std::string>;
+
+// lets, for loop initializers and parameters anywhere in the statement
+static void bindings(Statement& statement, Names& names)
+{
+    switch (statement.kind()) {
+    case ASTNode::Kind::LetStmt:
+        names.insert(dynamic_cast<LetStatement&>(statement).name());
+        break;
+    case ASTNode::Kind::IfStmt: {
+        auto& if_stmt = dynamic_cast<IfStatement&>(statement);
+        bindings(if_stmt.then_branch(), names);
+        if (if_stmt.else_branch()) {
+            bindings(*if_stmt.else_branch(), names);
+        }
+        break;
+    }
+    case ASTNode::Kind::ForStmt: {
+        auto& for_stmt = dynamic_cast<ForStatement&>(statement);
+        if (for_stmt.initializer()) {
+            bindings(*for_stmt.initializer(), names);
+        }
+        bindings(for_stmt.body(), names);
+        break;
+    }
+    case ASTNode::Kind::BlockStmt:
+        for (auto& stmt : dynamic_cast<BlockStatement&>(statement).statements()) {
+            bindings(*stmt, names);
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+namespace {
+
+// Checks one function body against the functions still assumed pure. Names
+// are only local from their `let` on and within the block declaring it, so a
+// read that could reach the caller's bindings under dynamic scoping fails.
+class PurityCheck {
+public:
+    PurityCheck(const Names& pure)
+        : m_pure(pure)
+    {
+    }
+
+    bool check(FnStatement& fn)
+    {
+        Names locals(fn.params().begin(), fn.params().end());
+        return statement(fn.body(), locals);
+    }
+
+private:
+    bool statement(Statement& statement, Names& locals);
+    bool expression(Expression& expression, const Names& locals);
+    bool local(Expression& expression, const Names& locals);
+
+    const Names& m_pure;
+};
+
+bool PurityCheck::local(Expression& expression, const Names& locals)
+{
+    return expression.kind() == ASTNode::Kind::VariableExpr
+        && locals.contains(dynamic_cast<VariableExpression&>(expression).name());
+}
+
+bool PurityCheck::statement(Statement& statement, Names& locals)
+{
+    switch (statement.kind()) {
+    case ASTNode::Kind::LetStmt: {
+        auto& let = dynamic_cast<LetStatement&>(statement);
+        if (let.value() && !expression(*let.value(), locals)) {
+            return false;
+        }
+        locals.insert(let.name());
+        return true;
+    }
+    case ASTNode::Kind::IfStmt: {
+        auto& if_stmt = dynamic_cast<IfStatement&>(statement);
+        if (!expression(if_stmt.condition(), locals)) {
+            return false;
+        }
+        Names then_locals = locals;
+        if (!this->statement(if_stmt.then_branch(), then_locals)) {
+            return false;
+        }
+        Names else_locals = locals;
+        return !if_stmt.else_branch() || this->statement(*if_stmt.else_branch(), else_locals);
+    }
+    case ASTNode::Kind::ForStmt: {
+        auto& for_stmt = dynamic_cast<ForStatement&>(statement);
+        Names loop_locals = locals;
+        if (for_stmt.initializer() && !this->statement(*for_stmt.initializer(), loop_locals)) {
+            return false;
+        }
+        if (for_stmt.condition() && !expression(*for_stmt.condition(), loop_locals)) {
+            return false;
+        }
+        if (for_stmt.increment() && !expression(*for_stmt.increment(), loop_locals)) {
+            return false;
+        }
+        return this->statement(for_stmt.body(), loop_locals);
+    }
+    case ASTNode::Kind::BlockStmt: {
+        Names block_locals = locals;
+        for (auto& stmt : dynamic_cast<BlockStatement&>(statement).statements()) {
+            if (!this->statement(*stmt, block_locals)) {
+                return false;
+            }
+        }
+        return true;
+    }
+    case ASTNode::Kind::ReturnStmt: {
+        auto& ret = dynamic_cast<ReturnStatement&>(statement);
+        return !ret.value() || expression(*ret.value(), locals);
+    }
+    case ASTNode::Kind::ExprStmt:
+        return expression(dynamic_cast<ExpressionStatement&>(statement).expr(), locals);
+    case ASTNode::Kind::EmptyStmt:
+    case ASTNode::Kind::BreakStmt:
+    case ASTNode::Kind::ContinueStmt:
+        return true;
+    default:
+        return false;
+    }
+}
+
+bool PurityCheck::expression(Expression& expression, const Names& locals)
+{
+    switch (expression.kind()) {
+    case ASTNode::Kind::LiteralExpr:
+        return true;
+    case ASTNode::Kind::VariableExpr: {
+        auto& name = dynamic_cast<VariableExpression&>(expression).name();
+        return locals.contains(name) || m_pure.contains(name);
+    }
+    case ASTNode::Kind::BinaryExpr: {
+        auto& binary = dynamic_cast<BinaryExpression&>(expression);
+        if (binary.op() == Operator::Assign) {
+            return local(binary.left(), locals) && this->expression(binary.right(), locals);
+        }
+        return this->expression(binary.left(), locals) && this->expression(binary.right(), locals);
+    }
+    case ASTNode::Kind::PrefixExpr:
+        return this->expression(dynamic_cast<PrefixExpression&>(expression).expr(), locals);
+    case ASTNode::Kind::PostfixExpr:
+        return local(dynamic_cast<PostfixExpression&>(expression).expr(), locals);
+    case ASTNode::Kind::CallExpr: {
+        auto& call = dynamic_cast<CallExpression&>(expression);
+        if (call.callee().kind() != ASTNode::Kind::VariableExpr || local(call.callee(), locals)
+            || !m_pure.contains(dynamic_cast<VariableExpression&>(call.callee()).name())) {
+            return false;
+        }
+        for (auto& arg : call.args()) {
+            if (!this->expression(*arg, locals)) {
+                return false;
+            }
+        }
+        return true;
+    }
+    case ASTNode::Kind::IndexExpr: {
+        auto& index = dynamic_cast<IndexExpression&>(expression);
+        return this->expression(index.object(), locals) && this->expression(index.index(), locals);
+    }
+    case ASTNode::Kind::AccessExpr:
+        return this->expression(dynamic_cast<AccessExpression&>(expression).object(), locals);
+    case ASTNode::Kind::ArrayExpr:
+        for (auto& element : dynamic_cast<ArrayExpression&>(expression).elements()) {
+            if (!this->expression(*element, locals)) {
+                return false;
+            }
+        }
+        return true;
+    case ASTNode::Kind::ObjectExpr:
+        for (auto& value : dynamic_cast<ObjectExpression&>(expression).values()) {
+            if (!this->expression(*value, locals)) {
+                return false;
+            }
+        }
+        return true;
+    default:
+        return false;
+    }
+}
+
+}
+
+std::unordered_set<std::string> pure_functions(Program& program)
+{
+    // a function whose name is also a variable somewhere may be shadowed at a call
+    Names rebound;
+    for (auto& stmt : program.statements()) {
+        bindings(*stmt, rebound);
+    }
+    for (auto& [name, fn] : program.functions()) {
+        rebound.insert(fn->params().begin(), fn->params().end());
+        bindings(fn->body(), rebound);
+    }
+
+    Names pure;
+    for (auto& [name, fn] : program.functions()) {
+        if (!rebound.contains(name)) {
+            pure.insert(name);
+        }
+    }
+
+    // drop the functions that fail against the rest until none does
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        PurityCheck check(pure);
+        for (auto& [name, fn] : program.functions()) {
+            if (pure.contains(name) && !check.check(*fn)) {
+                pure.erase(name);
+                changed = true;
+            }
+        }
+    }
+    return pure;
+}
+
+static bool cacheable(const Value& value)
+{
+    switch (value.kind()) {
+    case ValueKind::Undefined:
+    case ValueKind::Boolean:
+    case ValueKind::Integer:
+    case ValueKind::Float:
+    case ValueKind::String:
+        return true;
+    default:
+        return false;
+    }
+}
+
+MemoCache::MemoCache(Program& program, size_t capacity)
+    : m_capacity(capacity)
+{
+    for (auto& name : pure_functions(program)) {
+        m_pure.insert(program.functions().at(name).get());
+    }
+}
+
+std::optional<std::string> MemoCache::key(const FnStatement& fn, const std::vector<Value>& args) const
+{
+    auto key = std::format("{}", static_cast<const void*>(&fn));
+    for (auto& arg : args) {
+        switch (arg.kind()) {
+        case ValueKind::Undefined:
+            key += ",u";
+            break;
+        case ValueKind::Boolean:
+            key += arg.as_boolean() ? ",t" : ",f";
+            break;
+        case ValueKind::Integer:
+            key += std::format(",i{}", arg.as_integer());
+            break;
+        case ValueKind::Float:
+            key += std::format(",d{:x}", std::bit_cast<uint64_t>(arg.as_float()));
+            break;
+        case ValueKind::String: {
+            auto& string = arg.as_string();
+            key += std::format(",s{}:", string.size());
+            key += string;
+            break;
+        }
+        default:
+            return std::nullopt;
+        }
+    }
+    return key;
+}
+
+std::optional<Value> MemoCache::lookup(const FnStatement& fn, const std::vector<Value>& args)
+{
+    auto found_key = key(fn, args);
+    if (!found_key) {
+        m_stats.skipped++;
+        return std::nullopt;
+    }
+
+    auto found = m_index.find(*found_key);
+    if (found == m_index.end()) {
+        m_stats.misses++;
+        return std::nullopt;
+    }
+
+    m_stats.hits++;
+    m_entries.splice(m_entries.begin(), m_entries, found->second);
+    return found->second->result;
+}
+
+void MemoCache::store(const FnStatement& fn, const std::vector<Value>& args, const Value& result)
+{
+    if (m_capacity == 0 || !cacheable(result)) {
+        return;
+    }
+    auto stored_key = key(fn, args);
+    if (!stored_key || m_index.contains(*stored_key)) {
+        return;
+    }
+
+    if (m_entries.size() >= m_capacity) {
+        m_index.erase(m_entries.back().key);
+        m_entries.pop_back();
+        m_stats.evictions++;
+    }
+    m_entries.push_front({ *stored_key, result });
+    m_index.emplace(std::move(*stored_key), m_entries.begin());
+}
+
+void MemoCache::clear()
+{
+    m_entries.clear();
+    m_index.clear();
+}
+
+std::string MemoCache::report() const
+{
+    return std::format("pure: {}, entries: {}, hits: {}, misses: {}, evictions: {}, skipped: {}", m_pure.size(),
+        m_entries.size(), m_stats.hits, m_stats.misses, m_stats.evictions, m_stats.skipped);
+}
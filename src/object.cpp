@@ -1,8 +1,10 @@
 #include "object.h"
+#include "alloc.h"
 #include "ast.h"
 #include <cstdint>
 #include <iostream>
 #include <memory>
+#include <sstream>
 #include <typeinfo>
 
 std::string value_kind_str(ValueKind kind)
@@ -61,70 +63,69 @@ Comparison Object::compare(const Value& other)
     throw InvalidOperate(Operator::Equals, this->kind(), other.kind());
 }
 
-Value Object::index(const Value& index)
+Value Object::index(const Value&)
 {
     throw std::runtime_error("Not implemented");
 }
 
-Value Object::call(Value args...)
+void Object::set_index(const Value&, Value)
 {
     throw std::runtime_error("Not implemented");
 }
 
-Value Object::get_attr(std::string name)
+Value Object::call(std::vector<Value>&)
 {
     throw std::runtime_error("Not implemented");
 }
 
-void Object::set_attr(std::string name, Value value)
+Value Object::get_attr(std::string name)
 {
-    throw std::runtime_error("Not implemented");
+    throw InvalidOperate(std::format("invalid attribute {} for {}", name,
+        value_kind_str(this->kind())));
 }
 
-Value Object::method(std::string name, std::vector<const Value>& args)
+void Object::set_attr(std::string name, Value)
 {
-    throw std::runtime_error("Not implemented");
+    throw InvalidOperate(std::format("invalid attribute {} for {}", name,
+        value_kind_str(this->kind())));
 }
 
-template <typename T, typename... Arguments> Value NativeFunction<T, Arguments...>::call(Value args...) {
-    return Value(m_func(args));
+Value Object::method(std::string, std::vector<const Value>&)
+{
+    throw std::runtime_error("Not implemented");
 }
 
-
 Value::Value()
-    : m_obj(std::make_shared<Undefined>())
+    : m_obj(make_object<Undefined>(ValueKind::Undefined))
 {
 }
 
 Value::Value(bool value)
-    : m_obj(std::make_shared<Boolean>(value))
+    : m_obj(make_object<Boolean>(ValueKind::Boolean, value))
 {
 }
 
 Value::Value(int value)
-    : m_obj(std::make_shared<Integer>(value))
+    : m_obj(make_object<Integer>(ValueKind::Integer, value))
 {
 }
 
 Value::Value(int64_t value)
-    : m_obj(std::make_shared<Integer>(value))
+    : m_obj(make_object<Integer>(ValueKind::Integer, value))
 {
 }
 
 Value::Value(double value)
-    : m_obj(std::make_shared<Float>(value))
+    : m_obj(make_object<Float>(ValueKind::Float, value))
 {
 }
 
 Value::Value(std::string value)
-    : m_obj(std::make_shared<String>(value))
 {
-}
-
-Value Value::operator=(const Value& other)
-{
-    m_obj = other.m_obj;
-    return *this;
+    if (value.capacity() > std::string().capacity()) {
+        track_allocation(ValueKind::String, value.capacity() + 1);
+    }
+    m_obj = make_object<String>(ValueKind::String, std::move(value));
 }
 
 Value::operator bool() const
@@ -187,6 +188,21 @@ UserFunction& Value::as_user_function() const
     return *std::dynamic_pointer_cast<UserFunction>(this->m_obj);
 }
 
+Array& Value::as_array() const
+{
+    return *std::dynamic_pointer_cast<Array>(this->m_obj);
+}
+
+ShapedObject& Value::as_shaped() const
+{
+    return *std::dynamic_pointer_cast<ShapedObject>(this->m_obj);
+}
+
+Record& Value::as_record() const
+{
+    return *std::dynamic_pointer_cast<Record>(this->m_obj);
+}
+
 Comparison Undefined::compare(const Value& other)
 {
     switch (other.kind()) {
@@ -413,12 +429,118 @@ Comparison Float::compare(const Value& other)
     }
 }
 
+// concatenations up to this long are copied at once
+static constexpr size_t flat_concat_limit = 64;
+
+String::~String()
+{
+    if (!m_left) {
+        if (m_value.capacity() > std::string().capacity()) {
+            track_release(m_value.capacity() + 1);
+        }
+        return;
+    }
+
+    // long chains of concatenations are released without recursing through them
+    track_release(m_size);
+    std::vector<std::shared_ptr<String>> pending;
+    pending.push_back(std::move(m_left));
+    pending.push_back(std::move(m_right));
+    while (!pending.empty()) {
+        auto node = std::move(pending.back());
+        pending.pop_back();
+        if (node.use_count() == 1 && node->m_left) {
+            track_release(node->m_size);
+            pending.push_back(std::move(node->m_left));
+            pending.push_back(std::move(node->m_right));
+        }
+    }
+}
+
+void String::append_to(std::string& out) const
+{
+    std::vector<const String*> pending = { this };
+    while (!pending.empty()) {
+        auto node = pending.back();
+        pending.pop_back();
+        if (node->m_left) {
+            pending.push_back(node->m_right.get());
+            pending.push_back(node->m_left.get());
+        } else {
+            out += node->m_borrowed ? node->m_view : std::string_view(node->m_value);
+        }
+    }
+}
+
+Value String::borrow(std::string_view text)
+{
+    return Value(make_object<String>(ValueKind::String, String::Borrowed {}, text));
+}
+
+Value String::slice(const std::shared_ptr<String>& owner, size_t offset, size_t size)
+{
+    auto view = owner->view().substr(offset, size);
+    if (view.size() <= std::string().capacity()) {
+        return Value(std::string(view));
+    }
+
+    auto slice = make_object<String>(ValueKind::String, String::Borrowed {}, view);
+    slice->m_owner = owner->m_owner ? owner->m_owner : owner;
+    return Value(slice);
+}
+
+std::string_view String::view()
+{
+    if (m_borrowed) {
+        return m_view;
+    }
+    return value();
+}
+
+std::string& String::value()
+{
+    if (m_borrowed) {
+        m_value = m_view;
+        m_borrowed = false;
+        m_view = {};
+        m_owner = nullptr;
+        if (m_value.capacity() > std::string().capacity()) {
+            track_allocation(ValueKind::String, m_value.capacity() + 1);
+        }
+    }
+    if (m_left) {
+        // charged before the copy is made so the cap stops it
+        track_allocation(ValueKind::String, m_size + 1);
+        std::string value;
+        value.reserve(m_size);
+        if (value.capacity() > m_size) {
+            track_allocation(ValueKind::String, value.capacity() - m_size);
+        }
+        append_to(value);
+        m_value = std::move(value);
+        m_left = nullptr;
+        m_right = nullptr;
+        track_release(m_size);
+    }
+    return m_value;
+}
+
 Value String::add(const Value& other)
 {
     switch (other.kind()) {
     case ValueKind::String: {
-        auto other_string = other.as_string();
-        return Value(this->value() + other_string);
+        auto right = std::static_pointer_cast<String>(other.obj());
+        if (m_size + right->size() <= flat_concat_limit) {
+            std::string value;
+            value.reserve(m_size + right->size());
+            append_to(value);
+            right->append_to(value);
+            return Value(std::move(value));
+        }
+        // a concatenation is charged the characters it stands for until it is
+        // flattened, as if it were already flat
+        track_allocation(ValueKind::String, m_size + right->size());
+        return Value(make_object<String>(ValueKind::String, shared_from_this(), std::move(right)));
     }
     default:
         throw InvalidOperate(Operator::Add, this->kind(), other.kind());
@@ -429,12 +551,280 @@ Comparison String::compare(const Value& other)
 {
     switch (other.kind()) {
     case ValueKind::String: {
-        auto other_string = other.as_string();
-        return this->value() == other_string ? Comparison::Equal
-            : this->value() > other_string   ? Comparison::Greater
-                                             : Comparison::Less;
+        auto lhs = this->view();
+        auto rhs = static_cast<String*>(other.get())->view();
+        return lhs == rhs ? Comparison::Equal : lhs > rhs ? Comparison::Greater : Comparison::Less;
     }
     default:
         throw InvalidOperate(Operator::Equals, this->kind(), other.kind());
     }
-}
\ No newline at end of file
+}
+
+Array::Array(std::vector<Value> values)
+{
+    bool integers = !values.empty();
+    bool floats = !values.empty();
+    for (auto& value : values) {
+        integers = integers && value.kind() == ValueKind::Integer;
+        floats = floats && value.kind() == ValueKind::Float;
+    }
+
+    if (integers) {
+        std::vector<int64_t> storage;
+        storage.reserve(values.size());
+        for (auto& value : values) {
+            storage.push_back(value.as_integer());
+        }
+        m_storage = std::move(storage);
+    } else if (floats) {
+        std::vector<double> storage;
+        storage.reserve(values.size());
+        for (auto& value : values) {
+            storage.push_back(value.as_float());
+        }
+        m_storage = std::move(storage);
+    } else {
+        m_storage = std::move(values);
+    }
+
+    track_allocation(ValueKind::Array, capacity_bytes());
+}
+
+std::string Array::inspect()
+{
+    std::stringstream ss;
+
+    ss << "[";
+    for (size_t i = 0; i < length(); ++i) {
+        if (i > 0) {
+            ss << ", ";
+        }
+        ss << get(i).inspect();
+    }
+    ss << "]";
+
+    return ss.str();
+}
+
+size_t Array::length() const
+{
+    return std::visit([](auto& storage) { return storage.size(); }, m_storage);
+}
+
+Array::~Array()
+{
+    track_release(capacity_bytes());
+}
+
+size_t Array::capacity_bytes() const
+{
+    return std::visit([](auto& storage) {
+        return storage.capacity() * sizeof(storage[0]);
+    },
+        m_storage);
+}
+
+void Array::reserve(size_t capacity)
+{
+    auto before = capacity_bytes();
+    std::visit([capacity](auto& storage) { storage.reserve(capacity); }, m_storage);
+    auto after = capacity_bytes();
+    if (after > before) {
+        track_allocation(ValueKind::Array, after - before);
+    }
+}
+
+Value Array::get(size_t index) const
+{
+    if (auto storage = std::get_if<std::vector<int64_t>>(&m_storage)) {
+        return Value((*storage)[index]);
+    }
+    if (auto storage = std::get_if<std::vector<double>>(&m_storage)) {
+        return Value((*storage)[index]);
+    }
+    return std::get<std::vector<Value>>(m_storage)[index];
+}
+
+void Array::set(size_t index, Value value)
+{
+    auto kind = value.kind();
+
+    if (auto storage = integers()) {
+        if (kind == ValueKind::Integer) {
+            (*storage)[index] = value.as_integer();
+            return;
+        }
+        generalize();
+    } else if (auto storage = floats()) {
+        if (kind == ValueKind::Float) {
+            (*storage)[index] = value.as_float();
+            return;
+        }
+        generalize();
+    }
+
+    (*values())[index] = value;
+}
+
+void Array::push(Value value)
+{
+    auto kind = value.kind();
+
+    // an empty array takes the storage of its first element
+    if (length() == 0) {
+        if (kind == ValueKind::Integer && !integers()) {
+            m_storage = std::vector<int64_t>();
+        } else if (kind == ValueKind::Float && !floats()) {
+            m_storage = std::vector<double>();
+        }
+    }
+
+    bool typed = (integers() && kind == ValueKind::Integer) || (floats() && kind == ValueKind::Float);
+    if (!typed) {
+        generalize();
+    }
+
+    auto before = capacity_bytes();
+
+    if (auto storage = integers(); storage && kind == ValueKind::Integer) {
+        storage->push_back(value.as_integer());
+    } else if (auto storage = floats(); storage && kind == ValueKind::Float) {
+        storage->push_back(value.as_float());
+    } else {
+        values()->push_back(value);
+    }
+
+    auto after = capacity_bytes();
+    if (after > before) {
+        track_allocation(ValueKind::Array, after - before);
+    }
+}
+
+size_t Array::checked_index(const Value& index) const
+{
+    if (index.kind() != ValueKind::Integer) {
+        throw InvalidOperate(std::format("invalid index of {} for Array",
+            value_kind_str(index.kind())));
+    }
+
+    auto i = index.as_integer();
+    if (i < 0 || size_t(i) >= length()) {
+        throw std::runtime_error(std::format("index {} out of range for Array of length {}",
+            i, length()));
+    }
+
+    return size_t(i);
+}
+
+Value Array::index(const Value& index)
+{
+    return get(checked_index(index));
+}
+
+void Array::set_index(const Value& index, Value value)
+{
+    set(checked_index(index), value);
+}
+
+void Array::generalize()
+{
+    if (values() != nullptr) {
+        return;
+    }
+
+    auto before = capacity_bytes();
+
+    std::vector<Value> storage;
+    storage.reserve(length());
+    for (size_t i = 0; i < length(); ++i) {
+        storage.push_back(get(i));
+    }
+    m_storage = std::move(storage);
+
+    track_release(before);
+    track_allocation(ValueKind::Array, capacity_bytes());
+}
+
+std::string ShapedObject::inspect()
+{
+    std::stringstream ss;
+
+    ss << "{";
+    auto& keys = m_shape->keys();
+    for (size_t i = 0; i < keys.size(); ++i) {
+        if (i > 0) {
+            ss << ", ";
+        }
+        ss << keys[i] << ": " << load(i).inspect();
+    }
+    ss << "}";
+
+    return ss.str();
+}
+
+Value ShapedObject::get_attr(std::string name)
+{
+    auto slot = m_shape->lookup(name);
+    if (!slot.has_value()) {
+        return Value();
+    }
+
+    return load(slot.value());
+}
+
+Value ShapedObject::index(const Value& index)
+{
+    if (index.kind() != ValueKind::String) {
+        throw InvalidOperate(std::format("invalid index of {} for Object",
+            value_kind_str(index.kind())));
+    }
+
+    return get_attr(index.as_string());
+}
+
+void ShapedObject::set_index(const Value& index, Value value)
+{
+    if (index.kind() != ValueKind::String) {
+        throw InvalidOperate(std::format("invalid index of {} for Object",
+            value_kind_str(index.kind())));
+    }
+
+    set_attr(index.as_string(), value);
+}
+
+Record::Record(Shape* shape, std::vector<Value> slots)
+    : ShapedObject(shape)
+    , m_slots(std::move(slots))
+{
+    track_allocation(ValueKind::Object, m_slots.capacity() * sizeof(Value));
+}
+
+Record::~Record()
+{
+    track_release(m_slots.capacity() * sizeof(Value));
+}
+
+void Record::set_attr(std::string name, Value value)
+{
+    auto slot = m_shape->lookup(name);
+    if (slot.has_value()) {
+        m_slots[slot.value()] = value;
+        return;
+    }
+
+    if (m_dictionary) {
+        m_dictionary->add(name);
+    } else if (auto next = m_shape->extend(name)) {
+        m_shape = next;
+    } else {
+        m_dictionary = Shape::dictionary(*m_shape);
+        m_dictionary->add(name);
+        m_shape = m_dictionary.get();
+    }
+
+    auto before = m_slots.capacity();
+    m_slots.push_back(value);
+    if (m_slots.capacity() > before) {
+        track_allocation(ValueKind::Object, (m_slots.capacity() - before) * sizeof(Value));
+    }
+}
@@ -0,0 +1,1868 @@
+#include "optimizer.h"
+#include "ast.h"
+#include "builtins.h"
+#include "eval.h"
+#include "parser.h"
+#include <algorithm>
+#include <format>
+#include <functional>
+#include <map>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+std::string LoopStats::report() const
+{
+    return std::format("loops: {}, hoisted: {}, reduced: {}", loops, hoisted, reduced);
+}
+
+std::string InlineStats::report() const
+{
+    return std::format("inlined: {}, folded: {}", inlined, folded);
+}
+
+std::string CseStats::report() const
+{
+    return std::format("expressions: {}, eliminated: {}", expressions, eliminated);
+}
+
+std::string SpecializeStats::report() const
+{
+    return std::format("substituted: {}, {}", substituted, dead.report());
+}
+
+std::string DeadCodeStats::report() const
+{
+    auto names = [](const std::vector<std::string>& names) {
+        std::string list;
+        for (auto& name : names) {
+            list += (list.empty() ? "" : ", ") + name;
+        }
+        return list;
+    };
+    return std::format("statements: {}, branches: {}, bindings: {} [{}], functions: {} [{}]", statements, branches,
+        bindings.size(), names(bindings), functions.size(), names(functions));
+}
+
+using Names = std::unordered_set<std::string>;
+using Statements = std::vector<std::unique_ptr<Statement>>;
+
+// Called with every expression slot, outermost first; returning true means the
+// slot was replaced and its children are not visited. Assignment and postfix
+// targets are not offered, only the expressions inside them.
+using SlotVisitor = std::function<bool(std::unique_ptr<Expression>&)>;
+
+static void visit(std::unique_ptr<Expression>& slot, const SlotVisitor& visitor);
+
+static void visit_children(Expression& expression, const SlotVisitor& visitor)
+{
+    switch (expression.kind()) {
+    case ASTNode::Kind::BinaryExpr: {
+        auto& binary = dynamic_cast<BinaryExpression&>(expression);
+        if (binary.op() == Operator::Assign) {
+            if (binary.left().kind() != ASTNode::Kind::VariableExpr) {
+                visit_children(binary.left(), visitor);
+            }
+        } else {
+            visit(binary.left_ptr(), visitor);
+        }
+        visit(binary.right_ptr(), visitor);
+        break;
+    }
+    case ASTNode::Kind::PrefixExpr:
+        visit(dynamic_cast<PrefixExpression&>(expression).expr_ptr(), visitor);
+        break;
+    case ASTNode::Kind::CallExpr: {
+        auto& call = dynamic_cast<CallExpression&>(expression);
+        visit(call.callee_ptr(), visitor);
+        for (auto& arg : call.args()) {
+            visit(arg, visitor);
+        }
+        break;
+    }
+    case ASTNode::Kind::ArrayExpr:
+        for (auto& element : dynamic_cast<ArrayExpression&>(expression).elements()) {
+            visit(element, visitor);
+        }
+        break;
+    case ASTNode::Kind::ObjectExpr:
+        for (auto& value : dynamic_cast<ObjectExpression&>(expression).values()) {
+            visit(value, visitor);
+        }
+        break;
+    case ASTNode::Kind::IndexExpr: {
+        auto& index = dynamic_cast<IndexExpression&>(expression);
+        visit(index.object_ptr(), visitor);
+        visit(index.index_ptr(), visitor);
+        break;
+    }
+    case ASTNode::Kind::AccessExpr:
+        visit(dynamic_cast<AccessExpression&>(expression).object_ptr(), visitor);
+        break;
+    default:
+        break;
+    }
+}
+
+static void visit(std::unique_ptr<Expression>& slot, const SlotVisitor& visitor)
+{
+    if (!visitor(slot)) {
+        visit_children(*slot, visitor);
+    }
+}
+
+static void visit(Statement& statement, const SlotVisitor& visitor)
+{
+    switch (statement.kind()) {
+    case ASTNode::Kind::LetStmt: {
+        auto& let = dynamic_cast<LetStatement&>(statement);
+        if (let.value()) {
+            visit(let.value(), visitor);
+        }
+        break;
+    }
+    case ASTNode::Kind::IfStmt: {
+        auto& if_stmt = dynamic_cast<IfStatement&>(statement);
+        visit(if_stmt.condition_ptr(), visitor);
+        visit(if_stmt.then_branch(), visitor);
+        if (if_stmt.else_branch()) {
+            visit(*if_stmt.else_branch(), visitor);
+        }
+        break;
+    }
+    case ASTNode::Kind::ForStmt: {
+        auto& for_stmt = dynamic_cast<ForStatement&>(statement);
+        if (for_stmt.initializer()) {
+            visit(*for_stmt.initializer(), visitor);
+        }
+        if (for_stmt.condition()) {
+            visit(for_stmt.condition(), visitor);
+        }
+        if (for_stmt.increment()) {
+            visit(for_stmt.increment(), visitor);
+        }
+        visit(for_stmt.body(), visitor);
+        break;
+    }
+    case ASTNode::Kind::BlockStmt:
+        for (auto& stmt : dynamic_cast<BlockStatement&>(statement).statements()) {
+            visit(*stmt, visitor);
+        }
+        break;
+    case ASTNode::Kind::ReturnStmt: {
+        auto& ret = dynamic_cast<ReturnStatement&>(statement);
+        if (ret.value()) {
+            visit(ret.value(), visitor);
+        }
+        break;
+    }
+    case ASTNode::Kind::ExprStmt:
+        visit(dynamic_cast<ExpressionStatement&>(statement).expr_ptr(), visitor);
+        break;
+    default:
+        break;
+    }
+}
+
+// What running a piece of code may do to the names around it.
+struct Effects {
+    // names assigned, incremented or declared
+    Names writes;
+    // calls something that is not a builtin
+    bool calls = false;
+    // has a `continue` of the loop itself, not of a nested one
+    bool continues = false;
+};
+
+// Effects of statements and expressions, knowing which calls are to builtins.
+class EffectAnalysis {
+public:
+    explicit EffectAnalysis(Program& program);
+
+    void effects(Statement& statement, Effects& effects, bool nested) const;
+    void effects(Expression& expression, Effects& effects) const;
+
+    // every name the program assigns or declares anywhere
+    const Names& written() const { return m_written; }
+    // the names assigned or declared inside function bodies
+    const Names& function_writes() const { return m_function_writes; }
+
+private:
+    Program& m_program;
+    Names m_written;
+    Names m_function_writes;
+};
+
+EffectAnalysis::EffectAnalysis(Program& program)
+    : m_program(program)
+{
+    Effects all;
+    for (auto& stmt : program.statements()) {
+        effects(*stmt, all, false);
+    }
+    Effects functions;
+    for (auto& [name, fn] : program.functions()) {
+        effects(fn->body(), functions, false);
+    }
+    m_function_writes = std::move(functions.writes);
+    m_written = std::move(all.writes);
+    m_written.insert(m_function_writes.begin(), m_function_writes.end());
+}
+
+static bool numeric(KindSet kinds)
+{
+    auto numbers = KindSet(ValueKind::Integer) | ValueKind::Float;
+    return !kinds.empty() && (kinds & numbers) == kinds;
+}
+
+class LoopOptimizer {
+public:
+    LoopOptimizer(Program& program, const TypeEnvironment& environment);
+
+    LoopStats run();
+
+private:
+    // the loop being rewritten
+    struct Loop {
+        Effects effects;
+        // lets that go in front of the loop, after its initializer
+        Statements prelude;
+        // induction variable and its step per iteration
+        std::string induction;
+        int64_t step = 0;
+        // running products by their constant factor
+        std::map<std::string, std::string> products;
+        // statements that advance the running products, appended to the body
+        Statements updates;
+    };
+
+    void block(Statements& statements);
+    void statement(Statement& statement);
+    void loop(Statements& statements, size_t& index);
+
+    bool declared(const std::string& name) const;
+    bool invariant(Expression& expression) const;
+    std::optional<int64_t> induction_step(ForStatement& loop) const;
+    bool hoist(std::unique_ptr<Expression>& slot);
+    bool reduce(std::unique_ptr<Expression>& slot);
+    std::unique_ptr<Expression> temporary(std::unique_ptr<Expression> value);
+
+    Program& m_program;
+    const TypeEnvironment& m_environment;
+    EffectAnalysis m_effects;
+    std::vector<Names> m_scopes;
+    Loop* m_loop = nullptr;
+    LoopStats m_stats;
+    uint32_t m_temporaries = 0;
+};
+
+LoopOptimizer::LoopOptimizer(Program& program, const TypeEnvironment& environment)
+    : m_program(program)
+    , m_environment(environment)
+    , m_effects(program)
+{
+}
+
+void EffectAnalysis::effects(Statement& statement, Effects& effects, bool nested) const
+{
+    switch (statement.kind()) {
+    case ASTNode::Kind::LetStmt: {
+        auto& let = dynamic_cast<LetStatement&>(statement);
+        effects.writes.insert(let.name());
+        if (let.value()) {
+            this->effects(*let.value(), effects);
+        }
+        break;
+    }
+    case ASTNode::Kind::IfStmt: {
+        auto& if_stmt = dynamic_cast<IfStatement&>(statement);
+        this->effects(if_stmt.condition(), effects);
+        this->effects(if_stmt.then_branch(), effects, nested);
+        if (if_stmt.else_branch()) {
+            this->effects(*if_stmt.else_branch(), effects, nested);
+        }
+        break;
+    }
+    case ASTNode::Kind::ForStmt: {
+        auto& for_stmt = dynamic_cast<ForStatement&>(statement);
+        if (for_stmt.initializer()) {
+            this->effects(*for_stmt.initializer(), effects, nested);
+        }
+        if (for_stmt.condition()) {
+            this->effects(*for_stmt.condition(), effects);
+        }
+        if (for_stmt.increment()) {
+            this->effects(*for_stmt.increment(), effects);
+        }
+        this->effects(for_stmt.body(), effects, true);
+        break;
+    }
+    case ASTNode::Kind::BlockStmt:
+        for (auto& stmt : dynamic_cast<BlockStatement&>(statement).statements()) {
+            this->effects(*stmt, effects, nested);
+        }
+        break;
+    case ASTNode::Kind::ContinueStmt:
+        effects.continues |= !nested;
+        break;
+    case ASTNode::Kind::ReturnStmt: {
+        auto& ret = dynamic_cast<ReturnStatement&>(statement);
+        if (ret.value()) {
+            this->effects(*ret.value(), effects);
+        }
+        break;
+    }
+    case ASTNode::Kind::ExprStmt:
+        this->effects(dynamic_cast<ExpressionStatement&>(statement).expr(), effects);
+        break;
+    default:
+        break;
+    }
+}
+
+void EffectAnalysis::effects(Expression& expression, Effects& effects) const
+{
+    switch (expression.kind()) {
+    case ASTNode::Kind::BinaryExpr: {
+        auto& binary = dynamic_cast<BinaryExpression&>(expression);
+        if (binary.op() == Operator::Assign && binary.left().kind() == ASTNode::Kind::VariableExpr) {
+            effects.writes.insert(dynamic_cast<VariableExpression&>(binary.left()).name());
+        } else {
+            this->effects(binary.left(), effects);
+        }
+        this->effects(binary.right(), effects);
+        break;
+    }
+    case ASTNode::Kind::PrefixExpr:
+        this->effects(dynamic_cast<PrefixExpression&>(expression).expr(), effects);
+        break;
+    case ASTNode::Kind::PostfixExpr: {
+        auto& postfix = dynamic_cast<PostfixExpression&>(expression);
+        if (postfix.expr().kind() == ASTNode::Kind::VariableExpr) {
+            effects.writes.insert(dynamic_cast<VariableExpression&>(postfix.expr()).name());
+        }
+        break;
+    }
+    case ASTNode::Kind::CallExpr: {
+        auto& call = dynamic_cast<CallExpression&>(expression);
+        for (auto& arg : call.args()) {
+            this->effects(*arg, effects);
+        }
+        // builtins only touch the values they are given
+        auto builtin = false;
+        if (call.callee().kind() == ASTNode::Kind::VariableExpr) {
+            auto& name = dynamic_cast<VariableExpression&>(call.callee()).name();
+            builtin = builtins().contains(name) && !m_program.functions().contains(name)
+                && !m_written.contains(name);
+        } else {
+            this->effects(call.callee(), effects);
+        }
+        effects.calls |= !builtin;
+        break;
+    }
+    case ASTNode::Kind::ArrayExpr:
+        for (auto& element : dynamic_cast<ArrayExpression&>(expression).elements()) {
+            this->effects(*element, effects);
+        }
+        break;
+    case ASTNode::Kind::ObjectExpr:
+        for (auto& value : dynamic_cast<ObjectExpression&>(expression).values()) {
+            this->effects(*value, effects);
+        }
+        break;
+    case ASTNode::Kind::IndexExpr: {
+        auto& index = dynamic_cast<IndexExpression&>(expression);
+        this->effects(index.object(), effects);
+        this->effects(index.index(), effects);
+        break;
+    }
+    case ASTNode::Kind::AccessExpr:
+        this->effects(dynamic_cast<AccessExpression&>(expression).object(), effects);
+        break;
+    default:
+        break;
+    }
+}
+
+LoopStats LoopOptimizer::run()
+{
+    block(m_program.statements());
+    for (auto& [name, fn] : m_program.functions()) {
+        m_scopes.emplace_back(fn->params().begin(), fn->params().end());
+        statement(fn->body());
+        m_scopes.pop_back();
+    }
+    return m_stats;
+}
+
+bool LoopOptimizer::declared(const std::string& name) const
+{
+    for (auto& scope : m_scopes) {
+        if (scope.contains(name)) {
+            return true;
+        }
+    }
+    return m_environment.contains(name);
+}
+
+void LoopOptimizer::block(Statements& statements)
+{
+    m_scopes.emplace_back();
+    for (size_t i = 0; i < statements.size(); ++i) {
+        auto& stmt = *statements[i];
+        if (stmt.kind() == ASTNode::Kind::ForStmt) {
+            loop(statements, i);
+            continue;
+        }
+        statement(stmt);
+        if (stmt.kind() == ASTNode::Kind::LetStmt) {
+            m_scopes.back().insert(dynamic_cast<LetStatement&>(stmt).name());
+        }
+    }
+    m_scopes.pop_back();
+}
+
+void LoopOptimizer::statement(Statement& statement)
+{
+    switch (statement.kind()) {
+    case ASTNode::Kind::IfStmt: {
+        auto& if_stmt = dynamic_cast<IfStatement&>(statement);
+        this->statement(if_stmt.then_branch());
+        if (if_stmt.else_branch()) {
+            this->statement(*if_stmt.else_branch());
+        }
+        break;
+    }
+    case ASTNode::Kind::ForStmt:
+        // not in a statement list, so only the loops inside are rewritten
+        this->statement(dynamic_cast<ForStatement&>(statement).body());
+        break;
+    case ASTNode::Kind::BlockStmt:
+        block(dynamic_cast<BlockStatement&>(statement).statements());
+        break;
+    default:
+        break;
+    }
+}
+
+bool LoopOptimizer::invariant(Expression& expression) const
+{
+    if (!numeric(expression.kinds())) {
+        return false;
+    }
+
+    switch (expression.kind()) {
+    case ASTNode::Kind::LiteralExpr:
+        return true;
+    case ASTNode::Kind::VariableExpr: {
+        auto& name = dynamic_cast<VariableExpression&>(expression).name();
+        return !m_loop->effects.writes.contains(name) && declared(name);
+    }
+    case ASTNode::Kind::PrefixExpr: {
+        auto& prefix = dynamic_cast<PrefixExpression&>(expression);
+        return prefix.op() == Operator::Subtract && invariant(prefix.expr());
+    }
+    case ASTNode::Kind::BinaryExpr: {
+        auto& binary = dynamic_cast<BinaryExpression&>(expression);
+        switch (binary.op()) {
+        // division and modulo are left alone, they may fault on zero
+        case Operator::Add:
+        case Operator::Subtract:
+        case Operator::Multiply:
+            return invariant(binary.left()) && invariant(binary.right());
+        default:
+            return false;
+        }
+    }
+    default:
+        return false;
+    }
+}
+
+std::unique_ptr<Expression> LoopOptimizer::temporary(std::unique_ptr<Expression> value)
+{
+    auto name = std::format("$t{}", m_temporaries++);
+    auto kinds = value->kinds();
+    m_loop->prelude.push_back(std::make_unique<LetStatement>(name, std::move(value)));
+    m_scopes.back().insert(name);
+
+    auto variable = std::make_unique<VariableExpression>(name);
+    variable->kinds() = kinds;
+    return variable;
+}
+
+bool LoopOptimizer::hoist(std::unique_ptr<Expression>& slot)
+{
+    auto kind = slot->kind();
+    if (kind == ASTNode::Kind::LiteralExpr || kind == ASTNode::Kind::VariableExpr || !invariant(*slot)) {
+        return false;
+    }
+    slot = temporary(std::move(slot));
+    m_stats.hoisted++;
+    return true;
+}
+
+// `i++`, `i--`, `i = i + k` and `i = i - k` with an integer literal `k`
+std::optional<int64_t> LoopOptimizer::induction_step(ForStatement& loop) const
+{
+    auto& increment = loop.increment();
+    if (!increment) {
+        return std::nullopt;
+    }
+
+    if (increment->kind() == ASTNode::Kind::PostfixExpr) {
+        auto& postfix = dynamic_cast<PostfixExpression&>(*increment);
+        if (postfix.expr().kind() != ASTNode::Kind::VariableExpr) {
+            return std::nullopt;
+        }
+        return postfix.op() == Operator::Increase ? 1 : -1;
+    }
+    if (increment->kind() != ASTNode::Kind::BinaryExpr) {
+        return std::nullopt;
+    }
+
+    auto& assign = dynamic_cast<BinaryExpression&>(*increment);
+    if (assign.op() != Operator::Assign || assign.left().kind() != ASTNode::Kind::VariableExpr
+        || assign.right().kind() != ASTNode::Kind::BinaryExpr) {
+        return std::nullopt;
+    }
+    auto& name = dynamic_cast<VariableExpression&>(assign.left()).name();
+    auto& update = dynamic_cast<BinaryExpression&>(assign.right());
+    if ((update.op() != Operator::Add && update.op() != Operator::Subtract)
+        || update.left().kind() != ASTNode::Kind::VariableExpr
+        || dynamic_cast<VariableExpression&>(update.left()).name() != name
+        || update.right().kind() != ASTNode::Kind::LiteralExpr
+        || dynamic_cast<LiteralExpression&>(update.right()).literal_kind() != LiteralKind::Integer) {
+        return std::nullopt;
+    }
+    auto step = dynamic_cast<IntegerLiteral&>(update.right()).value();
+    return update.op() == Operator::Add ? step : -step;
+}
+
+bool LoopOptimizer::reduce(std::unique_ptr<Expression>& slot)
+{
+    if (slot->kind() != ASTNode::Kind::BinaryExpr) {
+        return false;
+    }
+    auto& product = dynamic_cast<BinaryExpression&>(*slot);
+    if (product.op() != Operator::Multiply) {
+        return false;
+    }
+
+    auto is_induction = [this](Expression& operand) {
+        return operand.kind() == ASTNode::Kind::VariableExpr
+            && dynamic_cast<VariableExpression&>(operand).name() == m_loop->induction;
+    };
+    auto& factor = is_induction(product.left()) ? product.right() : product.left();
+    if (!is_induction(product.left()) && !is_induction(product.right())) {
+        return false;
+    }
+    if (!factor.kinds().is(ValueKind::Integer) || !invariant(factor)) {
+        return false;
+    }
+
+    std::string key;
+    std::unique_ptr<Expression> delta;
+    if (factor.kind() == ASTNode::Kind::LiteralExpr) {
+        auto value = dynamic_cast<IntegerLiteral&>(factor).value();
+        key = std::to_string(value);
+        delta = std::make_unique<IntegerLiteral>(value * m_loop->step);
+    } else if (factor.kind() == ASTNode::Kind::VariableExpr) {
+        key = dynamic_cast<VariableExpression&>(factor).name();
+        delta = std::make_unique<VariableExpression>(key);
+        if (m_loop->step != 1) {
+            delta = std::make_unique<BinaryExpression>(Operator::Multiply, std::move(delta),
+                std::make_unique<IntegerLiteral>(m_loop->step));
+        }
+    } else {
+        return false;
+    }
+
+    auto found = m_loop->products.find(key);
+    if (found == m_loop->products.end()) {
+        // the running product starts at the initial value of the induction variable
+        auto kinds = product.kinds();
+        auto start = temporary(std::move(slot));
+        auto& name = dynamic_cast<VariableExpression&>(*start).name();
+
+        delta->kinds() = ValueKind::Integer;
+        if (delta->kind() == ASTNode::Kind::BinaryExpr) {
+            delta = temporary(std::move(delta));
+        }
+        auto sum = std::make_unique<BinaryExpression>(Operator::Add,
+            std::make_unique<VariableExpression>(name), std::move(delta));
+        m_loop->updates.push_back(std::make_unique<ExpressionStatement>(std::make_unique<BinaryExpression>(
+            Operator::Assign, std::make_unique<VariableExpression>(name), std::move(sum))));
+
+        found = m_loop->products.emplace(key, name).first;
+        slot = std::move(start);
+        slot->kinds() = kinds;
+    } else {
+        slot = std::make_unique<VariableExpression>(found->second);
+        slot->kinds() = ValueKind::Integer;
+    }
+    m_stats.reduced++;
+    return true;
+}
+
+void LoopOptimizer::loop(Statements& statements, size_t& index)
+{
+    auto& for_stmt = dynamic_cast<ForStatement&>(*statements[index]);
+    m_stats.loops++;
+
+    if (for_stmt.initializer()) {
+        statement(*for_stmt.initializer());
+        if (for_stmt.initializer()->kind() == ASTNode::Kind::LetStmt) {
+            m_scopes.back().insert(dynamic_cast<LetStatement&>(*for_stmt.initializer()).name());
+        }
+    }
+
+    Loop loop;
+    if (for_stmt.condition()) {
+        m_effects.effects(*for_stmt.condition(), loop.effects);
+    }
+    m_effects.effects(for_stmt.body(), loop.effects, false);
+    auto body_writes = loop.effects.writes;
+    if (for_stmt.increment()) {
+        m_effects.effects(*for_stmt.increment(), loop.effects);
+    }
+    if (loop.effects.calls) {
+        auto& writes = m_effects.function_writes();
+        loop.effects.writes.insert(writes.begin(), writes.end());
+        body_writes.insert(writes.begin(), writes.end());
+    }
+    m_loop = &loop;
+
+    auto hoist = [this](std::unique_ptr<Expression>& slot) { return this->hoist(slot); };
+    if (for_stmt.condition()) {
+        visit(for_stmt.condition(), hoist);
+    }
+    if (for_stmt.increment()) {
+        visit(for_stmt.increment(), hoist);
+    }
+    visit(for_stmt.body(), hoist);
+
+    // the induction variable must be bound before the loop, advanced only by
+    // the increment, and every iteration must reach the end of the body
+    auto step = induction_step(for_stmt);
+    auto& initializer = for_stmt.initializer();
+    if (step && !loop.effects.continues && for_stmt.body().kind() == ASTNode::Kind::BlockStmt && initializer) {
+        auto& increment = *for_stmt.increment();
+        auto& target = increment.kind() == ASTNode::Kind::PostfixExpr
+            ? dynamic_cast<PostfixExpression&>(increment).expr()
+            : dynamic_cast<BinaryExpression&>(increment).left();
+        auto& name = dynamic_cast<VariableExpression&>(target).name();
+
+        auto binds = false;
+        if (initializer->kind() == ASTNode::Kind::LetStmt) {
+            binds = dynamic_cast<LetStatement&>(*initializer).name() == name;
+        } else if (initializer->kind() == ASTNode::Kind::ExprStmt) {
+            auto& expr = dynamic_cast<ExpressionStatement&>(*initializer).expr();
+            binds = expr.kind() == ASTNode::Kind::BinaryExpr
+                && dynamic_cast<BinaryExpression&>(expr).op() == Operator::Assign
+                && dynamic_cast<BinaryExpression&>(expr).left().kind() == ASTNode::Kind::VariableExpr
+                && dynamic_cast<VariableExpression&>(dynamic_cast<BinaryExpression&>(expr).left()).name() == name;
+        }
+        if (binds && target.kinds().is(ValueKind::Integer) && !body_writes.contains(name)) {
+            loop.induction = name;
+            loop.step = *step;
+            auto reduce = [this](std::unique_ptr<Expression>& slot) { return this->reduce(slot); };
+            if (for_stmt.condition()) {
+                visit(for_stmt.condition(), reduce);
+            }
+            visit(for_stmt.body(), reduce);
+
+            auto& body = dynamic_cast<BlockStatement&>(for_stmt.body()).statements();
+            for (auto& update : loop.updates) {
+                body.push_back(std::move(update));
+            }
+        }
+    }
+    m_loop = nullptr;
+
+    if (!loop.prelude.empty()) {
+        Statements prelude;
+        if (initializer) {
+            prelude.push_back(std::move(initializer));
+        }
+        for (auto& let : loop.prelude) {
+            prelude.push_back(std::move(let));
+        }
+        auto count = prelude.size();
+        statements.insert(statements.begin() + index, std::make_move_iterator(prelude.begin()),
+            std::make_move_iterator(prelude.end()));
+        index += count;
+    }
+
+    statement(dynamic_cast<ForStatement&>(*statements[index]).body());
+}
+
+LoopStats optimize_loops(Program& program, const TypeEnvironment& environment)
+{
+    infer_types(program, environment);
+    return LoopOptimizer(program, environment).run();
+}
+
+static std::unique_ptr<Expression> clone(Expression& expression)
+{
+    std::unique_ptr<Expression> copy;
+
+    switch (expression.kind()) {
+    case ASTNode::Kind::LiteralExpr: {
+        auto& literal = dynamic_cast<LiteralExpression&>(expression);
+        switch (literal.literal_kind()) {
+        case LiteralKind::Boolean:
+            copy = std::make_unique<BooleanLiteral>(dynamic_cast<BooleanLiteral&>(literal).value());
+            break;
+        case LiteralKind::Integer:
+            copy = std::make_unique<IntegerLiteral>(dynamic_cast<IntegerLiteral&>(literal).value());
+            break;
+        case LiteralKind::Float:
+            copy = std::make_unique<FloatLiteral>(dynamic_cast<FloatLiteral&>(literal).value());
+            break;
+        case LiteralKind::String:
+            copy = std::make_unique<StringLiteral>(dynamic_cast<StringLiteral&>(literal).constant());
+            break;
+        default:
+            copy = std::make_unique<UndefinedLiteral>();
+            break;
+        }
+        break;
+    }
+    case ASTNode::Kind::VariableExpr:
+        copy = std::make_unique<VariableExpression>(dynamic_cast<VariableExpression&>(expression).name());
+        break;
+    case ASTNode::Kind::BinaryExpr: {
+        auto& binary = dynamic_cast<BinaryExpression&>(expression);
+        copy = std::make_unique<BinaryExpression>(binary.op(), clone(binary.left()), clone(binary.right()));
+        break;
+    }
+    case ASTNode::Kind::PrefixExpr: {
+        auto& prefix = dynamic_cast<PrefixExpression&>(expression);
+        copy = std::make_unique<PrefixExpression>(prefix.op(), clone(prefix.expr()));
+        break;
+    }
+    case ASTNode::Kind::PostfixExpr: {
+        auto& postfix = dynamic_cast<PostfixExpression&>(expression);
+        copy = std::make_unique<PostfixExpression>(postfix.op(), clone(postfix.expr()));
+        break;
+    }
+    case ASTNode::Kind::CallExpr: {
+        auto& call = dynamic_cast<CallExpression&>(expression);
+        std::vector<std::unique_ptr<Expression>> args;
+        for (auto& arg : call.args()) {
+            args.push_back(clone(*arg));
+        }
+        copy = std::make_unique<CallExpression>(clone(call.callee()), std::move(args));
+        break;
+    }
+    case ASTNode::Kind::ArrayExpr: {
+        std::vector<std::unique_ptr<Expression>> elements;
+        for (auto& element : dynamic_cast<ArrayExpression&>(expression).elements()) {
+            elements.push_back(clone(*element));
+        }
+        copy = std::make_unique<ArrayExpression>(std::move(elements));
+        break;
+    }
+    case ASTNode::Kind::ObjectExpr: {
+        auto& object = dynamic_cast<ObjectExpression&>(expression);
+        std::vector<std::unique_ptr<Expression>> values;
+        for (auto& value : object.values()) {
+            values.push_back(clone(*value));
+        }
+        copy = std::make_unique<ObjectExpression>(object.keys(), std::move(values));
+        break;
+    }
+    case ASTNode::Kind::IndexExpr: {
+        auto& index = dynamic_cast<IndexExpression&>(expression);
+        copy = std::make_unique<IndexExpression>(clone(index.object()), clone(index.index()));
+        break;
+    }
+    case ASTNode::Kind::AccessExpr: {
+        auto& access = dynamic_cast<AccessExpression&>(expression);
+        copy = std::make_unique<AccessExpression>(clone(access.object()), access.name());
+        break;
+    }
+    default:
+        throw std::runtime_error(std::format("cannot clone {}", node_kind_str(expression.kind())));
+    }
+
+    copy->kinds() = expression.kinds();
+    return copy;
+}
+
+// nodes in the expression
+static uint32_t size(Expression& expression)
+{
+    uint32_t nodes = 1;
+    visit_children(expression, [&nodes](std::unique_ptr<Expression>&) {
+        nodes++;
+        return false;
+    });
+    return nodes;
+}
+
+// true when evaluating the expression changes nothing; it may still throw
+static bool pure(Expression& expression)
+{
+    auto pure = true;
+    auto check = [&pure](Expression& expression) {
+        switch (expression.kind()) {
+        case ASTNode::Kind::CallExpr:
+        case ASTNode::Kind::PostfixExpr:
+            pure = false;
+            break;
+        case ASTNode::Kind::BinaryExpr:
+            pure &= dynamic_cast<BinaryExpression&>(expression).op() != Operator::Assign;
+            break;
+        default:
+            break;
+        }
+    };
+    check(expression);
+    visit_children(expression, [&check](std::unique_ptr<Expression>& child) {
+        check(*child);
+        return false;
+    });
+    return pure;
+}
+
+static bool literal(Expression& expression, LiteralKind kind)
+{
+    return expression.kind() == ASTNode::Kind::LiteralExpr
+        && dynamic_cast<LiteralExpression&>(expression).literal_kind() == kind;
+}
+
+static std::unique_ptr<Expression> literal(const Value& value)
+{
+    std::unique_ptr<Expression> literal;
+    switch (value.kind()) {
+    case ValueKind::Boolean:
+        literal = std::make_unique<BooleanLiteral>(value.as_boolean());
+        break;
+    case ValueKind::Integer:
+        literal = std::make_unique<IntegerLiteral>(value.as_integer());
+        break;
+    case ValueKind::Float:
+        literal = std::make_unique<FloatLiteral>(value.as_float());
+        break;
+    case ValueKind::String:
+        // as_string() leaves the String flat and owning its characters
+        value.as_string();
+        literal = std::make_unique<StringLiteral>(std::static_pointer_cast<String>(value.obj()));
+        break;
+    default:
+        return nullptr;
+    }
+    literal->kinds() = value.kind();
+    return literal;
+}
+
+class ConstantFolder {
+public:
+    uint32_t folded() const { return m_folded; }
+
+    // folds the children of `slot` first, then `slot` itself
+    void fold(std::unique_ptr<Expression>& slot);
+
+private:
+    bool foldable(Expression& expression) const;
+
+    Context m_context;
+    uint32_t m_folded = 0;
+};
+
+bool ConstantFolder::foldable(Expression& expression) const
+{
+    auto constant = [](Expression& operand) {
+        return operand.kind() == ASTNode::Kind::LiteralExpr && !literal(operand, LiteralKind::Undefined);
+    };
+
+    if (expression.kind() == ASTNode::Kind::PrefixExpr) {
+        return constant(dynamic_cast<PrefixExpression&>(expression).expr());
+    }
+    if (expression.kind() != ASTNode::Kind::BinaryExpr) {
+        return false;
+    }
+
+    auto& binary = dynamic_cast<BinaryExpression&>(expression);
+    if (binary.op() == Operator::Assign || !constant(binary.left()) || !constant(binary.right())) {
+        return false;
+    }
+    // integer division by 0, or of the minimum by -1, traps
+    if ((binary.op() == Operator::Divide || binary.op() == Operator::Modulo)
+        && literal(binary.left(), LiteralKind::Integer) && literal(binary.right(), LiteralKind::Integer)) {
+        auto divisor = dynamic_cast<IntegerLiteral&>(binary.right()).value();
+        return divisor != 0 && divisor != -1;
+    }
+    return true;
+}
+
+void ConstantFolder::fold(std::unique_ptr<Expression>& slot)
+{
+    visit_children(*slot, [this](std::unique_ptr<Expression>& child) {
+        fold(child);
+        return true;
+    });
+    if (!foldable(*slot)) {
+        return;
+    }
+
+    try {
+        auto value = Evaluator(m_context).eval(*slot);
+        auto folded = literal(value);
+        if (folded) {
+            slot = std::move(folded);
+            m_folded++;
+        }
+    } catch (std::exception&) {
+        // left for the run to report
+    }
+}
+
+uint32_t fold_constants(Program& program)
+{
+    ConstantFolder folder;
+    auto fold = [&folder](std::unique_ptr<Expression>& slot) {
+        folder.fold(slot);
+        return true;
+    };
+
+    for (auto& stmt : program.statements()) {
+        visit(*stmt, fold);
+    }
+    for (auto& [name, fn] : program.functions()) {
+        visit(fn->body(), fold);
+    }
+    return folder.folded();
+}
+
+// lets and for loop initializers anywhere in the statement
+static void declarations(Statement& statement, Names& names)
+{
+    switch (statement.kind()) {
+    case ASTNode::Kind::LetStmt:
+        names.insert(dynamic_cast<LetStatement&>(statement).name());
+        break;
+    case ASTNode::Kind::IfStmt: {
+        auto& if_stmt = dynamic_cast<IfStatement&>(statement);
+        declarations(if_stmt.then_branch(), names);
+        if (if_stmt.else_branch()) {
+            declarations(*if_stmt.else_branch(), names);
+        }
+        break;
+    }
+    case ASTNode::Kind::ForStmt: {
+        auto& for_stmt = dynamic_cast<ForStatement&>(statement);
+        if (for_stmt.initializer()) {
+            declarations(*for_stmt.initializer(), names);
+        }
+        declarations(for_stmt.body(), names);
+        break;
+    }
+    case ASTNode::Kind::BlockStmt:
+        for (auto& stmt : dynamic_cast<BlockStatement&>(statement).statements()) {
+            declarations(*stmt, names);
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+class Inliner {
+public:
+    Inliner(Program& program, uint32_t budget);
+
+    uint32_t run();
+
+private:
+    struct Helper {
+        FnStatement* fn;
+        Expression* body;
+        // names the body reads that are not parameters
+        Names free;
+        // references to each parameter
+        std::vector<uint32_t> uses;
+    };
+
+    void helpers();
+    bool inline_call(std::unique_ptr<Expression>& slot);
+
+    Program& m_program;
+    uint32_t m_budget;
+    EffectAnalysis m_effects;
+    std::unordered_map<std::string, Helper> m_helpers;
+    // locals of the function calls are being inlined into
+    Names m_locals;
+    uint32_t m_inlined = 0;
+};
+
+Inliner::Inliner(Program& program, uint32_t budget)
+    : m_program(program)
+    , m_budget(budget)
+    , m_effects(program)
+{
+}
+
+void Inliner::helpers()
+{
+    m_helpers.clear();
+    // parameters rebind names for everything called while they are in scope
+    Names params;
+    for (auto& [name, fn] : m_program.functions()) {
+        params.insert(fn->params().begin(), fn->params().end());
+    }
+    for (auto& [name, fn] : m_program.functions()) {
+        // a name the script rebinds may not hold the function at the call
+        if (m_effects.written().contains(name) || params.contains(name)) {
+            continue;
+        }
+
+        auto* body = &fn->body();
+        if (body->kind() == ASTNode::Kind::BlockStmt) {
+            auto& statements = dynamic_cast<BlockStatement&>(*body).statements();
+            if (statements.size() != 1) {
+                continue;
+            }
+            body = statements.front().get();
+        }
+        if (body->kind() != ASTNode::Kind::ReturnStmt) {
+            continue;
+        }
+        auto& value = dynamic_cast<ReturnStatement&>(*body).value();
+        if (!value || size(*value) > m_budget || !pure(*value)) {
+            continue;
+        }
+
+        Helper helper { fn.get(), value.get(), {}, std::vector<uint32_t>(fn->params().size()) };
+        auto& params = fn->params();
+        auto reference = [&](Expression& expression) {
+            if (expression.kind() != ASTNode::Kind::VariableExpr) {
+                return;
+            }
+            auto& variable = dynamic_cast<VariableExpression&>(expression).name();
+            auto param = std::find(params.begin(), params.end(), variable);
+            if (param == params.end()) {
+                helper.free.insert(variable);
+            } else {
+                helper.uses[param - params.begin()]++;
+            }
+        };
+        reference(*value);
+        visit_children(*value, [&reference](std::unique_ptr<Expression>& child) {
+            reference(*child);
+            return false;
+        });
+        m_helpers.emplace(name, std::move(helper));
+    }
+}
+
+bool Inliner::inline_call(std::unique_ptr<Expression>& slot)
+{
+    if (slot->kind() != ASTNode::Kind::CallExpr) {
+        return false;
+    }
+    auto& call = dynamic_cast<CallExpression&>(*slot);
+    if (call.callee().kind() != ASTNode::Kind::VariableExpr) {
+        return false;
+    }
+    auto& name = dynamic_cast<VariableExpression&>(call.callee()).name();
+    auto found = m_helpers.find(name);
+    if (found == m_helpers.end() || m_locals.contains(name)) {
+        return false;
+    }
+
+    auto& helper = found->second;
+    auto& args = call.args();
+    if (args.size() != helper.fn->params().size()) {
+        return false;
+    }
+    for (size_t i = 0; i < args.size(); ++i) {
+        auto simple = args[i]->kind() == ASTNode::Kind::LiteralExpr || args[i]->kind() == ASTNode::Kind::VariableExpr;
+        if (!pure(*args[i]) || (!simple && helper.uses[i] > 1)) {
+            return false;
+        }
+    }
+    for (auto& free : helper.free) {
+        if (m_locals.contains(free)) {
+            return false;
+        }
+    }
+
+    auto& params = helper.fn->params();
+    std::unique_ptr<Expression> body = clone(*helper.body);
+    visit(body, [&](std::unique_ptr<Expression>& slot) {
+        if (slot->kind() != ASTNode::Kind::VariableExpr) {
+            return false;
+        }
+        auto param = std::find(params.begin(), params.end(), dynamic_cast<VariableExpression&>(*slot).name());
+        if (param == params.end()) {
+            return false;
+        }
+        slot = clone(*args[param - params.begin()]);
+        return true;
+    });
+
+    slot = std::move(body);
+    m_inlined++;
+    return true;
+}
+
+uint32_t Inliner::run()
+{
+    auto inline_call = [this](std::unique_ptr<Expression>& slot) { return this->inline_call(slot); };
+
+    uint32_t inlined;
+    do {
+        inlined = m_inlined;
+        helpers();
+
+        m_locals.clear();
+        for (auto& stmt : m_program.statements()) {
+            visit(*stmt, inline_call);
+        }
+        for (auto& [name, fn] : m_program.functions()) {
+            m_locals = Names(fn->params().begin(), fn->params().end());
+            declarations(fn->body(), m_locals);
+            visit(fn->body(), inline_call);
+        }
+    } while (m_inlined != inlined);
+
+    return m_inlined;
+}
+
+InlineStats inline_functions(Program& program, uint32_t budget)
+{
+    InlineStats stats;
+    // folding first turns arguments like `-1` into literals that can be copied
+    stats.folded = fold_constants(program);
+    stats.inlined = Inliner(program, budget).run();
+    stats.folded += fold_constants(program);
+    return stats;
+}
+
+class CommonSubexpressions {
+public:
+    explicit CommonSubexpressions(Program& program);
+
+    CseStats run();
+
+private:
+    // a candidate expression met in the current run of statements
+    struct Occurrence {
+        // equal keys compute equal values, empty when not a candidate
+        std::string key;
+        std::unique_ptr<Expression>* slot;
+        size_t statement;
+        uint32_t size = 0;
+        // enclosing occurrence or -1
+        int parent;
+        bool replaced = false;
+    };
+
+    void block(Statements& statements);
+    void statement(Statement& statement);
+    // records the occurrences of `expression` in evaluation order
+    void collect(Expression& expression, size_t statement);
+    std::optional<std::string> collect(std::unique_ptr<Expression>& slot, size_t statement, int parent);
+    // records a statement's expression unless it writes something before it is done
+    void gate(std::unique_ptr<Expression>& expression, size_t statement, Effects& effects);
+    void invalidate(const Effects& effects);
+    void eliminate(Statements& statements);
+    bool live(const Occurrence& occurrence) const;
+
+    Program& m_program;
+    EffectAnalysis m_effects;
+    // names with the number of times they were written so far
+    std::unordered_map<std::string, uint32_t> m_versions;
+    // bumped by calls, which may write any name
+    uint32_t m_epoch = 0;
+    std::vector<Occurrence> m_occurrences;
+    uint32_t m_temporaries = 0;
+    CseStats m_stats;
+};
+
+CommonSubexpressions::CommonSubexpressions(Program& program)
+    : m_program(program)
+    , m_effects(program)
+{
+}
+
+CseStats CommonSubexpressions::run()
+{
+    block(m_program.statements());
+    for (auto& [name, fn] : m_program.functions()) {
+        statement(fn->body());
+    }
+    return m_stats;
+}
+
+void CommonSubexpressions::invalidate(const Effects& effects)
+{
+    if (effects.calls) {
+        m_epoch++;
+    }
+    for (auto& name : effects.writes) {
+        m_versions[name]++;
+    }
+}
+
+std::optional<std::string> CommonSubexpressions::collect(std::unique_ptr<Expression>& slot, size_t statement, int parent)
+{
+    auto& expression = *slot;
+
+    switch (expression.kind()) {
+    case ASTNode::Kind::LiteralExpr: {
+        auto& literal = dynamic_cast<LiteralExpression&>(expression);
+        switch (literal.literal_kind()) {
+        case LiteralKind::Boolean:
+            return std::format("b{}", dynamic_cast<BooleanLiteral&>(literal).value());
+        case LiteralKind::Integer:
+            return std::format("i{}", dynamic_cast<IntegerLiteral&>(literal).value());
+        case LiteralKind::Float:
+            return std::format("f{}", dynamic_cast<FloatLiteral&>(literal).value());
+        case LiteralKind::String:
+        {
+            auto& value = dynamic_cast<StringLiteral&>(literal).value();
+            return std::format("s{}:{}", value.size(), value);
+        }
+        default:
+            return std::nullopt;
+        }
+    }
+    case ASTNode::Kind::VariableExpr: {
+        auto& name = dynamic_cast<VariableExpression&>(expression).name();
+        return std::format("{}#{}.{}", name, m_epoch, m_versions[name]);
+    }
+    case ASTNode::Kind::BinaryExpr:
+    case ASTNode::Kind::PrefixExpr: {
+        auto binary = expression.kind() == ASTNode::Kind::BinaryExpr;
+        auto op = binary ? dynamic_cast<BinaryExpression&>(expression).op()
+                         : dynamic_cast<PrefixExpression&>(expression).op();
+        if (op == Operator::Assign) {
+            break;
+        }
+
+        // recorded before the operands, so enclosing occurrences come first
+        auto index = int(m_occurrences.size());
+        m_occurrences.push_back({ {}, &slot, statement, size(expression), parent });
+
+        std::optional<std::string> key;
+        if (binary) {
+            auto& node = dynamic_cast<BinaryExpression&>(expression);
+            auto lhs = collect(node.left_ptr(), statement, index);
+            auto rhs = collect(node.right_ptr(), statement, index);
+            if (lhs && rhs) {
+                key = std::format("({} {} {})", *lhs, operator_str(op), *rhs);
+            }
+        } else {
+            auto operand = collect(dynamic_cast<PrefixExpression&>(expression).expr_ptr(), statement, index);
+            if (operand) {
+                key = std::format("({} {})", operator_str(op), *operand);
+            }
+        }
+        if (key) {
+            m_occurrences[index].key = *key;
+        }
+        return key;
+    }
+    default:
+        break;
+    }
+
+    collect(expression, statement);
+    return std::nullopt;
+}
+
+void CommonSubexpressions::collect(Expression& expression, size_t statement)
+{
+    switch (expression.kind()) {
+    case ASTNode::Kind::BinaryExpr: {
+        auto& binary = dynamic_cast<BinaryExpression&>(expression);
+        if (binary.op() != Operator::Assign) {
+            collect(binary.left_ptr(), statement, -1);
+            collect(binary.right_ptr(), statement, -1);
+            break;
+        }
+        // the value is evaluated before the target
+        collect(binary.right_ptr(), statement, -1);
+        if (binary.left().kind() != ASTNode::Kind::VariableExpr) {
+            collect(binary.left(), statement);
+        }
+        break;
+    }
+    case ASTNode::Kind::PostfixExpr:
+        break;
+    default:
+        visit_children(expression, [this, statement](std::unique_ptr<Expression>& child) {
+            collect(child, statement, -1);
+            return true;
+        });
+        break;
+    }
+}
+
+void CommonSubexpressions::gate(std::unique_ptr<Expression>& expression, size_t statement, Effects& effects)
+{
+    m_effects.effects(*expression, effects);
+    if (!effects.calls && effects.writes.empty()) {
+        collect(expression, statement, -1);
+    }
+}
+
+void CommonSubexpressions::block(Statements& statements)
+{
+    auto outer = std::move(m_occurrences);
+    m_occurrences.clear();
+
+    for (size_t i = 0; i < statements.size(); ++i) {
+        auto& stmt = *statements[i];
+        Effects effects;
+
+        switch (stmt.kind()) {
+        case ASTNode::Kind::LetStmt: {
+            auto& let = dynamic_cast<LetStatement&>(stmt);
+            if (let.value()) {
+                gate(let.value(), i, effects);
+            }
+            effects.writes.insert(let.name());
+            break;
+        }
+        case ASTNode::Kind::ExprStmt: {
+            auto& expr = dynamic_cast<ExpressionStatement&>(stmt).expr_ptr();
+            // the target of `name = value` is only written once the value is done
+            auto* binary = dynamic_cast<BinaryExpression*>(expr.get());
+            if (binary && binary->op() == Operator::Assign && binary->left().kind() == ASTNode::Kind::VariableExpr) {
+                gate(binary->right_ptr(), i, effects);
+                effects.writes.insert(dynamic_cast<VariableExpression&>(binary->left()).name());
+            } else {
+                gate(expr, i, effects);
+            }
+            break;
+        }
+        case ASTNode::Kind::ReturnStmt: {
+            auto& ret = dynamic_cast<ReturnStatement&>(stmt);
+            if (ret.value()) {
+                gate(ret.value(), i, effects);
+            }
+            break;
+        }
+        case ASTNode::Kind::IfStmt: {
+            auto& if_stmt = dynamic_cast<IfStatement&>(stmt);
+            gate(if_stmt.condition_ptr(), i, effects);
+            statement(stmt);
+            m_effects.effects(stmt, effects, false);
+            break;
+        }
+        default:
+            statement(stmt);
+            m_effects.effects(stmt, effects, false);
+            break;
+        }
+
+        invalidate(effects);
+    }
+
+    eliminate(statements);
+    m_occurrences = std::move(outer);
+}
+
+void CommonSubexpressions::statement(Statement& statement)
+{
+    switch (statement.kind()) {
+    case ASTNode::Kind::IfStmt: {
+        auto& if_stmt = dynamic_cast<IfStatement&>(statement);
+        this->statement(if_stmt.then_branch());
+        if (if_stmt.else_branch()) {
+            this->statement(*if_stmt.else_branch());
+        }
+        break;
+    }
+    case ASTNode::Kind::ForStmt:
+        this->statement(dynamic_cast<ForStatement&>(statement).body());
+        break;
+    case ASTNode::Kind::BlockStmt:
+        block(dynamic_cast<BlockStatement&>(statement).statements());
+        break;
+    default:
+        break;
+    }
+}
+
+bool CommonSubexpressions::live(const Occurrence& occurrence) const
+{
+    if (occurrence.replaced) {
+        return false;
+    }
+    for (auto parent = occurrence.parent; parent != -1; parent = m_occurrences[parent].parent) {
+        if (m_occurrences[parent].replaced) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void CommonSubexpressions::eliminate(Statements& statements)
+{
+    std::map<std::string, std::vector<size_t>> groups;
+    for (size_t i = 0; i < m_occurrences.size(); ++i) {
+        auto& occurrence = m_occurrences[i];
+        // a lone operator on a name or literal is not worth a temporary
+        if (!occurrence.key.empty() && occurrence.size >= 3) {
+            groups[occurrence.key].push_back(i);
+        }
+    }
+
+    // larger expressions first, so their parts are not split out needlessly
+    std::vector<std::vector<size_t>*> repeated;
+    for (auto& [key, group] : groups) {
+        if (group.size() > 1) {
+            repeated.push_back(&group);
+        }
+    }
+    std::stable_sort(repeated.begin(), repeated.end(), [this](auto* lhs, auto* rhs) {
+        return m_occurrences[lhs->front()].size > m_occurrences[rhs->front()].size;
+    });
+
+    // temporaries to declare in front of each statement
+    std::map<size_t, std::vector<std::string>> declarations;
+    for (auto* group : repeated) {
+        std::vector<Occurrence*> occurrences;
+        for (auto index : *group) {
+            if (live(m_occurrences[index])) {
+                occurrences.push_back(&m_occurrences[index]);
+            }
+        }
+        if (occurrences.size() < 2) {
+            continue;
+        }
+
+        auto name = std::format("$c{}", m_temporaries++);
+        auto& first = *occurrences.front()->slot;
+        auto kinds = first->kinds();
+        declarations[occurrences.front()->statement].push_back(name);
+
+        auto target = std::make_unique<VariableExpression>(name);
+        target->kinds() = kinds;
+        first = std::make_unique<BinaryExpression>(Operator::Assign, std::move(target), std::move(first));
+        first->kinds() = kinds;
+
+        for (size_t i = 1; i < occurrences.size(); ++i) {
+            auto& slot = *occurrences[i]->slot;
+            slot = std::make_unique<VariableExpression>(name);
+            slot->kinds() = kinds;
+            occurrences[i]->replaced = true;
+            m_stats.eliminated++;
+        }
+        m_stats.expressions++;
+    }
+
+    for (auto it = declarations.rbegin(); it != declarations.rend(); ++it) {
+        auto position = statements.begin() + it->first;
+        for (auto& name : it->second) {
+            position = statements.insert(position, std::make_unique<LetStatement>(name, nullptr)) + 1;
+        }
+    }
+}
+
+CseStats eliminate_common_subexpressions(Program& program)
+{
+    return CommonSubexpressions(program).run();
+}
+
+class DeadCodeEliminator {
+public:
+    DeadCodeEliminator(Program& program, const Names& roots);
+
+    DeadCodeStats run();
+
+private:
+    void block(Statements& statements);
+    void statement(std::unique_ptr<Statement>& slot);
+    // names read by the code that can run, and the functions it reaches
+    void reads(Names& names);
+    void reads(Statement& statement, Names& names);
+    void functions(const Names& reads);
+    void bindings(const Names& reads);
+    void unbind(std::unique_ptr<Statement>& slot);
+    bool unbind(std::unique_ptr<Expression>& slot);
+
+    Program& m_program;
+    const Names& m_roots;
+    Names m_dead;
+    bool m_changed = false;
+    DeadCodeStats m_stats;
+};
+
+DeadCodeEliminator::DeadCodeEliminator(Program& program, const Names& roots)
+    : m_program(program)
+    , m_roots(roots)
+{
+}
+
+static bool terminates(Statement& statement)
+{
+    auto kind = statement.kind();
+    return kind == ASTNode::Kind::ReturnStmt || kind == ASTNode::Kind::BreakStmt
+        || kind == ASTNode::Kind::ContinueStmt;
+}
+
+void DeadCodeEliminator::block(Statements& statements)
+{
+    for (size_t i = 0; i < statements.size(); ++i) {
+        statement(statements[i]);
+        if (terminates(*statements[i]) && i + 1 < statements.size()) {
+            m_stats.statements += uint32_t(statements.size() - i - 1);
+            statements.erase(statements.begin() + i + 1, statements.end());
+            m_changed = true;
+        }
+    }
+
+    auto empty = std::remove_if(statements.begin(), statements.end(), [](auto& stmt) {
+        return stmt->kind() == ASTNode::Kind::EmptyStmt;
+    });
+    statements.erase(empty, statements.end());
+}
+
+static std::optional<bool> constant_condition(Expression& condition)
+{
+    if (!literal(condition, LiteralKind::Boolean)) {
+        return std::nullopt;
+    }
+    return dynamic_cast<BooleanLiteral&>(condition).value();
+}
+
+void DeadCodeEliminator::statement(std::unique_ptr<Statement>& slot)
+{
+    switch (slot->kind()) {
+    case ASTNode::Kind::IfStmt: {
+        auto& if_stmt = dynamic_cast<IfStatement&>(*slot);
+        auto taken = constant_condition(if_stmt.condition());
+        if (taken) {
+            std::unique_ptr<Statement> branch = *taken ? std::move(if_stmt.then_branch_ptr())
+                                                       : std::move(if_stmt.else_branch());
+            slot = branch ? std::move(branch) : std::make_unique<EmptyStatement>();
+            m_stats.branches++;
+            m_changed = true;
+            statement(slot);
+            break;
+        }
+        statement(if_stmt.then_branch_ptr());
+        if (if_stmt.else_branch()) {
+            statement(if_stmt.else_branch());
+        }
+        break;
+    }
+    case ASTNode::Kind::ForStmt: {
+        auto& for_stmt = dynamic_cast<ForStatement&>(*slot);
+        if (for_stmt.condition() && constant_condition(*for_stmt.condition()) == false) {
+            std::unique_ptr<Statement> initializer = std::move(for_stmt.initializer());
+            slot = initializer ? std::move(initializer) : std::make_unique<EmptyStatement>();
+            m_stats.branches++;
+            m_changed = true;
+            break;
+        }
+        statement(for_stmt.body_ptr());
+        break;
+    }
+    case ASTNode::Kind::BlockStmt:
+        block(dynamic_cast<BlockStatement&>(*slot).statements());
+        break;
+    case ASTNode::Kind::ExprStmt:
+        if (pure(dynamic_cast<ExpressionStatement&>(*slot).expr())) {
+            slot = std::make_unique<EmptyStatement>();
+            m_stats.statements++;
+            m_changed = true;
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+void DeadCodeEliminator::reads(Statement& statement, Names& names)
+{
+    std::function<void(Expression&)> read = [&](Expression& expression) {
+        if (expression.kind() == ASTNode::Kind::VariableExpr) {
+            names.insert(dynamic_cast<VariableExpression&>(expression).name());
+        }
+        // `x++` reads x too
+        if (expression.kind() == ASTNode::Kind::PostfixExpr) {
+            read(dynamic_cast<PostfixExpression&>(expression).expr());
+        }
+    };
+    visit(statement, [&read](std::unique_ptr<Expression>& slot) {
+        read(*slot);
+        return false;
+    });
+}
+
+void DeadCodeEliminator::reads(Names& names)
+{
+    names = m_roots;
+    for (auto& stmt : m_program.statements()) {
+        reads(*stmt, names);
+    }
+
+    // functions are reachable through any read of their name
+    Names visited;
+    bool grew;
+    do {
+        grew = false;
+        for (auto& [name, fn] : m_program.functions()) {
+            if (names.contains(name) && !visited.contains(name)) {
+                visited.insert(name);
+                reads(fn->body(), names);
+                grew = true;
+            }
+        }
+    } while (grew);
+}
+
+void DeadCodeEliminator::functions(const Names& reads)
+{
+    std::vector<std::string> unused;
+    for (auto& [name, fn] : m_program.functions()) {
+        if (!reads.contains(name)) {
+            unused.push_back(name);
+        }
+    }
+    std::sort(unused.begin(), unused.end());
+    for (auto& name : unused) {
+        m_program.functions().erase(name);
+        m_stats.functions.push_back(name);
+        m_changed = true;
+    }
+}
+
+// replaces `name = value` of a dead name by `value`
+bool DeadCodeEliminator::unbind(std::unique_ptr<Expression>& slot)
+{
+    while (slot->kind() == ASTNode::Kind::BinaryExpr) {
+        auto& binary = dynamic_cast<BinaryExpression&>(*slot);
+        if (binary.op() != Operator::Assign || binary.left().kind() != ASTNode::Kind::VariableExpr
+            || !m_dead.contains(dynamic_cast<VariableExpression&>(binary.left()).name())) {
+            break;
+        }
+        std::unique_ptr<Expression> value = std::move(binary.right_ptr());
+        slot = std::move(value);
+        m_changed = true;
+    }
+    return false;
+}
+
+void DeadCodeEliminator::unbind(std::unique_ptr<Statement>& slot)
+{
+    auto unbind = [this](std::unique_ptr<Expression>& slot) { return this->unbind(slot); };
+
+    switch (slot->kind()) {
+    case ASTNode::Kind::LetStmt: {
+        auto& let = dynamic_cast<LetStatement&>(*slot);
+        if (let.value()) {
+            visit(let.value(), unbind);
+        }
+        if (!m_dead.contains(let.name())) {
+            break;
+        }
+        m_stats.bindings.push_back(let.name());
+        if (let.value() && !pure(*let.value())) {
+            slot = std::make_unique<ExpressionStatement>(std::move(let.value()));
+        } else {
+            slot = std::make_unique<EmptyStatement>();
+        }
+        m_changed = true;
+        break;
+    }
+    case ASTNode::Kind::IfStmt: {
+        auto& if_stmt = dynamic_cast<IfStatement&>(*slot);
+        visit(if_stmt.condition_ptr(), unbind);
+        this->unbind(if_stmt.then_branch_ptr());
+        if (if_stmt.else_branch()) {
+            this->unbind(if_stmt.else_branch());
+        }
+        break;
+    }
+    case ASTNode::Kind::ForStmt: {
+        auto& for_stmt = dynamic_cast<ForStatement&>(*slot);
+        if (for_stmt.initializer()) {
+            this->unbind(for_stmt.initializer());
+            if (for_stmt.initializer()->kind() == ASTNode::Kind::EmptyStmt) {
+                for_stmt.initializer() = nullptr;
+            }
+        }
+        if (for_stmt.condition()) {
+            visit(for_stmt.condition(), unbind);
+        }
+        if (for_stmt.increment()) {
+            visit(for_stmt.increment(), unbind);
+        }
+        this->unbind(for_stmt.body_ptr());
+        break;
+    }
+    case ASTNode::Kind::BlockStmt:
+        for (auto& stmt : dynamic_cast<BlockStatement&>(*slot).statements()) {
+            this->unbind(stmt);
+        }
+        break;
+    case ASTNode::Kind::ReturnStmt: {
+        auto& ret = dynamic_cast<ReturnStatement&>(*slot);
+        if (ret.value()) {
+            visit(ret.value(), unbind);
+        }
+        break;
+    }
+    case ASTNode::Kind::ExprStmt:
+        visit(dynamic_cast<ExpressionStatement&>(*slot).expr_ptr(), unbind);
+        break;
+    default:
+        break;
+    }
+}
+
+void DeadCodeEliminator::bindings(const Names& reads)
+{
+    // only names the script declares; assigning anything else fails at run time
+    Names declared;
+    for (auto& stmt : m_program.statements()) {
+        declarations(*stmt, declared);
+    }
+    for (auto& [name, fn] : m_program.functions()) {
+        declarations(fn->body(), declared);
+    }
+
+    m_dead.clear();
+    for (auto& name : declared) {
+        if (!reads.contains(name)) {
+            m_dead.insert(name);
+        }
+    }
+    if (m_dead.empty()) {
+        return;
+    }
+
+    for (auto& stmt : m_program.statements()) {
+        unbind(stmt);
+    }
+    for (auto& [name, fn] : m_program.functions()) {
+        unbind(fn->body_ptr());
+    }
+}
+
+DeadCodeStats DeadCodeEliminator::run()
+{
+    do {
+        m_changed = false;
+
+        block(m_program.statements());
+        for (auto& [name, fn] : m_program.functions()) {
+            statement(fn->body_ptr());
+        }
+
+        Names names;
+        reads(names);
+        functions(names);
+        bindings(names);
+    } while (m_changed);
+
+    return m_stats;
+}
+
+DeadCodeStats eliminate_dead_code(Program& program, const std::unordered_set<std::string>& roots)
+{
+    fold_constants(program);
+    return DeadCodeEliminator(program, roots).run();
+}
+
+SpecializeStats specialize(Program& program, const Constants& constants, const std::unordered_set<std::string>& roots)
+{
+    // names the script binds itself would shadow the host binding
+    Names bound;
+    auto assigned = [&bound](std::unique_ptr<Expression>& slot) {
+        auto& expression = *slot;
+        if (expression.kind() == ASTNode::Kind::BinaryExpr) {
+            auto& binary = dynamic_cast<BinaryExpression&>(expression);
+            if (binary.op() == Operator::Assign && binary.left().kind() == ASTNode::Kind::VariableExpr) {
+                bound.insert(dynamic_cast<VariableExpression&>(binary.left()).name());
+            }
+        }
+        if (expression.kind() == ASTNode::Kind::PostfixExpr) {
+            auto& postfix = dynamic_cast<PostfixExpression&>(expression);
+            if (postfix.expr().kind() == ASTNode::Kind::VariableExpr) {
+                bound.insert(dynamic_cast<VariableExpression&>(postfix.expr()).name());
+            }
+        }
+        return false;
+    };
+    for (auto& stmt : program.statements()) {
+        declarations(*stmt, bound);
+        visit(*stmt, assigned);
+    }
+    for (auto& [name, fn] : program.functions()) {
+        bound.insert(name);
+        bound.insert(fn->params().begin(), fn->params().end());
+        declarations(fn->body(), bound);
+        visit(fn->body(), assigned);
+    }
+
+    SpecializeStats stats;
+    auto substitute = [&](std::unique_ptr<Expression>& slot) {
+        if (slot->kind() != ASTNode::Kind::VariableExpr) {
+            return false;
+        }
+        auto& name = dynamic_cast<VariableExpression&>(*slot).name();
+        auto constant = constants.find(name);
+        if (constant == constants.end() || bound.contains(name)) {
+            return false;
+        }
+        auto value = literal(constant->second);
+        if (value) {
+            slot = std::move(value);
+            stats.substituted++;
+        }
+        return true;
+    };
+    for (auto& stmt : program.statements()) {
+        visit(*stmt, substitute);
+    }
+    for (auto& [name, fn] : program.functions()) {
+        visit(fn->body(), substitute);
+    }
+
+    stats.dead = eliminate_dead_code(program, roots);
+    return stats;
+}
+
+SpecializationCache::SpecializationCache(std::string source, std::unordered_set<std::string> roots)
+    : m_source(std::move(source))
+    , m_roots(std::move(roots))
+{
+}
+
+std::shared_ptr<Program> SpecializationCache::get(const Constants& constants)
+{
+    std::vector<std::string> entries;
+    for (auto [name, value] : constants) {
+        entries.push_back(std::format("{}={}:{}", name, value_kind_str(value.kind()), value.inspect()));
+    }
+    std::sort(entries.begin(), entries.end());
+    std::string key;
+    for (auto& entry : entries) {
+        key += std::format("s{}:{};", entry.size(), entry);
+    }
+
+    auto found = m_programs.find(key);
+    if (found != m_programs.end()) {
+        m_hits++;
+        return found->second;
+    }
+
+    m_misses++;
+    std::shared_ptr<Program> program = Parser(m_source).parse();
+    specialize(*program, constants, m_roots);
+    m_programs.emplace(std::move(key), program);
+    return program;
+}
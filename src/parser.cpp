@@ -1,6 +1,9 @@
 #include "parser.h"
+#include "alloc.h"
 #include "ast.h"
+#include "flat.h"
 #include "tokenizer.h"
+#include <algorithm>
 #include <format>
 #include <memory>
 #include <stdexcept>
@@ -41,7 +44,14 @@ std::unique_ptr<Program> Parser::parse()
         peek = peek_token();
     }
 
-    return std::make_unique<Program>(std::move(statements), std::move(functions));
+    return make_node<Program>(std::move(statements), std::move(functions));
+}
+
+FlatBuffer Parser::parse_flat()
+{
+    // the tree is dropped as soon as it has been flattened
+    auto program = parse();
+    return flatten(*program);
 }
 
 std::unique_ptr<Statement> Parser::parse_statement()
@@ -66,11 +76,11 @@ std::unique_ptr<Statement> Parser::parse_statement()
     case TokenKind::LBrace:
         return parse_block_statement();
     case TokenKind::Semicolon:
-        return std::make_unique<EmptyStatement>();
+        return make_node<EmptyStatement>();
     default: {
         auto expr = parse_expression();
         consum_token(TokenKind::Semicolon);
-        return std::make_unique<ExpressionStatement>(std::move(expr));
+        return make_node<ExpressionStatement>(std::move(expr));
     }
     }
 }
@@ -111,7 +121,7 @@ std::unique_ptr<Statement> Parser::parse_let_statement()
 
     consum_token(TokenKind::Semicolon);
 
-    return std::make_unique<LetStatement>(name, std::move(expr));
+    return make_node<LetStatement>(name, std::move(expr));
 }
 
 std::unique_ptr<Statement> Parser::parse_if_statement()
@@ -128,7 +138,7 @@ std::unique_ptr<Statement> Parser::parse_if_statement()
         else_branch = parse_statement();
     }
 
-    return std::make_unique<IfStatement>(
+    return make_node<IfStatement>(
         std::move(condition), std::move(then_branch), std::move(else_branch));
 }
 
@@ -166,7 +176,7 @@ std::unique_ptr<Statement> Parser::parse_for_statement()
 
     body = parse_statement();
 
-    return std::make_unique<ForStatement>(std::move(initializer),
+    return make_node<ForStatement>(std::move(initializer),
         std::move(condition),
         std::move(increment), std::move(body));
 }
@@ -184,7 +194,7 @@ std::unique_ptr<Statement> Parser::parse_block_statement()
 
     consum_token(TokenKind::RBrace);
 
-    return std::make_unique<BlockStatement>(std::move(statements));
+    return make_node<BlockStatement>(std::move(statements));
 }
 
 std::unique_ptr<Statement> Parser::parse_return_statement()
@@ -196,13 +206,13 @@ std::unique_ptr<Statement> Parser::parse_return_statement()
     }
     if (peek->kind == TokenKind::Semicolon) {
         consum_token(TokenKind::Semicolon);
-        return std::make_unique<ReturnStatement>(nullptr);
+        return make_node<ReturnStatement>(nullptr);
     }
 
     auto expr = parse_expression();
     consum_token(TokenKind::Semicolon);
 
-    return std::make_unique<ReturnStatement>(std::move(expr));
+    return make_node<ReturnStatement>(std::move(expr));
 }
 
 std::unique_ptr<Statement> Parser::parse_break_statement()
@@ -210,7 +220,7 @@ std::unique_ptr<Statement> Parser::parse_break_statement()
     consum_token(TokenKind::Break);
     consum_token(TokenKind::Semicolon);
 
-    return std::make_unique<BreakStatement>();
+    return make_node<BreakStatement>();
 }
 
 std::unique_ptr<Statement> Parser::parse_continue_statement()
@@ -218,7 +228,7 @@ std::unique_ptr<Statement> Parser::parse_continue_statement()
     consum_token(TokenKind::Continue);
     consum_token(TokenKind::Semicolon);
 
-    return std::make_unique<ContinueStatement>();
+    return make_node<ContinueStatement>();
 }
 
 std::unique_ptr<Statement> Parser::parse_fn_statement()
@@ -233,7 +243,7 @@ std::unique_ptr<Statement> Parser::parse_fn_statement()
 
     auto body = parse_block_statement();
 
-    return std::make_unique<FnStatement>(name, params, std::move(body));
+    return make_node<FnStatement>(name, params, std::move(body));
 }
 
 std::unique_ptr<Expression> Parser::parse_expression()
@@ -288,6 +298,16 @@ Parser::parse_expression_precedence(Precedence precedence)
     return expr;
 }
 
+std::unique_ptr<Expression> Parser::string_literal(std::string_view text)
+{
+    auto found = m_strings.find(text);
+    if (found == m_strings.end()) {
+        auto constant = std::static_pointer_cast<String>(Value(std::string(text)).obj());
+        found = m_strings.emplace(std::string_view(constant->value()), constant).first;
+    }
+    return make_node<StringLiteral>(found->second);
+}
+
 std::unique_ptr<Expression> Parser::parse_prefix_expression()
 {
     auto peek = peek_token();
@@ -304,7 +324,7 @@ std::unique_ptr<Expression> Parser::parse_prefix_expression()
             throw std::runtime_error(
                 "Expected expression for prefix expression but got null");
         }
-        return std::make_unique<PrefixExpression>(Operator::Not, std::move(expr));
+        return make_node<PrefixExpression>(Operator::Not, std::move(expr));
     }
     case TokenKind::Minus: {
         next_token();
@@ -313,7 +333,7 @@ std::unique_ptr<Expression> Parser::parse_prefix_expression()
             throw std::runtime_error(
                 "Expected expression for prefix expression but got null");
         }
-        return std::make_unique<PrefixExpression>(Operator::Subtract,
+        return make_node<PrefixExpression>(Operator::Subtract,
             std::move(expr));
     }
     default:
@@ -333,7 +353,7 @@ Parser::parse_postfix_expression(Token& peek,
             throw std::runtime_error("Expected expression for index but got null");
         }
         consum_token(TokenKind::RBracket);
-        return std::make_unique<IndexExpression>(std::move(expr), std::move(index));
+        return make_node<IndexExpression>(std::move(expr), std::move(index));
     }
     case TokenKind::LParen: {
 
@@ -343,16 +363,21 @@ Parser::parse_postfix_expression(Token& peek,
             [this]() { return this->parse_expression(); });
         consum_token(TokenKind::RParen);
 
-        return std::make_unique<CallExpression>(std::move(expr), std::move(args));
+        return make_node<CallExpression>(std::move(expr), std::move(args));
+    }
+    case TokenKind::Dot: {
+        consum_token(TokenKind::Dot);
+        auto name = parse_identifier();
+        return make_node<AccessExpression>(std::move(expr), name);
     }
     case TokenKind::Increase: {
         consum_token(TokenKind::Increase);
-        return std::make_unique<PostfixExpression>(Operator::Increase,
+        return make_node<PostfixExpression>(Operator::Increase,
             std::move(expr));
     }
     case TokenKind::Decrease: {
         consum_token(TokenKind::Decrease);
-        return std::make_unique<PostfixExpression>(Operator::Decrease,
+        return make_node<PostfixExpression>(Operator::Decrease,
             std::move(expr));
     }
     default:
@@ -372,6 +397,7 @@ Parser::parse_infix_expression(std::unique_ptr<Expression> expr,
     switch (peek->kind) {
     case TokenKind::LParen:
     case TokenKind::LBracket:
+    case TokenKind::Dot:
     case TokenKind::Increase:
     case TokenKind::Decrease:
         return parse_postfix_expression(*peek, std::move(expr));
@@ -386,7 +412,7 @@ Parser::parse_infix_expression(std::unique_ptr<Expression> expr,
         if (rhs == nullptr) {
             throw std::runtime_error("Invalid binary rhs");
         }
-        return std::make_unique<BinaryExpression>(op, std::move(expr),
+        return make_node<BinaryExpression>(op, std::move(expr),
             std::move(rhs));
     }
     }
@@ -402,32 +428,36 @@ std::unique_ptr<Expression> Parser::parse_primary()
     switch (peek->kind) {
     case TokenKind::True: {
         auto token = next_token();
-        return std::make_unique<BooleanLiteral>(true);
+        return make_node<BooleanLiteral>(true);
     }
     case TokenKind::False: {
         auto token = next_token();
-        return std::make_unique<BooleanLiteral>(false);
+        return make_node<BooleanLiteral>(false);
     }
     case TokenKind::Undefined: {
         auto token = next_token();
-        return std::make_unique<UndefinedLiteral>();
+        return make_node<UndefinedLiteral>();
     }
     case TokenKind::Integer: {
         auto token = next_token();
         auto i = std::stoll(std::string(token->text));
-        return std::make_unique<IntegerLiteral>(i);
+        return make_node<IntegerLiteral>(i);
     }
     case TokenKind::Float: {
         auto token = next_token();
         auto f = std::stod(std::string(token->text));
-        return std::make_unique<FloatLiteral>(f);
+        return make_node<FloatLiteral>(f);
     }
     case TokenKind::String: {
         auto token = next_token();
-        std::string result;
         auto view = token->text;
         view.remove_prefix(1);
         view.remove_suffix(1);
+        if (view.find('\\') == std::string_view::npos) {
+            return string_literal(view);
+        }
+
+        std::string result;
 
         for (auto c = view.begin(); c != view.end(); ++c) {
             if (*c == '\\') {
@@ -445,18 +475,22 @@ std::unique_ptr<Expression> Parser::parse_primary()
                 case '\\':
                     result.push_back('\\');
                     break;
+                case '"':
+                    result.push_back('"');
+                    break;
                 default:
                     result.push_back('\\');
                     result.push_back(*c);
                 }
+                continue;
             }
             result.push_back(*c);
         }
-        return std::make_unique<StringLiteral>(result);
+        return string_literal(result);
     }
     case TokenKind::Identifier: {
         auto token = next_token();
-        return std::make_unique<VariableExpression>(std::string(token->text));
+        return make_node<VariableExpression>(std::string(token->text));
     }
 
     case TokenKind::LParen: {
@@ -475,7 +509,28 @@ std::unique_ptr<Expression> Parser::parse_primary()
             [this]() { return this->parse_expression(); });
         consum_token(TokenKind::RBracket);
 
-        return std::make_unique<ArrayExpression>(std::move(elements));
+        return make_node<ArrayExpression>(std::move(elements));
+    }
+
+    case TokenKind::LBrace: {
+        // object expression
+        consum_token(TokenKind::LBrace);
+        std::vector<std::string> keys;
+        std::vector<std::unique_ptr<Expression>> values = parse_list<std::unique_ptr<Expression>>(
+            TokenKind::RBrace, TokenKind::Comma,
+            [this, &keys]() {
+                auto key = parse_identifier();
+                if (std::find(keys.begin(), keys.end(), key) != keys.end()) {
+                    throw std::runtime_error(
+                        std::format("Duplicate key `{}` in object expression", key));
+                }
+                keys.push_back(key);
+                consum_token(TokenKind::Colon);
+                return this->parse_expression();
+            });
+        consum_token(TokenKind::RBrace);
+
+        return make_node<ObjectExpression>(std::move(keys), std::move(values));
     }
 
     default:
@@ -0,0 +1,347 @@
+#include "profiler.h"
+#include "ast.h"
+#include "object.h"
+#include <algorithm>
+#include <chrono>
+#include <format>
+#include <sstream>
+#include <string>
+#include <vector>
+
+void Profiler::enter(ASTNode& node)
+{
+    auto found = m_records.find(&node);
+    if (found == m_records.end()) {
+        Record record;
+        record.entry.node = &node;
+        record.entry.label = label(node);
+        found = m_records.insert({ &node, record }).first;
+    }
+
+    auto& record = found->second;
+    record.entry.count++;
+    record.active++;
+
+    auto path_length = m_path.size();
+    if (node.kind() == ASTNode::Kind::FnStmt) {
+        m_path.push_back(';');
+        m_path.append(dynamic_cast<FnStatement&>(node).name());
+    }
+
+    m_frames.push_back(Frame { &record, Clock::now(), std::chrono::nanoseconds(0), path_length });
+}
+
+void Profiler::leave()
+{
+    auto now = Clock::now();
+    auto frame = m_frames.back();
+    m_frames.pop_back();
+
+    auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(now - frame.start);
+    auto exclusive = elapsed - frame.children;
+
+    auto& record = *frame.record;
+    record.active--;
+    record.entry.exclusive += exclusive;
+    if (record.active == 0) {
+        record.entry.inclusive += elapsed;
+    }
+
+    m_folded[m_path] += exclusive;
+    m_path.resize(frame.path_length);
+
+    if (!m_frames.empty()) {
+        m_frames.back().children += elapsed;
+    }
+}
+
+void Profiler::reset()
+{
+    m_records.clear();
+    m_frames.clear();
+    m_folded.clear();
+    m_path = "main";
+}
+
+std::vector<ProfileEntry> Profiler::entries() const
+{
+    std::vector<ProfileEntry> entries;
+    entries.reserve(m_records.size());
+    for (auto& [node, record] : m_records) {
+        entries.push_back(record.entry);
+    }
+
+    std::sort(entries.begin(), entries.end(), [](auto& a, auto& b) {
+        return a.exclusive > b.exclusive;
+    });
+
+    return entries;
+}
+
+std::vector<ProfileEntry> Profiler::functions() const
+{
+    std::vector<ProfileEntry> functions;
+    for (auto& [node, record] : m_records) {
+        if (node->kind() == ASTNode::Kind::FnStmt) {
+            functions.push_back(record.entry);
+        }
+    }
+
+    std::sort(functions.begin(), functions.end(), [](auto& a, auto& b) {
+        return a.inclusive > b.inclusive;
+    });
+
+    return functions;
+}
+
+std::string Profiler::flat_report(size_t limit) const
+{
+    using std::chrono::duration_cast;
+    using std::chrono::microseconds;
+
+    auto all = entries();
+
+    std::chrono::nanoseconds total { 0 };
+    for (auto& entry : all) {
+        total += entry.exclusive;
+    }
+
+    std::stringstream ss;
+
+    ss << std::format("{:>7} {:>12} {:>12} {:>10}  {}", "self%", "self(us)",
+              "total(us)", "calls", "node")
+       << std::endl;
+
+    auto rows = std::min(limit, all.size());
+    for (size_t i = 0; i < rows; ++i) {
+        auto& entry = all[i];
+        double percent = total.count() > 0
+            ? 100.0 * double(entry.exclusive.count()) / double(total.count())
+            : 0.0;
+        ss << std::format("{:>6.2f}% {:>12} {:>12} {:>10}  {}", percent,
+                  duration_cast<microseconds>(entry.exclusive).count(),
+                  duration_cast<microseconds>(entry.inclusive).count(),
+                  entry.count, entry.label)
+           << std::endl;
+    }
+
+    auto functions = this->functions();
+    if (!functions.empty()) {
+        ss << std::endl
+           << std::format("{:>12} {:>12} {:>10}  {}", "self(us)", "total(us)",
+                  "calls", "function")
+           << std::endl;
+        for (auto& entry : functions) {
+            ss << std::format("{:>12} {:>12} {:>10}  {}",
+                      duration_cast<microseconds>(entry.exclusive).count(),
+                      duration_cast<microseconds>(entry.inclusive).count(),
+                      entry.count, entry.label)
+               << std::endl;
+        }
+    }
+
+    return ss.str();
+}
+
+std::string Profiler::folded_stacks() const
+{
+    std::vector<std::pair<std::string, std::chrono::nanoseconds>> stacks(
+        m_folded.begin(), m_folded.end());
+    std::sort(stacks.begin(), stacks.end());
+
+    std::stringstream ss;
+    for (auto& [path, elapsed] : stacks) {
+        auto us = std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count();
+        if (us > 0) {
+            ss << path << " " << us << std::endl;
+        }
+    }
+
+    return ss.str();
+}
+
+std::string Profiler::label(ASTNode& node)
+{
+    switch (node.kind()) {
+    case ASTNode::Kind::FnStmt:
+        return std::format("fn {}", dynamic_cast<FnStatement&>(node).name());
+    case ASTNode::Kind::LetStmt:
+        return std::format("LetStmt({})", dynamic_cast<LetStatement&>(node).name());
+    case ASTNode::Kind::BinaryExpr:
+        return std::format("BinaryExpr({})",
+            operator_str(dynamic_cast<BinaryExpression&>(node).op()));
+    case ASTNode::Kind::PrefixExpr:
+        return std::format("PrefixExpr({})",
+            operator_str(dynamic_cast<PrefixExpression&>(node).op()));
+    case ASTNode::Kind::VariableExpr:
+        return std::format("VariableExpr({})",
+            dynamic_cast<VariableExpression&>(node).name());
+    case ASTNode::Kind::AccessExpr:
+        return std::format("AccessExpr({})",
+            dynamic_cast<AccessExpression&>(node).name());
+    case ASTNode::Kind::CallExpr: {
+        auto& callee = dynamic_cast<CallExpression&>(node).callee();
+        if (callee.kind() == ASTNode::Kind::VariableExpr) {
+            return std::format("CallExpr({})",
+                dynamic_cast<VariableExpression&>(callee).name());
+        }
+        return "CallExpr";
+    }
+    default:
+        return node_kind_str(node.kind());
+    }
+}
+
+static void collect_caches(ASTNode& node, std::vector<CacheEntry>& caches)
+{
+    switch (node.kind()) {
+    case ASTNode::Kind::FnStmt:
+        collect_caches(dynamic_cast<FnStatement&>(node).body(), caches);
+        break;
+    case ASTNode::Kind::LetStmt: {
+        auto& let = dynamic_cast<LetStatement&>(node);
+        if (let.value()) {
+            collect_caches(*let.value(), caches);
+        }
+        break;
+    }
+    case ASTNode::Kind::IfStmt: {
+        auto& if_stmt = dynamic_cast<IfStatement&>(node);
+        collect_caches(if_stmt.condition(), caches);
+        collect_caches(if_stmt.then_branch(), caches);
+        if (if_stmt.else_branch()) {
+            collect_caches(*if_stmt.else_branch(), caches);
+        }
+        break;
+    }
+    case ASTNode::Kind::ForStmt: {
+        auto& for_stmt = dynamic_cast<ForStatement&>(node);
+        if (for_stmt.initializer()) {
+            collect_caches(*for_stmt.initializer(), caches);
+        }
+        if (for_stmt.condition()) {
+            collect_caches(*for_stmt.condition(), caches);
+        }
+        if (for_stmt.increment()) {
+            collect_caches(*for_stmt.increment(), caches);
+        }
+        collect_caches(for_stmt.body(), caches);
+        break;
+    }
+    case ASTNode::Kind::BlockStmt:
+        for (auto& stmt : dynamic_cast<BlockStatement&>(node).statements()) {
+            collect_caches(*stmt, caches);
+        }
+        break;
+    case ASTNode::Kind::ReturnStmt: {
+        auto& ret = dynamic_cast<ReturnStatement&>(node);
+        if (ret.value()) {
+            collect_caches(*ret.value(), caches);
+        }
+        break;
+    }
+    case ASTNode::Kind::ExprStmt:
+        collect_caches(dynamic_cast<ExpressionStatement&>(node).expr(), caches);
+        break;
+    case ASTNode::Kind::BinaryExpr: {
+        auto& binary = dynamic_cast<BinaryExpression&>(node);
+        collect_caches(binary.left(), caches);
+        collect_caches(binary.right(), caches);
+
+        auto& cache = binary.cache();
+        if (cache.hits + cache.misses > 0) {
+            std::string kinds;
+            for (size_t i = 0; i < cache.size; ++i) {
+                kinds += std::format("{}{}, {}", i > 0 ? " | " : "",
+                    value_kind_str(cache.entries[i].lhs), value_kind_str(cache.entries[i].rhs));
+            }
+            caches.push_back(CacheEntry { &node,
+                std::format("{} [{}]", Profiler::label(node), kinds), cache.hits, cache.misses });
+        }
+        break;
+    }
+    case ASTNode::Kind::PrefixExpr:
+        collect_caches(dynamic_cast<PrefixExpression&>(node).expr(), caches);
+        break;
+    case ASTNode::Kind::PostfixExpr:
+        collect_caches(dynamic_cast<PostfixExpression&>(node).expr(), caches);
+        break;
+    case ASTNode::Kind::CallExpr: {
+        auto& call = dynamic_cast<CallExpression&>(node);
+        collect_caches(call.callee(), caches);
+        for (auto& arg : call.args()) {
+            collect_caches(*arg, caches);
+        }
+        break;
+    }
+    case ASTNode::Kind::ArrayExpr:
+        for (auto& element : dynamic_cast<ArrayExpression&>(node).elements()) {
+            collect_caches(*element, caches);
+        }
+        break;
+    case ASTNode::Kind::IndexExpr: {
+        auto& index = dynamic_cast<IndexExpression&>(node);
+        collect_caches(index.object(), caches);
+        collect_caches(index.index(), caches);
+        break;
+    }
+    case ASTNode::Kind::ObjectExpr:
+        for (auto& value : dynamic_cast<ObjectExpression&>(node).values()) {
+            collect_caches(*value, caches);
+        }
+        break;
+    case ASTNode::Kind::AccessExpr: {
+        auto& access = dynamic_cast<AccessExpression&>(node);
+        collect_caches(access.object(), caches);
+
+        auto& cache = access.cache();
+        if (cache.hits + cache.misses > 0) {
+            caches.push_back(CacheEntry { &node, Profiler::label(node), cache.hits, cache.misses });
+        }
+        break;
+    }
+    default:
+        break;
+    }
+}
+
+std::vector<CacheEntry> Profiler::inline_caches(Program& program)
+{
+    std::vector<CacheEntry> caches;
+    for (auto& stmt : program.statements()) {
+        collect_caches(*stmt, caches);
+    }
+
+    std::vector<std::pair<std::string, FnStatement*>> functions;
+    for (auto& [name, fn] : program.functions()) {
+        functions.push_back({ name, fn.get() });
+    }
+    std::sort(functions.begin(), functions.end());
+    for (auto& [name, fn] : functions) {
+        collect_caches(*fn, caches);
+    }
+
+    std::stable_sort(caches.begin(), caches.end(), [](auto& a, auto& b) {
+        return a.hits + a.misses > b.hits + b.misses;
+    });
+
+    return caches;
+}
+
+std::string Profiler::cache_report(Program& program, size_t limit)
+{
+    auto caches = inline_caches(program);
+
+    std::stringstream ss;
+    ss << std::format("{:>7} {:>12} {:>10}  {}", "hit%", "hits", "misses", "site") << std::endl;
+
+    auto rows = std::min(limit, caches.size());
+    for (size_t i = 0; i < rows; ++i) {
+        auto& cache = caches[i];
+        ss << std::format("{:>6.2f}% {:>12} {:>10}  {}", 100.0 * cache.hit_rate(),
+                  cache.hits, cache.misses, cache.label)
+           << std::endl;
+    }
+
+    return ss.str();
+}
@@ -0,0 +1,1017 @@
+#include "regcode.h"
+#include "ast.h"
+#include "resolver.h"
+#include <algorithm>
+#include <format>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+std::string reg_opcode_str(RegOp op)
+{
+    switch (op) {
+#define EXPR_REG_OPCODE_NAME(name) \
+    case RegOp::name:              \
+        return #name;
+        EXPR_REG_OPCODES(EXPR_REG_OPCODE_NAME)
+#undef EXPR_REG_OPCODE_NAME
+    default:
+        return "Unknown";
+    }
+}
+
+// Static type of a register. None is the type of a local no assignment has
+// reached yet; Any means a boxed Value.
+enum class RegType {
+    None,
+    Int,
+    Float,
+    Bool,
+    Any,
+};
+
+static RegType join(RegType lhs, RegType rhs)
+{
+    if (lhs == RegType::None) {
+        return rhs;
+    }
+    if (rhs == RegType::None || lhs == rhs) {
+        return lhs;
+    }
+    return RegType::Any;
+}
+
+static bool numeric(RegType type)
+{
+    return type == RegType::Int || type == RegType::Float;
+}
+
+struct Operand {
+    uint32_t reg;
+    RegType type;
+};
+
+class RegCompiler {
+public:
+    RegCompiler(RegProgram& program, RegChunk& chunk,
+        std::unordered_map<std::string, uint32_t>& names,
+        const std::unordered_set<std::string>& rebound,
+        const std::unordered_set<std::string>* shared)
+        : m_program(program)
+        , m_chunk(chunk)
+        , m_names(names)
+        , m_rebound(rebound)
+        , m_resolver(shared)
+    {
+    }
+
+    void function(FnStatement& fn);
+    void top_level(std::vector<std::unique_ptr<Statement>>& statements);
+
+private:
+    struct Loop {
+        std::vector<size_t> breaks;
+        std::vector<size_t> continues;
+    };
+
+    void infer(uint32_t params);
+    RegType type_of(Expression& expression);
+
+    void statement(Statement& statement);
+    Operand expression(Expression& expression, std::optional<uint32_t> dst = std::nullopt);
+    Operand value(Expression& expression, std::optional<uint32_t> dst = std::nullopt);
+    Operand boxed(Operand operand, std::optional<uint32_t> dst = std::nullopt);
+    Operand as_float(Operand operand);
+    Operand binary(BinaryExpression& expression, std::optional<uint32_t> dst);
+    Operand assign(BinaryExpression& expression, std::optional<uint32_t> dst);
+    Operand store(uint32_t slot, Expression& expression);
+    Operand call(CallExpression& expression, std::optional<uint32_t> dst);
+    Operand postfix(PostfixExpression& expression, std::optional<uint32_t> dst);
+    size_t branch_unless(Expression& condition);
+
+    void emit(RegOp op, uint32_t a = 0, uint32_t b = 0, uint32_t c = 0)
+    {
+        m_chunk.code.push_back(RegInstruction { op, a, b, c });
+    }
+    size_t here() const { return m_chunk.code.size(); }
+    size_t jump(RegOp op, uint32_t a = 0, uint32_t b = 0)
+    {
+        emit(op, a, b);
+        return here() - 1;
+    }
+    void patch(size_t at) { m_chunk.code[at].c = uint32_t(here()); }
+
+    uint32_t temp()
+    {
+        auto reg = m_next++;
+        m_chunk.registers = std::max(m_chunk.registers, m_next);
+        return reg;
+    }
+    uint32_t target(std::optional<uint32_t> dst) { return dst ? *dst : temp(); }
+
+    uint32_t name(const std::string& name);
+    std::optional<uint32_t> local(Expression& expression) const;
+    RegType local_type(uint32_t slot) const { return m_types[slot]; }
+
+    RegProgram& m_program;
+    RegChunk& m_chunk;
+    std::unordered_map<std::string, uint32_t>& m_names;
+    const std::unordered_set<std::string>& m_rebound;
+    Resolver m_resolver;
+
+    std::vector<RegType> m_types;
+    std::vector<Loop> m_loops;
+    uint32_t m_next = 0;
+};
+
+uint32_t RegCompiler::name(const std::string& name)
+{
+    auto found = m_names.find(name);
+    if (found != m_names.end()) {
+        return found->second;
+    }
+
+    auto index = uint32_t(m_program.names.size());
+    m_program.names.push_back(name);
+    m_names.insert({ name, index });
+
+    return index;
+}
+
+std::optional<uint32_t> RegCompiler::local(Expression& expression) const
+{
+    auto found = m_resolver.slots.find(&expression);
+    if (found == m_resolver.slots.end()) {
+        return std::nullopt;
+    }
+    return found->second;
+}
+
+void RegCompiler::function(FnStatement& fn)
+{
+    m_chunk.name = fn.name();
+    m_chunk.params = uint32_t(fn.params().size());
+    m_resolver.function(fn);
+    infer(m_chunk.params);
+
+    statement(fn.body());
+
+    auto ret = temp();
+    emit(RegOp::LoadUndefined, ret);
+    emit(RegOp::Return, ret);
+}
+
+void RegCompiler::top_level(std::vector<std::unique_ptr<Statement>>& statements)
+{
+    m_chunk.name = "<main>";
+    for (auto& stmt : statements) {
+        m_resolver.statement(*stmt);
+    }
+    infer(0);
+
+    for (auto& stmt : statements) {
+        statement(*stmt);
+    }
+
+    auto ret = temp();
+    emit(RegOp::LoadUndefined, ret);
+    emit(RegOp::Return, ret);
+}
+
+// Gives every local the join of the types assigned to it, iterated to a fixed
+// point since assignments may read other locals.
+void RegCompiler::infer(uint32_t params)
+{
+    m_types.assign(m_resolver.locals(), RegType::None);
+    std::fill_n(m_types.begin(), params, RegType::Any);
+
+    for (bool changed = true; changed;) {
+        changed = false;
+        for (auto& assignment : m_resolver.assignments) {
+            RegType type;
+            if (assignment.postfix) {
+                type = m_types[assignment.slot] == RegType::Any ? RegType::Any : RegType::Int;
+            } else if (assignment.value) {
+                type = type_of(*assignment.value);
+            } else {
+                type = RegType::Any;
+            }
+
+            auto joined = join(m_types[assignment.slot], type);
+            if (joined != m_types[assignment.slot]) {
+                m_types[assignment.slot] = joined;
+                changed = true;
+            }
+        }
+    }
+
+    for (auto& type : m_types) {
+        if (type == RegType::None) {
+            type = RegType::Any;
+        }
+    }
+
+    m_next = m_chunk.registers = m_resolver.locals();
+}
+
+RegType RegCompiler::type_of(Expression& expression)
+{
+    switch (expression.kind()) {
+    case ASTNode::Kind::LiteralExpr:
+        switch (dynamic_cast<LiteralExpression&>(expression).literal_kind()) {
+        case LiteralKind::Integer:
+            return RegType::Int;
+        case LiteralKind::Float:
+            return RegType::Float;
+        case LiteralKind::Boolean:
+            return RegType::Bool;
+        default:
+            return RegType::Any;
+        }
+    case ASTNode::Kind::VariableExpr: {
+        auto slot = local(expression);
+        return slot ? m_types[*slot] : RegType::Any;
+    }
+    case ASTNode::Kind::BinaryExpr: {
+        auto& binary = dynamic_cast<BinaryExpression&>(expression);
+        if (binary.op() == Operator::Assign) {
+            auto slot = local(binary.left());
+            return slot ? m_types[*slot] : RegType::Any;
+        }
+
+        auto lhs = type_of(binary.left());
+        auto rhs = type_of(binary.right());
+        switch (binary.op()) {
+        case Operator::Equals:
+        case Operator::NotEquals:
+        case Operator::LessThan:
+        case Operator::LessThanOrEqual:
+        case Operator::GreaterThan:
+        case Operator::GreaterThanOrEqual:
+            return RegType::Bool;
+        case Operator::Add:
+        case Operator::Subtract:
+        case Operator::Multiply:
+        case Operator::Divide:
+        case Operator::Modulo:
+            if (lhs == RegType::None || rhs == RegType::None) {
+                return RegType::None;
+            }
+            if (lhs == RegType::Int && rhs == RegType::Int) {
+                return RegType::Int;
+            }
+            if (binary.op() != Operator::Modulo && numeric(lhs) && numeric(rhs)) {
+                return RegType::Float;
+            }
+            return RegType::Any;
+        default:
+            return RegType::Any;
+        }
+    }
+    case ASTNode::Kind::PrefixExpr: {
+        auto& prefix = dynamic_cast<PrefixExpression&>(expression);
+        if (prefix.op() == Operator::Not) {
+            return RegType::Bool;
+        }
+        auto type = type_of(prefix.expr());
+        return type == RegType::None || numeric(type) ? type : RegType::Any;
+    }
+    case ASTNode::Kind::PostfixExpr: {
+        auto slot = local(dynamic_cast<PostfixExpression&>(expression).expr());
+        return slot ? m_types[*slot] : RegType::Any;
+    }
+    default:
+        return RegType::Any;
+    }
+}
+
+void RegCompiler::statement(Statement& statement)
+{
+    // temporaries never outlive a statement
+    m_next = m_resolver.locals();
+
+    switch (statement.kind()) {
+    case ASTNode::Kind::LetStmt: {
+        auto& let = dynamic_cast<LetStatement&>(statement);
+        auto found = m_resolver.slots.find(&let);
+        if (found == m_resolver.slots.end()) {
+            auto value = let.value() ? this->value(*let.value()) : Operand { temp(), RegType::Any };
+            if (!let.value()) {
+                emit(RegOp::LoadUndefined, value.reg);
+            }
+            emit(RegOp::DefineGlobal, name(let.name()), value.reg);
+            break;
+        }
+
+        if (let.value()) {
+            store(found->second, *let.value());
+        } else {
+            emit(RegOp::LoadUndefined, found->second);
+        }
+        break;
+    }
+    case ASTNode::Kind::IfStmt: {
+        auto& if_stmt = dynamic_cast<IfStatement&>(statement);
+        auto otherwise = branch_unless(if_stmt.condition());
+        this->statement(if_stmt.then_branch());
+
+        if (if_stmt.else_branch()) {
+            auto end = jump(RegOp::Jump);
+            patch(otherwise);
+            this->statement(*if_stmt.else_branch());
+            patch(end);
+        } else {
+            patch(otherwise);
+        }
+        break;
+    }
+    case ASTNode::Kind::ForStmt: {
+        auto& for_stmt = dynamic_cast<ForStatement&>(statement);
+        if (for_stmt.initializer()) {
+            this->statement(*for_stmt.initializer());
+        }
+
+        auto start = here();
+        std::optional<size_t> exit;
+        if (for_stmt.condition()) {
+            m_next = m_resolver.locals();
+            exit = branch_unless(*for_stmt.condition());
+        }
+
+        m_loops.push_back(Loop());
+        this->statement(for_stmt.body());
+        auto loop = std::move(m_loops.back());
+        m_loops.pop_back();
+
+        for (auto at : loop.continues) {
+            patch(at);
+        }
+        if (for_stmt.increment()) {
+            m_next = m_resolver.locals();
+            expression(*for_stmt.increment());
+        }
+        emit(RegOp::Jump, 0, 0, uint32_t(start));
+
+        if (exit) {
+            patch(*exit);
+        }
+        for (auto at : loop.breaks) {
+            patch(at);
+        }
+        break;
+    }
+    case ASTNode::Kind::BlockStmt:
+        for (auto& stmt : dynamic_cast<BlockStatement&>(statement).statements()) {
+            this->statement(*stmt);
+        }
+        break;
+    case ASTNode::Kind::ReturnStmt: {
+        auto& ret = dynamic_cast<ReturnStatement&>(statement);
+        Operand result { temp(), RegType::Any };
+        if (ret.value()) {
+            result = value(*ret.value());
+        } else {
+            emit(RegOp::LoadUndefined, result.reg);
+        }
+        emit(RegOp::Return, result.reg);
+        break;
+    }
+    case ASTNode::Kind::BreakStmt:
+    case ASTNode::Kind::ContinueStmt: {
+        if (m_loops.empty()) {
+            throw std::runtime_error(std::format("{} outside of a loop",
+                statement.kind() == ASTNode::Kind::BreakStmt ? "break" : "continue"));
+        }
+        auto at = jump(RegOp::Jump);
+        auto& loop = m_loops.back();
+        (statement.kind() == ASTNode::Kind::BreakStmt ? loop.breaks : loop.continues).push_back(at);
+        break;
+    }
+    case ASTNode::Kind::ExprStmt:
+        expression(dynamic_cast<ExpressionStatement&>(statement).expr());
+        break;
+    case ASTNode::Kind::EmptyStmt:
+        break;
+    default:
+        throw std::runtime_error(std::format("cannot compile {}",
+            ASTInspector::inspect(statement)));
+    }
+}
+
+// Emits a jump taken when `condition` is false and returns it for patching.
+size_t RegCompiler::branch_unless(Expression& condition)
+{
+    if (condition.kind() == ASTNode::Kind::BinaryExpr) {
+        auto& binary = dynamic_cast<BinaryExpression&>(condition);
+        if (type_of(binary.left()) == RegType::Int && type_of(binary.right()) == RegType::Int) {
+            std::optional<RegOp> op;
+            switch (binary.op()) {
+            case Operator::Equals:
+                op = RegOp::JumpUnlessEqualII;
+                break;
+            case Operator::NotEquals:
+                op = RegOp::JumpUnlessNotEqualII;
+                break;
+            case Operator::LessThan:
+                op = RegOp::JumpUnlessLessII;
+                break;
+            case Operator::LessThanOrEqual:
+                op = RegOp::JumpUnlessLessEqualII;
+                break;
+            case Operator::GreaterThan:
+                op = RegOp::JumpUnlessGreaterII;
+                break;
+            case Operator::GreaterThanOrEqual:
+                op = RegOp::JumpUnlessGreaterEqualII;
+                break;
+            default:
+                break;
+            }
+
+            if (op) {
+                auto lhs = expression(binary.left());
+                auto rhs = expression(binary.right());
+                return jump(*op, lhs.reg, rhs.reg);
+            }
+        }
+    }
+
+    auto result = expression(condition);
+    if (result.type == RegType::Bool) {
+        return jump(RegOp::JumpIfFalse, result.reg);
+    }
+    return jump(RegOp::JumpIfFalseValue, boxed(result).reg);
+}
+
+Operand RegCompiler::boxed(Operand operand, std::optional<uint32_t> dst)
+{
+    auto reg = dst ? *dst : (operand.type == RegType::Any ? operand.reg : temp());
+
+    switch (operand.type) {
+    case RegType::Int:
+        emit(RegOp::BoxInt, reg, operand.reg);
+        break;
+    case RegType::Float:
+        emit(RegOp::BoxFloat, reg, operand.reg);
+        break;
+    case RegType::Bool:
+        emit(RegOp::BoxBool, reg, operand.reg);
+        break;
+    default:
+        if (reg != operand.reg) {
+            emit(RegOp::Move, reg, operand.reg);
+        }
+        break;
+    }
+
+    return Operand { reg, RegType::Any };
+}
+
+Operand RegCompiler::as_float(Operand operand)
+{
+    if (operand.type != RegType::Int) {
+        return operand;
+    }
+
+    auto reg = temp();
+    emit(RegOp::IntToFloat, reg, operand.reg);
+    return Operand { reg, RegType::Float };
+}
+
+// Compiles an expression into a boxed Value. Literals are boxed once, at
+// compile time.
+Operand RegCompiler::value(Expression& expression, std::optional<uint32_t> dst)
+{
+    if (expression.kind() == ASTNode::Kind::LiteralExpr) {
+        auto& literal = dynamic_cast<LiteralExpression&>(expression);
+        std::optional<Value> constant;
+        switch (literal.literal_kind()) {
+        case LiteralKind::Integer:
+            constant = Value(dynamic_cast<IntegerLiteral&>(literal).value());
+            break;
+        case LiteralKind::Float:
+            constant = Value(dynamic_cast<FloatLiteral&>(literal).value());
+            break;
+        case LiteralKind::Boolean:
+            constant = Value(dynamic_cast<BooleanLiteral&>(literal).value());
+            break;
+        default:
+            break;
+        }
+
+        if (constant) {
+            auto reg = target(dst);
+            m_program.constants.push_back(*constant);
+            emit(RegOp::LoadConst, reg, uint32_t(m_program.constants.size() - 1));
+            return Operand { reg, RegType::Any };
+        }
+    }
+
+    auto result = this->expression(expression, dst);
+    if (result.type == RegType::Any) {
+        return result;
+    }
+
+    // a typed temporary is boxed in place, a typed local into a new one
+    if (!dst && result.reg >= m_resolver.locals()) {
+        dst = result.reg;
+    }
+    return boxed(result, dst);
+}
+
+// Compiles an expression, writing the result to `dst` when given. Only the
+// last instruction of an expression writes `dst`, so it may also be one of
+// the operands.
+Operand RegCompiler::expression(Expression& expression, std::optional<uint32_t> dst)
+{
+    switch (expression.kind()) {
+    case ASTNode::Kind::LiteralExpr: {
+        auto& literal = dynamic_cast<LiteralExpression&>(expression);
+        auto reg = target(dst);
+        switch (literal.literal_kind()) {
+        case LiteralKind::Undefined:
+            emit(RegOp::LoadUndefined, reg);
+            return Operand { reg, RegType::Any };
+        case LiteralKind::Boolean:
+            emit(RegOp::LoadBool, reg, dynamic_cast<BooleanLiteral&>(literal).value());
+            return Operand { reg, RegType::Bool };
+        case LiteralKind::Integer:
+            m_program.integers.push_back(dynamic_cast<IntegerLiteral&>(literal).value());
+            emit(RegOp::LoadInt, reg, uint32_t(m_program.integers.size() - 1));
+            return Operand { reg, RegType::Int };
+        case LiteralKind::Float:
+            m_program.floats.push_back(dynamic_cast<FloatLiteral&>(literal).value());
+            emit(RegOp::LoadFloat, reg, uint32_t(m_program.floats.size() - 1));
+            return Operand { reg, RegType::Float };
+        case LiteralKind::String:
+            m_program.constants.push_back(Value(dynamic_cast<StringLiteral&>(literal).constant()));
+            emit(RegOp::LoadConst, reg, uint32_t(m_program.constants.size() - 1));
+            return Operand { reg, RegType::Any };
+        default:
+            throw std::runtime_error("Invalid literal kind");
+        }
+    }
+    case ASTNode::Kind::VariableExpr: {
+        auto slot = local(expression);
+        if (!slot) {
+            auto reg = target(dst);
+            emit(RegOp::GetGlobal, reg, name(dynamic_cast<VariableExpression&>(expression).name()));
+            return Operand { reg, RegType::Any };
+        }
+
+        auto type = local_type(*slot);
+        if (dst && *dst != *slot) {
+            emit(type == RegType::Any ? RegOp::Move : RegOp::MoveRaw, *dst, *slot);
+            return Operand { *dst, type };
+        }
+        return Operand { *slot, type };
+    }
+    case ASTNode::Kind::BinaryExpr: {
+        auto& binary = dynamic_cast<BinaryExpression&>(expression);
+        if (binary.op() == Operator::Assign) {
+            return assign(binary, dst);
+        }
+        return this->binary(binary, dst);
+    }
+    case ASTNode::Kind::PrefixExpr: {
+        auto& prefix = dynamic_cast<PrefixExpression&>(expression);
+        auto operand = this->expression(prefix.expr());
+        auto reg = target(dst);
+
+        if (prefix.op() == Operator::Not) {
+            if (operand.type == RegType::Bool) {
+                emit(RegOp::NotB, reg, operand.reg);
+            } else {
+                emit(RegOp::Not, reg, boxed(operand).reg);
+            }
+            return Operand { reg, RegType::Bool };
+        }
+        if (prefix.op() != Operator::Subtract) {
+            throw InvalidOperate(std::format("unsupported operator {}", operator_str(prefix.op())));
+        }
+
+        switch (operand.type) {
+        case RegType::Int:
+            emit(RegOp::NegateI, reg, operand.reg);
+            return Operand { reg, RegType::Int };
+        case RegType::Float:
+            emit(RegOp::NegateF, reg, operand.reg);
+            return Operand { reg, RegType::Float };
+        default:
+            emit(RegOp::Negate, reg, boxed(operand).reg);
+            return Operand { reg, RegType::Any };
+        }
+    }
+    case ASTNode::Kind::PostfixExpr:
+        return postfix(dynamic_cast<PostfixExpression&>(expression), dst);
+    case ASTNode::Kind::IndexExpr: {
+        auto& index = dynamic_cast<IndexExpression&>(expression);
+        auto object = value(index.object());
+        auto key = value(index.index());
+        auto reg = target(dst);
+        emit(RegOp::Index, reg, object.reg, key.reg);
+        return Operand { reg, RegType::Any };
+    }
+    case ASTNode::Kind::CallExpr:
+        return call(dynamic_cast<CallExpression&>(expression), dst);
+    case ASTNode::Kind::AccessExpr: {
+        auto& access = dynamic_cast<AccessExpression&>(expression);
+        auto object = value(access.object());
+        auto reg = target(dst);
+        m_program.attributes.push_back(name(access.name()));
+        emit(RegOp::GetAttr, reg, object.reg, uint32_t(m_program.attributes.size() - 1));
+        return Operand { reg, RegType::Any };
+    }
+    case ASTNode::Kind::ArrayExpr: {
+        auto& array = dynamic_cast<ArrayExpression&>(expression);
+        auto first = m_next;
+        auto count = uint32_t(array.elements().size());
+        for (uint32_t i = 0; i < count; ++i) {
+            temp();
+        }
+        for (uint32_t i = 0; i < count; ++i) {
+            value(*array.elements()[i], first + i);
+        }
+
+        auto reg = target(dst);
+        emit(RegOp::NewArray, reg, first, count);
+        return Operand { reg, RegType::Any };
+    }
+    case ASTNode::Kind::ObjectExpr: {
+        auto& object = dynamic_cast<ObjectExpression&>(expression);
+        auto first = m_next;
+        auto count = uint32_t(object.values().size());
+        for (uint32_t i = 0; i < count; ++i) {
+            temp();
+        }
+        for (uint32_t i = 0; i < count; ++i) {
+            value(*object.values()[i], first + i);
+        }
+
+        std::vector<uint32_t> keys;
+        for (auto& key : object.keys()) {
+            keys.push_back(name(key));
+        }
+        m_program.objects.push_back(std::move(keys));
+
+        auto reg = target(dst);
+        emit(RegOp::NewObject, reg, first, uint32_t(m_program.objects.size() - 1));
+        return Operand { reg, RegType::Any };
+    }
+    default:
+        throw std::runtime_error(std::format("cannot compile {}",
+            ASTInspector::inspect(expression)));
+    }
+}
+
+Operand RegCompiler::binary(BinaryExpression& expression, std::optional<uint32_t> dst)
+{
+    auto op = expression.op();
+    auto lhs_type = type_of(expression.left());
+    auto rhs_type = type_of(expression.right());
+
+    auto comparison = op == Operator::Equals || op == Operator::NotEquals
+        || op == Operator::LessThan || op == Operator::LessThanOrEqual
+        || op == Operator::GreaterThan || op == Operator::GreaterThanOrEqual;
+    auto arithmetic = op == Operator::Add || op == Operator::Subtract || op == Operator::Multiply
+        || op == Operator::Divide || op == Operator::Modulo;
+    if (!comparison && !arithmetic) {
+        throw InvalidOperate(std::format("unsupported operator {}", operator_str(op)));
+    }
+
+    auto integers = lhs_type == RegType::Int && rhs_type == RegType::Int;
+    auto floats = !integers && numeric(lhs_type) && numeric(rhs_type) && op != Operator::Modulo;
+
+    if (integers || floats) {
+        auto lhs = this->expression(expression.left());
+        auto rhs = this->expression(expression.right());
+        if (floats) {
+            lhs = as_float(lhs);
+            rhs = as_float(rhs);
+        }
+
+        RegOp code;
+        switch (op) {
+        case Operator::Add:
+            code = integers ? RegOp::AddII : RegOp::AddFF;
+            break;
+        case Operator::Subtract:
+            code = integers ? RegOp::SubII : RegOp::SubFF;
+            break;
+        case Operator::Multiply:
+            code = integers ? RegOp::MulII : RegOp::MulFF;
+            break;
+        case Operator::Divide:
+            code = integers ? RegOp::DivII : RegOp::DivFF;
+            break;
+        case Operator::Modulo:
+            code = RegOp::ModII;
+            break;
+        case Operator::Equals:
+            code = integers ? RegOp::EqualII : RegOp::EqualFF;
+            break;
+        case Operator::NotEquals:
+            code = integers ? RegOp::NotEqualII : RegOp::NotEqualFF;
+            break;
+        case Operator::LessThan:
+            code = integers ? RegOp::LessII : RegOp::LessFF;
+            break;
+        case Operator::LessThanOrEqual:
+            code = integers ? RegOp::LessEqualII : RegOp::LessEqualFF;
+            break;
+        case Operator::GreaterThan:
+            code = integers ? RegOp::GreaterII : RegOp::GreaterFF;
+            break;
+        default:
+            code = integers ? RegOp::GreaterEqualII : RegOp::GreaterEqualFF;
+            break;
+        }
+
+        auto reg = target(dst);
+        emit(code, reg, lhs.reg, rhs.reg);
+        return Operand { reg, comparison ? RegType::Bool : (integers ? RegType::Int : RegType::Float) };
+    }
+
+    auto lhs = value(expression.left());
+    auto rhs = value(expression.right());
+
+    RegOp code;
+    switch (op) {
+    case Operator::Add:
+        code = RegOp::Add;
+        break;
+    case Operator::Subtract:
+        code = RegOp::Sub;
+        break;
+    case Operator::Multiply:
+        code = RegOp::Mul;
+        break;
+    case Operator::Divide:
+        code = RegOp::Div;
+        break;
+    case Operator::Modulo:
+        code = RegOp::Mod;
+        break;
+    case Operator::Equals:
+        code = RegOp::Equal;
+        break;
+    case Operator::NotEquals:
+        code = RegOp::NotEqual;
+        break;
+    case Operator::LessThan:
+        code = RegOp::Less;
+        break;
+    case Operator::LessThanOrEqual:
+        code = RegOp::LessEqual;
+        break;
+    case Operator::GreaterThan:
+        code = RegOp::Greater;
+        break;
+    default:
+        code = RegOp::GreaterEqual;
+        break;
+    }
+
+    auto reg = target(dst);
+    emit(code, reg, lhs.reg, rhs.reg);
+    return Operand { reg, comparison ? RegType::Bool : RegType::Any };
+}
+
+Operand RegCompiler::assign(BinaryExpression& expression, std::optional<uint32_t> dst)
+{
+    auto& target = expression.left();
+
+    switch (target.kind()) {
+    case ASTNode::Kind::VariableExpr: {
+        auto slot = local(target);
+        if (!slot) {
+            auto result = value(expression.right());
+            emit(RegOp::SetGlobal, name(dynamic_cast<VariableExpression&>(target).name()), result.reg);
+            return result;
+        }
+
+        auto result = store(*slot, expression.right());
+        if (dst && *dst != *slot) {
+            emit(result.type == RegType::Any ? RegOp::Move : RegOp::MoveRaw, *dst, *slot);
+            return Operand { *dst, result.type };
+        }
+        return result;
+    }
+    case ASTNode::Kind::IndexExpr: {
+        auto& index = dynamic_cast<IndexExpression&>(target);
+        auto result = value(expression.right());
+        auto object = value(index.object());
+        auto key = value(index.index());
+        emit(RegOp::SetIndex, object.reg, key.reg, result.reg);
+        return boxed(result, dst);
+    }
+    case ASTNode::Kind::AccessExpr: {
+        auto& access = dynamic_cast<AccessExpression&>(target);
+        auto result = value(expression.right());
+        auto object = value(access.object());
+        m_program.attributes.push_back(name(access.name()));
+        emit(RegOp::SetAttr, object.reg, result.reg, uint32_t(m_program.attributes.size() - 1));
+        return boxed(result, dst);
+    }
+    default:
+        throw InvalidOperate(std::format("Invalid assignment target, {}",
+            node_kind_str(target.kind())));
+    }
+}
+
+// Compiles `expression` straight into the register of a local.
+Operand RegCompiler::store(uint32_t slot, Expression& expression)
+{
+    if (local_type(slot) == RegType::Any) {
+        return value(expression, slot);
+    }
+
+    auto result = this->expression(expression, slot);
+    if (result.type != local_type(slot)) {
+        throw std::logic_error(std::format("cannot store a {} expression in a {} register",
+            int(result.type), int(local_type(slot))));
+    }
+    return result;
+}
+
+Operand RegCompiler::postfix(PostfixExpression& expression, std::optional<uint32_t> dst)
+{
+    auto increase = expression.op() == Operator::Increase;
+    if (expression.expr().kind() != ASTNode::Kind::VariableExpr) {
+        throw InvalidOperate(std::format("Invalid {} target, {}",
+            operator_str(expression.op()), node_kind_str(expression.expr().kind())));
+    }
+
+    auto slot = local(expression.expr());
+    if (!slot) {
+        auto reg = target(dst);
+        emit(RegOp::GetGlobal, reg, name(dynamic_cast<VariableExpression&>(expression.expr()).name()));
+        emit(increase ? RegOp::Inc : RegOp::Dec, reg);
+        emit(RegOp::SetGlobal, name(dynamic_cast<VariableExpression&>(expression.expr()).name()), reg);
+        return Operand { reg, RegType::Any };
+    }
+
+    auto type = local_type(*slot);
+    if (type == RegType::Int) {
+        emit(increase ? RegOp::IncI : RegOp::DecI, *slot);
+    } else {
+        emit(increase ? RegOp::Inc : RegOp::Dec, *slot);
+    }
+
+    if (dst && *dst != *slot) {
+        emit(type == RegType::Any ? RegOp::Move : RegOp::MoveRaw, *dst, *slot);
+        return Operand { *dst, type };
+    }
+    return Operand { *slot, type };
+}
+
+Operand RegCompiler::call(CallExpression& expression, std::optional<uint32_t> dst)
+{
+    auto argc = uint32_t(expression.args().size());
+
+    // calls to a program function by name skip the callee lookup
+    std::optional<uint32_t> chunk;
+    if (expression.callee().kind() == ASTNode::Kind::VariableExpr && !local(expression.callee())) {
+        auto& name = dynamic_cast<VariableExpression&>(expression.callee()).name();
+        auto found = m_program.functions.find(name);
+        if (found != m_program.functions.end() && m_program.chunks[found->second].params == argc
+            && !m_rebound.contains(name)) {
+            chunk = found->second;
+        }
+    }
+
+    auto first = m_next;
+    auto callee = chunk ? first : temp();
+    auto args = m_next;
+    for (uint32_t i = 0; i < argc; ++i) {
+        temp();
+    }
+
+    if (!chunk) {
+        value(expression.callee(), callee);
+    }
+    for (uint32_t i = 0; i < argc; ++i) {
+        value(*expression.args()[i], args + i);
+    }
+
+    auto reg = target(dst);
+    if (chunk) {
+        emit(RegOp::Call, reg, *chunk, args);
+    } else {
+        emit(RegOp::CallValue, reg, callee, argc);
+    }
+    return Operand { reg, RegType::Any };
+}
+
+RegProgram compile_registers(Program& program)
+{
+    require_lexical_scoping(program);
+
+    RegProgram compiled;
+
+    // sorted so the same source always compiles to the same chunks
+    std::vector<std::string> names;
+    for (auto& [name, fn] : program.functions()) {
+        names.push_back(name);
+    }
+    std::sort(names.begin(), names.end());
+
+    compiled.chunks.resize(names.size() + 1);
+    for (uint32_t i = 0; i < names.size(); ++i) {
+        compiled.functions.insert({ names[i], i + 1 });
+        compiled.chunks[i + 1].params = uint32_t(program.functions()[names[i]]->params().size());
+    }
+
+    auto rebound = rebound_names(program);
+    std::unordered_map<std::string, uint32_t> interned;
+    for (auto& name : names) {
+        auto& chunk = compiled.chunks[compiled.functions[name]];
+        RegCompiler(compiled, chunk, interned, rebound, nullptr).function(*program.functions()[name]);
+    }
+
+    auto shared = shared_names(program);
+    RegCompiler(compiled, compiled.chunks[0], interned, rebound, &shared).top_level(program.statements());
+
+    return compiled;
+}
+
+std::string disassemble(const RegProgram& program)
+{
+    std::string out;
+
+    for (auto& chunk : program.chunks) {
+        out += std::format("{} (params: {}, registers: {}):\n", chunk.name, chunk.params, chunk.registers);
+        for (size_t i = 0; i < chunk.code.size(); ++i) {
+            auto& instruction = chunk.code[i];
+            auto line = std::format("  {:4} {:<24}", i, reg_opcode_str(instruction.op));
+
+            switch (instruction.op) {
+            case RegOp::LoadConst:
+                line += std::format("r{} {}", instruction.a, Value(program.constants[instruction.b]).inspect());
+                break;
+            case RegOp::LoadInt:
+                line += std::format("r{} {}", instruction.a, program.integers[instruction.b]);
+                break;
+            case RegOp::LoadFloat:
+                line += std::format("r{} {}", instruction.a, program.floats[instruction.b]);
+                break;
+            case RegOp::LoadBool:
+                line += std::format("r{} {}", instruction.a, instruction.b != 0);
+                break;
+            case RegOp::LoadUndefined:
+            case RegOp::Return:
+            case RegOp::Inc:
+            case RegOp::Dec:
+            case RegOp::IncI:
+            case RegOp::DecI:
+                line += std::format("r{}", instruction.a);
+                break;
+            case RegOp::GetGlobal:
+                line += std::format("r{} {}", instruction.a, program.names[instruction.b]);
+                break;
+            case RegOp::SetGlobal:
+            case RegOp::DefineGlobal:
+                line += std::format("{} r{}", program.names[instruction.a], instruction.b);
+                break;
+            case RegOp::Jump:
+                line += std::format("{}", instruction.c);
+                break;
+            case RegOp::JumpIfFalse:
+            case RegOp::JumpIfFalseValue:
+                line += std::format("r{} {}", instruction.a, instruction.c);
+                break;
+            case RegOp::Call:
+                line += std::format("r{} {} r{}", instruction.a, program.chunks[instruction.b].name, instruction.c);
+                break;
+            case RegOp::CallValue:
+            case RegOp::NewArray:
+                line += std::format("r{} r{} {}", instruction.a, instruction.b, instruction.c);
+                break;
+            case RegOp::NewObject:
+                line += std::format("r{} r{} #{}", instruction.a, instruction.b, instruction.c);
+                break;
+            case RegOp::GetAttr:
+            case RegOp::SetAttr:
+                line += std::format("r{} r{} {}", instruction.a, instruction.b,
+                    program.names[program.attributes[instruction.c]]);
+                break;
+            default:
+                if (instruction.op >= RegOp::JumpUnlessEqualII && instruction.op <= RegOp::JumpUnlessGreaterEqualII) {
+                    line += std::format("r{} r{} {}", instruction.a, instruction.b, instruction.c);
+                } else if (instruction.op >= RegOp::Add) {
+                    line += std::format("r{} r{} r{}", instruction.a, instruction.b, instruction.c);
+                } else {
+                    line += std::format("r{} r{}", instruction.a, instruction.b);
+                }
+                break;
+            }
+
+            out += line + '\n';
+        }
+    }
+
+    return out;
+}
@@ -0,0 +1,561 @@
+#include "alloc.h"
+#include "regcode.h"
+#include <format>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#if (defined(__GNUC__) || defined(__clang__)) && !defined(EXPR_SWITCH_DISPATCH)
+#define EXPR_COMPUTED_GOTO
+#endif
+
+RegisterVM::RegisterVM(RegProgram program, Context& context)
+    : m_program(std::move(program))
+    , m_context(context)
+    , m_access_caches(m_program.attributes.size())
+    , m_object_shapes(m_program.objects.size(), nullptr)
+{
+    for (auto& [name, chunk] : m_program.functions) {
+        m_context.insert_variable(name, Value(make_object<UserFunction>(ValueKind::UserFunction, name)));
+    }
+}
+
+// Makes room for the registers of `chunk` at `base` and returns them. Every
+// register is written before it is read, so new ones start out empty.
+RegisterVM::Register* RegisterVM::enter(const RegChunk& chunk, size_t base)
+{
+    if (m_registers.size() < base + chunk.registers) {
+        Register empty { .i = 0, .value = Value(std::shared_ptr<Object>()) };
+        m_registers.resize(base + chunk.registers, empty);
+    }
+    return m_registers.data() + base;
+}
+
+static int64_t integer(const Value& value)
+{
+    return static_cast<Integer*>(value.get())->value();
+}
+
+static bool integers(const Value& lhs, const Value& rhs)
+{
+    return lhs.kind() == ValueKind::Integer && rhs.kind() == ValueKind::Integer;
+}
+
+static Comparison compare(const Value& lhs, const Value& rhs)
+{
+    if (integers(lhs, rhs)) {
+        auto l = integer(lhs);
+        auto r = integer(rhs);
+        return l == r ? Comparison::Equal : (l < r ? Comparison::Less : Comparison::Greater);
+    }
+    return lhs.get()->compare(rhs);
+}
+
+Value RegisterVM::run()
+{
+    m_frames.clear();
+
+    const RegChunk* chunk = &m_program.chunks[0];
+    const RegInstruction* code = chunk->code.data();
+    const RegInstruction* ip = code;
+    size_t base = 0;
+    Register* r = enter(*chunk, base);
+
+#define A r[ip->a]
+#define B r[ip->b]
+#define C r[ip->c]
+#define JUMP(target)          \
+    {                         \
+        ip = code + (target); \
+        DISPATCH();           \
+    }
+
+#ifdef EXPR_COMPUTED_GOTO
+    static const void* dispatch_table[] = {
+#define EXPR_REG_OPCODE_LABEL(name) &&op_##name,
+        EXPR_REG_OPCODES(EXPR_REG_OPCODE_LABEL)
+#undef EXPR_REG_OPCODE_LABEL
+    };
+
+#define CASE(name) op_##name:
+#define DISPATCH() goto* dispatch_table[size_t(ip->op)]
+#define NEXT()      \
+    {               \
+        ++ip;       \
+        DISPATCH(); \
+    }
+
+    DISPATCH();
+#else
+#define CASE(name) case RegOp::name:
+#define DISPATCH() continue
+#define NEXT()     \
+    {              \
+        ++ip;      \
+        continue;  \
+    }
+
+    for (;;) {
+        switch (ip->op) {
+#endif
+
+    CASE(Move)
+    {
+        A.value = B.value;
+        NEXT();
+    }
+    CASE(MoveRaw)
+    {
+        A.i = B.i;
+        NEXT();
+    }
+    CASE(LoadConst)
+    {
+        A.value = m_program.constants[ip->b];
+        NEXT();
+    }
+    CASE(LoadInt)
+    {
+        A.i = m_program.integers[ip->b];
+        NEXT();
+    }
+    CASE(LoadFloat)
+    {
+        A.f = m_program.floats[ip->b];
+        NEXT();
+    }
+    CASE(LoadBool)
+    {
+        A.b = ip->b != 0;
+        NEXT();
+    }
+    CASE(LoadUndefined)
+    {
+        A.value = m_undefined;
+        NEXT();
+    }
+    CASE(BoxInt)
+    {
+        A.value = Value(B.i);
+        NEXT();
+    }
+    CASE(BoxFloat)
+    {
+        A.value = Value(B.f);
+        NEXT();
+    }
+    CASE(BoxBool)
+    {
+        A.value = Value(B.b);
+        NEXT();
+    }
+    CASE(IntToFloat)
+    {
+        A.f = double(B.i);
+        NEXT();
+    }
+    CASE(GetGlobal)
+    {
+        A.value = m_context.get_variable(m_program.names[ip->b]);
+        NEXT();
+    }
+    CASE(SetGlobal)
+    {
+        m_context.set_variable(m_program.names[ip->a], B.value);
+        NEXT();
+    }
+    CASE(DefineGlobal)
+    {
+        m_context.insert_variable(m_program.names[ip->a], B.value);
+        NEXT();
+    }
+
+#define GENERIC_ARITHMETIC(name, method, op)                         \
+    CASE(name)                                                       \
+    {                                                                \
+        if (integers(B.value, C.value)) {                            \
+            A.value = Value(int64_t(integer(B.value) op integer(C.value))); \
+        } else {                                                     \
+            A.value = B.value.get()->method(C.value);                \
+        }                                                            \
+        NEXT();                                                      \
+    }
+
+    GENERIC_ARITHMETIC(Add, add, +)
+    GENERIC_ARITHMETIC(Sub, sub, -)
+    GENERIC_ARITHMETIC(Mul, mul, *)
+#undef GENERIC_ARITHMETIC
+
+    CASE(Div)
+    {
+        A.value = B.value.get()->div(C.value);
+        NEXT();
+    }
+    CASE(Mod)
+    {
+        A.value = B.value.get()->mod(C.value);
+        NEXT();
+    }
+
+#define TYPED_ARITHMETIC(name, field, op) \
+    CASE(name)                            \
+    {                                     \
+        A.field = B.field op C.field;     \
+        NEXT();                           \
+    }
+
+    TYPED_ARITHMETIC(AddII, i, +)
+    TYPED_ARITHMETIC(SubII, i, -)
+    TYPED_ARITHMETIC(MulII, i, *)
+    TYPED_ARITHMETIC(AddFF, f, +)
+    TYPED_ARITHMETIC(SubFF, f, -)
+    TYPED_ARITHMETIC(MulFF, f, *)
+    TYPED_ARITHMETIC(DivFF, f, /)
+#undef TYPED_ARITHMETIC
+
+    CASE(DivII)
+    {
+        if (C.i == 0) {
+            throw InvalidOperate("integer division by zero");
+        }
+        A.i = B.i / C.i;
+        NEXT();
+    }
+    CASE(ModII)
+    {
+        if (C.i == 0) {
+            throw InvalidOperate("integer division by zero");
+        }
+        A.i = B.i % C.i;
+        NEXT();
+    }
+
+#define COMPARISON(name, test)                                   \
+    CASE(name)                                                   \
+    {                                                            \
+        auto result = compare(B.value, C.value);                 \
+        A.b = (test);                                            \
+        NEXT();                                                  \
+    }
+
+    COMPARISON(Equal, result == Comparison::Equal)
+    COMPARISON(NotEqual, result != Comparison::Equal)
+    COMPARISON(Less, result == Comparison::Less)
+    COMPARISON(LessEqual, result != Comparison::Greater)
+    COMPARISON(Greater, result == Comparison::Greater)
+    COMPARISON(GreaterEqual, result != Comparison::Less)
+#undef COMPARISON
+
+#define TYPED_COMPARISON(name, field, op) \
+    CASE(name)                            \
+    {                                     \
+        A.b = B.field op C.field;         \
+        NEXT();                           \
+    }
+
+    TYPED_COMPARISON(EqualII, i, ==)
+    TYPED_COMPARISON(NotEqualII, i, !=)
+    TYPED_COMPARISON(LessII, i, <)
+    TYPED_COMPARISON(LessEqualII, i, <=)
+    TYPED_COMPARISON(GreaterII, i, >)
+    TYPED_COMPARISON(GreaterEqualII, i, >=)
+    TYPED_COMPARISON(EqualFF, f, ==)
+    TYPED_COMPARISON(NotEqualFF, f, !=)
+    TYPED_COMPARISON(LessFF, f, <)
+    TYPED_COMPARISON(LessEqualFF, f, <=)
+    TYPED_COMPARISON(GreaterFF, f, >)
+    TYPED_COMPARISON(GreaterEqualFF, f, >=)
+#undef TYPED_COMPARISON
+
+    CASE(Negate)
+    {
+        auto& value = B.value;
+        switch (value.kind()) {
+        case ValueKind::Integer:
+            A.value = Value(-integer(value));
+            break;
+        case ValueKind::Float:
+            A.value = Value(-value.as_float());
+            break;
+        default:
+            throw InvalidOperate(Operator::Subtract, value.kind());
+        }
+        NEXT();
+    }
+    CASE(NegateI)
+    {
+        A.i = -B.i;
+        NEXT();
+    }
+    CASE(NegateF)
+    {
+        A.f = -B.f;
+        NEXT();
+    }
+    CASE(Not)
+    {
+        if (B.value.kind() != ValueKind::Boolean) {
+            throw InvalidOperate(Operator::Not, B.value.kind());
+        }
+        A.b = !B.value.as_boolean();
+        NEXT();
+    }
+    CASE(NotB)
+    {
+        A.b = !B.b;
+        NEXT();
+    }
+    CASE(Jump)
+    {
+        JUMP(ip->c);
+    }
+    CASE(JumpIfFalse)
+    {
+        if (!A.b) {
+            JUMP(ip->c);
+        }
+        NEXT();
+    }
+    CASE(JumpIfFalseValue)
+    {
+        auto& condition = A.value;
+        if (condition.kind() != ValueKind::Boolean) {
+            throw InvalidOperate(Operator::Equals, ValueKind::Boolean, condition.kind());
+        }
+        if (!static_cast<Boolean*>(condition.get())->value()) {
+            JUMP(ip->c);
+        }
+        NEXT();
+    }
+
+#define JUMP_UNLESS(name, op)  \
+    CASE(name)                 \
+    {                          \
+        if (!(A.i op B.i)) {   \
+            JUMP(ip->c);       \
+        }                      \
+        NEXT();                \
+    }
+
+    JUMP_UNLESS(JumpUnlessEqualII, ==)
+    JUMP_UNLESS(JumpUnlessNotEqualII, !=)
+    JUMP_UNLESS(JumpUnlessLessII, <)
+    JUMP_UNLESS(JumpUnlessLessEqualII, <=)
+    JUMP_UNLESS(JumpUnlessGreaterII, >)
+    JUMP_UNLESS(JumpUnlessGreaterEqualII, >=)
+#undef JUMP_UNLESS
+
+    CASE(Call)
+    {
+        auto& callee = m_program.chunks[ip->b];
+        auto args = ip->c;
+
+        m_frames.push_back(Frame { ip, chunk, base });
+        auto caller = base;
+        base += chunk->registers;
+
+        r = enter(callee, base);
+        for (uint32_t i = 0; i < callee.params; ++i) {
+            r[i].value = m_registers[caller + args + i].value;
+        }
+
+        chunk = &callee;
+        code = ip = callee.code.data();
+        DISPATCH();
+    }
+    CASE(CallValue)
+    {
+        auto callee = B.value;
+        auto argc = ip->c;
+
+        switch (callee.kind()) {
+        case ValueKind::UserFunction: {
+            auto found = m_program.functions.find(callee.as_user_function().name());
+            if (found == m_program.functions.end()) {
+                throw std::runtime_error("Function not found");
+            }
+
+            auto& target = m_program.chunks[found->second];
+            if (target.params != argc) {
+                throw InvalidOperate(std::format("Invalid call for {}", target.name));
+            }
+
+            auto args = ip->b + 1;
+            m_frames.push_back(Frame { ip, chunk, base });
+            auto caller = base;
+            base += chunk->registers;
+
+            r = enter(target, base);
+            for (uint32_t i = 0; i < argc; ++i) {
+                r[i].value = m_registers[caller + args + i].value;
+            }
+
+            chunk = &target;
+            code = ip = target.code.data();
+            DISPATCH();
+        }
+        case ValueKind::NativeFunction: {
+            std::vector<Value> args;
+            args.reserve(argc);
+            for (uint32_t i = 0; i < argc; ++i) {
+                args.push_back(r[ip->b + 1 + i].value);
+            }
+            A.value = callee.get()->call(args);
+            NEXT();
+        }
+        default:
+            throw InvalidOperate(std::format("Invalid call for {}", callee.inspect()));
+        }
+    }
+    CASE(Return)
+    {
+        auto result = A.value;
+        if (m_frames.empty()) {
+            return result;
+        }
+
+        auto& frame = m_frames.back();
+        ip = frame.ip;
+        chunk = frame.chunk;
+        code = chunk->code.data();
+        base = frame.base;
+        m_frames.pop_back();
+
+        r = m_registers.data() + base;
+        A.value = std::move(result);
+        NEXT();
+    }
+    CASE(NewArray)
+    {
+        std::vector<Value> elements;
+        elements.reserve(ip->c);
+        for (uint32_t i = 0; i < ip->c; ++i) {
+            elements.push_back(r[ip->b + i].value);
+        }
+        A.value = Value(make_object<Array>(ValueKind::Array, std::move(elements)));
+        NEXT();
+    }
+    CASE(NewObject)
+    {
+        auto& keys = m_program.objects[ip->c];
+        auto& shape = m_object_shapes[ip->c];
+        if (shape == nullptr) {
+            auto resolved = Shape::root();
+            for (auto key : keys) {
+                resolved = resolved->transition(m_program.names[key]);
+            }
+            shape = resolved;
+        }
+
+        std::vector<Value> slots;
+        slots.reserve(keys.size());
+        for (uint32_t i = 0; i < keys.size(); ++i) {
+            slots.push_back(r[ip->b + i].value);
+        }
+        A.value = Value(make_object<Record>(ValueKind::Object, shape, std::move(slots)));
+        NEXT();
+    }
+    CASE(Index)
+    {
+        A.value = B.value.get()->index(C.value);
+        NEXT();
+    }
+    CASE(SetIndex)
+    {
+        A.value.get()->set_index(B.value, C.value);
+        NEXT();
+    }
+    CASE(GetAttr)
+    {
+        auto& object = B.value;
+        auto& name = m_program.names[m_program.attributes[ip->c]];
+        if (object.kind() != ValueKind::Object) {
+            A.value = object.get()->get_attr(name);
+            NEXT();
+        }
+
+        auto& record = object.as_shaped();
+        auto& cache = m_access_caches[ip->c];
+        if (record.shape() == cache.shape) {
+            cache.hits++;
+            A.value = record.load(cache.slot);
+            NEXT();
+        }
+
+        cache.misses++;
+        auto value = record.get_attr(name);
+        auto slot = record.shape()->lookup(name);
+        if (slot.has_value() && record.shape()->cacheable()) {
+            cache.shape = record.shape();
+            cache.slot = slot.value();
+        }
+        A.value = std::move(value);
+        NEXT();
+    }
+    CASE(SetAttr)
+    {
+        auto& object = A.value;
+        auto& name = m_program.names[m_program.attributes[ip->c]];
+        if (object.kind() != ValueKind::Object) {
+            object.get()->set_attr(name, B.value);
+            NEXT();
+        }
+
+        auto& record = object.as_shaped();
+        auto& cache = m_access_caches[ip->c];
+        if (record.shape() == cache.shape) {
+            cache.hits++;
+            record.store(cache.slot, B.value);
+            NEXT();
+        }
+
+        cache.misses++;
+        record.set_attr(name, B.value);
+        if (record.shape()->cacheable()) {
+            cache.shape = record.shape();
+            cache.slot = record.shape()->lookup(name).value();
+        }
+        NEXT();
+    }
+    CASE(Inc)
+    {
+        if (A.value.kind() != ValueKind::Integer) {
+            throw InvalidOperate(Operator::Increase, A.value.kind());
+        }
+        A.value = Value(integer(A.value) + 1);
+        NEXT();
+    }
+    CASE(Dec)
+    {
+        if (A.value.kind() != ValueKind::Integer) {
+            throw InvalidOperate(Operator::Decrease, A.value.kind());
+        }
+        A.value = Value(integer(A.value) - 1);
+        NEXT();
+    }
+    CASE(IncI)
+    {
+        A.i++;
+        NEXT();
+    }
+    CASE(DecI)
+    {
+        A.i--;
+        NEXT();
+    }
+
+#ifndef EXPR_COMPUTED_GOTO
+        default:
+            throw std::runtime_error(std::format("invalid opcode {}", int(ip->op)));
+        }
+    }
+#endif
+
+#undef CASE
+#undef DISPATCH
+#undef NEXT
+#undef JUMP
+#undef A
+#undef B
+#undef C
+}
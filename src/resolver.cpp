@@ -0,0 +1,129 @@
+#include "resolver.h"
+#include "ast.h"
+
+void Resolver::statement(Statement& statement)
+{
+    switch (statement.kind()) {
+    case ASTNode::Kind::LetStmt: {
+        auto& let = dynamic_cast<LetStatement&>(statement);
+        if (let.value()) {
+            expression(*let.value());
+        }
+        if (!m_shared || !m_shared->contains(let.name())) {
+            auto slot = declare(let.name());
+            slots.insert({ &let, slot });
+            assignments.push_back({ slot, let.value().get() });
+        }
+        break;
+    }
+    case ASTNode::Kind::IfStmt: {
+        auto& if_stmt = dynamic_cast<IfStatement&>(statement);
+        expression(if_stmt.condition());
+        this->statement(if_stmt.then_branch());
+        if (if_stmt.else_branch()) {
+            this->statement(*if_stmt.else_branch());
+        }
+        break;
+    }
+    case ASTNode::Kind::ForStmt: {
+        auto& for_stmt = dynamic_cast<ForStatement&>(statement);
+        if (for_stmt.initializer()) {
+            this->statement(*for_stmt.initializer());
+        }
+        if (for_stmt.condition()) {
+            expression(*for_stmt.condition());
+        }
+        if (for_stmt.increment()) {
+            expression(*for_stmt.increment());
+        }
+        this->statement(for_stmt.body());
+        break;
+    }
+    case ASTNode::Kind::BlockStmt:
+        m_scopes.emplace_back();
+        for (auto& stmt : dynamic_cast<BlockStatement&>(statement).statements()) {
+            this->statement(*stmt);
+        }
+        m_scopes.pop_back();
+        break;
+    case ASTNode::Kind::ReturnStmt: {
+        auto& ret = dynamic_cast<ReturnStatement&>(statement);
+        if (ret.value()) {
+            expression(*ret.value());
+        }
+        returns.push_back(ret.value().get());
+        break;
+    }
+    case ASTNode::Kind::ExprStmt:
+        expression(dynamic_cast<ExpressionStatement&>(statement).expr());
+        break;
+    default:
+        break;
+    }
+}
+
+void Resolver::expression(Expression& expression)
+{
+    switch (expression.kind()) {
+    case ASTNode::Kind::VariableExpr: {
+        auto slot = resolve(dynamic_cast<VariableExpression&>(expression).name());
+        if (slot) {
+            slots.insert({ &expression, *slot });
+        }
+        break;
+    }
+    case ASTNode::Kind::BinaryExpr: {
+        auto& binary = dynamic_cast<BinaryExpression&>(expression);
+        this->expression(binary.left());
+        this->expression(binary.right());
+
+        auto target = slots.find(&binary.left());
+        if (binary.op() == Operator::Assign && target != slots.end()) {
+            assignments.push_back({ target->second, &binary.right() });
+        }
+        break;
+    }
+    case ASTNode::Kind::PrefixExpr:
+        this->expression(dynamic_cast<PrefixExpression&>(expression).expr());
+        break;
+    case ASTNode::Kind::PostfixExpr: {
+        auto& postfix = dynamic_cast<PostfixExpression&>(expression);
+        this->expression(postfix.expr());
+
+        auto target = slots.find(&postfix.expr());
+        if (target != slots.end()) {
+            assignments.push_back({ target->second, nullptr, true });
+        }
+        break;
+    }
+    case ASTNode::Kind::IndexExpr: {
+        auto& index = dynamic_cast<IndexExpression&>(expression);
+        this->expression(index.object());
+        this->expression(index.index());
+        break;
+    }
+    case ASTNode::Kind::CallExpr: {
+        auto& call = dynamic_cast<CallExpression&>(expression);
+        this->expression(call.callee());
+        for (auto& arg : call.args()) {
+            this->expression(*arg);
+        }
+        break;
+    }
+    case ASTNode::Kind::AccessExpr:
+        this->expression(dynamic_cast<AccessExpression&>(expression).object());
+        break;
+    case ASTNode::Kind::ArrayExpr:
+        for (auto& element : dynamic_cast<ArrayExpression&>(expression).elements()) {
+            this->expression(*element);
+        }
+        break;
+    case ASTNode::Kind::ObjectExpr:
+        for (auto& value : dynamic_cast<ObjectExpression&>(expression).values()) {
+            this->expression(*value);
+        }
+        break;
+    default:
+        break;
+    }
+}
@@ -0,0 +1,87 @@
+#include "shape.h"
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+
+Shape::Shape(const Shape& parent, const std::string& key)
+    : m_keys(parent.m_keys)
+    , m_slots(parent.m_slots)
+{
+    m_slots.insert({ key, m_keys.size() });
+    m_keys.push_back(key);
+}
+
+// shapes made by extend() across the whole tree
+static std::atomic<size_t> extended = 0;
+
+Shape* Shape::root()
+{
+    static Shape root;
+    return &root;
+}
+
+Shape* Shape::transition(const std::string& key)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    auto found = m_transitions.find(key);
+    if (found != m_transitions.end()) {
+        return found->second.get();
+    }
+
+    auto shape = std::unique_ptr<Shape>(new Shape(*this, key));
+    auto next = shape.get();
+    m_transitions.insert({ key, std::move(shape) });
+
+    return next;
+}
+
+Shape* Shape::extend(const std::string& key)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    auto found = m_transitions.find(key);
+    if (found != m_transitions.end()) {
+        return found->second.get();
+    }
+    if (m_transitions.size() >= max_transitions || m_keys.size() >= max_depth) {
+        return nullptr;
+    }
+    if (extended.fetch_add(1) >= max_extended) {
+        extended--;
+        return nullptr;
+    }
+
+    auto shape = std::unique_ptr<Shape>(new Shape(*this, key));
+    auto next = shape.get();
+    m_transitions.insert({ key, std::move(shape) });
+
+    return next;
+}
+
+std::unique_ptr<Shape> Shape::dictionary(const Shape& shape)
+{
+    auto copy = std::unique_ptr<Shape>(new Shape());
+    copy->m_keys = shape.m_keys;
+    copy->m_slots = shape.m_slots;
+    copy->m_dictionary = true;
+    return copy;
+}
+
+void Shape::add(const std::string& key)
+{
+    m_slots.insert({ key, m_keys.size() });
+    m_keys.push_back(key);
+}
+
+std::optional<size_t> Shape::lookup(const std::string& key) const
+{
+    auto found = m_slots.find(key);
+    if (found != m_slots.end()) {
+        return found->second;
+    }
+
+    return std::nullopt;
+}
@@ -0,0 +1,214 @@
+#include "sheet.h"
+#include "ast.h"
+#include "builtins.h"
+#include "eval.h"
+#include "object.h"
+#include <stdexcept>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+// a formula may only read: a write would change an input without invalidating
+// the cells that depend on it
+static void reads(Expression& expression, std::unordered_set<std::string>& names)
+{
+    switch (expression.kind()) {
+    case ASTNode::Kind::VariableExpr:
+        names.insert(dynamic_cast<VariableExpression&>(expression).name());
+        break;
+    case ASTNode::Kind::BinaryExpr: {
+        auto& binary = dynamic_cast<BinaryExpression&>(expression);
+        if (binary.op() == Operator::Assign) {
+            throw std::runtime_error("A formula cannot assign");
+        }
+        reads(binary.left(), names);
+        reads(binary.right(), names);
+        break;
+    }
+    case ASTNode::Kind::PrefixExpr:
+        reads(dynamic_cast<PrefixExpression&>(expression).expr(), names);
+        break;
+    case ASTNode::Kind::PostfixExpr:
+        throw std::runtime_error("A formula cannot increment or decrement");
+    case ASTNode::Kind::IndexExpr: {
+        auto& index = dynamic_cast<IndexExpression&>(expression);
+        reads(index.object(), names);
+        reads(index.index(), names);
+        break;
+    }
+    case ASTNode::Kind::CallExpr: {
+        auto& call = dynamic_cast<CallExpression&>(expression);
+        if (call.callee().kind() == ASTNode::Kind::VariableExpr) {
+            auto& name = dynamic_cast<VariableExpression&>(call.callee()).name();
+            if (mutating_builtin(name)) {
+                throw std::runtime_error("A formula cannot call " + name);
+            }
+        }
+        reads(call.callee(), names);
+        for (auto& arg : call.args()) {
+            reads(*arg, names);
+        }
+        break;
+    }
+    case ASTNode::Kind::AccessExpr:
+        reads(dynamic_cast<AccessExpression&>(expression).object(), names);
+        break;
+    case ASTNode::Kind::ArrayExpr:
+        for (auto& element : dynamic_cast<ArrayExpression&>(expression).elements()) {
+            reads(*element, names);
+        }
+        break;
+    case ASTNode::Kind::ObjectExpr:
+        for (auto& value : dynamic_cast<ObjectExpression&>(expression).values()) {
+            reads(*value, names);
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+void Sheet::assign(const std::string& name, Value value)
+{
+    if (m_cells.contains(name)) {
+        throw std::runtime_error("Cannot set formula as input: " + name);
+    }
+    m_context.define(name, value);
+    invalidate(name);
+}
+
+void Sheet::formula(const std::string& name, std::unique_ptr<Expression> expression)
+{
+    std::unordered_set<std::string> names;
+    reads(*expression, names);
+
+    auto& cell = m_cells[name];
+    for (auto& read : cell.reads) {
+        m_dependents[read].erase(name);
+    }
+
+    cell.reads = std::move(names);
+    for (auto& read : cell.reads) {
+        m_dependents[read].insert(name);
+    }
+    cell.expression = std::move(expression);
+    cell.stale = true;
+    invalidate(name);
+}
+
+void Sheet::load(Program& program)
+{
+    if (!program.functions().empty()) {
+        throw std::runtime_error("A sheet cannot define functions");
+    }
+    for (auto& stmt : program.statements()) {
+        if (stmt->kind() != ASTNode::Kind::LetStmt) {
+            throw std::runtime_error("A sheet only holds `let` formulas");
+        }
+    }
+
+    for (auto& stmt : program.statements()) {
+        auto& let = dynamic_cast<LetStatement&>(*stmt);
+        std::unique_ptr<Expression> value = std::move(let.value());
+        formula(let.name(), value ? std::move(value) : std::make_unique<UndefinedLiteral>());
+    }
+    program.statements().clear();
+}
+
+// the dependents of a stale cell are always stale too, so the walk stops at
+// the first stale cell on each path
+void Sheet::invalidate(const std::string& name)
+{
+    std::vector<const std::string*> pending = { &name };
+    while (!pending.empty()) {
+        auto found = m_dependents.find(*pending.back());
+        pending.pop_back();
+        if (found == m_dependents.end()) {
+            continue;
+        }
+        for (auto& dependent : found->second) {
+            auto& cell = m_cells.at(dependent);
+            if (!cell.stale) {
+                cell.stale = true;
+                pending.push_back(&dependent);
+            }
+        }
+    }
+}
+
+// formulas are evaluated depth first from an explicit stack, so a long chain
+// of cells does not recurse once per cell
+void Sheet::refresh(const std::string& name, Cell& cell)
+{
+    struct Pending {
+        const std::string* name;
+        Cell* cell;
+        // set once the cells it reads have been pushed
+        bool expanded;
+    };
+
+    std::vector<Pending> pending = { { &name, &cell, false } };
+    try {
+        while (!pending.empty()) {
+            auto [next_name, next, expanded] = pending.back();
+            if (!next->stale) {
+                pending.pop_back();
+                continue;
+            }
+
+            if (!expanded) {
+                if (next->active) {
+                    throw std::runtime_error("Formula depends on itself: " + *next_name);
+                }
+                next->active = true;
+                pending.back().expanded = true;
+                for (auto& read : next->reads) {
+                    auto found = m_cells.find(read);
+                    if (found != m_cells.end() && found->second.stale) {
+                        pending.push_back({ &found->first, &found->second, false });
+                    }
+                }
+                continue;
+            }
+
+            auto value = Evaluator(m_context).eval(*next->expression);
+            m_evaluations++;
+            m_context.define(*next_name, value);
+            next->active = false;
+            next->stale = false;
+            pending.pop_back();
+        }
+    } catch (...) {
+        for (auto& entry : pending) {
+            entry.cell->active = false;
+        }
+        throw;
+    }
+}
+
+Value Sheet::get(const std::string& name)
+{
+    auto found = m_cells.find(name);
+    if (found != m_cells.end()) {
+        refresh(found->first, found->second);
+    }
+    return m_context.get_variable(name);
+}
+
+size_t Sheet::recompute()
+{
+    auto before = m_evaluations;
+    for (auto& [name, cell] : m_cells) {
+        refresh(name, cell);
+    }
+    return size_t(m_evaluations - before);
+}
+
+size_t Sheet::stale() const
+{
+    size_t stale = 0;
+    for (auto& [name, cell] : m_cells) {
+        stale += cell.stale ? 1 : 0;
+    }
+    return stale;
+}
@@ -0,0 +1,604 @@
+#include "stream.h"
+#include "alloc.h"
+#include "eval.h"
+#include "flat.h"
+#include "parser.h"
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <format>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+// integer if the whole text is one, then double, otherwise nullopt
+static std::optional<Value> parse_number(std::string_view text)
+{
+    auto begin = text.data();
+    auto end = begin + text.size();
+
+    int64_t integer;
+    auto [integer_end, integer_error] = std::from_chars(begin, end, integer);
+    if (integer_error == std::errc() && integer_end == end) {
+        return Value(integer);
+    }
+
+    double number;
+    auto [number_end, number_error] = std::from_chars(begin, end, number);
+    if (number_error == std::errc() && number_end == end) {
+        return Value(number);
+    }
+
+    return std::nullopt;
+}
+
+void LineRecord::rebind(std::string_view line)
+{
+    m_line = line;
+    m_scanned = false;
+    m_generation++;
+}
+
+Value LineRecord::load(size_t slot)
+{
+    if (!m_scanned) {
+        m_spans.assign(m_shape->size(), { nullptr, 0 });
+        scan();
+        m_scanned = true;
+    }
+
+    if (m_loaded.size() < m_shape->size()) {
+        m_loaded.resize(m_shape->size(), 0);
+        m_values.resize(m_shape->size());
+    }
+
+    if (m_loaded[slot] != m_generation) {
+        auto [data, size] = m_spans[slot];
+        m_values[slot] = data == nullptr ? Value() : decode(std::string_view(data, size));
+        m_loaded[slot] = m_generation;
+    }
+
+    return m_values[slot];
+}
+
+void LineRecord::store(size_t slot, Value)
+{
+    throw InvalidOperate(std::format("field {} of input record is read-only",
+        m_shape->keys()[slot]));
+}
+
+void LineRecord::set_attr(std::string name, Value)
+{
+    throw InvalidOperate(std::format("field {} of input record is read-only", name));
+}
+
+static const char* skip_whitespace(const char* p, const char* end)
+{
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n')) {
+        ++p;
+    }
+    return p;
+}
+
+// `p` points at the opening quote, returns the position past the closing one
+static const char* skip_json_string(const char* p, const char* end)
+{
+    for (++p; p < end; ++p) {
+        if (*p == '\\') {
+            ++p;
+        } else if (*p == '"') {
+            return p + 1;
+        }
+    }
+
+    throw std::runtime_error("unterminated JSON string");
+}
+
+static const char* skip_json_value(const char* p, const char* end)
+{
+    if (p < end && *p == '"') {
+        return skip_json_string(p, end);
+    }
+
+    if (p < end && (*p == '{' || *p == '[')) {
+        int depth = 0;
+        while (p < end) {
+            switch (*p) {
+            case '"':
+                p = skip_json_string(p, end);
+                continue;
+            case '{':
+            case '[':
+                depth++;
+                break;
+            case '}':
+            case ']':
+                if (--depth == 0) {
+                    return p + 1;
+                }
+                break;
+            }
+            ++p;
+        }
+        throw std::runtime_error("unterminated JSON value");
+    }
+
+    while (p < end && *p != ',' && *p != '}' && *p != ']' && *p != ' ' && *p != '\t') {
+        ++p;
+    }
+    return p;
+}
+
+static void append_utf8(std::string& out, uint32_t code)
+{
+    if (code < 0x80) {
+        out.push_back(char(code));
+    } else if (code < 0x800) {
+        out.push_back(char(0xC0 | (code >> 6)));
+        out.push_back(char(0x80 | (code & 0x3F)));
+    } else if (code < 0x10000) {
+        out.push_back(char(0xE0 | (code >> 12)));
+        out.push_back(char(0x80 | ((code >> 6) & 0x3F)));
+        out.push_back(char(0x80 | (code & 0x3F)));
+    } else {
+        out.push_back(char(0xF0 | (code >> 18)));
+        out.push_back(char(0x80 | ((code >> 12) & 0x3F)));
+        out.push_back(char(0x80 | ((code >> 6) & 0x3F)));
+        out.push_back(char(0x80 | (code & 0x3F)));
+    }
+}
+
+// the four hex digits of a `\u` escape starting at `at`
+static uint32_t parse_json_hex4(std::string_view raw, size_t at)
+{
+    uint32_t code = 0;
+    auto digits = raw.substr(std::min(at, raw.size()), 4);
+    auto [end, error] = std::from_chars(digits.data(), digits.data() + digits.size(), code, 16);
+    if (error != std::errc() || digits.size() != 4 || end != digits.data() + 4) {
+        throw std::runtime_error("invalid \\u escape in JSON string");
+    }
+    return code;
+}
+
+static std::string unescape_json_string(std::string_view raw)
+{
+    std::string result;
+    result.reserve(raw.size());
+
+    for (size_t i = 0; i < raw.size(); ++i) {
+        if (raw[i] != '\\' || i + 1 >= raw.size()) {
+            result.push_back(raw[i]);
+            continue;
+        }
+
+        switch (raw[++i]) {
+        case 'n':
+            result.push_back('\n');
+            break;
+        case 't':
+            result.push_back('\t');
+            break;
+        case 'r':
+            result.push_back('\r');
+            break;
+        case 'b':
+            result.push_back('\b');
+            break;
+        case 'f':
+            result.push_back('\f');
+            break;
+        case 'u': {
+            auto code = parse_json_hex4(raw, i + 1);
+            i += 4;
+            if (code >= 0xDC00 && code <= 0xDFFF) {
+                throw std::runtime_error("unpaired surrogate in JSON string");
+            }
+            if (code >= 0xD800 && code <= 0xDBFF) {
+                // a high surrogate must be followed by an escaped low one
+                if (raw.substr(i + 1, 2) != "\\u") {
+                    throw std::runtime_error("unpaired surrogate in JSON string");
+                }
+                auto low = parse_json_hex4(raw, i + 3);
+                if (low < 0xDC00 || low > 0xDFFF) {
+                    throw std::runtime_error("unpaired surrogate in JSON string");
+                }
+                code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+                i += 6;
+            }
+            append_utf8(result, code);
+            break;
+        }
+        default:
+            result.push_back(raw[i]);
+        }
+    }
+
+    return result;
+}
+
+// calls `field(key, raw)` for the top-level fields of the JSON object on
+// `line` until it returns false
+template <typename Field>
+static void scan_json_object(std::string_view line, Field field)
+{
+    auto p = line.data();
+    auto end = p + line.size();
+
+    p = skip_whitespace(p, end);
+    if (p == end || *p != '{') {
+        throw std::runtime_error("expected a JSON object per line");
+    }
+    ++p;
+
+    while (true) {
+        p = skip_whitespace(p, end);
+        if (p == end || *p == '}') {
+            return;
+        }
+        if (*p != '"') {
+            throw std::runtime_error("expected a JSON object key");
+        }
+
+        auto key_begin = p + 1;
+        p = skip_json_string(p, end);
+        auto key = std::string_view(key_begin, p - 1 - key_begin);
+
+        p = skip_whitespace(p, end);
+        if (p == end || *p != ':') {
+            throw std::runtime_error("expected `:` after a JSON object key");
+        }
+        p = skip_whitespace(p + 1, end);
+
+        auto value_begin = p;
+        p = skip_json_value(p, end);
+        if (!field(key, std::string_view(value_begin, p - value_begin))) {
+            return;
+        }
+
+        p = skip_whitespace(p, end);
+        if (p < end && *p == ',') {
+            ++p;
+        }
+    }
+}
+
+void JsonRecord::scan()
+{
+    auto& keys = m_shape->keys();
+    auto remaining = keys.size();
+
+    scan_json_object(m_line, [&](std::string_view key, std::string_view raw) {
+        for (size_t slot = 0; slot < keys.size(); ++slot) {
+            if (m_spans[slot].first == nullptr && keys[slot] == key) {
+                m_spans[slot] = { raw.data(), raw.size() };
+                remaining--;
+                break;
+            }
+        }
+        return remaining > 0;
+    });
+}
+
+Value JsonRecord::get_attr(std::string name)
+{
+    auto slot = m_shape->lookup(name);
+    if (!slot.has_value()) {
+        auto next = m_shape->extend(name);
+        if (next == nullptr) {
+            // past the shape limits the key is looked up in this line only
+            Value value;
+            scan_json_object(m_line, [&](std::string_view key, std::string_view raw) {
+                if (key != name) {
+                    return true;
+                }
+                value = decode(raw);
+                return false;
+            });
+            return value;
+        }
+
+        // first read of this key, every later line is scanned for it too
+        m_shape = next;
+        rebind(m_line);
+        slot = m_shape->size() - 1;
+    }
+
+    return load(slot.value());
+}
+
+Value JsonRecord::decode(std::string_view raw)
+{
+    switch (raw.front()) {
+    case '"':
+        return Value(unescape_json_string(raw.substr(1, raw.size() - 2)));
+    case '{':
+    case '[':
+        // nested values are handed over as their JSON text
+        return Value(std::string(raw));
+    default:
+        break;
+    }
+
+    if (raw == "true") {
+        return Value(true);
+    }
+    if (raw == "false") {
+        return Value(false);
+    }
+    if (raw == "null") {
+        return Value();
+    }
+
+    auto number = parse_number(raw);
+    if (!number.has_value()) {
+        throw std::runtime_error(std::format("invalid JSON value `{}`", raw));
+    }
+
+    return number.value();
+}
+
+// calls `field` with the raw text of each comma separated field, quotes included
+template <typename Callback>
+static void split_csv(std::string_view line, Callback field)
+{
+    size_t start = 0;
+    bool quoted = false;
+
+    for (size_t i = 0; i < line.size(); ++i) {
+        auto c = line[i];
+        if (c == '"') {
+            quoted = !quoted;
+        } else if (c == ',' && !quoted) {
+            if (!field(line.substr(start, i - start))) {
+                return;
+            }
+            start = i + 1;
+        }
+    }
+
+    field(line.substr(start));
+}
+
+static std::string unquote_csv(std::string_view raw)
+{
+    if (raw.size() < 2 || raw.front() != '"') {
+        return std::string(raw);
+    }
+
+    std::string result;
+    raw = raw.substr(1, raw.size() - 2);
+    for (size_t i = 0; i < raw.size(); ++i) {
+        result.push_back(raw[i]);
+        if (raw[i] == '"' && i + 1 < raw.size() && raw[i + 1] == '"') {
+            ++i;
+        }
+    }
+
+    return result;
+}
+
+Shape* CsvRecord::parse_header(std::string_view line)
+{
+    auto shape = Shape::root();
+
+    split_csv(line, [&shape](std::string_view raw) {
+        auto name = unquote_csv(raw);
+        if (shape->lookup(name).has_value()) {
+            throw std::runtime_error(std::format("duplicate CSV column `{}`", name));
+        }
+        shape = shape->transition(name);
+        return true;
+    });
+
+    return shape;
+}
+
+void CsvRecord::scan()
+{
+    size_t slot = 0;
+    split_csv(m_line, [this, &slot](std::string_view raw) {
+        m_spans[slot++] = { raw.data(), raw.size() };
+        return slot < m_spans.size();
+    });
+}
+
+Value CsvRecord::decode(std::string_view raw)
+{
+    if (raw.empty()) {
+        return Value();
+    }
+
+    if (raw.front() == '"') {
+        return Value(unquote_csv(raw));
+    }
+
+    auto number = parse_number(raw);
+    if (number.has_value()) {
+        return number.value();
+    }
+
+    return Value(std::string(raw));
+}
+
+static void append_column(std::string& out, const Value& value)
+{
+    switch (value.kind()) {
+    case ValueKind::Undefined:
+        return;
+    case ValueKind::String: {
+        auto& text = value.as_string();
+        if (text.find_first_of(",\"\n") == std::string::npos) {
+            out.append(text);
+            return;
+        }
+
+        out.push_back('"');
+        for (auto c : text) {
+            if (c == '"') {
+                out.push_back('"');
+            }
+            out.push_back(c);
+        }
+        out.push_back('"');
+        return;
+    }
+    default:
+        out.append(value.obj()->inspect());
+    }
+}
+
+// Evaluates the expression over the lines of one chunk at a time. Each worker
+// owns its flattened program and evaluator, so inline caches are never shared
+// between threads.
+class StreamWorker {
+public:
+    StreamWorker(std::string_view expression, const StreamOptions& options,
+        Shape* header)
+    {
+        Program program(Parser(expression).parse_expression());
+        m_buffer = flatten(program);
+
+        if (options.format == RecordFormat::CSV) {
+            m_record = make_object<CsvRecord>(ValueKind::Object, header);
+        } else {
+            m_record = make_object<JsonRecord>(ValueKind::Object);
+        }
+        m_context.define(options.record_name, m_record);
+
+        m_evaluator = std::make_unique<FlatEvaluator>(m_buffer.view(), m_context);
+    }
+
+    void run(std::string_view chunk, std::string& out, StreamStats& stats)
+    {
+        while (!chunk.empty()) {
+            auto newline = chunk.find('\n');
+            auto line = chunk.substr(0, newline);
+            chunk.remove_prefix(newline == std::string_view::npos ? chunk.size() : newline + 1);
+
+            if (!line.empty() && line.back() == '\r') {
+                line.remove_suffix(1);
+            }
+            if (line.empty()) {
+                continue;
+            }
+
+            stats.records++;
+            m_record->rebind(line);
+
+            try {
+                auto value = m_evaluator->eval();
+                emit(line, value, out, stats);
+            } catch (std::exception& e) {
+                stats.errors++;
+            }
+        }
+    }
+
+private:
+    void emit(std::string_view line, Value& value, std::string& out, StreamStats& stats)
+    {
+        switch (value.kind()) {
+        case ValueKind::Boolean:
+            if (!value.as_boolean()) {
+                return;
+            }
+            out.append(line);
+            break;
+        case ValueKind::Array: {
+            auto& array = value.as_array();
+            for (size_t i = 0; i < array.length(); ++i) {
+                if (i > 0) {
+                    out.push_back(',');
+                }
+                append_column(out, array.get(i));
+            }
+            break;
+        }
+        default:
+            append_column(out, value);
+        }
+
+        out.push_back('\n');
+        stats.emitted++;
+    }
+
+    FlatBuffer m_buffer;
+    std::shared_ptr<LineRecord> m_record;
+    Context m_context;
+    std::unique_ptr<FlatEvaluator> m_evaluator;
+};
+
+StreamStats stream_records(std::string_view input, std::string_view expression,
+    const StreamOptions& options, std::ostream& out)
+{
+    Shape* header = nullptr;
+    if (options.format == RecordFormat::CSV) {
+        auto newline = input.find('\n');
+        auto line = input.substr(0, newline);
+        if (!line.empty() && line.back() == '\r') {
+            line.remove_suffix(1);
+        }
+        header = CsvRecord::parse_header(line);
+        input.remove_prefix(newline == std::string_view::npos ? input.size() : newline + 1);
+    }
+
+    std::vector<std::string_view> chunks;
+    while (!input.empty()) {
+        auto size = std::min(options.chunk_size, input.size());
+        auto newline = input.find('\n', size - 1);
+        size = newline == std::string_view::npos ? input.size() : newline + 1;
+        chunks.push_back(input.substr(0, size));
+        input.remove_prefix(size);
+    }
+
+    auto threads = std::max<size_t>(options.threads, 1);
+
+    // parsing up front also reports a malformed expression before any work
+    std::vector<std::unique_ptr<StreamWorker>> workers;
+    for (size_t i = 0; i < threads; ++i) {
+        workers.push_back(std::make_unique<StreamWorker>(expression, options, header));
+    }
+
+    StreamStats total;
+
+    // a window of chunks is evaluated in parallel, then written in order
+    auto window = threads * 4;
+    for (size_t start = 0; start < chunks.size(); start += window) {
+        auto count = std::min(window, chunks.size() - start);
+        std::vector<std::string> outputs(count);
+        std::vector<StreamStats> stats(count);
+        std::atomic<size_t> next = 0;
+
+        auto work = [&](StreamWorker& worker) {
+            for (auto i = next++; i < count; i = next++) {
+                worker.run(chunks[start + i], outputs[i], stats[i]);
+            }
+        };
+
+        if (threads == 1) {
+            work(*workers[0]);
+        } else {
+            std::vector<std::thread> pool;
+            for (auto& worker : workers) {
+                pool.emplace_back(work, std::ref(*worker));
+            }
+            for (auto& thread : pool) {
+                thread.join();
+            }
+        }
+
+        for (size_t i = 0; i < count; ++i) {
+            out.write(outputs[i].data(), std::streamsize(outputs[i].size()));
+            total.records += stats[i].records;
+            total.emitted += stats[i].emitted;
+            total.errors += stats[i].errors;
+        }
+    }
+
+    return total;
+}
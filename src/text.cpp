@@ -0,0 +1,305 @@
+#include "text.h"
+#include "alloc.h"
+#include "builtins.h"
+#include "object.h"
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <format>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#if defined(__GNUC__) && defined(__SSE2__) && (defined(__x86_64__) || defined(__i386__))
+#define EXPR_X86_SIMD
+#include <immintrin.h>
+#endif
+
+static size_t find_bytes_scalar(const char* data, size_t n, const char* needle, size_t m)
+{
+    auto found = std::string_view(data, n).find(std::string_view(needle, m));
+    return found == std::string_view::npos ? n : found;
+}
+
+#ifdef EXPR_X86_SIMD
+
+#define TARGET_AVX2 __attribute__((target("avx2")))
+
+static bool has_avx2()
+{
+    static const bool supported = __builtin_cpu_supports("avx2");
+    return supported;
+}
+
+TARGET_AVX2 static size_t find_byte_avx2(const char* data, size_t n, char byte)
+{
+    __m256i target = _mm256_set1_epi8(byte);
+
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        __m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+        uint32_t mask = uint32_t(_mm256_movemask_epi8(_mm256_cmpeq_epi8(block, target)));
+        if (mask != 0) {
+            return i + size_t(__builtin_ctz(mask));
+        }
+    }
+    for (; i < n; ++i) {
+        if (data[i] == byte) {
+            return i;
+        }
+    }
+
+    return n;
+}
+
+static size_t find_byte_sse2(const char* data, size_t n, char byte)
+{
+    __m128i target = _mm_set1_epi8(byte);
+
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+        uint32_t mask = uint32_t(_mm_movemask_epi8(_mm_cmpeq_epi8(block, target)));
+        if (mask != 0) {
+            return i + size_t(__builtin_ctz(mask));
+        }
+    }
+    for (; i < n; ++i) {
+        if (data[i] == byte) {
+            return i;
+        }
+    }
+
+    return n;
+}
+
+// m is at least 2 and at most n
+TARGET_AVX2 static size_t find_bytes_avx2(const char* data, size_t n, const char* needle, size_t m)
+{
+    __m256i first = _mm256_set1_epi8(needle[0]);
+    __m256i last = _mm256_set1_epi8(needle[m - 1]);
+
+    size_t i = 0;
+    for (; i + m - 1 + 32 <= n; i += 32) {
+        __m256i block_first = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+        __m256i block_last = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i + m - 1));
+        uint32_t mask = uint32_t(_mm256_movemask_epi8(
+            _mm256_and_si256(_mm256_cmpeq_epi8(block_first, first), _mm256_cmpeq_epi8(block_last, last))));
+        while (mask != 0) {
+            auto offset = size_t(__builtin_ctz(mask));
+            if (std::memcmp(data + i + offset + 1, needle + 1, m - 2) == 0) {
+                return i + offset;
+            }
+            mask &= mask - 1;
+        }
+    }
+
+    return i + find_bytes_scalar(data + i, n - i, needle, m);
+}
+
+static size_t find_bytes_sse2(const char* data, size_t n, const char* needle, size_t m)
+{
+    __m128i first = _mm_set1_epi8(needle[0]);
+    __m128i last = _mm_set1_epi8(needle[m - 1]);
+
+    size_t i = 0;
+    for (; i + m - 1 + 16 <= n; i += 16) {
+        __m128i block_first = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+        __m128i block_last = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i + m - 1));
+        uint32_t mask = uint32_t(
+            _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(block_first, first), _mm_cmpeq_epi8(block_last, last))));
+        while (mask != 0) {
+            auto offset = size_t(__builtin_ctz(mask));
+            if (std::memcmp(data + i + offset + 1, needle + 1, m - 2) == 0) {
+                return i + offset;
+            }
+            mask &= mask - 1;
+        }
+    }
+
+    return i + find_bytes_scalar(data + i, n - i, needle, m);
+}
+
+#endif
+
+size_t find_byte(const char* data, size_t n, char byte)
+{
+#ifdef EXPR_X86_SIMD
+    if (has_avx2()) {
+        return find_byte_avx2(data, n, byte);
+    }
+    return find_byte_sse2(data, n, byte);
+#else
+    auto found = std::memchr(data, byte, n);
+    return found ? size_t(static_cast<const char*>(found) - data) : n;
+#endif
+}
+
+size_t find_bytes(const char* data, size_t n, const char* needle, size_t m)
+{
+    if (m == 0) {
+        return 0;
+    }
+    if (m > n) {
+        return n;
+    }
+    if (m == 1) {
+        return find_byte(data, n, needle[0]);
+    }
+
+#ifdef EXPR_X86_SIMD
+    if (has_avx2()) {
+        return find_bytes_avx2(data, n, needle, m);
+    }
+    return find_bytes_sse2(data, n, needle, m);
+#else
+    return find_bytes_scalar(data, n, needle, m);
+#endif
+}
+
+static size_t find(std::string_view text, std::string_view needle, size_t from = 0)
+{
+    if (needle.empty()) {
+        return from;
+    }
+    auto found = find_bytes(text.data() + from, text.size() - from, needle.data(), needle.size());
+    return found == text.size() - from ? std::string_view::npos : from + found;
+}
+
+static std::shared_ptr<String> string_argument(const std::string& name, std::vector<Value>& args, size_t i)
+{
+    if (args[i].kind() != ValueKind::String) {
+        throw InvalidOperate(std::format("{} expects a String, got {}", name, value_kind_str(args[i].kind())));
+    }
+    return std::static_pointer_cast<String>(args[i].obj());
+}
+
+static int64_t integer_argument(const std::string& name, std::vector<Value>& args, size_t i)
+{
+    if (args[i].kind() != ValueKind::Integer) {
+        throw InvalidOperate(std::format("{} expects an Integer, got {}", name, value_kind_str(args[i].kind())));
+    }
+    return args[i].as_integer();
+}
+
+static std::shared_ptr<String> separator_argument(const std::string& name, std::vector<Value>& args, size_t i)
+{
+    auto separator = string_argument(name, args, i);
+    if (separator->size() == 0) {
+        throw InvalidOperate(std::format("{} expects a non-empty String", name));
+    }
+    return separator;
+}
+
+template <typename Transform>
+static void define_transform(BuiltinTable& table, std::string name, Transform transform)
+{
+    define_builtin(table, name, [name, transform](std::vector<Value>& args) {
+        check_arguments(name, args, 1);
+        auto text = string_argument(name, args, 0)->view();
+        std::string out(text.size(), '\0');
+        for (size_t i = 0; i < text.size(); ++i) {
+            out[i] = char(transform(static_cast<unsigned char>(text[i])));
+        }
+        return Value(std::move(out));
+    });
+}
+
+// Offsets and lengths count bytes. Functions returning part of a string share
+// its characters instead of copying them, see String::slice().
+void register_string_builtins(BuiltinTable& table)
+{
+    define_builtin(table, "find", [](std::vector<Value>& args) {
+        check_arguments("find", args, 2);
+        auto found = find(string_argument("find", args, 0)->view(), string_argument("find", args, 1)->view());
+        return Value(found == std::string_view::npos ? int64_t(-1) : int64_t(found));
+    });
+
+    define_builtin(table, "contains", [](std::vector<Value>& args) {
+        check_arguments("contains", args, 2);
+        auto text = string_argument("contains", args, 0)->view();
+        return Value(find(text, string_argument("contains", args, 1)->view()) != std::string_view::npos);
+    });
+
+    define_builtin(table, "starts_with", [](std::vector<Value>& args) {
+        check_arguments("starts_with", args, 2);
+        auto text = string_argument("starts_with", args, 0)->view();
+        return Value(text.starts_with(string_argument("starts_with", args, 1)->view()));
+    });
+
+    define_builtin(table, "ends_with", [](std::vector<Value>& args) {
+        check_arguments("ends_with", args, 2);
+        auto text = string_argument("ends_with", args, 0)->view();
+        return Value(text.ends_with(string_argument("ends_with", args, 1)->view()));
+    });
+
+    define_builtin(table, "substring", [](std::vector<Value>& args) {
+        check_arguments("substring", args, 3);
+        auto text = string_argument("substring", args, 0);
+        auto start = integer_argument("substring", args, 1);
+        auto end = integer_argument("substring", args, 2);
+        if (start < 0 || end < start || size_t(end) > text->size()) {
+            throw InvalidOperate(std::format("substring {}..{} out of range for length {}", start, end, text->size()));
+        }
+        return String::slice(text, size_t(start), size_t(end - start));
+    });
+
+    define_builtin(table, "trim", [](std::vector<Value>& args) {
+        check_arguments("trim", args, 1);
+        auto text = string_argument("trim", args, 0);
+        auto view = text->view();
+        auto start = view.find_first_not_of(" \t\n\r\f\v");
+        if (start == std::string_view::npos) {
+            return Value(std::string());
+        }
+        auto end = view.find_last_not_of(" \t\n\r\f\v") + 1;
+        if (start == 0 && end == view.size()) {
+            return args[0];
+        }
+        return String::slice(text, start, end - start);
+    });
+
+    define_builtin(table, "split", [](std::vector<Value>& args) {
+        check_arguments("split", args, 2);
+        auto text = string_argument("split", args, 0);
+        auto separator = separator_argument("split", args, 1)->view();
+        auto view = text->view();
+
+        std::vector<Value> parts;
+        size_t start = 0;
+        for (auto found = find(view, separator); found != std::string_view::npos;
+            found = find(view, separator, start)) {
+            parts.push_back(String::slice(text, start, found - start));
+            start = found + separator.size();
+        }
+        parts.push_back(String::slice(text, start, view.size() - start));
+        return Value(make_object<Array>(ValueKind::Array, std::move(parts)));
+    });
+
+    define_builtin(table, "replace", [](std::vector<Value>& args) {
+        check_arguments("replace", args, 3);
+        auto view = string_argument("replace", args, 0)->view();
+        auto from = separator_argument("replace", args, 1)->view();
+        auto to = string_argument("replace", args, 2)->view();
+
+        auto found = find(view, from);
+        if (found == std::string_view::npos) {
+            return args[0];
+        }
+
+        std::string out;
+        size_t start = 0;
+        for (; found != std::string_view::npos; found = find(view, from, start)) {
+            out.append(view.substr(start, found - start));
+            out.append(to);
+            start = found + from.size();
+        }
+        out.append(view.substr(start));
+        return Value(std::move(out));
+    });
+
+    // ASCII only, other bytes are kept as they are
+    define_transform(table, "lower", [](unsigned char c) { return c >= 'A' && c <= 'Z' ? c + ('a' - 'A') : c; });
+    define_transform(table, "upper", [](unsigned char c) { return c >= 'a' && c <= 'z' ? c - ('a' - 'A') : c; });
+}
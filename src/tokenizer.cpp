@@ -118,23 +118,19 @@ Token Tokenizer::eat_string()
     next_char();
 
     while (true) {
-        char32_t peek = peek_char();
+        char32_t peek = next_char();
         if (peek == 0) {
-            return make_token(TokenKind::String, start);
+            throw std::runtime_error("Unterminated string literal");
         }
 
-        if (peek == '\\') {
+        if (escaped) {
+            escaped = false;
+        } else if (peek == '\\') {
             escaped = true;
-        }
-
-        if (peek == '"' && !escaped) {
+        } else if (peek == '"') {
             return make_token(TokenKind::String, start);
         }
-
-        next_char();
     }
-
-    return make_token(TokenKind::String, start);
 }
 
 Token Tokenizer::eat_punctuation()
@@ -0,0 +1,474 @@
+#include "types.h"
+#include "ast.h"
+#include "builtins.h"
+#include "bytecode.h"
+#include "object.h"
+#include "resolver.h"
+#include <format>
+#include <map>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <vector>
+
+std::string kinds_str(KindSet kinds)
+{
+    if (kinds.empty()) {
+        return "never";
+    }
+    if (kinds.is_any()) {
+        return "any";
+    }
+
+    std::string str;
+    for (auto kind : { ValueKind::Undefined, ValueKind::Boolean, ValueKind::Integer, ValueKind::Float,
+             ValueKind::String, ValueKind::Array, ValueKind::Object, ValueKind::UserFunction,
+             ValueKind::NativeFunction }) {
+        if (kinds.contains(kind)) {
+            str += (str.empty() ? "" : " | ") + value_kind_str(kind);
+        }
+    }
+    return str;
+}
+
+std::string TypeInfo::report() const
+{
+    std::stringstream ss;
+    for (auto& fn : functions) {
+        std::string params;
+        for (auto& param : fn.params) {
+            params += std::format("{}{}: {}", params.empty() ? "" : ", ", param.name, kinds_str(param.kinds));
+        }
+
+        if (fn.name == "<main>") {
+            ss << fn.name << std::endl;
+        } else {
+            ss << std::format("fn {}({}) -> {}", fn.name, params, kinds_str(fn.result)) << std::endl;
+        }
+        for (auto& local : fn.locals) {
+            ss << std::format("  let {}: {}", local.name, kinds_str(local.kinds)) << std::endl;
+        }
+    }
+    return ss.str();
+}
+
+// the kinds `lhs op rhs` may produce, following Integer, Float and String;
+// pairs that throw contribute nothing
+static KindSet binary_kinds(Operator op, KindSet lhs, KindSet rhs)
+{
+    switch (op) {
+    case Operator::Equals:
+    case Operator::NotEquals:
+    case Operator::LessThan:
+    case Operator::LessThanOrEqual:
+    case Operator::GreaterThan:
+    case Operator::GreaterThanOrEqual:
+        return lhs.empty() || rhs.empty() ? KindSet() : KindSet(ValueKind::Boolean);
+    default:
+        break;
+    }
+
+    auto numeric = KindSet(ValueKind::Integer) | ValueKind::Float;
+    KindSet kinds;
+    if (lhs.contains(ValueKind::Integer) && rhs.contains(ValueKind::Integer)) {
+        kinds |= ValueKind::Integer;
+    }
+    if (op != Operator::Modulo && !(lhs & numeric).empty() && !(rhs & numeric).empty()
+        && (lhs.contains(ValueKind::Float) || rhs.contains(ValueKind::Float))) {
+        kinds |= ValueKind::Float;
+    }
+    if (op == Operator::Add && lhs.contains(ValueKind::String) && rhs.contains(ValueKind::String)) {
+        kinds |= ValueKind::String;
+    }
+    return kinds;
+}
+
+class TypeInference {
+public:
+    TypeInference(Program& program, const TypeEnvironment& environment);
+
+    TypeInfo run();
+
+private:
+    struct Function {
+        std::string name;
+        FnStatement* fn = nullptr;
+        Resolver resolver { nullptr };
+        std::vector<KindSet> slots;
+        KindSet result;
+    };
+
+    void function(Function& function);
+    void statement(Statement& statement);
+    KindSet expression(Expression& expression);
+    KindSet call(CallExpression& expression);
+    KindSet variable(VariableExpression& expression);
+    void assign(Expression& target, KindSet kinds);
+
+    // a program function that direct calls by `name` reach
+    Function* callee(const std::string& name);
+    bool always_returns(Statement& statement) const;
+    std::optional<uint32_t> local(const ASTNode& node) const;
+
+    void join(KindSet& target, KindSet kinds)
+    {
+        if ((target | kinds) != target) {
+            target |= kinds;
+            m_changed = true;
+        }
+    }
+
+    Program& m_program;
+    Function m_main;
+    std::map<std::string, Function> m_functions;
+    // every kind assigned to a name anywhere, plus the host's
+    std::unordered_map<std::string, KindSet> m_names;
+    Function* m_current = nullptr;
+    bool m_changed = false;
+};
+
+TypeInference::TypeInference(Program& program, const TypeEnvironment& environment)
+    : m_program(program)
+    , m_names(environment.begin(), environment.end())
+{
+    auto shared = shared_names(program);
+    m_main.name = "<main>";
+    m_main.resolver = Resolver(&shared);
+    for (auto& stmt : program.statements()) {
+        m_main.resolver.statement(*stmt);
+    }
+    // `shared` is only needed while resolving
+    m_main.slots.resize(m_main.resolver.locals());
+
+    for (auto& [name, fn] : program.functions()) {
+        auto& function = m_functions[name];
+        function.name = name;
+        function.fn = fn.get();
+        function.resolver.function(*fn);
+        function.slots.resize(function.resolver.locals());
+    }
+}
+
+std::optional<uint32_t> TypeInference::local(const ASTNode& node) const
+{
+    auto& slots = m_current->resolver.slots;
+    auto found = slots.find(&node);
+    if (found == slots.end()) {
+        return std::nullopt;
+    }
+    return found->second;
+}
+
+TypeInference::Function* TypeInference::callee(const std::string& name)
+{
+    auto found = m_functions.find(name);
+    // a name the script or the host also assigns may hold something else
+    if (found == m_functions.end() || m_names.contains(name)) {
+        return nullptr;
+    }
+    return &found->second;
+}
+
+TypeInfo TypeInference::run()
+{
+    do {
+        m_changed = false;
+        function(m_main);
+        for (auto& [name, function] : m_functions) {
+            this->function(function);
+        }
+    } while (m_changed);
+
+    TypeInfo info;
+    auto describe = [](Function& function) {
+        FunctionType type { function.name, {}, {}, function.result };
+
+        uint32_t params = function.fn ? uint32_t(function.fn->params().size()) : 0;
+        for (uint32_t i = 0; i < params; ++i) {
+            type.params.push_back({ function.fn->params()[i], function.slots[i] });
+        }
+
+        std::vector<VariableType> locals(function.slots.size() - params);
+        for (auto& [node, slot] : function.resolver.slots) {
+            if (node->kind() == ASTNode::Kind::LetStmt) {
+                auto let = dynamic_cast<LetStatement*>(const_cast<ASTNode*>(node));
+                locals[slot - params] = { let->name(), function.slots[slot] };
+            }
+        }
+        type.locals = std::move(locals);
+        return type;
+    };
+
+    info.functions.push_back(describe(m_main));
+    for (auto& [name, function] : m_functions) {
+        info.functions.push_back(describe(function));
+    }
+    return info;
+}
+
+void TypeInference::function(Function& function)
+{
+    m_current = &function;
+    if (!function.fn) {
+        for (auto& stmt : m_program.statements()) {
+            statement(*stmt);
+        }
+        return;
+    }
+
+    // parameters are names other functions can see too
+    auto& params = function.fn->params();
+    for (size_t i = 0; i < params.size(); ++i) {
+        join(m_names[params[i]], function.slots[i]);
+    }
+
+    statement(function.fn->body());
+    if (!always_returns(function.fn->body())) {
+        join(function.result, ValueKind::Undefined);
+    }
+}
+
+bool TypeInference::always_returns(Statement& statement) const
+{
+    switch (statement.kind()) {
+    case ASTNode::Kind::ReturnStmt:
+        return true;
+    case ASTNode::Kind::BlockStmt:
+        for (auto& stmt : dynamic_cast<BlockStatement&>(statement).statements()) {
+            if (always_returns(*stmt)) {
+                return true;
+            }
+        }
+        return false;
+    case ASTNode::Kind::IfStmt: {
+        auto& if_stmt = dynamic_cast<IfStatement&>(statement);
+        return if_stmt.else_branch() && always_returns(if_stmt.then_branch())
+            && always_returns(*if_stmt.else_branch());
+    }
+    default:
+        return false;
+    }
+}
+
+void TypeInference::statement(Statement& statement)
+{
+    switch (statement.kind()) {
+    case ASTNode::Kind::LetStmt: {
+        auto& let = dynamic_cast<LetStatement&>(statement);
+        auto kinds = let.value() ? expression(*let.value()) : KindSet(ValueKind::Undefined);
+
+        auto slot = local(let);
+        if (slot) {
+            join(m_current->slots[*slot], kinds);
+        }
+        join(m_names[let.name()], kinds);
+        break;
+    }
+    case ASTNode::Kind::IfStmt: {
+        auto& if_stmt = dynamic_cast<IfStatement&>(statement);
+        expression(if_stmt.condition());
+        this->statement(if_stmt.then_branch());
+        if (if_stmt.else_branch()) {
+            this->statement(*if_stmt.else_branch());
+        }
+        break;
+    }
+    case ASTNode::Kind::ForStmt: {
+        auto& for_stmt = dynamic_cast<ForStatement&>(statement);
+        if (for_stmt.initializer()) {
+            this->statement(*for_stmt.initializer());
+        }
+        if (for_stmt.condition()) {
+            expression(*for_stmt.condition());
+        }
+        this->statement(for_stmt.body());
+        if (for_stmt.increment()) {
+            expression(*for_stmt.increment());
+        }
+        break;
+    }
+    case ASTNode::Kind::BlockStmt:
+        for (auto& stmt : dynamic_cast<BlockStatement&>(statement).statements()) {
+            this->statement(*stmt);
+        }
+        break;
+    case ASTNode::Kind::ReturnStmt: {
+        auto& ret = dynamic_cast<ReturnStatement&>(statement);
+        join(m_current->result, ret.value() ? expression(*ret.value()) : KindSet(ValueKind::Undefined));
+        break;
+    }
+    case ASTNode::Kind::ExprStmt:
+        expression(dynamic_cast<ExpressionStatement&>(statement).expr());
+        break;
+    default:
+        break;
+    }
+}
+
+void TypeInference::assign(Expression& target, KindSet kinds)
+{
+    if (target.kind() != ASTNode::Kind::VariableExpr) {
+        return;
+    }
+
+    auto slot = local(target);
+    if (slot) {
+        join(m_current->slots[*slot], kinds);
+    }
+    join(m_names[dynamic_cast<VariableExpression&>(target).name()], kinds);
+}
+
+KindSet TypeInference::variable(VariableExpression& expression)
+{
+    auto slot = local(expression);
+    if (slot) {
+        return m_current->slots[*slot];
+    }
+
+    auto& name = expression.name();
+    auto fn = callee(name);
+    if (fn) {
+        // used as a value, so it may be called with anything
+        auto& params = fn->fn->params();
+        for (size_t i = 0; i < params.size(); ++i) {
+            join(fn->slots[i], KindSet::any());
+        }
+        return ValueKind::UserFunction;
+    }
+
+    auto found = m_names.find(name);
+    if (found != m_names.end()) {
+        return found->second;
+    }
+    if (builtins().contains(name)) {
+        return ValueKind::NativeFunction;
+    }
+    // defined by the host without a declared kind
+    return KindSet::any();
+}
+
+KindSet TypeInference::call(CallExpression& expression)
+{
+    std::vector<KindSet> args;
+    for (auto& arg : expression.args()) {
+        args.push_back(this->expression(*arg));
+    }
+
+    if (expression.callee().kind() == ASTNode::Kind::VariableExpr && !local(expression.callee())) {
+        auto& callee = dynamic_cast<VariableExpression&>(expression.callee());
+        auto fn = this->callee(callee.name());
+        if (fn && fn->fn->params().size() == args.size()) {
+            callee.kinds() = ValueKind::UserFunction;
+            for (size_t i = 0; i < args.size(); ++i) {
+                join(fn->slots[i], args[i]);
+            }
+            return fn->result;
+        }
+    }
+
+    this->expression(expression.callee());
+    return KindSet::any();
+}
+
+KindSet TypeInference::expression(Expression& expression)
+{
+    KindSet kinds;
+
+    switch (expression.kind()) {
+    case ASTNode::Kind::LiteralExpr:
+        switch (dynamic_cast<LiteralExpression&>(expression).literal_kind()) {
+        case LiteralKind::Boolean:
+            kinds = ValueKind::Boolean;
+            break;
+        case LiteralKind::Integer:
+            kinds = ValueKind::Integer;
+            break;
+        case LiteralKind::Float:
+            kinds = ValueKind::Float;
+            break;
+        case LiteralKind::String:
+            kinds = ValueKind::String;
+            break;
+        default:
+            kinds = ValueKind::Undefined;
+            break;
+        }
+        break;
+    case ASTNode::Kind::VariableExpr:
+        kinds = variable(dynamic_cast<VariableExpression&>(expression));
+        break;
+    case ASTNode::Kind::BinaryExpr: {
+        auto& binary = dynamic_cast<BinaryExpression&>(expression);
+        if (binary.op() == Operator::Assign) {
+            kinds = this->expression(binary.right());
+            if (binary.left().kind() == ASTNode::Kind::VariableExpr) {
+                assign(binary.left(), kinds);
+                binary.left().kinds() = variable(dynamic_cast<VariableExpression&>(binary.left()));
+            } else {
+                this->expression(binary.left());
+            }
+            break;
+        }
+
+        auto lhs = this->expression(binary.left());
+        auto rhs = this->expression(binary.right());
+        kinds = binary_kinds(binary.op(), lhs, rhs);
+        break;
+    }
+    case ASTNode::Kind::PrefixExpr: {
+        auto& prefix = dynamic_cast<PrefixExpression&>(expression);
+        auto operand = this->expression(prefix.expr());
+        if (prefix.op() == Operator::Not) {
+            kinds = operand.contains(ValueKind::Boolean) ? KindSet(ValueKind::Boolean) : KindSet();
+        } else {
+            kinds = operand & (KindSet(ValueKind::Integer) | ValueKind::Float);
+        }
+        break;
+    }
+    case ASTNode::Kind::PostfixExpr: {
+        auto& postfix = dynamic_cast<PostfixExpression&>(expression);
+        auto operand = this->expression(postfix.expr());
+        kinds = operand.contains(ValueKind::Integer) ? KindSet(ValueKind::Integer) : KindSet();
+        assign(postfix.expr(), kinds);
+        break;
+    }
+    case ASTNode::Kind::CallExpr:
+        kinds = call(dynamic_cast<CallExpression&>(expression));
+        break;
+    case ASTNode::Kind::ArrayExpr:
+        for (auto& element : dynamic_cast<ArrayExpression&>(expression).elements()) {
+            this->expression(*element);
+        }
+        kinds = ValueKind::Array;
+        break;
+    case ASTNode::Kind::ObjectExpr:
+        for (auto& value : dynamic_cast<ObjectExpression&>(expression).values()) {
+            this->expression(*value);
+        }
+        kinds = ValueKind::Object;
+        break;
+    case ASTNode::Kind::IndexExpr: {
+        auto& index = dynamic_cast<IndexExpression&>(expression);
+        this->expression(index.object());
+        this->expression(index.index());
+        // elements are not tracked
+        kinds = KindSet::any();
+        break;
+    }
+    case ASTNode::Kind::AccessExpr:
+        this->expression(dynamic_cast<AccessExpression&>(expression).object());
+        kinds = KindSet::any();
+        break;
+    default:
+        kinds = KindSet::any();
+        break;
+    }
+
+    expression.kinds() = kinds;
+    return kinds;
+}
+
+TypeInfo infer_types(Program& program, const TypeEnvironment& environment)
+{
+    return TypeInference(program, environment).run();
+}
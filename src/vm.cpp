@@ -0,0 +1,463 @@
+#include "alloc.h"
+#include "bytecode.h"
+#include <format>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#if (defined(__GNUC__) || defined(__clang__)) && !defined(EXPR_SWITCH_DISPATCH)
+#define EXPR_COMPUTED_GOTO
+#endif
+
+VM::VM(Bytecode bytecode, Context& context)
+    : m_bytecode(std::move(bytecode))
+    , m_context(context)
+    , m_access_caches(m_bytecode.access_sites)
+    , m_object_shapes(m_bytecode.objects.size(), nullptr)
+{
+    for (auto& [name, chunk] : m_bytecode.functions) {
+        m_context.insert_variable(name, Value(make_object<UserFunction>(ValueKind::UserFunction, name)));
+    }
+}
+
+static int64_t integer(const Value& value)
+{
+    return static_cast<Integer*>(value.get())->value();
+}
+
+static bool integers(const Value& lhs, const Value& rhs)
+{
+    return lhs.kind() == ValueKind::Integer && rhs.kind() == ValueKind::Integer;
+}
+
+static Comparison compare(const Value& lhs, const Value& rhs)
+{
+    if (integers(lhs, rhs)) {
+        auto l = integer(lhs);
+        auto r = integer(rhs);
+        return l == r ? Comparison::Equal : (l < r ? Comparison::Less : Comparison::Greater);
+    }
+    return lhs.get()->compare(rhs);
+}
+
+Value VM::get_attr(const Instruction& instruction, Value& object)
+{
+    auto& name = m_bytecode.names[instruction.a];
+    if (object.kind() != ValueKind::Object) {
+        return object.get()->get_attr(name);
+    }
+
+    auto& record = object.as_shaped();
+    auto& cache = m_access_caches[instruction.b];
+    if (record.shape() == cache.shape) {
+        cache.hits++;
+        return record.load(cache.slot);
+    }
+
+    cache.misses++;
+    auto value = record.get_attr(name);
+
+    auto slot = record.shape()->lookup(name);
+    if (slot.has_value() && record.shape()->cacheable()) {
+        cache.shape = record.shape();
+        cache.slot = slot.value();
+    }
+
+    return value;
+}
+
+void VM::set_attr(const Instruction& instruction, Value& object, Value& value)
+{
+    auto& name = m_bytecode.names[instruction.a];
+    if (object.kind() != ValueKind::Object) {
+        object.get()->set_attr(name, value);
+        return;
+    }
+
+    auto& record = object.as_shaped();
+    auto& cache = m_access_caches[instruction.b];
+    if (record.shape() == cache.shape) {
+        cache.hits++;
+        record.store(cache.slot, value);
+        return;
+    }
+
+    cache.misses++;
+    record.set_attr(name, value);
+    if (record.shape()->cacheable()) {
+        cache.shape = record.shape();
+        cache.slot = record.shape()->lookup(name).value();
+    }
+}
+
+Value VM::make_record(uint32_t site, size_t count)
+{
+    auto& keys = m_bytecode.objects[site];
+    auto& shape = m_object_shapes[site];
+    if (shape == nullptr) {
+        auto resolved = Shape::root();
+        for (auto key : keys) {
+            resolved = resolved->transition(m_bytecode.names[key]);
+        }
+        shape = resolved;
+    }
+
+    std::vector<Value> slots(std::make_move_iterator(m_stack.end() - count),
+        std::make_move_iterator(m_stack.end()));
+    m_stack.resize(m_stack.size() - count);
+
+    return Value(make_object<Record>(ValueKind::Object, shape, std::move(slots)));
+}
+
+Value VM::run()
+{
+    auto& main = m_bytecode.chunks[0];
+    m_stack.clear();
+    m_frames.clear();
+    m_stack.resize(main.locals, m_undefined);
+
+    const Instruction* code = main.code.data();
+    const Instruction* ip = code;
+    size_t base = 0;
+
+#define TOP() m_stack.back()
+#define SECOND() m_stack[m_stack.size() - 2]
+#define LOCAL(slot) m_stack[base + (slot)]
+#define JUMP(target)          \
+    {                         \
+        ip = code + (target); \
+        DISPATCH();           \
+    }
+
+#ifdef EXPR_COMPUTED_GOTO
+    static const void* dispatch_table[] = {
+#define EXPR_OPCODE_LABEL(name) &&op_##name,
+        EXPR_OPCODES(EXPR_OPCODE_LABEL)
+#undef EXPR_OPCODE_LABEL
+    };
+
+#define CASE(name) op_##name:
+#define DISPATCH() goto* dispatch_table[size_t(ip->op)]
+#define NEXT()      \
+    {               \
+        ++ip;       \
+        DISPATCH(); \
+    }
+
+    DISPATCH();
+#else
+#define CASE(name) case Opcode::name:
+#define DISPATCH() continue
+#define NEXT()     \
+    {              \
+        ++ip;      \
+        continue;  \
+    }
+
+    for (;;) {
+        switch (ip->op) {
+#endif
+
+    CASE(LoadConst)
+    {
+        m_stack.push_back(m_bytecode.constants[ip->a]);
+        NEXT();
+    }
+    CASE(LoadUndefined)
+    {
+        m_stack.push_back(m_undefined);
+        NEXT();
+    }
+    CASE(LoadLocal)
+    {
+        m_stack.push_back(LOCAL(ip->a));
+        NEXT();
+    }
+    CASE(StoreLocal)
+    {
+        LOCAL(ip->a) = std::move(TOP());
+        m_stack.pop_back();
+        NEXT();
+    }
+    CASE(LoadGlobal)
+    {
+        m_stack.push_back(m_context.get_variable(m_bytecode.names[ip->a]));
+        NEXT();
+    }
+    CASE(StoreGlobal)
+    {
+        m_context.set_variable(m_bytecode.names[ip->a], TOP());
+        m_stack.pop_back();
+        NEXT();
+    }
+    CASE(DefineGlobal)
+    {
+        m_context.insert_variable(m_bytecode.names[ip->a], TOP());
+        m_stack.pop_back();
+        NEXT();
+    }
+    CASE(Pop)
+    {
+        m_stack.pop_back();
+        NEXT();
+    }
+    CASE(Dup)
+    {
+        m_stack.push_back(TOP());
+        NEXT();
+    }
+
+#define ARITHMETIC(name, method, op)                              \
+    CASE(name)                                                    \
+    {                                                             \
+        auto& lhs = SECOND();                                     \
+        auto& rhs = TOP();                                        \
+        if (integers(lhs, rhs)) {                                 \
+            lhs = Value(int64_t(integer(lhs) op integer(rhs)));   \
+        } else {                                                  \
+            lhs = lhs.get()->method(rhs);                         \
+        }                                                         \
+        m_stack.pop_back();                                       \
+        NEXT();                                                   \
+    }
+
+    ARITHMETIC(Add, add, +)
+    ARITHMETIC(Sub, sub, -)
+    ARITHMETIC(Mul, mul, *)
+#undef ARITHMETIC
+
+    CASE(Div)
+    {
+        SECOND() = SECOND().get()->div(TOP());
+        m_stack.pop_back();
+        NEXT();
+    }
+    CASE(Mod)
+    {
+        SECOND() = SECOND().get()->mod(TOP());
+        m_stack.pop_back();
+        NEXT();
+    }
+
+#define COMPARISON(name, test)                                    \
+    CASE(name)                                                    \
+    {                                                             \
+        auto result = compare(SECOND(), TOP());                   \
+        SECOND() = Value(bool(test));                             \
+        m_stack.pop_back();                                       \
+        NEXT();                                                   \
+    }                                                             \
+    CASE(JumpUnless##name)                                        \
+    {                                                             \
+        auto result = compare(SECOND(), TOP());                   \
+        m_stack.resize(m_stack.size() - 2);                       \
+        if (!(test)) {                                            \
+            JUMP(ip->a);                                          \
+        }                                                         \
+        NEXT();                                                   \
+    }
+
+    COMPARISON(Equal, result == Comparison::Equal)
+    COMPARISON(NotEqual, result != Comparison::Equal)
+    COMPARISON(Less, result == Comparison::Less)
+    COMPARISON(LessEqual, result != Comparison::Greater)
+    COMPARISON(Greater, result == Comparison::Greater)
+    COMPARISON(GreaterEqual, result != Comparison::Less)
+#undef COMPARISON
+
+    CASE(Negate)
+    {
+        auto& value = TOP();
+        switch (value.kind()) {
+        case ValueKind::Integer:
+            value = Value(-integer(value));
+            break;
+        case ValueKind::Float:
+            value = Value(-value.as_float());
+            break;
+        default:
+            throw InvalidOperate(Operator::Subtract, value.kind());
+        }
+        NEXT();
+    }
+    CASE(Not)
+    {
+        auto& value = TOP();
+        if (value.kind() != ValueKind::Boolean) {
+            throw InvalidOperate(Operator::Not, value.kind());
+        }
+        value = Value(!value.as_boolean());
+        NEXT();
+    }
+    CASE(Jump)
+    {
+        JUMP(ip->a);
+    }
+    CASE(JumpIfFalse)
+    {
+        auto& condition = TOP();
+        if (condition.kind() != ValueKind::Boolean) {
+            throw InvalidOperate(Operator::Equals, ValueKind::Boolean, condition.kind());
+        }
+        auto taken = !static_cast<Boolean*>(condition.get())->value();
+        m_stack.pop_back();
+        if (taken) {
+            JUMP(ip->a);
+        }
+        NEXT();
+    }
+    CASE(Call)
+    {
+        auto argc = ip->a;
+        auto callee = m_stack[m_stack.size() - argc - 1];
+
+        switch (callee.kind()) {
+        case ValueKind::UserFunction: {
+            auto found = m_bytecode.functions.find(callee.as_user_function().name());
+            if (found == m_bytecode.functions.end()) {
+                throw std::runtime_error("Function not found");
+            }
+
+            auto& chunk = m_bytecode.chunks[found->second];
+            if (chunk.params != argc) {
+                throw InvalidOperate(std::format("Invalid call for {}", chunk.name));
+            }
+
+            m_frames.push_back(Frame { ip, code, base, m_stack.size() - argc - 1 });
+            base = m_stack.size() - argc;
+            m_stack.resize(base + chunk.locals, m_undefined);
+            code = ip = chunk.code.data();
+            DISPATCH();
+        }
+        case ValueKind::NativeFunction: {
+            std::vector<Value> args(std::make_move_iterator(m_stack.end() - argc),
+                std::make_move_iterator(m_stack.end()));
+            m_stack.resize(m_stack.size() - argc - 1);
+            m_stack.push_back(callee.get()->call(args));
+            NEXT();
+        }
+        default:
+            throw InvalidOperate(std::format("Invalid call for {}", callee.inspect()));
+        }
+    }
+    CASE(CallFunction)
+    {
+        auto& chunk = m_bytecode.chunks[ip->a];
+        if (chunk.params != ip->b) {
+            throw InvalidOperate(std::format("Invalid call for {}", chunk.name));
+        }
+
+        m_frames.push_back(Frame { ip, code, base, m_stack.size() - ip->b });
+        base = m_stack.size() - ip->b;
+        m_stack.resize(base + chunk.locals, m_undefined);
+        code = ip = chunk.code.data();
+        DISPATCH();
+    }
+    CASE(Return)
+    {
+        auto result = std::move(TOP());
+        if (m_frames.empty()) {
+            m_stack.clear();
+            return result;
+        }
+
+        auto& frame = m_frames.back();
+        m_stack.resize(frame.unwind);
+        m_stack.push_back(std::move(result));
+        ip = frame.ip;
+        code = frame.code;
+        base = frame.base;
+        m_frames.pop_back();
+        NEXT();
+    }
+    CASE(MakeArray)
+    {
+        std::vector<Value> elements(std::make_move_iterator(m_stack.end() - ip->a),
+            std::make_move_iterator(m_stack.end()));
+        m_stack.resize(m_stack.size() - ip->a);
+        m_stack.push_back(Value(make_object<Array>(ValueKind::Array, std::move(elements))));
+        NEXT();
+    }
+    CASE(MakeObject)
+    {
+        auto object = make_record(ip->a, m_bytecode.objects[ip->a].size());
+        m_stack.push_back(std::move(object));
+        NEXT();
+    }
+    CASE(Index)
+    {
+        SECOND() = SECOND().get()->index(TOP());
+        m_stack.pop_back();
+        NEXT();
+    }
+    CASE(SetIndex)
+    {
+        auto size = m_stack.size();
+        m_stack[size - 2].get()->set_index(m_stack[size - 1], m_stack[size - 3]);
+        m_stack.resize(size - 2);
+        NEXT();
+    }
+    CASE(GetAttr)
+    {
+        TOP() = get_attr(*ip, TOP());
+        NEXT();
+    }
+    CASE(SetAttr)
+    {
+        set_attr(*ip, TOP(), SECOND());
+        m_stack.pop_back();
+        NEXT();
+    }
+
+#define LOCAL_CONSTANT(name, method, op)                                     \
+    CASE(name)                                                               \
+    {                                                                        \
+        auto& local = LOCAL(ip->a);                                          \
+        auto& constant = m_bytecode.constants[ip->b];                        \
+        if (integers(local, constant)) {                                     \
+            m_stack.push_back(Value(int64_t(integer(local) op integer(constant)))); \
+        } else {                                                             \
+            m_stack.push_back(local.get()->method(constant));                \
+        }                                                                    \
+        NEXT();                                                              \
+    }
+
+    LOCAL_CONSTANT(AddLocalConst, add, +)
+    LOCAL_CONSTANT(SubLocalConst, sub, -)
+#undef LOCAL_CONSTANT
+
+    CASE(IncLocal)
+    {
+        auto& local = LOCAL(ip->a);
+        if (local.kind() != ValueKind::Integer) {
+            throw InvalidOperate(Operator::Increase, local.kind());
+        }
+        local = Value(integer(local) + 1);
+        NEXT();
+    }
+    CASE(DecLocal)
+    {
+        auto& local = LOCAL(ip->a);
+        if (local.kind() != ValueKind::Integer) {
+            throw InvalidOperate(Operator::Decrease, local.kind());
+        }
+        local = Value(integer(local) - 1);
+        NEXT();
+    }
+
+#ifndef EXPR_COMPUTED_GOTO
+        default:
+            throw std::runtime_error(std::format("invalid opcode {}", int(ip->op)));
+        }
+    }
+#endif
+
+#undef CASE
+#undef DISPATCH
+#undef NEXT
+#undef JUMP
+#undef LOCAL
+#undef SECOND
+#undef TOP
+}
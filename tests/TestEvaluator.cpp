@@ -1,7 +1,24 @@
+#include "alloc.h"
 #include "ast.h"
+#include "binding.h"
+#include "bytecode.h"
+#include "closure.h"
+#include "dag.h"
 #include "eval.h"
+#include "flat.h"
+#include "jit.h"
+#include "memo.h"
+#include "optimizer.h"
 #include "parser.h"
+#include "profiler.h"
+#include "regcode.h"
+#include "sheet.h"
+#include "text.h"
+#include "types.h"
 
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
 #include <format>
 #include <iostream>
 #include <memory>
@@ -9,6 +26,15 @@
 #include <tuple>
 #include <vector>
 
+// Programs whose result depends on the tree evaluator resolving a function's
+// free names through its callers' bindings. The compiled backends reject them.
+const std::vector<std::string_view> DYNAMICALLY_SCOPED = {
+    "fn h() { return k; } fn f(k) { return h(); } fn g() { return f(3); } let k = 100; return g();",
+    "fn fr() { return q; } fn g() { let q = 5; return fr(); } return g();",
+    "fn g(x) { return h(x); } fn h(x) { return x + 1; } fn k(x) { return x * 100; } fn caller() { let h = k; return g(1); } return caller();",
+    "fn g(x) { return h(x); } fn h(x) { return x + 1; } fn k(x) { return x * 100; } fn caller(h) { return g(1); } return caller(k);",
+};
+
 int test_eval_expression()
 {
     std::vector<std::tuple<std::string_view, Value>> tests = {
@@ -110,7 +136,7 @@ int test_eval_environment()
 
     std::vector<std::tuple<std::string_view, Value>> tests = {
         { "return a + 1;", Value(2) },
-        // { "return fib(10);", Value(55) },
+        { "return fib(10);", Value(55) },
     };
 
     for (auto& [input, expected] : tests) {
@@ -124,9 +150,67 @@ int test_eval_environment()
             auto context = Context(std::move(program));
 
             context.define("a", 1);
-            // context.define("fib", std::make_shared<NativeFunction<int, int>>("fib", fib));
+            context.define("fib", std::make_shared<NativeFunction<int, int>>("fib", fib));
+
+            auto ret = std::make_unique<Evaluator>(context)->eval();
+
+            if (ret.kind() != expected.kind()) {
+                throw std::runtime_error(std::format("expected: {}, got: {}",
+                    value_kind_str(expected.kind()),
+                    value_kind_str(ret.kind())));
+            }
+
+            if (ret.obj()->compare(expected) != Comparison::Equal) {
+                throw std::runtime_error(std::format(
+                    "expected: {}, got: {}", expected.inspect(), ret.inspect()));
+            }
+            std::cout << std::format("PASSED: `{}` = {}", input, ret.inspect())
+                      << std::endl;
+        } catch (std::exception& e) {
+            std::cout << std::format("FAILED: {}", e.what()) << std::endl;
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+int test_eval_array()
+{
+    std::vector<std::tuple<std::string_view, Value>> tests = {
+        { "let a = [1, 2, 3]; return a[1];", Value(2) },
+        { "let a = [1, 2.5]; return a[1];", Value(2.5) },
+        { "let a = [1, 2, 3]; a[0] = 10; return a[0] + len(a);", Value(13) },
+        { "let a = []; for (let i = 0; i < 10; i++) { push(a, i * 2); } return a[9] + len(a);",
+            Value(28) },
+        { "let a = [1.5, 2.5]; push(a, 3); return a[2];", Value(3) },
+        { "let a = [[1, 2], [3, 4]]; return a[1][0];", Value(3) },
+        { "return sum([1, 2, 3, 4, 5, 6, 7, 8, 9]);", Value(45) },
+        { "return sum([0.5, 1.5, 2.5, 3.5, 4.5]);", Value(12.5) },
+        { "return mean([1, 2, 3, 4]);", Value(2.5) },
+        { "return dot([1, 2, 3, 4, 5], [5, 4, 3, 2, 1]);", Value(35) },
+        { "return dot([1.0, 2.0, 3.0], [1, 2, 3]);", Value(14.0) },
+        { "return min([3.5, -1.5, 2.0, 7.0, -1.5]) + max([3, 9, 2]);", Value(7.5) },
+        { "return argmax([0.1, 0.7, 0.3, 0.7, 0.2]);", Value(1) },
+        { "return scale([1, 2, 3], 2)[2];", Value(6) },
+        { "return vadd([1, 2, 3], [1.5, 1.5, 1.5])[2];", Value(4.5) },
+        { "return vmul([1, 2, 3, 4, 5], [2, 2, 2, 2, 2])[4];", Value(10) },
+        { "return sum(filter([1, 2, 3, 4], [true, false, true, false]));", Value(4) },
+        { "return min([3, 1, 2.5]);", Value(1) },
+        { "return max([3, 1, 2.5]);", Value(3) },
+        { "return max([3, 1, 4.5]);", Value(4.5) },
+        { "return filter([3, 1.5, 2], [true, false, true])[1];", Value(2) },
+    };
+
+    for (auto& [input, expected] : tests) {
+        try {
+            auto parse = std::make_unique<Parser>(input);
 
-            // std::shared_ptr<Object> f = std::make_shared<Callable<int,int>>("fib", fib);
+            auto program = parse->parse();
+
+            std::cout << ASTInspector::inspect(*program) << std::endl;
+
+            auto context = Context(std::move(program));
 
             auto ret = std::make_unique<Evaluator>(context)->eval();
 
@@ -148,19 +232,1522 @@ int test_eval_environment()
         }
     }
 
+    try {
+        auto context = Context {};
+        auto expr = std::make_unique<Parser>("[1, 2, 3]")->parse_expression();
+        auto ret = std::make_unique<Evaluator>(context)->eval(*expr);
+        if (ret.as_array().integers() == nullptr) {
+            throw std::runtime_error("expected contiguous integer storage");
+        }
+        std::cout << std::format("PASSED: `[1, 2, 3]` = {}", ret.inspect()) << std::endl;
+    } catch (std::exception& e) {
+        std::cout << std::format("FAILED: {}", e.what()) << std::endl;
+        return -1;
+    }
+
+    for (auto input : { "return scale([1.0], \"x\");", "return scale([1, 2], true);" }) {
+        try {
+            auto context = Context(std::make_unique<Parser>(input)->parse());
+            auto ret = std::make_unique<Evaluator>(context)->eval();
+            std::cout << std::format("FAILED: `{}` = {}, expected an error", input, ret.inspect()) << std::endl;
+            return -1;
+        } catch (InvalidOperate& e) {
+            std::cout << std::format("PASSED: `{}` rejected with: {}", input, e.what()) << std::endl;
+        }
+    }
+
     return 0;
 }
 
-int main(int argc, const char* argv[])
+int test_eval_object()
 {
+    std::vector<std::tuple<std::string_view, Value>> tests = {
+        { "let p = {x: 1, y: 2}; return p.x + p.y;", Value(3) },
+        { "let p = {x: 1}; p.y = 5; return p.y * 2 + len(p);", Value(12) },
+        { "let p = {a: {b: [1, 2, 3]}}; return p.a.b[2];", Value(3) },
+        { "let p = {x: 1}; return p.y == undefined;", Value(true) },
+        { "let s = 0; for (let i = 0; i < 10; i++) { let p = {v: i, w: 1}; p.v = p.v + p.w; s = s + p.v; } return s;",
+            Value(55) },
+        { "fn norm(p) { return p.x * p.x + p.y * p.y; } return norm({x: 3, y: 4});", Value(25) },
+    };
 
-    std::cout << "Testing evaluator..." << std::endl;
+    for (auto& [input, expected] : tests) {
+        try {
+            auto parse = std::make_unique<Parser>(input);
 
-    test_eval_expression();
+            auto program = parse->parse();
 
-    test_eval_program();
+            std::cout << ASTInspector::inspect(*program) << std::endl;
 
-    test_eval_environment();
+            auto context = Context(std::move(program));
+
+            auto ret = std::make_unique<Evaluator>(context)->eval();
+
+            if (ret.kind() != expected.kind()) {
+                throw std::runtime_error(std::format("expected: {}, got: {}",
+                    value_kind_str(expected.kind()),
+                    value_kind_str(ret.kind())));
+            }
+
+            if (ret.obj()->compare(expected) != Comparison::Equal) {
+                throw std::runtime_error(std::format(
+                    "expected: {}, got: {}", expected.inspect(), ret.inspect()));
+            }
+            std::cout << std::format("PASSED: `{}` = {}", input, ret.inspect())
+                      << std::endl;
+        } catch (std::exception& e) {
+            std::cout << std::format("FAILED: {}", e.what()) << std::endl;
+            return -1;
+        }
+    }
+
+    try {
+        auto expr = std::make_unique<Parser>("p.y")->parse_expression();
+        auto& access = dynamic_cast<AccessExpression&>(*expr);
+
+        for (int i = 0; i < 100; ++i) {
+            auto record = make_object<Record>(ValueKind::Object);
+            record->set_attr("x", Value(i));
+            record->set_attr("y", Value(i * 2));
+
+            auto context = Context {};
+            context.define("p", record);
+            auto ret = std::make_unique<Evaluator>(context)->eval(*expr);
+            if (ret.as_integer() != i * 2) {
+                throw std::runtime_error(std::format("expected: {}, got: {}", i * 2, ret.inspect()));
+            }
+        }
+
+        if (access.cache().misses != 1 || access.cache().hits != 99) {
+            throw std::runtime_error(std::format("expected 1 miss and 99 hits, got {} and {}",
+                access.cache().misses, access.cache().hits));
+        }
+        std::cout << "PASSED: `p.y` cached the field slot across records of one shape" << std::endl;
+    } catch (std::exception& e) {
+        std::cout << std::format("FAILED: {}", e.what()) << std::endl;
+        return -1;
+    }
+
+    try {
+        // keys computed at run time stop growing the shared shape tree
+        auto expr = std::make_unique<Parser>("p.v + p.v")->parse_expression();
+        auto base = make_object<Record>(ValueKind::Object);
+        base->set_attr("v", Value(0));
+
+        for (size_t i = 0; i < 4 * Shape::max_transitions; ++i) {
+            auto record = make_object<Record>(ValueKind::Object);
+            record->set_attr("v", Value(int(i)));
+            record->set_attr(std::format("key{}", i), Value(int(i)));
+
+            auto context = Context {};
+            context.define("p", record);
+            auto ret = std::make_unique<Evaluator>(context)->eval(*expr);
+            if (ret.as_integer() != int64_t(i * 2)
+                || record->get_attr(std::format("key{}", i)).as_integer() != int64_t(i)) {
+                throw std::runtime_error(std::format("unexpected fields in record {}", i));
+            }
+            if (i >= Shape::max_transitions && record->shape()->cacheable()) {
+                throw std::runtime_error(std::format("expected record {} to use a dictionary shape", i));
+            }
+        }
+        std::cout << "PASSED: dynamic keys fall back to dictionary shapes" << std::endl;
+
+        // and a record that keeps adding fresh keys stops deepening it
+        auto record = make_object<Record>(ValueKind::Object);
+        for (size_t i = 0; i < 4 * Shape::max_depth; ++i) {
+            record->set_attr(std::format("depth{}", i), Value(int(i)));
+            if (i >= Shape::max_depth && record->shape()->cacheable()) {
+                throw std::runtime_error(std::format("expected a dictionary shape after {} keys", i + 1));
+            }
+        }
+        for (size_t i = 0; i < 4 * Shape::max_depth; ++i) {
+            if (record->get_attr(std::format("depth{}", i)).as_integer() != int64_t(i)) {
+                throw std::runtime_error(std::format("unexpected depth{}", i));
+            }
+        }
+        std::cout << "PASSED: long chains of dynamic keys fall back to dictionary shapes" << std::endl;
+    } catch (std::exception& e) {
+        std::cout << std::format("FAILED: {}", e.what()) << std::endl;
+        return -1;
+    }
+
+    return 0;
+}
+
+struct Request {
+    int64_t status;
+    double latency;
+    std::string_view path;
+    bool cached;
+};
+
+int test_eval_binding()
+{
+    auto input = "if (r.cached) { return 0.0; } if (r.status >= 500) { return r.latency * 2; } return r.latency + len(r.path);";
+
+    std::vector<std::tuple<Request, Value>> tests = {
+        { Request { 200, 1.5, "/index", false }, Value(7.5) },
+        { Request { 503, 4.0, "/api", false }, Value(8.0) },
+        { Request { 200, 9.0, "/", true }, Value(0.0) },
+    };
+
+    try {
+        auto schema = std::make_shared<Schema>();
+        schema->field<int64_t>("status", offsetof(Request, status))
+            .field<double>("latency", offsetof(Request, latency))
+            .field<std::string_view>("path", offsetof(Request, path))
+            .field<bool>("cached", offsetof(Request, cached));
+
+        auto request = make_object<HostRecord>(ValueKind::Object, schema);
+
+        std::shared_ptr<Program> program = std::make_unique<Parser>(input)->parse();
+        auto context = Context(program);
+        context.define("r", request);
+        auto evaluator = std::make_unique<Evaluator>(context);
+
+        for (auto& [data, expected] : tests) {
+            request->rebind(&data);
+
+            auto ret = evaluator->eval();
+
+            if (ret.kind() != expected.kind()) {
+                throw std::runtime_error(std::format("expected: {}, got: {}",
+                    value_kind_str(expected.kind()),
+                    value_kind_str(ret.kind())));
+            }
+
+            if (ret.obj()->compare(expected) != Comparison::Equal) {
+                throw std::runtime_error(std::format(
+                    "expected: {}, got: {}", expected.inspect(), ret.inspect()));
+            }
+            std::cout << std::format("PASSED: `{}` with {} = {}", input,
+                request->inspect(), ret.inspect())
+                      << std::endl;
+        }
+
+        try {
+            auto assign = std::make_unique<Parser>("r.status = 1")->parse_expression();
+            evaluator->eval(*assign);
+            throw std::runtime_error("expected host record fields to be read-only");
+        } catch (InvalidOperate& e) {
+            std::cout << std::format("PASSED: `r.status = 1` rejected with: {}", e.what())
+                      << std::endl;
+        }
+    } catch (std::exception& e) {
+        std::cout << std::format("FAILED: {}", e.what()) << std::endl;
+        return -1;
+    }
+
+    return 0;
+}
+
+int test_eval_flat()
+{
+    using Clock = std::chrono::steady_clock;
+
+    std::vector<std::string_view> tests = {
+        "let sum = 0; for (let i = 0; i < 10; i++) { if (i % 2 == 1) { sum = sum + i; } } return sum;",
+        "fn fib(n) { if (n <= 0) { return 0; } if (n <= 2) { return 1; } return fib(n - 1) + fib(n - 2); } return fib(18);",
+        "let p = {x: 1, y: [1, 2, 3]}; p.x = p.x + p.y[2]; return p.x;",
+    };
+
+    for (auto& input : tests) {
+        try {
+            auto start = Clock::now();
+            auto tree_context = Context(std::make_unique<Parser>(input)->parse());
+            auto expected = std::make_unique<Evaluator>(tree_context)->eval();
+            auto tree = Clock::now() - start;
+
+            start = Clock::now();
+            auto buffer = std::make_unique<Parser>(input)->parse_flat();
+            auto context = Context {};
+            auto ret = FlatEvaluator(buffer.view(), context).eval();
+            auto flat = Clock::now() - start;
+
+            if (ret.kind() != expected.kind() || ret.obj()->compare(expected) != Comparison::Equal) {
+                throw std::runtime_error(std::format(
+                    "expected: {}, got: {}", expected.inspect(), ret.inspect()));
+            }
+            std::cout << std::format("PASSED: `{}` = {} (tree {}us, flat {}us)", input, ret.inspect(),
+                std::chrono::duration_cast<std::chrono::microseconds>(tree).count(),
+                std::chrono::duration_cast<std::chrono::microseconds>(flat).count())
+                      << std::endl;
+        } catch (std::exception& e) {
+            std::cout << std::format("FAILED: {}", e.what()) << std::endl;
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+int test_eval_bytecode()
+{
+    using Clock = std::chrono::steady_clock;
+
+    std::vector<std::string_view> tests = {
+        "let sum = 0; for (let i = 0; i < 10; i++) { if (i % 2 == 1) { sum = sum + i; } } return sum;",
+        "fn fib(n) { if (n <= 0) { return 0; } if (n <= 2) { return 1; } return fib(n - 1) + fib(n - 2); } return fib(18);",
+        "let p = {x: 1, y: [1, 2, 3]}; p.x = p.x + p.y[2]; return p.x;",
+        "let limit = 3; fn below(n) { return n < limit; } let x = 0; for (;;) { x++; if (!below(x)) { break; } } return x;",
+        "let a = [1, 2, 3]; a[0] = 10; let s = 0; for (let i = 0; i < len(a); i++) { if (a[i] == 2) { continue; } s = s + a[i]; } return s;",
+        "let x = 1; { let x = 2; x = x * 10; } return -x;",
+        "fn g(x) { return h(x); } fn h(x) { return x + 1; } fn k(x) { return x * 100; } let h = k; return g(1);",
+        "fn g(x) { return h(x); } fn h(x) { return x + 1; } fn k(x) { return x * 100; } h = k; return g(1);",
+    };
+
+    for (auto& input : tests) {
+        try {
+            auto start = Clock::now();
+            auto tree_context = Context(std::make_unique<Parser>(input)->parse());
+            auto expected = std::make_unique<Evaluator>(tree_context)->eval();
+            auto tree = Clock::now() - start;
+
+            start = Clock::now();
+            auto program = std::make_unique<Parser>(input)->parse();
+            auto context = Context {};
+            auto ret = VM(compile(*program), context).run();
+            auto vm = Clock::now() - start;
+
+            if (ret.kind() != expected.kind() || ret.obj()->compare(expected) != Comparison::Equal) {
+                throw std::runtime_error(std::format(
+                    "expected: {}, got: {}", expected.inspect(), ret.inspect()));
+            }
+            std::cout << std::format("PASSED: `{}` = {} (tree {}us, vm {}us)", input, ret.inspect(),
+                std::chrono::duration_cast<std::chrono::microseconds>(tree).count(),
+                std::chrono::duration_cast<std::chrono::microseconds>(vm).count())
+                      << std::endl;
+        } catch (std::exception& e) {
+            std::cout << std::format("FAILED: {}", e.what()) << std::endl;
+            return -1;
+        }
+    }
+
+    // the loop and call benchmarks lean on the fused instructions
+    auto input = "fn fib(n) { if (n < 2) { return n; } return fib(n - 1) + fib(n - 2); } let s = 0; for (let i = 0; i < 10; i++) { s = s + fib(i); } return s;";
+    try {
+        auto program = std::make_unique<Parser>(input)->parse();
+        auto listing = disassemble(compile(*program));
+
+        for (auto op : { "JumpUnlessLess", "SubLocalConst", "CallFunction", "IncLocal" }) {
+            if (listing.find(op) == std::string::npos) {
+                throw std::runtime_error(std::format("expected {} in:\n{}", op, listing));
+            }
+        }
+        std::cout << "PASSED: superinstructions in `" << input << "`" << std::endl;
+    } catch (std::exception& e) {
+        std::cout << std::format("FAILED: {}", e.what()) << std::endl;
+        return -1;
+    }
+
+    for (auto& input : DYNAMICALLY_SCOPED) {
+        try {
+            auto program = std::make_unique<Parser>(input)->parse();
+            compile(*program);
+            std::cout << std::format("FAILED: `{}` compiled", input) << std::endl;
+            return -1;
+        } catch (std::runtime_error& e) {
+            std::cout << std::format("PASSED: `{}` rejected with: {}", input, e.what()) << std::endl;
+        }
+    }
+
+    return 0;
+}
+
+int test_eval_registers()
+{
+    std::vector<std::string_view> tests = {
+        "let sum = 0; for (let i = 0; i < 10; i++) { if (i % 2 == 1) { sum = sum + i; } } return sum;",
+        "fn fib(n) { if (n <= 0) { return 0; } if (n <= 2) { return 1; } return fib(n - 1) + fib(n - 2); } return fib(18);",
+        "let p = {x: 1, y: [1, 2, 3]}; p.x = p.x + p.y[2]; return p.x;",
+        "let limit = 3; fn below(n) { return n < limit; } let x = 0; for (;;) { x++; if (!below(x)) { break; } } return x;",
+        "let a = [1, 2, 3]; a[0] = 10; let s = 0; for (let i = 0; i < len(a); i++) { if (a[i] == 2) { continue; } s = s + a[i]; } return s;",
+        "let x = 1; { let x = 2; x = x * 10; } return -x;",
+        "let price = 0.0; let qty = 3; for (let i = 1; i <= qty; i++) { price = price + 2.5 * i; } return price / qty;",
+        "let x = 1; x = x + 0.5; let b = x > 1; return !b == false;",
+        "let t = 7; let u = t / 2 + t % 4; return [u, -t, t >= 7];",
+        "fn g(x) { return h(x); } fn h(x) { return x + 1; } fn k(x) { return x * 100; } let h = k; return g(1);",
+        "fn g(x) { return h(x); } fn h(x) { return x + 1; } fn k(x) { return x * 100; } h = k; return g(1);",
+    };
+
+    for (auto& input : tests) {
+        try {
+            auto tree_context = Context(std::make_unique<Parser>(input)->parse());
+            auto expected = std::make_unique<Evaluator>(tree_context)->eval();
+
+            auto program = std::make_unique<Parser>(input)->parse();
+            auto context = Context {};
+            auto ret = RegisterVM(compile_registers(*program), context).run();
+
+            if (ret.kind() != expected.kind() || ret.inspect() != expected.inspect()) {
+                throw std::runtime_error(std::format(
+                    "expected: {}, got: {}", expected.inspect(), ret.inspect()));
+            }
+            std::cout << std::format("PASSED: `{}` = {}", input, ret.inspect()) << std::endl;
+        } catch (std::exception& e) {
+            std::cout << std::format("FAILED: `{}`: {}", input, e.what()) << std::endl;
+            return -1;
+        }
+    }
+
+    // locals whose type is known end up in typed instructions
+    auto input = "let s = 0; for (let i = 0; i < 100; i++) { s = s + i * 2; } return s;";
+    try {
+        auto program = std::make_unique<Parser>(input)->parse();
+        auto listing = disassemble(compile_registers(*program));
+
+        for (auto op : { "JumpUnlessLessII", "MulII", "AddII", "IncI" }) {
+            if (listing.find(op) == std::string::npos) {
+                throw std::runtime_error(std::format("expected {} in:\n{}", op, listing));
+            }
+        }
+        for (auto op : { "Add ", "Mul " }) {
+            if (listing.find(op) != std::string::npos) {
+                throw std::runtime_error(std::format("unexpected generic {}in:\n{}", op, listing));
+            }
+        }
+        std::cout << "PASSED: typed instructions in `" << input << "`" << std::endl;
+    } catch (std::exception& e) {
+        std::cout << std::format("FAILED: {}", e.what()) << std::endl;
+        return -1;
+    }
+
+    for (auto& input : DYNAMICALLY_SCOPED) {
+        try {
+            auto program = std::make_unique<Parser>(input)->parse();
+            compile_registers(*program);
+            std::cout << std::format("FAILED: `{}` compiled", input) << std::endl;
+            return -1;
+        } catch (std::runtime_error& e) {
+            std::cout << std::format("PASSED: `{}` rejected with: {}", input, e.what()) << std::endl;
+        }
+    }
+
+    return 0;
+}
+
+int test_eval_closures()
+{
+    std::vector<std::string_view> tests = {
+        "let sum = 0; for (let i = 0; i < 10; i++) { if (i % 2 == 1) { sum = sum + i; } } return sum;",
+        "fn fib(n) { if (n <= 0) { return 0; } if (n <= 2) { return 1; } return fib(n - 1) + fib(n - 2); } return fib(18);",
+        "let p = {x: 1, y: [1, 2, 3]}; p.x = p.x + p.y[2]; return p.x;",
+        "let limit = 3; fn below(n) { return n < limit; } let x = 0; for (;;) { x++; if (!below(x)) { break; } } return x;",
+        "let a = [1, 2, 3]; a[0] = 10; let s = 0; for (let i = 0; i < len(a); i++) { if (a[i] == 2) { continue; } s = s + a[i]; } return s;",
+        "let x = 1; { let x = 2; x = x * 10; } return -x;",
+        "let price = 0.0; let qty = 3; for (let i = 1; i <= qty; i++) { price = price + 2.5 * i; } return price / qty;",
+        "fn count() { let n = 0; n++; return n; } return [count(), count()];",
+        "fn apply(f, x) { return f(x); } fn twice(x) { return x * 2; } return apply(twice, 21);",
+        "fn g(x) { return h(x); } fn h(x) { return x + 1; } fn k(x) { return x * 100; } let h = k; return g(1);",
+        "fn g(x) { return h(x); } fn h(x) { return x + 1; } fn k(x) { return x * 100; } h = k; return g(1);",
+    };
+
+    for (auto& input : tests) {
+        try {
+            auto tree_context = Context(std::make_unique<Parser>(input)->parse());
+            auto expected = std::make_unique<Evaluator>(tree_context)->eval();
+
+            auto program = std::make_unique<Parser>(input)->parse();
+            auto context = Context {};
+            auto ret = ClosureProgram(*program).run(context);
+
+            if (ret.kind() != expected.kind() || ret.inspect() != expected.inspect()) {
+                throw std::runtime_error(std::format(
+                    "expected: {}, got: {}", expected.inspect(), ret.inspect()));
+            }
+            std::cout << std::format("PASSED: `{}` = {}", input, ret.inspect()) << std::endl;
+        } catch (std::exception& e) {
+            std::cout << std::format("FAILED: `{}`: {}", input, e.what()) << std::endl;
+            return -1;
+        }
+    }
+
+    for (auto& input : DYNAMICALLY_SCOPED) {
+        try {
+            auto program = std::make_unique<Parser>(input)->parse();
+            ClosureProgram compiled(*program);
+            std::cout << std::format("FAILED: `{}` compiled", input) << std::endl;
+            return -1;
+        } catch (std::runtime_error& e) {
+            std::cout << std::format("PASSED: `{}` rejected with: {}", input, e.what()) << std::endl;
+        }
+    }
+
+    return 0;
+}
+
+int test_eval_types()
+{
+    std::vector<std::tuple<std::string_view, std::vector<std::string_view>>> tests = {
+        { "fn fib(n) { if (n <= 2) { return 1; } return fib(n - 1) + fib(n - 2); } return fib(18);",
+            { "fn fib(n: Integer) -> Integer" } },
+        { "fn scale(x) { let y = x * 2; return y; } return [scale(1), scale(1.5)];",
+            { "fn scale(x: Integer | Float) -> Integer | Float", "  let y: Integer | Float" } },
+        { "fn half(n) { if (n < 5) { return n; } } return half(2);", { "fn half(n: Integer) -> Undefined | Integer" } },
+        { "fn apply(f, x) { return f(x); } fn twice(x) { return x * 2; } return apply(twice, 21);",
+            { "fn apply(f: UserFunction, x: Integer) -> any", "fn twice(x: any) -> Integer | Float" } },
+        { "let s = 0; for (let i = 0; i < limit; i++) { s = s + i * step; } return s;",
+            { "  let i: Integer", "  let s: Integer" } },
+    };
+
+    for (auto& [input, expected] : tests) {
+        try {
+            auto tree_context = Context(std::make_unique<Parser>(input)->parse());
+            tree_context.define("limit", 10);
+            tree_context.define("step", 3);
+            auto value = std::make_unique<Evaluator>(tree_context)->eval();
+
+            auto environment = TypeEnvironment {
+                { "limit", ValueKind::Integer },
+                { "step", ValueKind::Integer },
+            };
+            auto program = std::make_unique<Parser>(input)->parse();
+            auto report = infer_types(*program, environment).report();
+            for (auto& line : expected) {
+                if (report.find(line) == std::string::npos) {
+                    throw std::runtime_error(std::format("missing `{}` in:\n{}", line, report));
+                }
+            }
+
+            // the closure backend drops kind checks where the kinds are known
+            auto context = Context {};
+            context.define("limit", 10);
+            context.define("step", 3);
+            auto ret = ClosureProgram(*program, environment).run(context);
+            if (ret.kind() != value.kind() || ret.inspect() != value.inspect()) {
+                throw std::runtime_error(std::format("expected: {}, got: {}", value.inspect(), ret.inspect()));
+            }
+            std::cout << std::format("PASSED: `{}` = {}", input, ret.inspect()) << std::endl;
+            std::cout << report;
+        } catch (std::exception& e) {
+            std::cout << std::format("FAILED: `{}`: {}", input, e.what()) << std::endl;
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+int test_eval_loops()
+{
+    // program, hoisted, reduced
+    std::vector<std::tuple<std::string_view, uint32_t, uint32_t>> tests = {
+        { "let n = 5; let x = 3; let y = 4; let sum = 0; for (let i = 0; i < n * 2; i++) { sum = sum + x * y + i * 4; } return sum;", 2, 1 },
+        { "let w = 3; let out = []; for (let i = 0; i < 4; i++) { for (let j = 0; j < w; j++) { push(out, i * w + j); } } return out;", 0, 1 },
+        { "let s = 0; for (let i = 10; i > 0; i = i - 2) { s = s + i * 3 + 3 * i; } return s;", 0, 2 },
+        { "let s = 0; for (let i = 0; i < 10; i++) { if (i % 3 == 0) { continue; } s = s + i * 7; } return s;", 0, 0 },
+        { "let k = 2; fn bump() { k = k + 1; return 0; } let s = 0; for (let i = 0; i < 5; i++) { s = s + k * 10 + bump(); } return s;", 0, 0 },
+        { "let s = 0; for (let i = 0; i < 4; i++) { s = s + scale * 3 + i * scale; } return s;", 1, 1 },
+        { "fn f(v) { let s = 0; for (let i = 0; i < 3; i++) { s = s + -v * 2; } return s; } return [f(2), f(1.5)];", 1, 0 },
+        { "let s = 0; let f = 1.5; for (let i = 0; i < 0; i++) { s = s + f * 2.0; } return s;", 1, 0 },
+        { "let a = 1; let b = a; for (let i = 0; i < 3; i++) { b++; } return [a, b];", 0, 0 },
+    };
+
+    for (auto& [input, hoisted, reduced] : tests) {
+        try {
+            auto tree_context = Context(std::make_unique<Parser>(input)->parse());
+            tree_context.define("scale", 5);
+            auto expected = std::make_unique<Evaluator>(tree_context)->eval();
+
+            std::shared_ptr<Program> program = std::make_unique<Parser>(input)->parse();
+            auto stats = optimize_loops(*program, { { "scale", ValueKind::Integer } });
+            if (stats.hoisted != hoisted || stats.reduced != reduced) {
+                throw std::runtime_error(std::format("expected {} hoisted and {} reduced, got {}",
+                    hoisted, reduced, stats.report()));
+            }
+
+            auto context = Context(program);
+            context.define("scale", 5);
+            auto tree = std::make_unique<Evaluator>(context)->eval();
+            auto closure_context = Context {};
+            closure_context.define("scale", 5);
+            auto closure = ClosureProgram(*program).run(closure_context);
+            auto register_context = Context {};
+            register_context.define("scale", 5);
+            auto registers = RegisterVM(compile_registers(*program), register_context).run();
+
+            for (auto ret : { tree, closure, registers }) {
+                if (ret.kind() != expected.kind() || ret.inspect() != expected.inspect()) {
+                    throw std::runtime_error(std::format(
+                        "expected: {}, got: {}\n{}", expected.inspect(), ret.inspect(), ASTInspector::inspect(*program)));
+                }
+            }
+            std::cout << std::format("PASSED: `{}` = {} ({})", input, tree.inspect(), stats.report()) << std::endl;
+        } catch (std::exception& e) {
+            std::cout << std::format("FAILED: `{}`: {}", input, e.what()) << std::endl;
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+int test_eval_inlining()
+{
+    // program, inlined, folded
+    std::vector<std::tuple<std::string_view, uint32_t, uint32_t>> tests = {
+        { "fn add(a, b) { return a + b; } let s = 0; for (let i = 0; i < 10; i++) { s = add(s, i); } return s;", 1, 0 },
+        { "fn double(x) { return x * 2; } fn quad(x) { return double(double(x)); } return quad(5) + double(1.5);", 4, 4 },
+        { "fn fib(n) { if (n < 2) { return n; } return fib(n - 1) + fib(n - 2); } fn inc(x) { return x + 1; } return fib(inc(9));", 1, 1 },
+        { "fn sq(v) { return v * v; } let x = 3; return sq(x + 1) + sq(x);", 1, 0 },
+        { "fn first(a, b) { return a; } let y = 2; return first(y * 3, [1, 2]);", 1, 0 },
+        { "fn add(a, b) { return b + a; } let x = 1; return add(x, x++);", 0, 0 },
+        { "fn get(p) { return p.x * scale; } let scale = 3; return get({x: 1}) + get({x: 2});", 2, 0 },
+        { "fn div(a, b) { return a / b + a % b; } return [div(7, 2), div(-9, 4)];", 2, 7 },
+    };
+
+    for (auto& [input, inlined, folded] : tests) {
+        try {
+            auto tree_context = Context(std::make_unique<Parser>(input)->parse());
+            auto expected = std::make_unique<Evaluator>(tree_context)->eval();
+
+            std::shared_ptr<Program> program = std::make_unique<Parser>(input)->parse();
+            auto stats = inline_functions(*program);
+            if (stats.inlined != inlined || stats.folded != folded) {
+                throw std::runtime_error(std::format("expected {} inlined and {} folded, got {}\n{}",
+                    inlined, folded, stats.report(), ASTInspector::inspect(*program)));
+            }
+
+            auto context = Context(program);
+            auto tree = std::make_unique<Evaluator>(context)->eval();
+            auto closure_context = Context {};
+            auto closure = ClosureProgram(*program).run(closure_context);
+            auto register_context = Context {};
+            auto registers = RegisterVM(compile_registers(*program), register_context).run();
+
+            for (auto ret : { tree, closure, registers }) {
+                if (ret.kind() != expected.kind() || ret.inspect() != expected.inspect()) {
+                    throw std::runtime_error(std::format(
+                        "expected: {}, got: {}\n{}", expected.inspect(), ret.inspect(), ASTInspector::inspect(*program)));
+                }
+            }
+            std::cout << std::format("PASSED: `{}` = {} ({})", input, tree.inspect(), stats.report()) << std::endl;
+        } catch (std::exception& e) {
+            std::cout << std::format("FAILED: `{}`: {}", input, e.what()) << std::endl;
+            return -1;
+        }
+    }
+
+    // a parameter rebinds the callee's name for everything it calls
+    std::vector<std::string_view> rebound = {
+        "fn h(x) { return x + 1; } fn k(x) { return 100; } fn g(x) { return h(x); } fn caller(h) { return g(1); } return caller(k);",
+        "fn h(x) { return x + 1; } fn k(x) { return 100; } fn g() { return h(1) + 0; } fn caller(h) { return g(); } return caller(k);",
+    };
+    for (auto input : rebound) {
+        try {
+            auto tree_context = Context(std::make_unique<Parser>(input)->parse());
+            auto expected = std::make_unique<Evaluator>(tree_context)->eval();
+
+            std::shared_ptr<Program> program = std::make_unique<Parser>(input)->parse();
+            auto stats = inline_functions(*program);
+            auto context = Context(program);
+            auto tree = std::make_unique<Evaluator>(context)->eval();
+            if (tree.inspect() != expected.inspect() || tree.inspect() != "100") {
+                throw std::runtime_error(std::format(
+                    "expected: {}, got: {}\n{}", expected.inspect(), tree.inspect(), ASTInspector::inspect(*program)));
+            }
+            std::cout << std::format("PASSED: `{}` = {} ({})", input, tree.inspect(), stats.report()) << std::endl;
+        } catch (std::exception& e) {
+            std::cout << std::format("FAILED: `{}`: {}", input, e.what()) << std::endl;
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+int test_eval_cse()
+{
+    // program, expressions, eliminated
+    std::vector<std::tuple<std::string_view, uint32_t, uint32_t>> tests = {
+        { "let price = 3; let qty = 4; let a = price * qty + 1; let b = price * qty > 10; return [a, b];", 1, 1 },
+        { "let x = 2; let a = x * 3; x = 5; let b = x * 3; return [a, b];", 0, 0 },
+        { "let k = 2; fn bump() { k = 10; return 0; } let a = k * k; bump(); let b = k * k; return [a, b];", 0, 0 },
+        { "let a = 1; let b = 2; let c = 3; return [(a + b) * c, (a + b) * c, a + b];", 2, 2 },
+        { "fn area(w, h) { let s = w * h; let t = w * h * 2; return s + t; } let r = 0; for (let i = 0; i < 3; i++) { r = r + area(i, i + 1); } return r;", 1, 1 },
+        { "let name = \"bob\"; let a = name + \"!\" == \"bob!\"; let b = [name + \"!\"]; return [a, b];", 1, 1 },
+        { "let x = 4; let y = 5; if (x * y > 10) { x = 1; } return x * y;", 0, 0 },
+    };
+
+    for (auto& [input, expressions, eliminated] : tests) {
+        try {
+            auto tree_context = Context(std::make_unique<Parser>(input)->parse());
+            auto expected = std::make_unique<Evaluator>(tree_context)->eval();
+
+            std::shared_ptr<Program> program = std::make_unique<Parser>(input)->parse();
+            auto stats = eliminate_common_subexpressions(*program);
+            if (stats.expressions != expressions || stats.eliminated != eliminated) {
+                throw std::runtime_error(std::format("expected {} expressions and {} eliminated, got {}\n{}",
+                    expressions, eliminated, stats.report(), ASTInspector::inspect(*program)));
+            }
+
+            auto context = Context(program);
+            auto tree = std::make_unique<Evaluator>(context)->eval();
+            auto closure_context = Context {};
+            auto closure = ClosureProgram(*program).run(closure_context);
+            auto register_context = Context {};
+            auto registers = RegisterVM(compile_registers(*program), register_context).run();
+
+            for (auto ret : { tree, closure, registers }) {
+                if (ret.kind() != expected.kind() || ret.inspect() != expected.inspect()) {
+                    throw std::runtime_error(std::format(
+                        "expected: {}, got: {}\n{}", expected.inspect(), ret.inspect(), ASTInspector::inspect(*program)));
+                }
+            }
+            std::cout << std::format("PASSED: `{}` = {} ({})", input, tree.inspect(), stats.report()) << std::endl;
+        } catch (std::exception& e) {
+            std::cout << std::format("FAILED: `{}`: {}", input, e.what()) << std::endl;
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+int test_eval_dead_code()
+{
+    // program, statements, branches, bindings, functions
+    std::vector<std::tuple<std::string_view, uint32_t, uint32_t, size_t, size_t>> tests = {
+        { "let a = 1; let unused = a * 2; return a;", 0, 0, 1, 0 },
+        { "fn f(x) { return x + 1; let y = 2; y = y + 1; } return f(2);", 2, 0, 0, 0 },
+        { "let n = 3; if (2 * 2 > 5) { n = 0; } else { n = n + 1; } return n;", 0, 1, 0, 0 },
+        { "fn used() { return 1; } fn helper() { return 2; } fn unused() { return helper(); } return used();", 0, 0, 0, 2 },
+        { "let log = []; let tmp = push(log, 1); tmp = push(log, 2); return len(log);", 0, 0, 1, 0 },
+        { "let s = 0; for (let i = 0; i < 4; i++) { s = s + i; if (i > 1) { break; s = 100; } } 1 + 2; return s;", 2, 0, 0, 0 },
+        { "let t = 0; for (let i = 0; 1 > 2; i++) { t = t + 1; } return t;", 0, 1, 1, 0 },
+        { "let x = 1; x++; return 2;", 0, 0, 0, 0 },
+    };
+
+    for (auto& [input, statements, branches, bindings, functions] : tests) {
+        try {
+            auto tree_context = Context(std::make_unique<Parser>(input)->parse());
+            auto expected = std::make_unique<Evaluator>(tree_context)->eval();
+
+            std::shared_ptr<Program> program = std::make_unique<Parser>(input)->parse();
+            auto stats = eliminate_dead_code(*program);
+            if (stats.statements != statements || stats.branches != branches || stats.bindings.size() != bindings
+                || stats.functions.size() != functions) {
+                throw std::runtime_error(
+                    std::format("expected {} statements, {} branches, {} bindings and {} functions, got {}\n{}",
+                        statements, branches, bindings, functions, stats.report(), ASTInspector::inspect(*program)));
+            }
+
+            auto context = Context(program);
+            auto tree = std::make_unique<Evaluator>(context)->eval();
+            auto closure_context = Context {};
+            auto closure = ClosureProgram(*program).run(closure_context);
+            auto register_context = Context {};
+            auto registers = RegisterVM(compile_registers(*program), register_context).run();
+
+            for (auto ret : { tree, closure, registers }) {
+                if (ret.kind() != expected.kind() || ret.inspect() != expected.inspect()) {
+                    throw std::runtime_error(std::format(
+                        "expected: {}, got: {}\n{}", expected.inspect(), ret.inspect(), ASTInspector::inspect(*program)));
+                }
+            }
+            std::cout << std::format("PASSED: `{}` = {} ({})", input, tree.inspect(), stats.report()) << std::endl;
+        } catch (std::exception& e) {
+            std::cout << std::format("FAILED: `{}`: {}", input, e.what()) << std::endl;
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+int test_eval_specialize()
+{
+    auto host = [](Context& context, bool strict) {
+        context.define_constant("strict", strict);
+        context.define_constant("limit", 100);
+        context.define("amount", 250);
+    };
+
+    // program, substituted, branches
+    std::vector<std::tuple<std::string_view, uint32_t, uint32_t>> tests = {
+        { "if (strict) { return 0; } else if (amount > limit * 2) { return 1; } return 2;", 2, 1 },
+        { "fn over(x) { return x > limit; } return over(amount);", 1, 0 },
+        { "let fee = 0; if (strict) { fee = 10; } return amount + fee;", 1, 1 },
+        { "let limit = 5; return amount > limit;", 0, 0 },
+        { "fn reset() { limit = 0; return 0; } if (strict) { reset(); } return limit;", 1, 1 },
+    };
+
+    for (auto& [input, substituted, branches] : tests) {
+        try {
+            auto tree_context = Context(std::make_unique<Parser>(input)->parse());
+            host(tree_context, false);
+            auto expected = std::make_unique<Evaluator>(tree_context)->eval();
+
+            SpecializationCache cache { std::string(input) };
+            auto program = cache.get(tree_context.constants());
+            if (cache.get(tree_context.constants()) != program || cache.hits() != 1 || cache.size() != 1) {
+                throw std::runtime_error("expected the second lookup to hit the cache");
+            }
+            auto stats = specialize(*std::make_unique<Parser>(input)->parse(), tree_context.constants());
+            if (stats.substituted != substituted || stats.dead.branches != branches) {
+                throw std::runtime_error(std::format("expected {} substituted and {} branches, got {}\n{}",
+                    substituted, branches, stats.report(), ASTInspector::inspect(*program)));
+            }
+
+            auto context = Context(program);
+            host(context, false);
+            auto tree = std::make_unique<Evaluator>(context)->eval();
+            auto closure_context = Context {};
+            host(closure_context, false);
+            auto closure = ClosureProgram(*program).run(closure_context);
+            auto register_context = Context {};
+            host(register_context, false);
+            auto registers = RegisterVM(compile_registers(*program), register_context).run();
+
+            for (auto ret : { tree, closure, registers }) {
+                if (ret.kind() != expected.kind() || ret.inspect() != expected.inspect()) {
+                    throw std::runtime_error(std::format(
+                        "expected: {}, got: {}\n{}", expected.inspect(), ret.inspect(), ASTInspector::inspect(*program)));
+                }
+            }
+
+            // other constant values get their own program
+            auto strict_context = Context {};
+            host(strict_context, true);
+            if (cache.get(strict_context.constants()) == program || cache.size() != 2) {
+                throw std::runtime_error("expected a new program for new constant values");
+            }
+            std::cout << std::format("PASSED: `{}` = {} ({})", input, tree.inspect(), stats.report()) << std::endl;
+        } catch (std::exception& e) {
+            std::cout << std::format("FAILED: `{}`: {}", input, e.what()) << std::endl;
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+int test_eval_dag()
+{
+    std::vector<std::string_view> rules = {
+        "price * qty > 100",
+        "price * qty - discount > 50",
+        "r.kind == \"bulk\"",
+        "(r.kind == \"bulk\") == (price * qty > 100)",
+        "(-price) < 0",
+        "r.tags[0] == \"a\"",
+        "len(r.tags) > 1",
+        "price * qty / 0.5",
+    };
+    std::vector<std::string_view> inputs = {
+        "let r = {kind: \"bulk\", tags: [\"a\", \"b\"]};",
+        "let r = {kind: \"retail\", tags: [\"c\"]};",
+    };
+
+    try {
+        ExpressionDAG dag;
+        for (auto& rule : rules) {
+            dag.add(std::make_unique<Parser>(rule)->parse_expression());
+        }
+        if (dag.nodes() >= dag.references()) {
+            throw std::runtime_error("nothing shared: " + dag.report());
+        }
+
+        for (size_t i = 0; i < inputs.size(); ++i) {
+            auto context = Context(std::make_unique<Parser>(inputs[i])->parse());
+            std::make_unique<Evaluator>(context)->eval();
+            context.define("price", int(10 + i * 20));
+            context.define("qty", 12);
+            context.define("discount", 7.5);
+
+            auto results = dag.evaluate(context);
+            for (size_t j = 0; j < rules.size(); ++j) {
+                auto expected = Evaluator(context).eval(*std::make_unique<Parser>(rules[j])->parse_expression());
+                if (results[j].kind() != expected.kind() || results[j].inspect() != expected.inspect()) {
+                    throw std::runtime_error(std::format("`{}`: expected: {}, got: {}",
+                        rules[j], expected.inspect(), results[j].inspect()));
+                }
+            }
+        }
+        std::cout << std::format("PASSED: rule set DAG ({})", dag.report()) << std::endl;
+    } catch (std::exception& e) {
+        std::cout << std::format("FAILED: rule set DAG: {}", e.what()) << std::endl;
+        return -1;
+    }
+
+    return 0;
+}
+
+int test_eval_memo()
+{
+    // program, pure functions, hits
+    std::vector<std::tuple<std::string_view, std::vector<std::string>, uint64_t>> tests = {
+        { "fn fib(n) { if (n < 2) { return n; } return fib(n - 1) + fib(n - 2); } return fib(60);", { "fib" }, 58 },
+        { "fn tariff(w, zone) { let rate = 2; for (let i = 0; i < zone; i++) { rate = rate * 2; } return w * rate; } "
+          "let s = 0; for (let i = 0; i < 100; i++) { s = s + tariff(i % 5, 3); } return s;",
+            { "tariff" }, 95 },
+        { "let scale = 3; fn scaled(x) { return x * scale; } fn twice(x) { return scaled(x) * 2; } return twice(4);", {}, 0 },
+        { "fn greet(name) { return \"hi \" + name; } fn shout(name) { return greet(name) + \"!\"; } "
+          "return [shout(\"a\"), shout(\"a\"), shout(\"b\")];",
+            { "greet", "shout" }, 1 },
+        { "fn make(n) { return [n]; } fn log(a) { push(a, 1); return len(a); } let a = make(1); return [log(a), log(a)];",
+            { "make" }, 0 },
+        { "fn odd(n) { if (n == 0) { return false; } return even(n - 1); } fn even(n) { if (n == 0) { return true; } "
+          "return odd(n - 1); } fn f(x) { let even = x; return even; } return [odd(7), f(2)];",
+            { "f" }, 0 },
+    };
+
+    for (auto& [input, expected_pure, hits] : tests) {
+        try {
+            std::string expected;
+            if (input.find("fib(60)") != std::string_view::npos) {
+                expected = "1548008755920";
+            } else {
+                auto plain_context = Context(std::make_unique<Parser>(input)->parse());
+                expected = std::make_unique<Evaluator>(plain_context)->eval().inspect();
+            }
+
+            std::shared_ptr<Program> program = std::make_unique<Parser>(input)->parse();
+            auto pure = pure_functions(*program);
+            if (pure != std::unordered_set<std::string>(expected_pure.begin(), expected_pure.end())) {
+                std::string names;
+                for (auto& name : pure) {
+                    names += " " + name;
+                }
+                throw std::runtime_error("unexpected pure functions:" + names);
+            }
+
+            MemoCache memo(*program);
+            auto context = Context(program);
+            auto evaluator = Evaluator(context);
+            evaluator.set_memo(&memo);
+            auto ret = evaluator.eval();
+            if (ret.inspect() != expected) {
+                throw std::runtime_error(std::format("expected: {}, got: {}", expected, ret.inspect()));
+            }
+            if (memo.stats().hits != hits) {
+                throw std::runtime_error(std::format("expected {} hits, got {}", hits, memo.report()));
+            }
+            std::cout << std::format("PASSED: `{}` = {} ({})", input, ret.inspect(), memo.report()) << std::endl;
+        } catch (std::exception& e) {
+            std::cout << std::format("FAILED: `{}`: {}", input, e.what()) << std::endl;
+            return -1;
+        }
+    }
+
+    // a bounded cache still answers correctly, just more slowly
+    auto input = "fn fib(n) { if (n < 2) { return n; } return fib(n - 1) + fib(n - 2); } "
+                 "let s = 0; for (let i = 0; i < 30; i++) { s = s + fib(i); } return s;";
+    try {
+        std::shared_ptr<Program> program = std::make_unique<Parser>(input)->parse();
+        MemoCache memo(*program, 8);
+        auto context = Context(program);
+        auto evaluator = Evaluator(context);
+        evaluator.set_memo(&memo);
+        auto ret = evaluator.eval();
+        if (ret.inspect() != "1346268" || memo.size() != 8 || memo.stats().evictions == 0) {
+            throw std::runtime_error(std::format("got {} ({})", ret.inspect(), memo.report()));
+        }
+        std::cout << std::format("PASSED: bounded memo ({})", memo.report()) << std::endl;
+    } catch (std::exception& e) {
+        std::cout << std::format("FAILED: bounded memo: {}", e.what()) << std::endl;
+        return -1;
+    }
+
+    return 0;
+}
+
+int test_eval_strings()
+{
+    std::string line = "a line of a message built piece by piece; ";
+    std::string repeated;
+    for (int i = 0; i < 30; ++i) {
+        repeated += line;
+    }
+
+    std::vector<std::tuple<std::string, std::string>> tests = {
+        { "let s = \"\"; for (let i = 0; i < 20000; i++) { s = s + \"piece \"; } return len(s);", "120000" },
+        { std::format("let s = \"\"; for (let i = 0; i < 30; i++) {{ s = s + \"{}\"; }} return s == \"{}\";", line,
+              repeated),
+            "true" },
+        { std::format("let a = \"{}\" + \"{}\"; let b = a + \"1\"; let c = a + \"2\"; return [len(b), c > b, a + a == b];",
+              line, line),
+            "[85, true, false]" },
+        { "let s = \"\"; for (let i = 0; i < 100; i++) { s = \"<\" + s + \">\"; } return [len(s), s < \"<<>\"];",
+            "[200, true]" },
+    };
+
+    for (auto& [input, expected] : tests) {
+        try {
+            auto start = std::chrono::steady_clock::now();
+            auto context = Context(std::make_unique<Parser>(input)->parse());
+            auto tree = std::make_unique<Evaluator>(context)->eval();
+            auto elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start);
+
+            std::shared_ptr<Program> program = std::make_unique<Parser>(input)->parse();
+            auto closure_context = Context {};
+            auto closure = ClosureProgram(*program).run(closure_context);
+            auto register_context = Context {};
+            auto registers = RegisterVM(compile_registers(*program), register_context).run();
+
+            for (auto ret : { tree, closure, registers }) {
+                if (ret.inspect() != expected) {
+                    throw std::runtime_error(std::format("expected: {}, got: {}", expected, ret.inspect()));
+                }
+            }
+            std::cout << std::format("PASSED: `{}...` = {} ({:.2f} ms)", input.substr(0, 60), expected, elapsed.count())
+                      << std::endl;
+        } catch (std::exception& e) {
+            std::cout << std::format("FAILED: `{}`: {}", input, e.what()) << std::endl;
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+int test_eval_string_constants()
+{
+    try {
+        // every evaluation of a literal returns the same String
+        auto literal = std::make_unique<Parser>("\"GET\"")->parse_expression();
+        Context empty;
+        auto first = Evaluator(empty).eval(*literal);
+        auto second = Evaluator(empty).eval(*literal);
+        if (first.get() != second.get()) {
+            throw std::runtime_error("literal copied on evaluation");
+        }
+
+        // and the parser shares one String between literals of the same text
+        auto pair = std::make_unique<Parser>("\"a\\tb\" == \"a\\tb\"")->parse_expression();
+        auto& binary = dynamic_cast<BinaryExpression&>(*pair);
+        auto& lhs = dynamic_cast<StringLiteral&>(binary.left());
+        auto& rhs = dynamic_cast<StringLiteral&>(binary.right());
+        if (lhs.constant() != rhs.constant() || lhs.value() != "a\tb") {
+            throw std::runtime_error("literals of the same text not shared");
+        }
+
+        // host strings are borrowed until something needs a std::string
+        std::string buffer = "/api/orders/42";
+        auto input = "if (path == \"/api/orders/42\") { return [len(path), path > \"/api\", path + \"?v=1\"]; } return false;";
+        auto program = std::shared_ptr<Program>(std::make_unique<Parser>(input)->parse());
+        auto context = Context(program);
+        context.define("path", String::borrow(buffer));
+        auto tree = Evaluator(context).eval();
+        auto closure_context = Context {};
+        closure_context.define("path", String::borrow(buffer));
+        auto closure = ClosureProgram(*program).run(closure_context);
+        for (auto ret : { tree, closure }) {
+            if (ret.inspect() != "[14, true, \"/api/orders/42?v=1\"]") {
+                throw std::runtime_error("got " + ret.inspect());
+            }
+        }
+        auto path = context.get_variable("path");
+        if (!static_cast<String*>(path.get())->borrowed()) {
+            throw std::runtime_error("borrowed string copied by comparison or len");
+        }
+        path.as_string();
+        if (static_cast<String*>(path.get())->borrowed()) {
+            throw std::runtime_error("expected as_string() to copy a borrowed string");
+        }
+        std::cout << std::format("PASSED: string constants and borrowed strings = {}", tree.inspect()) << std::endl;
+    } catch (std::exception& e) {
+        std::cout << std::format("FAILED: string constants: {}", e.what()) << std::endl;
+        return -1;
+    }
+
+    return 0;
+}
+
+int test_eval_string_builtins()
+{
+    std::vector<std::tuple<std::string_view, std::string_view>> tests = {
+        { "return [find(\"GET /api/orders\", \"/api\"), find(\"abc\", \"d\"), find(\"abc\", \"\")];", "[4, -1, 0]" },
+        { "return [contains(\"application/json; charset=utf-8\", \"json\"), contains(\"text/html\", \"json\")];",
+            "[true, false]" },
+        { "let p = \"/api/v2/orders/42\"; return [starts_with(p, \"/api/\"), ends_with(p, \"/42\"), ends_with(p, \"/4\")];",
+            "[true, true, false]" },
+        { "return substring(\"customer-0042-priority\", 9, 13) + \"|\" + substring(\"abc\", 3, 3);", "\"0042|\"" },
+        { "return [trim(\"  \\tpadded value \\n\"), trim(\"   \"), trim(\"tight\")];", "[\"padded value\", \"\", \"tight\"]" },
+        { "let parts = split(\"a,b,,c\", \",\"); return [len(parts), parts[2], parts[3]];", "[4, \"\", \"c\"]" },
+        { "return split(\"key => value => more\", \" => \");", "[\"key\", \"value\", \"more\"]" },
+        { "return [lower(\"MiXeD 42\"), upper(\"MiXeD 42\")];", "[\"mixed 42\", \"MIXED 42\"]" },
+        { "return [replace(\"a-b-c\", \"-\", \" + \"), replace(\"none\", \"x\", \"y\")];", "[\"a + b + c\", \"none\"]" },
+        { "let s = \"\"; for (let i = 0; i < 40; i++) { s = s + \"segment-\"; } s = s + \"needle\"; "
+          "return [find(s, \"needle\"), contains(s, \"segment-needle\"), len(split(s, \"-\"))];",
+            "[320, true, 41]" },
+    };
+
+    for (auto& [input, expected] : tests) {
+        try {
+            std::shared_ptr<Program> program = std::make_unique<Parser>(input)->parse();
+            auto context = Context(program);
+            auto tree = std::make_unique<Evaluator>(context)->eval();
+            auto closure_context = Context {};
+            auto closure = ClosureProgram(*program).run(closure_context);
+            auto register_context = Context {};
+            auto registers = RegisterVM(compile_registers(*program), register_context).run();
+
+            for (auto ret : { tree, closure, registers }) {
+                if (ret.inspect() != expected) {
+                    throw std::runtime_error(std::format("expected: {}, got: {}", expected, ret.inspect()));
+                }
+            }
+            std::cout << std::format("PASSED: `{}` = {}", input, tree.inspect()) << std::endl;
+        } catch (std::exception& e) {
+            std::cout << std::format("FAILED: `{}`: {}", input, e.what()) << std::endl;
+            return -1;
+        }
+    }
+
+    // the vector search against std::string_view at every alignment and length
+    try {
+        std::string text;
+        for (int i = 0; i < 300; ++i) {
+            text.push_back(char('a' + (i * 7 + i / 13) % 5));
+        }
+        for (size_t start = 0; start < 40; ++start) {
+            for (size_t length = 1; length < 6; ++length) {
+                for (size_t at : { size_t(0), size_t(31), size_t(150), text.size() - length }) {
+                    auto needle = text.substr(at, length);
+                    auto haystack = std::string_view(text).substr(start);
+                    auto expected = haystack.find(needle);
+                    auto found = find_bytes(haystack.data(), haystack.size(), needle.data(), needle.size());
+                    if (found != (expected == std::string_view::npos ? haystack.size() : expected)) {
+                        throw std::runtime_error(std::format("`{}` from {}: expected {}, got {}", needle, start,
+                            expected, found));
+                    }
+                }
+            }
+        }
+        std::cout << "PASSED: find_bytes matches std::string_view::find" << std::endl;
+
+        // long slices share the characters of the string they were taken from
+        auto expr = std::make_unique<Parser>("trim(\"   a value long enough to be shared   \")")->parse_expression();
+        Context empty;
+        auto trimmed = Evaluator(empty).eval(*expr);
+        if (!static_cast<String*>(trimmed.get())->borrowed() || trimmed.inspect() != "\"a value long enough to be shared\"") {
+            throw std::runtime_error("expected trim() to share the characters");
+        }
+    } catch (std::exception& e) {
+        std::cout << std::format("FAILED: find_bytes: {}", e.what()) << std::endl;
+        return -1;
+    }
+
+    return 0;
+}
+
+int test_eval_sheet()
+{
+    try {
+        Sheet sheet;
+        sheet.input("price", 3);
+        sheet.input("qty", 4);
+        sheet.input("rate", 0.5);
+        auto program = std::make_unique<Parser>(
+            "let total = price * qty; let tax = total * rate; let due = total + tax; let label = [qty, \"items\"];")
+                           ->parse();
+        sheet.load(*program);
+
+        auto check = [&sheet](std::string_view name, std::string_view expected) {
+            auto value = sheet.get(std::string(name));
+            if (value.inspect() != expected) {
+                throw std::runtime_error(std::format("{}: expected: {}, got: {}", name, expected, value.inspect()));
+            }
+        };
+        auto expect = [&sheet](uint64_t evaluations) {
+            if (sheet.evaluations() != evaluations) {
+                throw std::runtime_error(
+                    std::format("expected {} evaluations, got {}", evaluations, sheet.evaluations()));
+            }
+        };
+
+        check("due", "18");
+        expect(3);
+        if (sheet.recompute() != 1) {
+            throw std::runtime_error("expected only label to be left");
+        }
+        check("due", "18");
+        expect(4);
+
+        // rate only reaches tax and due
+        sheet.input("rate", 1);
+        if (sheet.stale() != 2 || sheet.recompute() != 2) {
+            throw std::runtime_error("expected only tax and due to be recomputed");
+        }
+        check("due", "24");
+        check("label", "[4, \"items\"]");
+        expect(6);
+
+        sheet.formula("tax", std::make_unique<Parser>("qty")->parse_expression());
+        check("due", "16");
+        expect(8);
+
+        sheet.formula("qty", std::make_unique<Parser>("due - 10")->parse_expression());
+        try {
+            sheet.get("due");
+            throw std::logic_error("expected a cycle");
+        } catch (std::runtime_error&) {
+        }
+
+        // a formula that writes its inputs would leave dependents stale
+        Sheet writes;
+        writes.input("n", 1);
+        for (auto source : { "n = 5", "n++ + 1", "[n--]", "push(a, n)", "len(a) + push(a, 1)" }) {
+            try {
+                writes.formula("w", std::make_unique<Parser>(source)->parse_expression());
+                throw std::logic_error(std::format("expected `{}` to be rejected", source));
+            } catch (std::runtime_error&) {
+            }
+        }
+        try {
+            auto program = std::make_unique<Parser>("let a = n; let b = (n = a + 1);")->parse();
+            writes.load(*program);
+            throw std::logic_error("expected an assignment to be rejected");
+        } catch (std::runtime_error&) {
+        }
+
+        // a chain of formulas where each reads the previous one and an input
+        Sheet chain;
+        const int cells = 2000;
+        for (int i = 0; i < cells; ++i) {
+            chain.input(std::format("x{}", i), i);
+            auto source = i == 0 ? std::string("x0") : std::format("c{} + x{}", i - 1, i);
+            chain.formula(std::format("c{}", i), std::make_unique<Parser>(source)->parse_expression());
+        }
+        if (chain.recompute() != cells || chain.get(std::format("c{}", cells - 1)).inspect() != "1999000") {
+            throw std::runtime_error("wrong chain total");
+        }
+        chain.input(std::format("x{}", cells - 10), 0);
+        if (chain.recompute() != 10 || chain.get(std::format("c{}", cells - 1)).inspect() != "1997010") {
+            throw std::runtime_error("expected the last 10 cells to be recomputed");
+        }
+
+        // reading the end of a long chain does not recurse once per cell
+        Sheet deep;
+        const int depth = 100000;
+        deep.input("a0", 0);
+        for (int i = 1; i <= depth; ++i) {
+            deep.formula(std::format("a{}", i), std::make_unique<Parser>(std::format("a{} + 1", i - 1))->parse_expression());
+        }
+        if (deep.get(std::format("a{}", depth)).as_integer() != depth || deep.stale() != 0) {
+            throw std::runtime_error("wrong value at the end of a long chain");
+        }
+        std::cout << std::format("PASSED: sheet ({} evaluations, chain of {} with {} evaluations)", sheet.evaluations(),
+                         cells, chain.evaluations())
+                  << std::endl;
+    } catch (std::exception& e) {
+        std::cout << std::format("FAILED: sheet: {}", e.what()) << std::endl;
+        return -1;
+    }
+
+    return 0;
+}
+
+int test_eval_jit()
+{
+    std::vector<std::string_view> tests = {
+        "fn fib(n) { if (n <= 2) { return 1; } return fib(n - 1) + fib(n - 2); } return fib(20);",
+        "fn scale(r, n) { let s = 0.0; for (let i = 0; i < n; i++) { s = s + r * 1.5; } return s / n; } let t = 0.0; for (let i = 0; i < 300; i++) { t = t + scale(i, 4); } return t;",
+        "fn sign(x) { if (x < 0) { return -1; } if (x == 0) { return 0; } return 1; } let s = 0; for (let i = -150; i < 150; i++) { s = s + sign(i) + sign(i * 0.5); } return s;",
+        "fn odd(n) { return n % 2 == 1; } fn count(n) { let c = 0; for (let i = 0; i < n; i++) { if (!odd(i)) { continue; } c++; } return c; } let s = 0; for (let i = 0; i < 300; i++) { s = s + count(i); } return s;",
+        "fn half(n) { if (n < 5) { return n; } } let s = 0; for (let i = 0; i < 300; i++) { let r = half(i % 10); if (i % 10 < 5) { s = s + r; } } return s;",
+        "fn greet(n) { return \"hi\"; } let s = \"\"; for (let i = 0; i < 300; i++) { s = greet(i); } return s;",
+        "fn g(x) { return h(x); } fn h(x) { return x + 1; } fn k(x) { return x * 100; } fn caller() { let h = k; let s = 0; for (let i = 0; i < 10; i++) { s = s + g(i); } return s; } return caller();",
+        "fn g(x) { return h(x); } fn h(x) { return x + 1; } fn k(x) { return x * 100; } fn caller(h) { let s = 0; for (let i = 0; i < 10; i++) { s = s + g(i); } return s; } return caller(k);",
+    };
+
+    for (auto& input : tests) {
+        try {
+            auto tree_context = Context(std::make_unique<Parser>(input)->parse());
+            auto expected = std::make_unique<Evaluator>(tree_context)->eval();
+
+            std::shared_ptr<Program> program = std::make_unique<Parser>(input)->parse();
+            auto context = Context(program);
+            auto jit = Jit(program, 2);
+            auto evaluator = Evaluator(context);
+            evaluator.set_jit(&jit);
+            auto ret = evaluator.eval();
+
+            if (ret.kind() != expected.kind() || ret.inspect() != expected.inspect()) {
+                throw std::runtime_error(std::format(
+                    "expected: {}, got: {}", expected.inspect(), ret.inspect()));
+            }
+
+            auto& stats = jit.stats();
+            if (Jit::supported() && input.find("greet") == std::string_view::npos
+                && (stats.compiled == 0 || stats.native_calls == 0)) {
+                throw std::runtime_error("nothing ran natively:\n" + jit.report());
+            }
+            if (Jit::supported() && input.find("half") != std::string_view::npos && stats.deopts == 0) {
+                throw std::runtime_error("expected deopts:\n" + jit.report());
+            }
+            if (input.find("greet") != std::string_view::npos && stats.compiled != 0) {
+                throw std::runtime_error("compiled a string function:\n" + jit.report());
+            }
+            std::cout << std::format("PASSED: `{}` = {}", input, ret.inspect()) << std::endl;
+            std::cout << jit.report();
+        } catch (std::exception& e) {
+            std::cout << std::format("FAILED: `{}`: {}", input, e.what()) << std::endl;
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+int test_eval_binary_caches()
+{
+    auto input = "fn add(a, b) { return a + b; } let s = 0; for (let i = 0; i < 100; i++) { s = add(s, i); } return [s, add(1.5, 2), add(\"a\", \"b\")];";
+
+    try {
+        std::shared_ptr<Program> program = std::make_unique<Parser>(input)->parse();
+        auto context = Context(program);
+        auto ret = std::make_unique<Evaluator>(context)->eval();
+        if (ret.inspect() != "[4950, 3.5, \"ab\"]") {
+            throw std::runtime_error(std::format("got {}", ret.inspect()));
+        }
+
+        auto caches = Profiler::inline_caches(*program);
+        auto add = std::find_if(caches.begin(), caches.end(), [](auto& cache) {
+            return cache.label.starts_with("BinaryExpr(+) [Integer, Integer | Float, Integer");
+        });
+        if (add == caches.end() || add->hits != 99 || add->misses != 3) {
+            throw std::runtime_error("polymorphic site not cached:\n" + Profiler::cache_report(*program));
+        }
+
+        auto less = std::find_if(caches.begin(), caches.end(), [](auto& cache) {
+            return cache.label == "BinaryExpr(<) [Integer, Integer]";
+        });
+        if (less == caches.end() || less->hit_rate() < 0.99) {
+            throw std::runtime_error("monomorphic site not cached:\n" + Profiler::cache_report(*program));
+        }
+
+        std::cout << "PASSED: binary operator caches" << std::endl
+                  << Profiler::cache_report(*program);
+    } catch (std::exception& e) {
+        std::cout << std::format("FAILED: {}", e.what()) << std::endl;
+        return -1;
+    }
+
+    return 0;
+}
+
+int test_eval_profile()
+{
+#ifdef EXPR_PROFILE
+    auto input = "fn fib(n) { if (n <= 2) { return 1; } return fib(n - 1) + fib(n - 2); } return fib(15);";
+
+    try {
+        auto parse = std::make_unique<Parser>(input);
+
+        auto program = parse->parse();
+
+        auto context = Context(std::move(program));
+
+        Profiler profiler;
+        auto evaluator = std::make_unique<Evaluator>(context);
+        evaluator->set_profiler(&profiler);
+
+        auto ret = evaluator->eval();
+
+        auto functions = profiler.functions();
+        if (functions.size() != 1 || functions[0].count != 1219) {
+            throw std::runtime_error(std::format("expected 1219 calls of fib, got {}",
+                functions.empty() ? 0 : functions[0].count));
+        }
+
+        std::cout << profiler.flat_report(10) << std::endl;
+        std::cout << profiler.folded_stacks() << std::endl;
+
+        std::cout << std::format("PASSED: `{}` = {}", input, ret.inspect())
+                  << std::endl;
+    } catch (std::exception& e) {
+        std::cout << std::format("FAILED: {}", e.what()) << std::endl;
+        return -1;
+    }
+#endif
+
+    return 0;
+}
+
+int test_eval_allocation()
+{
+    auto input = "let sum = 0; for (let i = 0; i < 100; i++) { sum = sum + i; } return sum;";
+
+    try {
+        AllocationTracker parse_tracker;
+        std::unique_ptr<Program> program;
+        {
+            AllocationScope scope(parse_tracker);
+            program = std::make_unique<Parser>(input)->parse();
+        }
+
+        if (parse_tracker.nodes(ASTNode::Kind::ForStmt).objects != 1) {
+            throw std::runtime_error("expected one ForStmt allocation");
+        }
+
+        std::shared_ptr<Program> shared = std::move(program);
+
+        AllocationTracker eval_tracker;
+        {
+            auto context = Context(shared);
+            AllocationScope scope(eval_tracker);
+            std::make_unique<Evaluator>(context)->eval();
+        }
+
+        if (eval_tracker.values(ValueKind::Integer).objects == 0) {
+            throw std::runtime_error("expected Integer allocations");
+        }
+
+        std::cout << parse_tracker.report() << std::endl;
+        std::cout << eval_tracker.report() << std::endl;
+
+        // the limit applies to live bytes, so a long loop over a constant
+        // working set runs to completion
+        if (eval_tracker.peak() >= eval_tracker.total().bytes / 4) {
+            throw std::runtime_error(std::format("expected a small peak, got {} of {} bytes",
+                eval_tracker.peak(), eval_tracker.total().bytes));
+        }
+
+        AllocationTracker bounded(4096);
+        {
+            auto loop = std::shared_ptr<Program>(
+                Parser("let sum = 0; for (let i = 0; i < 100000; i++) { sum = sum + i; } return sum;").parse());
+            auto context = Context(loop);
+            AllocationScope scope(bounded);
+            auto result = std::make_unique<Evaluator>(context)->eval();
+            if (result.as_integer() != 4999950000) {
+                throw std::runtime_error("unexpected sum under a memory limit");
+            }
+        }
+
+        auto growing = "let a = []; for (let i = 0; i < 100000; i++) { push(a, [i]); } return len(a);";
+        AllocationTracker limited(64 * 1024);
+        try {
+            auto context = Context(std::shared_ptr<Program>(Parser(growing).parse()));
+            AllocationScope scope(limited);
+            std::make_unique<Evaluator>(context)->eval();
+            throw std::runtime_error("expected memory limit to be exceeded");
+        } catch (MemoryLimitExceeded& e) {
+            std::cout << std::format("PASSED: `{}` stopped with: {}", growing, e.what())
+                      << std::endl;
+        }
+
+        // a context stays usable after a caught limit error
+        auto filling = "fn fill(n) { let x = []; for (let i = 0; i < n; i++) { push(x, [i]); } return len(x); } return fill(100000);";
+        auto reused = Context(std::shared_ptr<Program>(Parser(filling).parse()));
+        AllocationTracker small(64 * 1024);
+        try {
+            AllocationScope scope(small);
+            std::make_unique<Evaluator>(reused)->eval();
+            throw std::runtime_error("expected memory limit to be exceeded");
+        } catch (MemoryLimitExceeded&) {
+        }
+        if (reused.stack().depth() != 1) {
+            throw std::runtime_error(std::format("expected 1 frame after the error, got {}", reused.stack().depth()));
+        }
+        try {
+            auto stale = std::make_unique<Parser>("x")->parse_expression();
+            std::make_unique<Evaluator>(reused)->eval(*stale);
+            throw std::logic_error("expected `x` to be out of scope");
+        } catch (std::runtime_error&) {
+        }
+        auto again = std::make_unique<Parser>("fill(3)")->parse_expression();
+        if (std::make_unique<Evaluator>(reused)->eval(*again).as_integer() != 3) {
+            throw std::runtime_error("unexpected result when reusing the context");
+        }
+        std::cout << std::format("PASSED: `{}` leaves the context clean", filling) << std::endl;
+        // a concatenation is charged its length before it is flattened
+        auto doubling = "let s = \"" + std::string(70, 'x') + "\"; for (let i = 0; i < 23; i++) { s = s + s; } return s == \"x\";";
+        AllocationTracker capped(1024 * 1024);
+        try {
+            auto context = Context(std::shared_ptr<Program>(Parser(doubling).parse()));
+            AllocationScope scope(capped);
+            std::make_unique<Evaluator>(context)->eval();
+            throw std::runtime_error("expected memory limit to be exceeded");
+        } catch (MemoryLimitExceeded& e) {
+            if (capped.peak() > 2 * 1024 * 1024) {
+                throw std::runtime_error(std::format("expected the rope to stop near the limit, peaked at {}", capped.peak()));
+            }
+            std::cout << std::format("PASSED: doubling a string stopped with: {}", e.what()) << std::endl;
+        }
+
+        // flattening one built outside the limit is charged before the copy
+        Value rope(std::string(70, 'x'));
+        for (int i = 0; i < 12; i++) {
+            rope = rope.obj()->add(rope);
+        }
+        AllocationTracker flatten(64 * 1024);
+        try {
+            AllocationScope scope(flatten);
+            std::static_pointer_cast<String>(rope.obj())->value();
+            throw std::runtime_error("expected flattening to exceed the memory limit");
+        } catch (MemoryLimitExceeded& e) {
+            if (std::static_pointer_cast<String>(rope.obj())->flat()) {
+                throw std::runtime_error("expected the rope to stay unflattened");
+            }
+            std::cout << std::format("PASSED: flattening a rope stopped with: {}", e.what()) << std::endl;
+        }
+    } catch (std::exception& e) {
+        std::cout << std::format("FAILED: {}", e.what()) << std::endl;
+        return -1;
+    }
+
+    return 0;
+}
+
+int main(int argc, const char* argv[])
+{
+
+    std::cout << "Testing evaluator..." << std::endl;
+
+    test_eval_expression();
+
+    test_eval_program();
+
+    test_eval_environment();
+
+    test_eval_array();
+
+    test_eval_object();
+
+    test_eval_binding();
+
+    test_eval_flat();
+
+    test_eval_bytecode();
+
+    test_eval_registers();
+
+    test_eval_jit();
+
+    test_eval_closures();
+
+    test_eval_binary_caches();
+
+    test_eval_types();
+
+    test_eval_loops();
+
+    test_eval_inlining();
+
+    test_eval_cse();
+
+    test_eval_dag();
+
+    test_eval_dead_code();
+
+    test_eval_specialize();
+
+    test_eval_strings();
+
+    test_eval_string_constants();
+
+    test_eval_string_builtins();
+
+    test_eval_sheet();
+
+    test_eval_memo();
+
+    test_eval_profile();
+
+    test_eval_allocation();
 
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,205 @@
+#include "eval.h"
+#include "flat.h"
+#include "image.h"
+#include "parser.h"
+
+#include <chrono>
+#include <cstdio>
+#include <format>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+const std::vector<std::string_view> PROGRAMS = {
+    "return (1 + 2) * 3 / 4.0;",
+    "let sum = 0; for (let i = 0; i < 10; i++) { if (i % 2 == 1) { sum = sum + i; } } return sum;",
+    "fn fib(n) { if (n <= 0) { return 0; } if (n <= 2) { return 1; } return fib(n - 1) + fib(n - 2); } return fib(15);",
+    "fn norm(p) { return p.x * p.x + p.y * p.y; } let p = {x: 3, y: 4}; p.y = 5; return norm(p);",
+    "let a = [1, 2, 3]; a[0] = 10; return a[0] + len(a) + sum(a);",
+    "let s = \"it's \\\"quoted\\\"\"; return s + \"!\";",
+    "let x = 0; for (;;) { x++; if (x >= 5) { break; } } return -x;",
+};
+
+int test_image_roundtrip()
+{
+    auto path = std::string("TestImage.img");
+
+    for (auto& input : PROGRAMS) {
+        try {
+            std::shared_ptr<Program> program = std::make_unique<Parser>(input)->parse();
+
+            auto tree_context = Context(program);
+            auto expected = std::make_unique<Evaluator>(tree_context)->eval();
+
+            auto buffer = flatten(*program);
+            write_image(buffer.view(), path);
+
+            ProgramImage image(path);
+            auto context = Context {};
+            auto ret = FlatEvaluator(image.program(), context).eval();
+
+            if (ret.kind() != expected.kind() || ret.obj()->compare(expected) != Comparison::Equal) {
+                throw std::runtime_error(std::format(
+                    "expected: {}, got: {}", expected.inspect(), ret.inspect()));
+            }
+            std::cout << std::format("PASSED: `{}` = {}", input, ret.inspect())
+                      << std::endl;
+        } catch (std::exception& e) {
+            std::cout << std::format("FAILED: {}", e.what()) << std::endl;
+            std::remove(path.c_str());
+            return -1;
+        }
+    }
+
+    std::remove(path.c_str());
+    return 0;
+}
+
+int test_image_rejects()
+{
+    auto path = std::string("TestImage.img");
+
+    try {
+        std::shared_ptr<Program> program = std::make_unique<Parser>(PROGRAMS[2])->parse();
+        auto buffer = flatten(*program);
+        write_image(buffer.view(), path);
+
+        std::string bytes;
+        {
+            std::ifstream in(path, std::ios::binary);
+            bytes.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+        }
+
+        auto expect_error = [&](std::string data, std::string_view what) {
+            std::ofstream(path, std::ios::binary | std::ios::trunc) << data;
+            try {
+                ProgramImage image(path);
+            } catch (ImageError& e) {
+                std::cout << std::format("PASSED: {} rejected with: {}", what, e.what()) << std::endl;
+                return;
+            }
+            throw std::runtime_error(std::format("{} was not rejected", what));
+        };
+
+        auto corrupted = bytes;
+        corrupted[sizeof(ImageHeader) + 20] ^= 1;
+        expect_error(corrupted, "a flipped bit");
+
+        auto versioned = bytes;
+        versioned[8] = char(IMAGE_VERSION + 1);
+        expect_error(versioned, "a newer version");
+
+        expect_error(bytes.substr(0, bytes.size() - 8), "a truncated image");
+
+        // images with a valid checksum but indices past their sections
+        auto expect_invalid = [&](FlatProgram view, std::string_view what) {
+            std::stringstream out;
+            write_image(view, out);
+            expect_error(out.str(), what);
+        };
+
+        auto view = buffer.view();
+        std::vector<FlatNode> nodes(view.nodes.begin(), view.nodes.end());
+        for (auto& node : nodes) {
+            if (node.node_kind() == ASTNode::Kind::BinaryExpr) {
+                node.a = uint32_t(nodes.size() + 100);
+                break;
+            }
+        }
+        auto crafted = view;
+        crafted.nodes = nodes;
+        expect_invalid(crafted, "a node child out of range");
+
+        nodes.assign(view.nodes.begin(), view.nodes.end());
+        for (uint32_t i = 0; i < nodes.size(); ++i) {
+            if (nodes[i].node_kind() == ASTNode::Kind::ReturnStmt) {
+                nodes[i].a = i;
+                break;
+            }
+        }
+        crafted.nodes = nodes;
+        expect_invalid(crafted, "a node referring to itself");
+
+        std::vector<FlatFunction> functions(view.functions.begin(), view.functions.end());
+        functions[0].body = uint32_t(view.nodes.size());
+        crafted = view;
+        crafted.functions = functions;
+        expect_invalid(crafted, "a function body out of range");
+
+        functions.assign(view.functions.begin(), view.functions.end());
+        functions[0].param_count = uint32_t(view.lists.size() + 1);
+        crafted.functions = functions;
+        expect_invalid(crafted, "a function parameter list out of range");
+    } catch (std::exception& e) {
+        std::cout << std::format("FAILED: {}", e.what()) << std::endl;
+        std::remove(path.c_str());
+        return -1;
+    }
+
+    std::remove(path.c_str());
+    return 0;
+}
+
+int test_image_startup()
+{
+    using std::chrono::duration_cast;
+    using std::chrono::microseconds;
+    using Clock = std::chrono::steady_clock;
+
+    std::string source;
+    for (int i = 0; i < 2000; ++i) {
+        source += std::format("fn f{0}(a, b) {{ let x = a * {0} + b; if (x % 2 == 0) {{ return x / 2; }} return {{v: x, w: [a, b, \"s{0}\"]}}; }}\n", i);
+    }
+    source += "return f1999(1, 2).v;";
+
+    auto path = std::string("TestImage.img");
+
+    try {
+        auto start = Clock::now();
+        std::shared_ptr<Program> program = std::make_unique<Parser>(source)->parse();
+        auto parsed = Clock::now();
+
+        write_image(flatten(*program).view(), path);
+
+        auto load = Clock::now();
+        ProgramImage image(path);
+        auto context = Context {};
+        FlatEvaluator evaluator(image.program(), context);
+        auto loaded = Clock::now();
+
+        auto ret = evaluator.eval();
+        std::remove(path.c_str());
+
+        if (ret.as_integer() != 1999 + 2) {
+            throw std::runtime_error(std::format("expected: 2001, got: {}", ret.inspect()));
+        }
+
+        std::cout << std::format("PASSED: parse {}us, load image {}us for {} bytes of source",
+            duration_cast<microseconds>(parsed - start).count(),
+            duration_cast<microseconds>(loaded - load).count(), source.size())
+                  << std::endl;
+    } catch (std::exception& e) {
+        std::cout << std::format("FAILED: {}", e.what()) << std::endl;
+        std::remove(path.c_str());
+        return -1;
+    }
+
+    return 0;
+}
+
+int main(int argc, const char* argv[])
+{
+    std::cout << "Testing image..." << std::endl;
+
+    test_image_roundtrip();
+
+    test_image_rejects();
+
+    test_image_startup();
+
+    return 0;
+}
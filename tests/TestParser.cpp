@@ -40,7 +40,7 @@ int test_parse_program() {
 }
 
 int main(int argc, const char *argv[]) {
-  // test_parse_expression();
+  test_parse_expression();
   test_parse_program();
 
   return 0;
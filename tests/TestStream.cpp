@@ -0,0 +1,184 @@
+#include "stream.h"
+
+#include <cstdio>
+#include <format>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <vector>
+
+const std::string_view NDJSON = R"({"status": 200, "path": "/index", "latency": 1.5, "tags": ["a", "b"]}
+{"status": 503, "path": "/api", "latency": 4.25, "level": "error"}
+{"path": "/health", "status": 500, "latency": 0.5, "level": "error"}
+{"status": 404, "path": "/missing\"quoted\"", "latency": 2.0}
+)";
+
+const std::string_view CSV = R"(status,path,latency
+200,/index,1.5
+503,"/api,v2",4.25
+500,/health,0.5
+)";
+
+int test_stream_records()
+{
+    std::vector<std::tuple<RecordFormat, std::string_view, std::string_view, std::string_view>> tests = {
+        { RecordFormat::NDJSON, NDJSON, "r.status >= 500",
+            "{\"status\": 503, \"path\": \"/api\", \"latency\": 4.25, \"level\": \"error\"}\n"
+            "{\"path\": \"/health\", \"status\": 500, \"latency\": 0.5, \"level\": \"error\"}\n" },
+        { RecordFormat::NDJSON, NDJSON, "[r.path, r.latency * 2]",
+            "/index,3\n/api,8.5\n/health,1\n\"/missing\"\"quoted\"\"\",4\n" },
+        { RecordFormat::NDJSON, NDJSON, "r.level == \"error\"",
+            "{\"status\": 503, \"path\": \"/api\", \"latency\": 4.25, \"level\": \"error\"}\n"
+            "{\"path\": \"/health\", \"status\": 500, \"latency\": 0.5, \"level\": \"error\"}\n" },
+        { RecordFormat::NDJSON, NDJSON, "r.tags", "\"[\"\"a\"\", \"\"b\"\"]\"\n\n\n\n" },
+        { RecordFormat::NDJSON, R"({"s": "smile \ud83d\ude00 \u00e9"})", "r.s", "smile \xF0\x9F\x98\x80 \xC3\xA9\n" },
+        { RecordFormat::CSV, CSV, "r.status != 200", "503,\"/api,v2\",4.25\n500,/health,0.5\n" },
+        { RecordFormat::CSV, CSV, "[r.path, r.status]", "/index,200\n\"/api,v2\",503\n/health,500\n" },
+    };
+
+    for (auto& [format, input, expression, expected] : tests) {
+        try {
+            StreamOptions options;
+            options.format = format;
+
+            std::stringstream out;
+            stream_records(input, expression, options, out);
+
+            if (out.str() != expected) {
+                throw std::runtime_error(std::format("expected:\n{}got:\n{}", expected, out.str()));
+            }
+            std::cout << std::format("PASSED: `{}`", expression) << std::endl;
+        } catch (std::exception& e) {
+            std::cout << std::format("FAILED: {}", e.what()) << std::endl;
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+int test_stream_errors()
+{
+    try {
+        StreamOptions options;
+        std::stringstream out;
+        auto stats = stream_records(NDJSON, "r.latency > 1.0", options, out);
+        if (stats.records != 4 || stats.emitted != 3 || stats.errors != 0) {
+            throw std::runtime_error(std::format("unexpected stats {} {} {}",
+                stats.records, stats.emitted, stats.errors));
+        }
+
+        // records without a `level` compare undefined with a string
+        stats = stream_records(NDJSON, "r.level != \"error\"", options, out);
+        if (stats.errors != 2) {
+            throw std::runtime_error(std::format("expected 2 errors, got {}", stats.errors));
+        }
+
+        // malformed escapes and lone surrogates fail the record
+        stats = stream_records(R"({"s": "\u12zz"}
+{"s": "\ud83d"}
+{"s": "\ude00"}
+{"s": "\ud83d\u0041"}
+)", "r.s", options, out);
+        if (stats.errors != 4) {
+            throw std::runtime_error(std::format("expected 4 escape errors, got {}", stats.errors));
+        }
+        std::cout << "PASSED: failing records are counted and skipped" << std::endl;
+    } catch (std::exception& e) {
+        std::cout << std::format("FAILED: {}", e.what()) << std::endl;
+        return -1;
+    }
+
+    return 0;
+}
+
+int test_stream_keys()
+{
+    try {
+        // keys read at run time stop growing the shared shape at its limits
+        auto keys = 2 * Shape::max_depth;
+        std::string line = "{";
+        for (size_t i = 0; i < keys; ++i) {
+            line += std::format("{}\"key{}\": {}", i == 0 ? "" : ", ", i, i);
+        }
+        line += "}";
+
+        JsonRecord record;
+        record.rebind(line);
+        for (size_t i = 0; i < keys; ++i) {
+            auto value = record.get_attr(std::format("key{}", i));
+            if (value.as_integer() != int64_t(i)) {
+                throw std::runtime_error(std::format("expected key{} = {}, got {}", i, i, value.inspect()));
+            }
+        }
+        if (record.shape()->size() > Shape::max_depth) {
+            throw std::runtime_error(std::format("expected at most {} shape keys, got {}",
+                Shape::max_depth, record.shape()->size()));
+        }
+        if (record.get_attr("missing").kind() != ValueKind::Undefined) {
+            throw std::runtime_error("expected a missing key to be undefined");
+        }
+        std::cout << "PASSED: runtime keys past the shape limits are looked up per line" << std::endl;
+    } catch (std::exception& e) {
+        std::cout << std::format("FAILED: {}", e.what()) << std::endl;
+        return -1;
+    }
+
+    return 0;
+}
+
+int test_stream_parallel()
+{
+    std::string input;
+    for (int i = 0; i < 20000; ++i) {
+        input += std::format("{{\"id\": {}, \"value\": {}, \"name\": \"row{}\"}}\n", i, (i * 7919) % 1000, i);
+    }
+
+    auto path = std::string("TestStream.ndjson");
+    std::ofstream(path) << input;
+
+    try {
+        MappedFile file(path);
+
+        StreamOptions serial;
+        std::stringstream expected;
+        stream_records(file.view(), "[r.id, r.value * 2, r.name]", serial, expected);
+
+        StreamOptions parallel;
+        parallel.threads = 4;
+        parallel.chunk_size = 4096;
+        std::stringstream out;
+        auto stats = stream_records(file.view(), "[r.id, r.value * 2, r.name]", parallel, out);
+
+        std::remove(path.c_str());
+
+        if (stats.records != 20000 || out.str() != expected.str()) {
+            throw std::runtime_error("parallel output differs from serial output");
+        }
+        std::cout << std::format("PASSED: {} records over 4 threads", stats.records) << std::endl;
+    } catch (std::exception& e) {
+        std::remove(path.c_str());
+        std::cout << std::format("FAILED: {}", e.what()) << std::endl;
+        return -1;
+    }
+
+    return 0;
+}
+
+int main(int argc, const char* argv[])
+{
+    std::cout << "Testing stream..." << std::endl;
+
+    test_stream_records();
+
+    test_stream_errors();
+
+    test_stream_keys();
+
+    test_stream_parallel();
+
+    return 0;
+}
@@ -0,0 +1,39 @@
+#include "flat.h"
+#include "image.h"
+#include "parser.h"
+
+#include <format>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <memory>
+#include <string>
+
+int main(int argc, const char* argv[])
+{
+    if (argc != 3) {
+        std::cerr << "usage: expr-compile <script> <image>" << std::endl
+                  << std::endl
+                  << "Parses <script> and writes it as a program image that workers can map"
+                  << std::endl
+                  << "with ProgramImage instead of parsing it again." << std::endl;
+        return 2;
+    }
+
+    try {
+        std::ifstream in(argv[1], std::ios::binary);
+        if (!in) {
+            throw std::runtime_error(std::format("cannot open {}", argv[1]));
+        }
+        std::string source((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+
+        auto program = std::make_unique<Parser>(source)->parse();
+        auto buffer = flatten(*program);
+        write_image(buffer.view(), argv[2]);
+    } catch (std::exception& e) {
+        std::cerr << std::format("expr-compile: {}", e.what()) << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,85 @@
+#include "stream.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <format>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <thread>
+
+static void usage()
+{
+    std::cerr << "usage: expr-stream [--ndjson | --csv] [--threads N] [--name NAME] [--stats]"
+              << " <expression> <file>" << std::endl
+              << std::endl
+              << "Evaluates <expression> for every record of <file>, bound as `r` by default." << std::endl
+              << "A true Boolean result writes the record, an Array result writes a CSV row," << std::endl
+              << "anything else writes one column. The format defaults to the file extension." << std::endl;
+}
+
+int main(int argc, const char* argv[])
+{
+    StreamOptions options;
+    options.threads = std::max(1u, std::thread::hardware_concurrency());
+
+    bool stats = false;
+    bool format_given = false;
+    std::string_view expression;
+    std::string path;
+
+    for (int i = 1; i < argc; ++i) {
+        std::string_view arg = argv[i];
+        if (arg == "--ndjson") {
+            options.format = RecordFormat::NDJSON;
+            format_given = true;
+        } else if (arg == "--csv") {
+            options.format = RecordFormat::CSV;
+            format_given = true;
+        } else if (arg == "--threads" && i + 1 < argc) {
+            options.threads = std::strtoul(argv[++i], nullptr, 10);
+        } else if (arg == "--name" && i + 1 < argc) {
+            options.record_name = argv[++i];
+        } else if (arg == "--stats") {
+            stats = true;
+        } else if (arg == "--help" || arg == "-h") {
+            usage();
+            return 0;
+        } else if (expression.empty()) {
+            expression = arg;
+        } else if (path.empty()) {
+            path = arg;
+        } else {
+            usage();
+            return 2;
+        }
+    }
+
+    if (expression.empty() || path.empty()) {
+        usage();
+        return 2;
+    }
+
+    if (!format_given && path.ends_with(".csv")) {
+        options.format = RecordFormat::CSV;
+    }
+
+    try {
+        std::ios::sync_with_stdio(false);
+
+        MappedFile file(path);
+        auto result = stream_records(file.view(), expression, options, std::cout);
+        std::cout.flush();
+
+        if (stats) {
+            std::cerr << std::format("records: {}, emitted: {}, errors: {}",
+                result.records, result.emitted, result.errors)
+                      << std::endl;
+        }
+    } catch (std::exception& e) {
+        std::cerr << std::format("expr-stream: {}", e.what()) << std::endl;
+        return 1;
+    }
+
+    return 0;
+}